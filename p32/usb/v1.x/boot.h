@@ -26,6 +26,13 @@ TESTING
  * 1.4.2  Added PIC32MX470F512H support
  * 1.4.3  Added PIC32MX440F256H support
  * 1.4.4  Fixed Config. bits definitions
+ * 1.5.0  Added SIGN_FLASH command and image signature in QUERY_DEVICE
+ * 1.6.0  Added PROGRAM_COMPRESSED command (LZ compressed program data)
+ * 1.7.0  Added GET_STATS command (time spent per command and NVM operation)
+ * 1.8.0  Added DFU 1.1 interface (DFU=true, see dfu.h)
+ * 1.9.0  Added UF2 mass storage interface (MSC=true, see msc.h),
+ *        synchronous flash writes (the host gets NAKs), size unverified on 8K parts
+ *        PROGRAM_COMPRESSED programs whole rows (FlashWriteRow)
 ***********************************************************************/
 
 #ifndef _BOOT_H_
@@ -38,10 +45,10 @@ TESTING
 #define USB_MAJOR_VER                       1       // Firmware version, major release number.
 #endif
 #ifndef USB_MINOR_VER
-#define USB_MINOR_VER                       4       // Firmware version, minor release number.
+#define USB_MINOR_VER                       9       // Firmware version, minor release number.
 #endif
 #ifndef USB_DEVPT_VER
-#define USB_DEVPT_VER                       4       // Firmware version, dvpt release number
+#define USB_DEVPT_VER                       0       // Firmware version, dvpt release number
 #endif
 
 // Specific to USB Pinguino Device
@@ -84,8 +91,18 @@ TESTING
 #define USB_EP0_BUFF_SIZE                   64
 
 // For tracking Alternate Setting
+#if (_DFU_ENABLE_) && (_MSC_ENABLE_)
+#define USB_MAX_NUM_INT                     3       // HID, DFU and MSC interfaces
+#elif (_DFU_ENABLE_) || (_MSC_ENABLE_)
+#define USB_MAX_NUM_INT                     2       // HID and DFU or MSC interfaces
+#else
 #define USB_MAX_NUM_INT                     1
+#endif
+#if (_MSC_ENABLE_)
+#define USB_MAX_EP_NUMBER                   2       // HID_EP and MSC_EP
+#else
 #define USB_MAX_EP_NUMBER                   1
+#endif
 #define USB_NUM_STRING_DESCRIPTORS          4
 
 //#define USB_ENABLE_ALL_HANDLERS
@@ -0,0 +1,732 @@
+/***********************************************************************
+    Title:  USB Pinguino Bootloader
+    File:   command.c
+    Descr.: USB HID bootloader commands (uploader32.py protocol)
+    Author: Régis Blanchot <rblanchot@gmail.com>
+
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+ **********************************************************************
+    The command handler only talks to the flash, USB and core modules
+    through flash.h, usb.h and core.h. Built with -D__HOST__ it gets
+    the mocks of host/ instead and runs natively (see host/replay.c).
+ **********************************************************************/
+
+#if defined(__HOST__)                   // Native build, see host/
+#include "host/host.h"
+#else
+#include "p32xxxx.h"                    // Registers definitions
+#include "typedefs.h"                   // UINT8, UINT32, ...
+#include "mem.h"                        // Pinguino memory regions description
+#include "flash.h"                      // Flash write and flash erase functions
+#include "core.h"                       // MemCopy, MemClear, SoftReset, FCPU
+#include "delay.h"                      // Delayus
+#include "usb.h"                        // USB device framework definitions
+#endif
+#include "command.h"                    // USBPacket, commands codes
+#include "stats.h"                      // BootStats (GET_STATS)
+
+#if (_DEBUG_ENABLE_)                    // defined in makefile
+#include "serial.h"                     // UART functions
+#endif
+
+/***********************************************************************
+ * CONSTANTS
+ **********************************************************************/
+
+//BootState Variable States
+#define	IDLESTATE               0x00
+#define NOTIDLESTATE            0x01
+
+//CRC-32 (IEEE 802.3, reflected) as computed by zlib.crc32() on the host
+#define CRC32_POLYNOMIAL        0xEDB88320
+#define CRC32_INIT              0xFFFFFFFF
+
+//LZ decompressor (see LzDecode)
+#define LZ_WINDOW_SIZE          1024    //Must be a power of 2, max. offset is 1024
+#define LZ_MIN_MATCH            3       //Match length is 3 to 66
+#define LZ_FLAGS                0x00    //Decoder states
+#define LZ_ITEM                 0x01
+#define LZ_MATCH                0x02
+
+/***********************************************************************
+ * VARIABLES
+ **********************************************************************/
+
+//64 bytes buffer for receiving packets on EP1 OUT from the PC
+static USBPacket PacketFromPC;
+//64 bytes buffer for sending packets on EP1 IN to the PC
+static USBPacket PacketToPC;
+static USBPacket PacketFromPCBuffer;
+
+// USB_HANDLE is a pointer (void *) to an entry in the BDT.
+static USB_HANDLE USBOutHandle = 0;
+static USB_HANDLE USBInHandle = 0;
+static UINT8  BootState;
+static UINT32 DataBuffer32[BUFFERSIZE32];
+static UINT8  DataIndex32;
+static UINT32 Address32;
+static UINT32 ImageLength32;            //bytes written since the last ERASE_DEVICE
+static UINT32 ImageCRC32;               //running CRC-32 of these bytes
+static UINT8  ImageError;               //a word has not been programmed as sent
+
+static UINT8  LzWindow[LZ_WINDOW_SIZE]; //last decompressed bytes
+static UINT16 LzIndex;                  //next write position in LzWindow
+static UINT8  LzState;                  //LZ_FLAGS, LZ_ITEM or LZ_MATCH
+static UINT8  LzFlags;                  //flag byte of the current group
+static UINT8  LzCount;                  //items left in the current group
+static UINT8  LzToken;                  //1st byte of a pending match
+static UINT32 LzWord;                   //bytes gathered for the next word
+static UINT8  LzBytes;                  //number of bytes in LzWord
+static UINT32 LzRow[FLASH_ROW_SIZE/WORDSIZE];           //decompressed words of the current row
+static UINT32 LzRowStart;               //address of the first word in LzRow
+static UINT8  LzRowWords;               //number of words in LzRow
+
+BootStats bootStats;                    //see stats.h
+static UINT32 StatsStart;               //core timer when bootStats was cleared
+static UINT32 StatsMark;                //core timer at the end of the last command
+
+/*******************************************************************************
+ * FUNCTION PROTOTYPES
+ ******************************************************************************/
+
+static void WriteFlashBlock(void);
+static void ImageAddWord(UINT32, UINT32, UINT8);
+static void WriteImageSign(void);
+static void LzDecode(UINT8);
+static void LzFlushRow(void);
+static void StatsClear(void);
+static void StatsMemCopy(void *, void *, UINT32);
+
+/***********************************************************************
+ * Initializes the commands state, called once before USBDeviceInit()
+ **********************************************************************/
+
+void CommandInit(void)
+{
+    // Initializes the variable holding the handle for the last transmission
+    USBOutHandle = 0;
+    USBInHandle = 0;
+
+    BootState = IDLESTATE;
+    Address32 = INVALIDADDRESS;
+    DataIndex32 = 0;
+    ImageLength32 = 0;
+    ImageCRC32 = CRC32_INIT;
+    ImageError = 0;
+    LzRowWords = 0;
+
+    StatsClear();
+}
+
+/***********************************************************************
+ * Clears the GET_STATS counters
+ **********************************************************************/
+
+static void StatsClear(void)
+{
+    MemClear(&bootStats, sizeof(BootStats));
+    bootStats.Length = sizeof(BootStats);
+    bootStats.TickHz = FCP0;
+    StatsStart = StatsMark = ReadCoreTimer();
+}
+
+/***********************************************************************
+ * MemCopy() with its time added to bootStats.MemCopy
+ **********************************************************************/
+
+static void StatsMemCopy(void *from, void *to, UINT32 nbytes)
+{
+    UINT32 t0 = ReadCoreTimer();
+
+    MemCopy(from, to, nbytes);
+    bootStats.MemCopy += ReadCoreTimer() - t0;
+}
+
+/***********************************************************************
+ * Bootloader service commands routine.
+ **********************************************************************/
+
+void USBPacketHandler(void)
+{
+    UINT32 i;
+    UINT8 nwords32;
+    UINT8 index32;
+    UINT8 cmd;
+    UINT32 t0, t1;
+
+    #if (_DEBUG_ENABLE_)
+    //SerialPrint("> USBPacketHandler\r\n");
+    #endif
+
+    // *** RB20141210 : OK ***
+    if (BootState == IDLESTATE)
+    {
+        // Are we done sending the last response ?
+        // Check USBOutHandle->STAT.UOWN
+        if (!USBHandleBusy(USBInHandle))
+        {
+            // Did we receive a command ?
+            // Check USBOutHandle->STAT.UOWN
+            if (!USBHandleBusy(USBOutHandle))
+            {
+                // Time since the end of the last command
+                bootStats.UsbWait += ReadCoreTimer() - StatsMark;
+
+                // Make a copy of received data.
+                // void Memcopy (void *from, void *to, UINT32 nbytes)
+                StatsMemCopy(&PacketFromPCBuffer, &PacketFromPC, TOTALPACKETSIZE8);
+
+                #if (_TRACE_ENABLE_)
+                SerialTrace("CMD", PacketFromPC.Command);
+                #endif
+
+                // Restart receiver, to be ready for a next packet.
+                USBOutHandle = USBTransferOnePacket(OUT_FROM_HOST, (UINT8*)&PacketFromPCBuffer);
+                BootState = NOTIDLESTATE;
+
+                //Initialize the next packet sent to the host
+                MemClear(&PacketToPC, TOTALPACKETSIZE8);
+            }
+        }
+    }
+
+    else //(BootState Not in Idle State)
+    {
+        #if 0//(_DEBUG_ENABLE_)
+        SerialPrint("> Received command ");
+        SerialPrintNumber(PacketFromPC.Command, 10);
+        SerialPrint("\r\n");
+        #endif
+
+        cmd = PacketFromPC.Command & (STATS_COMMANDS - 1);
+        t0 = ReadCoreTimer();
+
+        switch (PacketFromPC.Command)
+        {
+
+//**********************************************************************
+            case QUERY_DEVICE:
+//**********************************************************************
+
+                #if 0//(_DEBUG_ENABLE_)
+                SerialPrint("> Sending Device data\r\n");
+                #endif
+
+                // Prepare a response packet
+                PacketToPC.Command1     = (UINT8)  QUERY_DEVICE;
+                PacketToPC.DataSize     = (UINT8)  DATABLOCKSIZE8;
+                PacketToPC.DeviceFamily = (UINT8)  DEVICE_FAMILY;
+                PacketToPC.Type1        = (UINT8)  TYPEPROGRAMMEMORY;
+                PacketToPC.Address1     = (UINT32) APP_PROGRAM_ADDR_START;
+                PacketToPC.Length1      = (UINT32) APP_PROGRAM_LENGTH;
+                PacketToPC.Type2        = (UINT8)  TYPEPROGRAMMEMORY;
+                PacketToPC.Address2     = (UINT32) FCPU;
+                PacketToPC.Length2      = (UINT32) FPB;
+                PacketToPC.Type3        = (UINT8)  TYPEPROGRAMMEMORY;
+                PacketToPC.major        = (UINT32) USB_MAJOR_VER;
+                PacketToPC.minor        = (UINT32) USB_MINOR_VER;
+                PacketToPC.devpt        = (UINT32) USB_DEVPT_VER;
+                PacketToPC.Type4        = (UINT8)  TYPEENDOFTYPELIST;
+
+                // Report the signature of the image currently in flash
+                if (((ImageSign*)APP_SIGN_ADDR)->Magic == APP_SIGN_MAGIC)
+                {
+                    PacketToPC.ImageLength = ((ImageSign*)APP_SIGN_ADDR)->Length;
+                    PacketToPC.ImageCRC    = ((ImageSign*)APP_SIGN_ADDR)->CRC;
+                    PacketToPC.ImageTime   = ((ImageSign*)APP_SIGN_ADDR)->Time;
+                }
+
+                // Send the packet to the host
+                if (!USBHandleBusy(USBInHandle))
+                {
+                    //#define USBTxOnePacket(ep,data,len)     USBTransferOnePacket(ep,IN_TO_HOST,data,len)
+                    //USBInHandle = USBTxOnePacket(HID_EP, (UINT8*)&PacketToPC, TotalPacketSize8);
+                    //USBInHandle = USBTransferOnePacket(HID_EP, IN_TO_HOST, (UINT8*)&PacketToPC, TotalPacketSize8);
+                    USBInHandle = USBTransferOnePacket(IN_TO_HOST, (UINT8*)&PacketToPC);
+                    BootState = IDLESTATE;
+                }
+                break;
+
+//**********************************************************************
+            case GET_DATA:
+//**********************************************************************
+
+                // Prepare a response packet
+                PacketToPC.Command = GET_DATA;
+                PacketToPC.Address = PacketFromPC.Address;
+                PacketToPC.Size = PacketFromPC.Size;
+
+                //nwords32 = PacketFromPC.Size / WORDSIZE;
+
+                #if 0//(_DEBUG_ENABLE_)
+                SerialPrint("> Reading 0x");
+                SerialPrintNumber(ConvertFlashToVirtualAddress(PacketFromPC.Address), 16);
+                SerialPrint("\r\n");
+                #endif
+                
+                // void memcopy (void *from, void *to, UINT32 nbytes)
+                // Copy memory from PacketFromPC.Address to PacketToPC.Data32
+                StatsMemCopy( (void*) ConvertFlashToVirtualAddress(PacketFromPC.Address),
+                         (void*) PacketToPC.Data32,
+                         PacketFromPC.Size );
+                
+                #if 0//(_DEBUG_ENABLE_)
+                SerialPrint("Sending Device's ID 0x");
+                SerialPrintNumber(PacketToPC.Data32[0], 16);
+                SerialPrint("\r\n");
+                #endif
+
+                if (!USBHandleBusy(USBInHandle))
+                {
+                    USBInHandle = USBTransferOnePacket(IN_TO_HOST, (UINT8*)&PacketToPC);
+                    BootState = IDLESTATE;
+                }
+                break;
+
+//**********************************************************************
+            case ERASE_DEVICE:
+//**********************************************************************
+                
+                // a new upload starts, see stats.h
+                StatsClear();
+
+                FlashClearError();
+                // erase memory from ebase address to be able to write the
+                // user application Interrupt Vector Table
+                for (i = APP_EBASE_ADDR;            //APP_PROGRAM_ADDR_START;
+                     i < APP_PROGRAM_ADDR_END;
+                     i = i + FLASH_PAGE_SIZE)
+                {
+                    #if 0//(_DEBUG_ENABLE_)
+                    SerialPrint("Erasing block from 0x");
+                    SerialPrintNumber(i, 16);
+                    SerialPrint(" to 0x");
+                    SerialPrintNumber(i + FLASH_PAGE_SIZE, 16);
+                    SerialPrint("\r\n");
+                    #endif
+
+                    FlashErasePage((void*)i);
+                    //Call USBDeviceTasks() periodically to prevent falling off
+                    //the bus if any SETUP packets should happen to arrive.
+                    //USBDeviceTasks();
+                    //IFS1CLR = _IFS1_USBIF_MASK;
+                }
+
+                // the old signature went with the first page (APP_SIGN_ADDR)
+                ImageLength32 = 0;
+                ImageCRC32 = CRC32_INIT;
+                ImageError = 0;
+                LzRowWords = 0;
+
+                BootState = IDLESTATE;
+                break;
+
+//**********************************************************************
+            case PROGRAM_DEVICE:
+//**********************************************************************
+
+                // number of 32-bit words to write
+                nwords32 = PacketFromPC.Size / WORDSIZE;
+
+                if (Address32 == INVALIDADDRESS)
+                    Address32 = PacketFromPC.Address;
+
+                if (Address32 == PacketFromPC.Address)
+                {
+                    for (i = 0; i < nwords32; i++)
+                    {
+                        //Data field is right justified.
+                        //Need to put it in the buffer left justified.
+
+                        // BufferSize32=14, nwords32=14
+                        // index32 from 0 to 13
+                        index32 = BUFFERSIZE32 - nwords32 + i;
+
+                        // DataIndex32 from 0 to 13
+                        DataBuffer32[DataIndex32] = PacketFromPC.Data32[index32];
+                        DataIndex32 += 1;// if 13 then 14
+                        Address32 += WORDSIZE;
+                        //Call WriteFlashBlock() when buffer is full
+                        if (DataIndex32 == BUFFERSIZE32)
+                            WriteFlashBlock();
+                    }
+                }
+                //else host sent us a non-contiguous packet address...  to make
+                //this firmware simpler, host should not do this without sending
+                //a PROGRAM_COMPLETE command in between program sections.
+                BootState = IDLESTATE;
+                break;
+
+//**********************************************************************
+            case PROGRAM_COMPLETE:
+//**********************************************************************
+
+                WriteFlashBlock();
+                LzFlushRow();
+                //Reinitialize pointer to an invalid range, so we know the next
+                //PROGRAM_DEVICE will be the start address of a contiguous section.
+                Address32 = INVALIDADDRESS;
+                BootState = IDLESTATE;
+                break;
+
+//**********************************************************************
+            case PROGRAM_COMPRESSED:
+//**********************************************************************
+
+                // Same bound as GET_STATS, the image won't be signed
+                if (PacketFromPC.Size > DATABLOCKSIZE8)
+                {
+                    ImageError = 1;
+                    BootState = IDLESTATE;
+                    break;
+                }
+
+                // first packet of a segment, reset the decompressor
+                if (Address32 == INVALIDADDRESS)
+                {
+                    Address32 = PacketFromPC.Address;
+                    LzIndex = 0;
+                    LzState = LZ_FLAGS;
+                    LzWord = 0;
+                    LzBytes = 0;
+                }
+
+                // compressed data is right justified
+                for (i = TOTALPACKETSIZE8 - PacketFromPC.Size; i < TOTALPACKETSIZE8; i++)
+                    LzDecode(PacketFromPC.Contents[i]);
+
+                BootState = IDLESTATE;
+                break;
+
+//**********************************************************************
+            case SIGN_FLASH:
+//**********************************************************************
+
+                WriteImageSign();
+                BootState = IDLESTATE;
+                break;
+
+//**********************************************************************
+            case RESET_DEVICE:
+//**********************************************************************
+
+                // Disable the USB module and wait for the USB cable
+                // capacitance to discharge down to disconnected (SE0) state.
+                // Otherwise host might not realize we disconnected/reconnected
+                // when we do the reset.
+                #if (_TRACE_ENABLE_)
+                SerialTraceFlush();
+                #endif
+                U1CON = 0x00;
+                Delayus(1000);
+                SoftReset();
+                break;
+
+//**********************************************************************
+            case GET_STATS:
+//**********************************************************************
+
+                // Same layout as GET_DATA, Address is the offset in bootStats
+                PacketToPC.Command = GET_STATS;
+                PacketToPC.Address = PacketFromPC.Address;
+                PacketToPC.Size = PacketFromPC.Size;
+
+                if (PacketFromPC.Size > DATABLOCKSIZE8 ||
+                    PacketFromPC.Address > sizeof(BootStats) - PacketFromPC.Size)
+                    PacketToPC.Size = 0;
+
+                bootStats.Elapsed = ReadCoreTimer() - StatsStart;
+                MemCopy((UINT8*)&bootStats + PacketFromPC.Address,
+                        (void*) PacketToPC.Data32,
+                        PacketToPC.Size);
+
+                if (!USBHandleBusy(USBInHandle))
+                {
+                    USBInHandle = USBTransferOnePacket(IN_TO_HOST, (UINT8*)&PacketToPC);
+                    BootState = IDLESTATE;
+                }
+                break;
+
+            default:
+                // Unknown command, drop it
+                BootState = IDLESTATE;
+                break;
+
+        }//End switch
+
+        // Time spent in this command, until it's done
+        t1 = ReadCoreTimer();
+        bootStats.CmdTicks[cmd] += t1 - t0;
+        if (BootState == IDLESTATE)
+        {
+            bootStats.CmdCount[cmd]++;
+            StatsMark = t1;
+        }
+
+    }//End if/else
+
+}//End USBPacketHandler()
+
+/***********************************************************************
+ * Notify uploader32.py that a USB event occured.
+ **********************************************************************/
+
+void USBEventHandler(void)
+{
+    //enable the HID endpoint
+    USBEnableEndpoint(HID_EP, USB_IN_ENABLED | USB_OUT_ENABLED | USB_HANDSHAKE_ENABLED | USB_DISALLOW_SETUP);
+    //Arm the OUT endpoint for the first packet
+    //USBOutHandle = USBTransferOnePacket(HID_EP, OUT_FROM_HOST, (UINT8*) &PacketFromPCBuffer, TotalPacketSize8);
+    USBOutHandle = USBTransferOnePacket(OUT_FROM_HOST, (UINT8*) &PacketFromPCBuffer);
+}
+
+#if 0
+void USBEventHandler(USB_EVENT event) //, void *pdata, UINT16 size)
+{
+    switch (event)
+    {
+        case EVENT_CONFIGURED:
+            //USBCBInitEP();
+            //enable the HID endpoint
+            USBEnableEndpoint(HID_EP, USB_IN_ENABLED | USB_OUT_ENABLED | USB_HANDSHAKE_ENABLED | USB_DISALLOW_SETUP);
+            //Arm the OUT endpoint for the first packet
+            //USBOutHandle = HIDRxPacket(HID_EP, (UINT8*) &PacketFromPCBuffer, TotalPacketSize8);
+            //USBOutHandle = USBRxOnePacket(HID_EP, (UINT8*) &PacketFromPCBuffer, TotalPacketSize8);
+            USBOutHandle = USBTransferOnePacket(HID_EP, OUT_FROM_HOST, (UINT8*) &PacketFromPCBuffer, TotalPacketSize8);
+            break;
+        case EVENT_EP0_REQUEST:
+            USBCheckHIDRequest();
+            break;
+        case EVENT_SET_DESCRIPTOR:
+            //USBCBStdSetDscHandler();
+            break;
+        case EVENT_SOF:
+            //USBCB_SOF_Handler();
+            break;
+        case EVENT_SUSPEND:
+            //USBCBSuspend();
+            break;
+        case EVENT_RESUME:
+            //USBCBWakeFromSuspend();
+            break;
+        case EVENT_BUS_ERROR:
+            //USBCBErrorHandler();
+            break;
+        case EVENT_TRANSFER:
+            Nop();
+            break;
+        default:
+            break;
+    }
+    //return TRUE;
+}
+#endif
+
+/***********************************************************************
+ * Write blocks of 32-bit words
+ * DataIndex32 : number of words to write
+ * from (Address32 - 56) to Address32
+ **********************************************************************/
+
+static void WriteFlashBlock()
+{
+    UINT32 i = 0;
+    UINT32 address;
+    UINT8  res;
+
+    #if 0//(_DEBUG_ENABLE_)
+    //SerialPrint("0x");
+    SerialPrintNumber(Address32 - DataIndex32 * WORDSIZE, 16);
+    #endif
+
+    while (DataIndex32)
+    {
+        address = Address32 - DataIndex32 * WORDSIZE;
+        res = FlashWriteWord((void*) address, DataBuffer32[i]);
+        ImageAddWord(address, DataBuffer32[i], res);
+                       
+        #if 0//(_DEBUG_ENABLE_)
+        SerialPrint("[");
+        SerialPrintNumber((UINT32)DataBuffer32[i], 16);
+        SerialPrint("]");
+        SerialPrint("=[");
+        SerialPrintNumber(*(UINT32*)((void*) Address32 - DataIndex32 * WORDSIZE), 16);
+        SerialPrint("] ");
+        #endif
+        
+        DataIndex32 -= 1;
+        i += 1;
+    }
+
+    #if 0//(_DEBUG_ENABLE_)
+    SerialPrint("\r\n");
+    #endif
+    //Nop(); // Why ? Not necessary for PIC32MX2 family
+}
+
+/***********************************************************************
+ * Adds the word just programmed at address to the image CRC-32
+ * The word is read back from the flash, so that the signature covers
+ * what has actually been programmed. ImageError is set if the NVM
+ * operation failed (res) or if the word differs from data, and stays
+ * set until the next ERASE_DEVICE.
+ **********************************************************************/
+
+static void ImageAddWord(UINT32 address, UINT32 data, UINT8 res)
+{
+    UINT32 word = *(UINT32*)address;
+    UINT8  bit;
+
+    if (res || word != data)
+        ImageError = 1;
+
+    // Update the image CRC-32 (word is little-endian, LSB first)
+    ImageCRC32 ^= word;
+    for (bit = 0; bit < 32; bit++)
+        ImageCRC32 = (ImageCRC32 >> 1) ^ (CRC32_POLYNOMIAL & -(ImageCRC32 & 1));
+    ImageLength32 += WORDSIZE;
+}
+
+/***********************************************************************
+ * Store the image signature at APP_SIGN_ADDR
+ * The record is written only if every word has been programmed without
+ * error since the last ERASE_DEVICE and if the length and CRC-32 sent
+ * by the host match the words read back from the flash, so that
+ * uploader32.py can skip the upload when the same image is already there.
+ * Magic is written last and only if the other words read back right.
+ * There is no reply, uploader32.py checks the signature with QUERY_DEVICE.
+ **********************************************************************/
+
+static void WriteImageSign()
+{
+    ImageSign *sign = (ImageSign*)APP_SIGN_ADDR;
+    UINT8 res;
+
+    // Flush data still in the buffers
+    WriteFlashBlock();
+    LzFlushRow();
+
+    if (sign->Magic != INVALIDADDRESS)
+        return;
+
+    if (ImageError ||
+        PacketFromPC.SignLength != ImageLength32 ||
+        PacketFromPC.SignCRC != ~ImageCRC32)
+    {
+        #if (_DEBUG_ENABLE_)
+        SerialPrint("Bad image signature\r\n");
+        #endif
+        return;
+    }
+
+    res  = FlashWriteWord((void*)&sign->Length, ImageLength32);
+    res |= FlashWriteWord((void*)&sign->CRC,    ~ImageCRC32);
+    res |= FlashWriteWord((void*)&sign->Time,   PacketFromPC.SignTime);
+    if (res || sign->Length != ImageLength32 ||
+               sign->CRC    != ~ImageCRC32   ||
+               sign->Time   != PacketFromPC.SignTime)
+        return;
+
+    // Magic is written last so that an incomplete record is never valid
+    FlashWriteWord((void*)&sign->Magic,  APP_SIGN_MAGIC);
+}
+
+/***********************************************************************
+ * Streaming LZ decompressor for PROGRAM_COMPRESSED
+ * The stream is made of groups of one flag byte followed by 8 items,
+ * flag bits are read LSB first :
+ * 0 : 1 literal byte
+ * 1 : 2-byte match [ (length-3) << 2 | (offset-1) >> 8 ] [ (offset-1) & 0xFF ]
+ *     copies length bytes from offset bytes back (1 to LZ_WINDOW_SIZE)
+ * Decompressed bytes are gathered into words and the words into LzRow,
+ * which is programmed at once when the row is complete (see LzFlushRow).
+ * A segment must be a multiple of WORDSIZE.
+ **********************************************************************/
+
+static void LzPutByte(UINT8 c)
+{
+    LzWindow[LzIndex++ & (LZ_WINDOW_SIZE - 1)] = c;
+
+    LzWord |= (UINT32)c << (8 * LzBytes);
+    if (++LzBytes == WORDSIZE)
+    {
+        if (LzRowWords == 0)
+            LzRowStart = Address32;
+        LzRow[(Address32 % FLASH_ROW_SIZE) / WORDSIZE] = LzWord;
+        LzRowWords += 1;
+        Address32 += WORDSIZE;
+        LzWord = 0;
+        LzBytes = 0;
+        //Call LzFlushRow() at the end of the row
+        if (Address32 % FLASH_ROW_SIZE == 0)
+            LzFlushRow();
+    }
+}
+
+/***********************************************************************
+ * Programs the words gathered in LzRow
+ * A full row is written with a single row operation, the head or the
+ * tail of a segment that only covers a part of a row is written word
+ * by word, so that the other words of the row are left untouched.
+ * Every word is then read back and added to the image CRC-32.
+ **********************************************************************/
+
+static void LzFlushRow(void)
+{
+    UINT32 address = LzRowStart;
+    UINT8  n = (LzRowStart % FLASH_ROW_SIZE) / WORDSIZE;
+    UINT8  row = (LzRowWords == FLASH_ROW_SIZE/WORDSIZE);
+    UINT8  res = 0;
+
+    if (row)
+        res = FlashWriteRow((void*)LzRowStart, (void*)LzRow);
+
+    while (LzRowWords)
+    {
+        if (!row)
+            res = FlashWriteWord((void*)address, LzRow[n]);
+        ImageAddWord(address, LzRow[n], res);
+        address += WORDSIZE;
+        LzRowWords -= 1;
+        n += 1;
+    }
+}
+
+static void LzDecode(UINT8 c)
+{
+    UINT16 offset;
+    UINT8  length;
+
+    if (LzState == LZ_FLAGS)
+    {
+        LzFlags = c;
+        LzCount = 8;
+        LzState = LZ_ITEM;
+        return;
+    }
+
+    if (LzState == LZ_ITEM && (LzFlags & 1))
+    {
+        // wait for the 2nd byte of the match
+        LzToken = c;
+        LzState = LZ_MATCH;
+        return;
+    }
+
+    if (LzState == LZ_ITEM)
+    {
+        LzPutByte(c);
+    }
+    else // LZ_MATCH
+    {
+        offset = (((UINT16)(LzToken & 0x03) << 8) | c) + 1;
+        length = (LzToken >> 2) + LZ_MIN_MATCH;
+        while (length--)
+            LzPutByte(LzWindow[(LzIndex - offset) & (LZ_WINDOW_SIZE - 1)]);
+    }
+
+    // next item
+    LzFlags >>= 1;
+    LzState = (--LzCount) ? LZ_ITEM : LZ_FLAGS;
+}
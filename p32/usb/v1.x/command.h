@@ -0,0 +1,125 @@
+/***********************************************************************
+    Title:  USB Pinguino Bootloader
+    File:   command.h
+    Descr.: USB HID bootloader commands (uploader32.py protocol)
+    Author: Régis Blanchot <rblanchot@gmail.com>
+
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+ **********************************************************************/
+
+#ifndef _COMMAND_H_
+#define _COMMAND_H_
+
+#if defined(__HOST__)                   // Native build, see host/
+#include "host/host.h"
+#else
+#include "typedefs.h"                   // UINT8, UINT32, ...
+#include "usb.h"                        // HID_INT_EP_SIZE
+#endif
+
+/***********************************************************************
+ * CONSTANTS
+ **********************************************************************/
+
+//Switch State Variable Choices
+#define	QUERY_DEVICE            0x02    //Command that the host uses to learn about the device (what regions can be programmed, and what type of memory is the region)
+#define	UNLOCK_CONFIG           0x03    //Note, this command is used for both locking and unlocking the config bits (see the "//Unlock Configs Command Definitions" below)
+#define ERASE_DEVICE            0x04    //Host sends this command to start an erase operation.  Firmware controls which pages should be erased.
+//Sub-command for the ERASE_DEVICE command
+//#define UNLOCKCONFIG          0x00    //Unlock Configs Command Definitions
+//#define LOCKCONFIG            0x01    //lock Configs Command Definitions
+#define PROGRAM_DEVICE          0x05    //If host is going to send a full DataBlockSize8 to be programmed, it uses this command.
+#define	PROGRAM_COMPLETE        0x06    //If host send less than a DataBlockSize8 to be programmed, or if it wished to program whatever was left in the buffer, it uses this command.
+#define GET_DATA                0x07    //The host sends this command in order to read out memory from the device.  Used during verify (and read/export hex operations)
+#define	RESET_DEVICE            0x08    //Resets the microcontroller, so it can update the config bits (if they were programmed, and so as to leave the bootloader (and potentially go back into the main application)
+#define SIGN_FLASH              0x09    //Host sends this command after a complete upload to store the image length, CRC-32 and timestamp (see APP_SIGN_ADDR)
+#define PROGRAM_COMPRESSED      0x0A    //Same as PROGRAM_DEVICE but data is LZ compressed (see LzDecode). Address is the start address of the segment.
+#define GET_STATS               0x0B    //Same as GET_DATA but reads the time counters of stats.h, Address is the offset in BootStats.
+
+//Query Device Response "Types"
+#define	TYPEPROGRAMMEMORY       0x01    //When the host sends a QUERY_DEVICE command, need to respond by populating a list of valid memory regions that exist in the device (and should be programmed)
+#define TYPEEEPROM              0x02
+#define TYPECONFIGWORDS         0x03
+#define	TYPEENDOFTYPELIST       0xFF    //Sort of serves as a "null terminator" like number, which denotes the end of the memory region list has been reached.
+
+//OtherConstants
+#define INVALIDADDRESS          0xFFFFFFFF
+
+//Application and Microcontroller constants
+#define DEVICE_FAMILY           0x03    //0x01 for PIC18, 0x02 for PIC24, 0x03 for PIC32
+
+#define	TOTALPACKETSIZE8        HID_INT_EP_SIZE
+#define DATABLOCKSIZE8          56      //Number of bytes in the "Data" field of a standard request to/from the PC.  Must be an even number from 2 to 56.
+#define BUFFERSIZE32            (DATABLOCKSIZE8/WORDSIZE)
+
+/***********************************************************************
+ * TYPE DEFINITIONS
+ **********************************************************************/
+
+typedef union __attribute__((packed)) _USB_HID_BOOTLOADER_COMMAND
+{
+    UINT8 Contents[TOTALPACKETSIZE8];
+
+    //For GET_DATA / PROGRAM_DEVICE command
+    struct __attribute__((packed))
+    {
+        UINT8  Command;
+        UINT32 Address;
+        UINT8  Size;
+        UINT8  PadBytes[TOTALPACKETSIZE8 - 6 - DATABLOCKSIZE8];
+        UINT32 Data32[BUFFERSIZE32];
+    };
+
+    //For QUERRY_DEVICE command
+    struct __attribute__((packed))
+    {
+        UINT8  Command1;
+        UINT8  DataSize;
+        UINT8  DeviceFamily;
+        UINT8  Type1;
+        UINT32 Address1;
+        UINT32 Length1;
+        UINT8  Type2;
+        UINT32 Address2;
+        UINT32 Length2;
+        UINT8  Type3; //End of sections list indicator goes here, when not programming the vectors, in that case fill with 0xFF.
+        UINT32 major;
+        UINT32 minor;
+        UINT32 devpt;
+        UINT8  Type4; //End of sections list indicator goes here, fill with 0xFF.
+        UINT32 ImageLength;
+        UINT32 ImageCRC;
+        UINT32 ImageTime;
+        UINT8  ExtraPadBytes[TOTALPACKETSIZE8 - 47];
+    };
+
+    //For SIGN_FLASH command
+    struct __attribute__((packed))
+    {
+        UINT8  Command2;
+        UINT32 SignLength;
+        UINT32 SignCRC;
+        UINT32 SignTime;
+    };
+} USBPacket;
+
+//Image signature record stored at APP_SIGN_ADDR
+typedef struct
+{
+    UINT32 Magic;
+    UINT32 Length;
+    UINT32 CRC;
+    UINT32 Time;
+} ImageSign;
+
+/*******************************************************************************
+ * FUNCTION PROTOTYPES
+ ******************************************************************************/
+
+void CommandInit(void);
+void USBPacketHandler(void);
+//void USBEventHandler(USB_EVENT);
+void USBEventHandler(void);
+
+#endif /* _COMMAND_H_ */
@@ -15,6 +15,9 @@
 #include "typedefs.h"
 #include "boot.h"               // USB Vendor and Product IDs
 #include "usb.h"                // USB Device abstraction layer interface
+#if (_DFU_ENABLE_)
+#include "dfu.h"                // DFU_ATTRIBUTES, DFU_TRANSFER_SIZE
+#endif
 
 /* Device Descriptor */
 
@@ -95,6 +98,66 @@ const USB_CONFIG_DESCRIPTOR usb_config_descriptor =
         _INTERRUPT,                             // Endpoint Transfer Type
         HID_INT_OUT_EP_SIZE,                    // size
         0x01                                    // Interval
+    #if (_DFU_ENABLE_)
+    },
+
+    /* DFU Interface Descriptor */
+    {
+        sizeof(USB_INTERFACE_DESCRIPTOR),    // 0x09 Size of this descriptor in bytes
+        USB_DESCRIPTOR_INTERFACE,               // INTERFACE descriptor type
+        DFU_INTF_ID,                            // Interface Number
+        0,                                      // Alternate Setting Number
+        0,                                      // Number of endpoints in this intf (EP0 only)
+        DFU_INTF,                               // Class code
+        DFU_INTF_SUBCLASS,                      // Subclass code
+        DFU_PROTOCOL_DFU,                       // Protocol code
+        0                                       // Interface string index
+    },
+
+    /* DFU Functional Descriptor */
+    {
+        sizeof(USB_DFU_FUNCTIONAL_DESCRIPTOR),  // 0x09
+        DSC_DFU,                                // DFU FUNCTIONAL descriptor type
+        DFU_ATTRIBUTES,                         // see dfu.h
+        DFU_DETACH_TIMEOUT,                     // ms
+        DFU_TRANSFER_SIZE,                      // one flash row per block
+        0x0110                                  // DFU Spec Release Number in BCD format (1.1)
+    #endif
+    #if (_MSC_ENABLE_)
+    },
+
+    /* MSC Interface Descriptor */
+    {
+        sizeof(USB_INTERFACE_DESCRIPTOR),    // 0x09 Size of this descriptor in bytes
+        USB_DESCRIPTOR_INTERFACE,               // INTERFACE descriptor type
+        MSC_INTF_ID,                            // Interface Number
+        0,                                      // Alternate Setting Number
+        2,                                      // Number of endpoints in this intf
+        MSC_INTF,                               // Class code
+        MSC_INTF_SUBCLASS,                      // Subclass code
+        MSC_PROTOCOL_BOT,                       // Protocol code
+        0                                       // Interface string index
+    },
+
+    /* Endpoint Descriptor */
+    {
+        sizeof(USB_ENDPOINT_DESCRIPTOR),     // 0x07
+        USB_DESCRIPTOR_ENDPOINT,                // Endpoint Descriptor
+        MSC_EP | _EP_IN,                        // EndpointAddress
+        _BULK,                                  // Endpoint Transfer Type
+        MSC_EP_SIZE,                            // size
+        0x00                                    // Interval
+    },
+
+    /* Endpoint Descriptor */
+    {
+        sizeof(USB_ENDPOINT_DESCRIPTOR),     // 0x07
+        USB_DESCRIPTOR_ENDPOINT,                // Endpoint Descriptor
+        MSC_EP | _EP_OUT,                       // EndpointAddress
+        _BULK,                                  // Endpoint Transfer Type
+        MSC_EP_SIZE,                            // size
+        0x00                                    // Interval
+    #endif
     }
 };
 
@@ -0,0 +1,358 @@
+/***********************************************************************
+    Title:  USB Pinguino Bootloader
+    File:   dfu.c
+    Descr.: USB DFU 1.1 interface (DFU=true)
+    Author: Régis Blanchot <rblanchot@gmail.com>
+
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+ **********************************************************************
+    The requests are handled on EP0 by USBCheckDFURequest(), called
+    from USBCtrlTrfSetupHandler() next to the HID one. The flash is
+    written by DFUTasks(), called from the main loop (see dfu.h).
+ **********************************************************************/
+
+#include "p32xxxx.h"                    // Registers definitions
+#include "typedefs.h"                   // UINT8, UINT32, ...
+#include "mem.h"                        // Pinguino memory regions description
+#include "flash.h"                      // Flash write and flash erase functions
+#include "core.h"                       // SoftReset
+#include "delay.h"                      // Delayus
+#include "usb.h"                        // USB device framework definitions
+#include "dfu.h"                        // DFU requests, states and status
+
+#if (_DEBUG_ENABLE_)                    // defined in makefile
+#include "serial.h"                     // UART functions
+#endif
+
+#if (_DFU_ENABLE_)
+
+/***********************************************************************
+ * CONSTANTS
+ **********************************************************************/
+
+//NVM operations of a DFU_DNLOAD block, done in this order
+#define DFU_NVM_PAGE            0x01    //erase the page of the row (1st row of a page)
+#define DFU_NVM_ROW             0x02    //write the row
+#define DFU_NVM_VERIFY          0x04    //read the row back
+#define DFU_NVM_TAIL            0x08    //erase the pages after the last block (manifestation)
+
+/***********************************************************************
+ * VARIABLES
+ **********************************************************************/
+
+extern USB_VOLATILE IN_PIPE inPipe;
+extern USB_VOLATILE OUT_PIPE outPipe;
+extern volatile CTRL_TRF_SETUP SetupPkt;
+extern USB_VOLATILE UINT8 controlTransferState;
+
+static UINT32 DfuBuffer[DFU_TRANSFER_SIZE/WORDSIZE];  //row to write
+static DFUStatus DfuStatus;             //DFU_GETSTATUS answer, holds bState
+static UINT32 DfuAddress;               //row of the current block, next page of the tail
+static UINT8  DfuPending;               //DFU_NVM_xxx not started yet
+static UINT8  DfuNvmOp;                 //DFU_NVM_xxx in progress, 0 if none
+static UINT8  DfuDetach;                //reset once DFU_DETACH is acknowledged
+
+/*******************************************************************************
+ * FUNCTION PROTOTYPES
+ ******************************************************************************/
+
+static void DFUDownloadDone(void);
+static UINT8 DFUVerify(void);
+static UINT32 DFUPollTimeout(void);
+
+/***********************************************************************
+ * Initializes the DFU state, called once before USBDeviceInit()
+ **********************************************************************/
+
+void DFUInit(void)
+{
+    DfuStatus.bStatus = DFU_STATUS_OK;
+    DfuStatus.bState = DFU_STATE_IDLE;
+    DfuStatus.iString = 0;
+    DfuPending = 0;
+    DfuNvmOp = 0;
+    DfuDetach = FALSE;
+}
+
+/***********************************************************************
+ * Called on each pass of the main loop
+ * Starts the NVM operations of the last block once DFU_GETSTATUS has
+ * answered dfuDNBUSY, one at a time, without waiting for them.
+ * The tail pages are erased the same way, one per pass, as soon as
+ * the zero-length DFU_DNLOAD has come.
+ **********************************************************************/
+
+void DFUTasks(void)
+{
+    if (DfuNvmOp)
+    {
+        if (FlashBusy())
+            return;
+
+        if (FlashEnd())
+        {
+            DfuPending = 0;
+            if (DfuNvmOp == DFU_NVM_ROW)
+                DfuStatus.bStatus = DFU_STATUS_ERR_PROG;
+            else
+                DfuStatus.bStatus = DFU_STATUS_ERR_ERASE;
+        }
+        DfuNvmOp = 0;
+    }
+
+    // DFU_DETACH : same as RESET_DEVICE (see command.c), once the
+    // status stage is over
+    if (DfuDetach && controlTransferState == WAIT_SETUP)
+    {
+        #if (_TRACE_ENABLE_)
+        SerialTraceFlush();
+        #endif
+        U1CON = 0x00;
+        Delayus(1000);
+        SoftReset();
+    }
+
+    if (DfuPending == 0)
+        return;
+
+    if (DfuStatus.bState != DFU_STATE_DNBUSY &&
+        DfuStatus.bState != DFU_STATE_MANIFEST_SYNC &&
+        DfuStatus.bState != DFU_STATE_MANIFEST)
+        return;
+
+    if (DfuPending & DFU_NVM_PAGE)
+    {
+        DfuNvmOp = DFU_NVM_PAGE;
+        FlashStartErasePage((void*)DfuAddress);
+    }
+    else if (DfuPending & DFU_NVM_ROW)
+    {
+        DfuNvmOp = DFU_NVM_ROW;
+        FlashStartWriteRow((void*)DfuAddress, (void*)DfuBuffer);
+    }
+    else if (DfuPending & DFU_NVM_TAIL)
+    {
+        // DFU_NVM_TAIL stays pending up to the last page
+        DfuNvmOp = DFU_NVM_TAIL;
+        FlashStartErasePage((void*)DfuAddress);
+        DfuAddress += FLASH_PAGE_SIZE;
+        if (DfuAddress < APP_PROGRAM_ADDR_END)
+            return;
+    }
+    else // DFU_NVM_VERIFY
+    {
+        if (!DFUVerify())
+            DfuStatus.bStatus = DFU_STATUS_ERR_VERIFY;
+    }
+
+    DfuPending &= ~(DfuNvmOp ? DfuNvmOp : DFU_NVM_VERIFY);
+}
+
+/***********************************************************************
+ * Compares the row just written with DfuBuffer
+ * Reads through KSEG1 so that the prefetch cache is not involved.
+ **********************************************************************/
+
+static UINT8 DFUVerify(void)
+{
+    UINT32 *flash = (UINT32*)KVA0_TO_KVA1(DfuAddress);
+    UINT32 i;
+
+    for (i = 0; i < DFU_TRANSFER_SIZE/WORDSIZE; i++)
+        if (flash[i] != DfuBuffer[i])
+            return FALSE;
+
+    return TRUE;
+}
+
+/***********************************************************************
+ * bwPollTimeout : time left for the NVM operations of the last block
+ * or of the tail (the page being erased and the ones after it)
+ **********************************************************************/
+
+static UINT32 DFUPollTimeout(void)
+{
+    UINT8 ops = DfuPending | DfuNvmOp;
+    UINT32 ms = 0;
+
+    if (ops & DFU_NVM_PAGE)
+        ms += DFU_PAGE_MS;
+    if (ops & DFU_NVM_ROW)
+        ms += DFU_ROW_MS;
+    if (ops & DFU_NVM_TAIL)
+        ms += DFU_PAGE_MS * ((APP_PROGRAM_ADDR_END - DfuAddress) / FLASH_PAGE_SIZE + 1);
+
+    return ms;
+}
+
+/***********************************************************************
+ * End of the DFU_DNLOAD data stage, the block is in DfuBuffer
+ **********************************************************************/
+
+static void DFUDownloadDone(void)
+{
+    DfuStatus.bState = DFU_STATE_DNLOAD_SYNC;
+}
+
+/********************************************************************
+ * Handles DFU specific request that happen on EP0.
+ * Leaving both pipes idle stalls the request (see USBCtrlEPServiceComplete).
+ *******************************************************************/
+
+void USBCheckDFURequest(void)
+{
+    UINT32 address, ms, i;
+    UINT16 block, length;
+    UINT8 state = DfuStatus.bState;
+    UINT8 error = DFU_STATUS_ERR_STALLEDPKT;
+
+    if (SetupPkt.Recipient != USB_SETUP_RECIPIENT_INTERFACE_BITFIELD)
+        return;
+
+    if (SetupPkt.bIntfID != DFU_INTF_ID)
+        return;
+
+    if (SetupPkt.RequestType != USB_SETUP_TYPE_CLASS_BITFIELD)
+        return;
+
+    block = SetupPkt.W_Value.Val;
+    length = SetupPkt.wLength;
+    address = APP_EBASE_ADDR + (UINT32)block * DFU_TRANSFER_SIZE;
+
+    switch (SetupPkt.bRequest)
+    {
+        case DFU_DNLOAD:
+            if (state != DFU_STATE_IDLE && state != DFU_STATE_DNLOAD_IDLE)
+                break;
+
+            // zero-length block : end of the download, the pages after
+            // the one of the last block still hold the old application,
+            // DFUTasks() erases them up to APP_PROGRAM_ADDR_END
+            if (length == 0)
+            {
+                if (state != DFU_STATE_DNLOAD_IDLE)
+                    break;
+                DfuAddress = (DfuAddress & ~(FLASH_PAGE_SIZE - 1)) + FLASH_PAGE_SIZE;
+                if (DfuAddress < APP_PROGRAM_ADDR_END)
+                    DfuPending = DFU_NVM_TAIL;
+                DfuStatus.bState = DFU_STATE_MANIFEST_SYNC;
+                inPipe.info.Val = USB_EP0_NO_DATA | USB_EP0_BUSY;
+                return;
+            }
+
+            // APP_PROGRAM_ADDR_END is page aligned, a row never crosses it
+            if (length > DFU_TRANSFER_SIZE || address >= APP_PROGRAM_ADDR_END)
+            {
+                error = DFU_STATUS_ERR_ADDRESS;
+                break;
+            }
+
+            DfuAddress = address;
+            DfuPending = DFU_NVM_ROW | DFU_NVM_VERIFY;
+            if (address % FLASH_PAGE_SIZE == 0)
+                DfuPending |= DFU_NVM_PAGE;
+            // a new upload starts, block 0 erases the old signature
+            // with its page (APP_SIGN_ADDR)
+            if (block == 0)
+                FlashClearError();
+
+            // a short block leaves the end of the row unprogrammed
+            for (i = 0; i < DFU_TRANSFER_SIZE/WORDSIZE; i++)
+                DfuBuffer[i] = 0xFFFFFFFF;
+
+            outPipe.pDst.bRam = (UINT8*)DfuBuffer;
+            outPipe.wCount.Val = length;
+            outPipe.pFunc = DFUDownloadDone;
+            outPipe.info.bits.busy = 1;
+            return;
+
+        case DFU_UPLOAD:
+            if (state != DFU_STATE_IDLE && state != DFU_STATE_UPLOAD_IDLE)
+                break;
+            if (length > DFU_TRANSFER_SIZE)
+                break;
+
+            // a short block ends the upload
+            if (address >= APP_PROGRAM_ADDR_END)
+            {
+                DfuStatus.bState = DFU_STATE_IDLE;
+                length = 0;
+            }
+            else
+            {
+                DfuStatus.bState = DFU_STATE_UPLOAD_IDLE;
+            }
+
+            inPipe.pSrc.bRom = (const UINT8*)address;
+            inPipe.wCount.Val = length;
+            inPipe.info.Val = USB_EP0_INCLUDE_ZERO | USB_EP0_BUSY | USB_EP0_ROM;
+            return;
+
+        case DFU_GETSTATUS:
+            if (state == DFU_STATE_DNLOAD_SYNC || state == DFU_STATE_DNBUSY)
+            {
+                if (DfuPending || DfuNvmOp)
+                    state = DFU_STATE_DNBUSY;       // DFUTasks() goes on
+                else if (DfuStatus.bStatus != DFU_STATUS_OK)
+                    state = DFU_STATE_ERROR;
+                else
+                    state = DFU_STATE_DNLOAD_IDLE;
+            }
+            else if (state == DFU_STATE_MANIFEST_SYNC || state == DFU_STATE_MANIFEST)
+            {
+                if (DfuPending || DfuNvmOp)
+                    state = DFU_STATE_MANIFEST;     // tail erase goes on
+                else if (DfuStatus.bStatus != DFU_STATUS_OK)
+                    state = DFU_STATE_ERROR;
+                else
+                    state = DFU_STATE_IDLE;         // manifestation tolerant
+            }
+
+            ms = (state == DFU_STATE_DNBUSY || state == DFU_STATE_MANIFEST) ?
+                 DFUPollTimeout() : 0;
+            DfuStatus.bwPollTimeout[0] = ms;
+            DfuStatus.bwPollTimeout[1] = ms >> 8;
+            DfuStatus.bwPollTimeout[2] = ms >> 16;
+            DfuStatus.bState = state;
+
+            inPipe.pSrc.bRam = (UINT8*)&DfuStatus;
+            inPipe.wCount.Val = sizeof(DFUStatus);
+            inPipe.info.Val = USB_EP0_INCLUDE_ZERO | USB_EP0_BUSY | USB_EP0_RAM;
+            return;
+
+        case DFU_CLRSTATUS:
+            if (state != DFU_STATE_ERROR)
+                break;
+            DfuStatus.bStatus = DFU_STATUS_OK;
+            DfuStatus.bState = DFU_STATE_IDLE;
+            inPipe.info.Val = USB_EP0_NO_DATA | USB_EP0_BUSY;
+            return;
+
+        case DFU_GETSTATE:
+            inPipe.pSrc.bRam = (UINT8*)&DfuStatus.bState;
+            inPipe.wCount.Val = 1;
+            inPipe.info.Val = USB_EP0_INCLUDE_ZERO | USB_EP0_BUSY | USB_EP0_RAM;
+            return;
+
+        case DFU_ABORT:
+            if (state == DFU_STATE_DNBUSY || state == DFU_STATE_ERROR)
+                break;
+            DfuPending = 0;
+            DfuStatus.bState = DFU_STATE_IDLE;
+            inPipe.info.Val = USB_EP0_NO_DATA | USB_EP0_BUSY;
+            return;
+
+        case DFU_DETACH:
+            DfuDetach = TRUE;
+            inPipe.info.Val = USB_EP0_NO_DATA | USB_EP0_BUSY;
+            return;
+    }
+
+    // request not supported in this state
+    DfuPending = 0;
+    DfuStatus.bStatus = error;
+    DfuStatus.bState = DFU_STATE_ERROR;
+}
+
+#endif /* _DFU_ENABLE_ */
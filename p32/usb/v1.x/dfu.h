@@ -0,0 +1,108 @@
+/***********************************************************************
+    Title:  USB Pinguino Bootloader
+    File:   dfu.h
+    Descr.: USB DFU 1.1 interface (DFU=true)
+    Author: Régis Blanchot <rblanchot@gmail.com>
+
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+ **********************************************************************
+    Built with DFU=true, the bootloader has a second interface, in DFU
+    mode, next to the HID one (uploader32.py still works). Standard
+    DFU hosts can then upload or read the application :
+
+        dfu-util -d 04d8:003c -a 0 -D app.bin -R
+        dfu-util -d 04d8:003c -a 0 -U dump.bin
+
+    Block n is the flash row at APP_EBASE_ADDR + n * DFU_TRANSFER_SIZE,
+    so app.bin is the application image from APP_EBASE_ADDR on, e.g.
+    on a 32MX270F256B (8K bootloader) :
+
+        srec_cat app.hex -intel -crop 0x1D002000 0x1D040000 \
+                 -offset -0x1D002000 -o app.bin -binary
+
+    Download
+    Each DFU_DNLOAD block is copied in a row buffer. The next
+    DFU_GETSTATUS answers dfuDNBUSY with bwPollTimeout, then DFUTasks()
+    starts the row write without waiting for it : the host polls the
+    status while the NVM controller programs the row. Blocks must come
+    in order from 0 : the page of a block is erased when its first row
+    comes, so block 0 also erases the signature (see APP_SIGN_ADDR).
+    A row is read back once written (errVERIFY).
+    The zero-length DFU_DNLOAD that ends the download erases the pages
+    after the last block up to APP_PROGRAM_ADDR_END, nothing of a longer
+    application is left behind. DFU_GETSTATUS answers dfuMANIFEST until
+    the last page is erased.
+    A block past APP_PROGRAM_ADDR_END gets errADDRESS. The application
+    area cannot shrink under the bootloader either, the link fails if
+    the bootloader outgrows BOOT_PROGRAM_LENGTH (see lkr/elf32pic32mx.x).
+
+    DFU_DETACH (dfu-util -R) resets the device once its status stage
+    is over, the bootloader then starts the application.
+ **********************************************************************/
+
+#ifndef _DFU_H_
+#define _DFU_H_
+
+#include "typedefs.h"                   // UINT8, UINT32, ...
+#include "flash.h"                      // FLASH_ROW_SIZE
+
+// Class requests (DFU 1.1, table 3.2)
+#define DFU_DETACH              0x00
+#define DFU_DNLOAD              0x01
+#define DFU_UPLOAD              0x02
+#define DFU_GETSTATUS           0x03
+#define DFU_CLRSTATUS           0x04
+#define DFU_GETSTATE            0x05
+#define DFU_ABORT               0x06
+
+// bState (DFU 1.1, section 6.1.2)
+#define DFU_STATE_APP_IDLE              0
+#define DFU_STATE_APP_DETACH            1
+#define DFU_STATE_IDLE                  2
+#define DFU_STATE_DNLOAD_SYNC           3
+#define DFU_STATE_DNBUSY                4
+#define DFU_STATE_DNLOAD_IDLE           5
+#define DFU_STATE_MANIFEST_SYNC         6
+#define DFU_STATE_MANIFEST              7
+#define DFU_STATE_MANIFEST_WAIT_RESET   8
+#define DFU_STATE_UPLOAD_IDLE           9
+#define DFU_STATE_ERROR                 10
+
+// bStatus (DFU 1.1, section 6.1.2)
+#define DFU_STATUS_OK                   0x00
+#define DFU_STATUS_ERR_WRITE            0x03
+#define DFU_STATUS_ERR_ERASE            0x04
+#define DFU_STATUS_ERR_PROG             0x06
+#define DFU_STATUS_ERR_VERIFY           0x07
+#define DFU_STATUS_ERR_ADDRESS          0x08
+#define DFU_STATUS_ERR_STALLEDPKT       0x0F
+
+// Functional descriptor (see descriptors.c)
+#define DFU_CAN_DNLOAD          0x01
+#define DFU_CAN_UPLOAD          0x02
+#define DFU_MANIFESTATION_TOLERANT 0x04
+#define DFU_WILL_DETACH         0x08
+#define DFU_ATTRIBUTES          (DFU_CAN_DNLOAD | DFU_CAN_UPLOAD | \
+                                 DFU_MANIFESTATION_TOLERANT | DFU_WILL_DETACH)
+#define DFU_DETACH_TIMEOUT      1000    // ms
+#define DFU_TRANSFER_SIZE       FLASH_ROW_SIZE
+
+// bwPollTimeout, max. NVM times of the PIC32MX data sheets
+#define DFU_ROW_MS              3       // row write
+#define DFU_PAGE_MS             20      // page erase
+
+// DFU_GETSTATUS answer
+typedef struct __attribute__((packed))
+{
+    UINT8 bStatus;
+    UINT8 bwPollTimeout[3];             // ms, little endian
+    UINT8 bState;
+    UINT8 iString;
+} DFUStatus;
+
+void DFUInit(void);
+void DFUTasks(void);
+void USBCheckDFURequest(void);
+
+#endif /* _DFU_H_ */
@@ -17,10 +17,14 @@
 #include "hardware.h"
 #include "delay.h"              // Delayus
 #include "core.h"
+#include "stats.h"              // bootStats
 #if (_DEBUG_ENABLE_)            // defined in m
 #include "serial.h"             // UART functions
 #endif
 
+static UINT8  flashOp;                  // operation started by FlashStart()
+static UINT32 flashT1;                  // its start time, see stats.h
+
 /***********************************************************************
  * Performs flash Write/Erase operation
  * This function must generate MIPS32 code only
@@ -28,7 +32,20 @@
 
 UINT8 FlashOperation(UINT8 op)
 {
-    UINT8 res;
+    FlashStart(op);
+    return FlashEnd();
+}
+
+/***********************************************************************
+ * Starts a flash Write/Erase operation and returns at once
+ * The core stalls on its next flash fetch until the operation is done,
+ * but the USB module goes on answering the host (see dfu.c).
+ * FlashEnd() must be called once FlashBusy() is false.
+ **********************************************************************/
+
+void FlashStart(UINT8 op)
+{
+    UINT32 t0;
     //UINT32 status;
     //UINT32 delay_count = 1500;
 
@@ -37,10 +54,14 @@ UINT8 FlashOperation(UINT8 op)
 
     // 1-Select Flash operation to perform
     // Enable writes to WR bit and LVD circuit
+    t0 = ReadCoreTimer();
     NVMCON = _NVMCON_WREN_MASK | op;
 
     // 2-Wait for LVD to become stable (at least 6us).
     Delayus(7);
+    flashT1 = ReadCoreTimer();
+    flashOp = op;
+    bootStats.LvdWait += flashT1 - t0;
     // Assume we're running at max frequency (80 MHz) so we're always safe
     // 1 cycle = 1/80MHz = 12.5 ns so 6us is about 500 cycles
     //while (delay_count--);
@@ -54,10 +75,22 @@ UINT8 FlashOperation(UINT8 op)
     NVMCONSET = _NVMCON_WR_MASK;
     //NVMCON |= _NVMCON_WR_MASK;
     //NVMCONbits.WR = 1;
+}
+
+/***********************************************************************
+ * Waits for the operation started by FlashStart() to complete
+ * Returns '0' if operation completed successfully.
+ **********************************************************************/
+
+UINT8 FlashEnd(void)
+{
+    UINT8 res;
+    UINT32 t2;
 
     // 5-Wait for operation to complete (WR=0)
-    while (NVMCON & _NVMCON_WR_MASK);
+    while (FlashBusy());
     //while (NVMCONbits.WR);
+    t2 = ReadCoreTimer();
 
     // 6-Disable Flash Write/Erase operations
     NVMCONCLR = _NVMCON_WREN_MASK;
@@ -72,8 +105,18 @@ UINT8 FlashOperation(UINT8 op)
     #endif
 
     res = FlashError();
+
+    // See stats.h
+    if (flashOp < STATS_NVMOPS)
+    {
+        bootStats.NvmCount[flashOp]++;
+        bootStats.NvmTicks[flashOp] += t2 - flashT1;
+    }
     
-    #if (_DEBUG_ENABLE_)
+    #if (_TRACE_ENABLE_)
+    if (res)
+        SerialTrace("NVMERR", NVMCON);
+    #elif (_DEBUG_ENABLE_)
     if (res)
         SerialPrint("Error\r\n");
     #endif
@@ -124,7 +167,9 @@ UINT8 FlashErasePage(void* address)
     // Convert Address to Physical Address
     NVMADDR = ConvertToPhysicalAddress(address);
 
-    #if (_DEBUG_ENABLE_)
+    #if (_TRACE_ENABLE_)
+        SerialTrace("ERASE", NVMADDR);
+    #elif (_DEBUG_ENABLE_)
         SerialPrint("Erase page at 0x");
         SerialPrintNumber(NVMADDR,16);
         SerialPrint("\r\n");
@@ -151,7 +196,9 @@ UINT8 FlashWriteWord(void* address, UINT32 data)
     // Load data into NVMDATA register
     NVMDATA = data;
 
-    #if (_DEBUG_ENABLE_)
+    #if (_TRACE_ENABLE_)
+        SerialTrace("WORD", NVMADDR);
+    #elif (_DEBUG_ENABLE_)
         SerialPrint("Write 0x");
         SerialPrintNumber(NVMADDR,16);
         SerialPrint(" with word 0x");
@@ -182,12 +229,44 @@ UINT8 FlashWriteRow(void* address, void* data)
     // Set NVMSRCADDR to the SRAM data buffer Address
     NVMSRCADDR = ConvertToPhysicalAddress(data);
 
+    #if (_TRACE_ENABLE_)
+        SerialTrace("ROW", NVMADDR);
+    #endif
+
     // Unlock and Write Row
     res = FlashOperation(FLASH_ROW_WRITE);
 
     return res;
 }
 
+/***********************************************************************
+ * Same as FlashErasePage() and FlashWriteRow() but only start the
+ * operation, see FlashStart().
+ **********************************************************************/
+
+void FlashStartErasePage(void* address)
+{
+    NVMADDR = ConvertToPhysicalAddress(address);
+
+    #if (_TRACE_ENABLE_)
+        SerialTrace("ERASE", NVMADDR);
+    #endif
+
+    FlashStart(FLASH_PAGE_ERASE);
+}
+
+void FlashStartWriteRow(void* address, void* data)
+{
+    NVMADDR = ConvertToPhysicalAddress(address);
+    NVMSRCADDR = ConvertToPhysicalAddress(data);
+
+    #if (_TRACE_ENABLE_)
+        SerialTrace("ROW", NVMADDR);
+    #endif
+
+    FlashStart(FLASH_ROW_WRITE);
+}
+
 /***********************************************************************
  * Clears the NVMCON error flag.
  * returns '0' if operation completed successfully.
@@ -24,6 +24,16 @@
 #define FLASH_PAGE_SIZE                 0x1000
 #endif
 
+// The Flash row size is
+// - 32 instructions (128 bytes) on PIC32MX-1XX/2XX devices
+// - 128 instructions (512 bytes) on PIC32MX-3XX/7XX devices
+
+#if defined(__PIC32MX2__)
+#define FLASH_ROW_SIZE                  0x80
+#else
+#define FLASH_ROW_SIZE                  0x200
+#endif
+
 // PIC32MX270F256B issues
 // - BMXPFMSZ returns 512K instead of 256K
 // - BMXDRMSZ returns 128K instead of 64K
@@ -46,6 +56,11 @@ UINT8 FlashOperation(UINT8);
 UINT8 FlashErasePage(void*);
 UINT8 FlashWriteWord(void*, UINT32);
 UINT8 FlashWriteRow(void*, void*);
+void  FlashStart(UINT8);
+UINT8 FlashEnd(void);
+void  FlashStartErasePage(void*);
+void  FlashStartWriteRow(void*, void*);
+#define FlashBusy()         (NVMCON & _NVMCON_WR_MASK)
 //UINT8 FlashClearError();
 #define FlashError()        (NVMCON & (_NVMCON_WRERR_MASK | _NVMCON_LVDERR_MASK))
 #define FlashClearError()   FlashOperation(FLASH_NOP)
@@ -0,0 +1,660 @@
+/***********************************************************************
+    Title:  USB Pinguino Bootloader
+    File:   host/gadget.c
+    Descr.: runs command.c as a Linux USB gadget (raw_gadget, dummy_hcd)
+    Author: Régis Blanchot <rblanchot@gmail.com>
+
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+ **********************************************************************
+    usage: sudo ./gadget [-w us] [-r us] [-e us] [-l us] [-p us]
+                         [-i flash.bin] [-d driver] [-u device]
+
+    The bootloader enumerates on the local machine as the real board,
+    HID interface, EP1 IN/OUT interrupt at 0x81/0x01, so that the
+    unmodified uploader32.py goes through libusb, usbfs and the host
+    controller driver as it would with the hardware :
+        sudo modprobe dummy_hcd
+        sudo modprobe raw_gadget
+        sudo ./gadget -i flash.bin &
+        python ../tools/uploader32.py path/filename.hex
+
+    raw_gadget is used rather than FunctionFS as the descriptors and the
+    endpoint addresses are then the gadget's own : FunctionFS lets the
+    UDC choose them (0x85, 0x02 ... on dummy_udc).
+
+    The flash is the file -i (a memfd without it), kept from one run to
+    the next, and the flash operations really stall the handler for the
+    configured times (-w word write, -r row write, -e page erase).
+    Each EP1 packet is delayed by -l us (hub, host controller latency)
+    and, with -p, held until the next frame boundary (-p 1000, full-speed
+    frames). The device is full speed whatever dummy_hcd is.
+
+    Three threads do the bus side : ep0 (enumeration, HID requests), EP1
+    OUT and EP1 IN. The main thread is the firmware : it calls
+    USBPacketHandler() and moves the packets between the threads and the
+    mock buffer descriptors (sie.c). An IN descriptor is released when
+    the host has read the packet, as the SIE would do.
+    RESET_DEVICE restarts the command handler, the device stays attached.
+    Ctrl-C prints the totals.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+#include "host.h"
+#include "../command.h"
+
+#define USB_VENDOR_ID           0x04D8  // MICROCHIP, see boot.h
+#define USB_PRODUCT_ID          0x003C  // PINGUINO, see boot.h
+#define USB_EP0_BUFF_SIZE       64
+
+#define BCD(x)                  ((((x) / 10) << 4) | ((x) % 10))
+
+#if defined(__32MX220F032B__)
+#define SERIAL                  "32MX220"
+#elif defined(__32MX250F128B__)
+#define SERIAL                  "32MX250"
+#elif defined(__32MX440F256H__)
+#define SERIAL                  "32MX440"
+#elif defined(__32MX470F512H__)
+#define SERIAL                  "32MX470"
+#else //defined(__32MX270F256B__)
+#define SERIAL                  "32MX270"
+#endif
+
+/***********************************************************************
+ * Descriptors, the same as descriptors.c (HID interface only)
+ **********************************************************************/
+
+#define HID_DT_HID              0x21
+#define HID_DT_REPORT           0x22
+#define HID_REQ_SET_IDLE        0x0A
+#define HID_REQ_SET_PROTOCOL    0x0B
+
+static const UINT8 hid_rpt01[] =
+{
+    0x06, 0x00, 0xFF,           // Usage Page = 0xFF00 (Vendor Defined Page 1)
+    0x09, 0x01,                 // Usage (Vendor Usage 1)
+    0xA1, 0x01,                 // Collection (Application)
+    0x19, 0x01,                 //      Usage Minimum
+    0x29, 0x40,                 //      Usage Maximum, 64 input usages
+    0x15, 0x00,                 //      Logical Minimum
+    0x26, 0xFF, 0x00,           //      Logical Maximum
+    0x75, 0x08,                 //      Report Size: 8-bit field size
+    0x95, 0x40,                 //      Report Count: 64 8-bit fields
+    0x81, 0x00,                 //      Input (Data, Array, Abs)
+    0x19, 0x01,                 //      Usage Minimum
+    0x29, 0x40,                 //      Usage Maximum, 64 output usages
+    0x91, 0x00,                 //      Output (Data, Array, Abs)
+    0xC0                        // End Collection
+};
+
+static const struct usb_device_descriptor device =
+{
+    .bLength            = USB_DT_DEVICE_SIZE,
+    .bDescriptorType    = USB_DT_DEVICE,
+    .bcdUSB             = 0x0200,
+    .bMaxPacketSize0    = USB_EP0_BUFF_SIZE,
+    .idVendor           = USB_VENDOR_ID,
+    .idProduct          = USB_PRODUCT_ID,
+    .bcdDevice          = (BCD(USB_MAJOR_VER) << 8) | BCD(USB_MINOR_VER),
+    .iManufacturer      = 1,
+    .iProduct           = 2,
+    .iSerialNumber      = 3,
+    .bNumConfigurations = 1
+};
+
+// usb_endpoint_descriptor without the audio fields
+typedef struct __attribute__((packed))
+{
+    UINT8  bLength;
+    UINT8  bDescriptorType;
+    UINT8  bEndpointAddress;
+    UINT8  bmAttributes;
+    UINT16 wMaxPacketSize;
+    UINT8  bInterval;
+} EpDesc;
+
+static const struct __attribute__((packed))
+{
+    struct usb_config_descriptor config;
+    struct usb_interface_descriptor intf;
+    struct __attribute__((packed))
+    {
+        UINT8  bLength;
+        UINT8  bDescriptorType;
+        UINT16 bcdHID;
+        UINT8  bCountryCode;
+        UINT8  bNumDescriptors;
+        UINT8  bClassDescriptorType;
+        UINT16 wDescriptorLength;
+    } hid;
+    EpDesc in;
+    EpDesc out;
+} config =
+{
+    .config =
+    {
+        .bLength             = USB_DT_CONFIG_SIZE,
+        .bDescriptorType     = USB_DT_CONFIG,
+        .wTotalLength        = sizeof(config),
+        .bNumInterfaces      = 1,
+        .bConfigurationValue = 1,
+        .bmAttributes        = USB_CONFIG_ATT_ONE | USB_CONFIG_ATT_SELFPOWER,
+        .bMaxPower           = 50
+    },
+    .intf =
+    {
+        .bLength             = USB_DT_INTERFACE_SIZE,
+        .bDescriptorType     = USB_DT_INTERFACE,
+        .bNumEndpoints       = 2,
+        .bInterfaceClass     = USB_CLASS_HID
+    },
+    .hid = { 9, HID_DT_HID, 0x0111, 0, 1, HID_DT_REPORT, sizeof(hid_rpt01) },
+    .in =
+    {
+        .bLength             = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType     = USB_DT_ENDPOINT,
+        .bEndpointAddress    = USB_DIR_IN | HID_EP,
+        .bmAttributes        = USB_ENDPOINT_XFER_INT,
+        .wMaxPacketSize      = HID_INT_EP_SIZE,
+        .bInterval           = 1
+    },
+    .out =
+    {
+        .bLength             = USB_DT_ENDPOINT_SIZE,
+        .bDescriptorType     = USB_DT_ENDPOINT,
+        .bEndpointAddress    = USB_DIR_OUT | HID_EP,
+        .bmAttributes        = USB_ENDPOINT_XFER_INT,
+        .wMaxPacketSize      = HID_INT_EP_SIZE,
+        .bInterval           = 1
+    }
+};
+
+static const char *strings[] = { NULL, "SeaIceLab", "Pinguino", SERIAL };
+
+/***********************************************************************
+ * State shared by the threads
+ **********************************************************************/
+
+typedef struct
+{
+    struct usb_raw_ep_io io;
+    UINT8 data[256];
+} RawIo;
+
+static int raw;                         // /dev/raw-gadget
+static int epIn = -1, epOut = -1;       // raw_gadget endpoint handles
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static volatile int configured;         // SET_CONFIGURATION seen (ep0)
+static UINT8 outPacket[HID_INT_EP_SIZE];
+static int outFull;                     // EP1 OUT -> firmware
+static UINT8 inPacket[HID_INT_EP_SIZE];
+static int inBusy, inDone, inError;     // firmware -> EP1 IN
+
+static UINT32 latencyUs;                // -l, per packet
+static UINT32 frameUs;                  // -p, frame pacing
+static volatile sig_atomic_t quit;
+
+static jmp_buf resetJump;
+static UINT32 commands[256];
+static UINT32 resets;
+
+/***********************************************************************
+ * core.c and delay.c stand-ins, real time
+ **********************************************************************/
+
+UINT64 HostNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void MemClear(void *address, UINT32 nbytes)
+{
+    memset(address, 0, nbytes & ~(WORDSIZE - 1));
+}
+
+void MemCopy(void *from, void *to, UINT32 nbytes)
+{
+    memcpy(to, from, nbytes & ~(WORDSIZE - 1));
+}
+
+void Delayus(UINT32 us)
+{
+    usleep(us);
+}
+
+// The flash stalls are slept (nvmSleep), host time is device time
+UINT32 ReadCoreTimer(void)
+{
+    return (UINT32)(HostNow() / 1000 * FCPUMHZ / 2);
+}
+
+// The bootloader starts again
+void SoftReset(void)
+{
+    longjmp(resetJump, 1);
+}
+
+/***********************************************************************
+ * Bus timing
+ **********************************************************************/
+
+static void Latency(void)
+{
+    UINT64 now;
+
+    if (latencyUs)
+        usleep(latencyUs);
+
+    // the host controller schedules interrupt transfers once per frame
+    if (frameUs)
+    {
+        now = HostNow() / 1000;
+        usleep(frameUs - now % frameUs);
+    }
+}
+
+/***********************************************************************
+ * ep0 : enumeration and HID class requests
+ **********************************************************************/
+
+static int Ep0Write(const void *data, UINT16 len, UINT16 wLength)
+{
+    RawIo io;
+
+    io.io.ep = 0;
+    io.io.flags = 0;
+    io.io.length = len < wLength ? len : wLength;
+    memcpy(io.data, data, io.io.length);
+    return ioctl(raw, USB_RAW_IOCTL_EP0_WRITE, &io);
+}
+
+static int Ep0Read(UINT16 wLength)
+{
+    RawIo io;
+
+    io.io.ep = 0;
+    io.io.flags = 0;
+    io.io.length = wLength < sizeof(io.data) ? wLength : sizeof(io.data);
+    return ioctl(raw, USB_RAW_IOCTL_EP0_READ, &io);
+}
+
+static int EpEnable(const EpDesc *desc)
+{
+    struct usb_endpoint_descriptor ep;
+
+    memset(&ep, 0, sizeof(ep));
+    memcpy(&ep, desc, USB_DT_ENDPOINT_SIZE);
+    return ioctl(raw, USB_RAW_IOCTL_EP_ENABLE, &ep);
+}
+
+// Returns -1 to stall the request
+static int Ep0Setup(const struct usb_ctrlrequest *req)
+{
+    UINT8 type = req->wValue >> 8, index = req->wValue & 0xFF;
+    UINT8 buf[2 + 2 * 32];
+    UINT32 i;
+
+    if (req->bRequestType == (USB_DIR_IN | USB_TYPE_STANDARD | USB_RECIP_DEVICE) &&
+        req->bRequest == USB_REQ_GET_DESCRIPTOR)
+    {
+        switch (type)
+        {
+            case USB_DT_DEVICE:
+                return Ep0Write(&device, sizeof(device), req->wLength);
+
+            case USB_DT_CONFIG:
+                return Ep0Write(&config, sizeof(config), req->wLength);
+
+            case USB_DT_STRING:
+                if (index >= sizeof(strings) / sizeof(strings[0]))
+                    return -1;
+                if (index == 0)
+                {
+                    buf[0] = 4; buf[1] = USB_DT_STRING;
+                    buf[2] = 0x09; buf[3] = 0x04;
+                }
+                else
+                {
+                    for (i = 0; strings[index][i]; i++)
+                    {
+                        buf[2 + 2 * i] = strings[index][i];
+                        buf[3 + 2 * i] = 0;
+                    }
+                    buf[0] = 2 + 2 * i; buf[1] = USB_DT_STRING;
+                }
+                return Ep0Write(buf, buf[0], req->wLength);
+
+            default:                    // device qualifier : full speed only
+                return -1;
+        }
+    }
+
+    if (req->bRequestType == (USB_DIR_IN | USB_TYPE_STANDARD | USB_RECIP_INTERFACE) &&
+        req->bRequest == USB_REQ_GET_DESCRIPTOR)
+    {
+        if (type == HID_DT_REPORT)
+            return Ep0Write(hid_rpt01, sizeof(hid_rpt01), req->wLength);
+        if (type == HID_DT_HID)
+            return Ep0Write(&config.hid, sizeof(config.hid), req->wLength);
+        return -1;
+    }
+
+    if (req->bRequestType == (USB_DIR_OUT | USB_TYPE_STANDARD | USB_RECIP_DEVICE) &&
+        req->bRequest == USB_REQ_SET_CONFIGURATION)
+    {
+        if (epIn < 0)
+        {
+            epIn = EpEnable(&config.in);
+            epOut = EpEnable(&config.out);
+            if (epIn < 0 || epOut < 0)
+                return -1;
+            ioctl(raw, USB_RAW_IOCTL_VBUS_DRAW, config.config.bMaxPower);
+            ioctl(raw, USB_RAW_IOCTL_CONFIGURE, 0);
+        }
+        pthread_mutex_lock(&lock);
+        configured = (req->wValue != 0);
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&lock);
+        return Ep0Read(0);
+    }
+
+    if (req->bRequestType == (USB_DIR_OUT | USB_TYPE_STANDARD | USB_RECIP_INTERFACE) &&
+        req->bRequest == USB_REQ_SET_INTERFACE)
+        return Ep0Read(0);
+
+    // SET_IDLE, SET_PROTOCOL (usbhid, before uploader32.py detaches it)
+    if (req->bRequestType == (USB_DIR_OUT | USB_TYPE_CLASS | USB_RECIP_INTERFACE) &&
+        (req->bRequest == HID_REQ_SET_IDLE || req->bRequest == HID_REQ_SET_PROTOCOL))
+        return Ep0Read(req->wLength);
+
+    return -1;
+}
+
+static void *Ep0Thread(void *arg)
+{
+    struct
+    {
+        struct usb_raw_event event;
+        struct usb_ctrlrequest req;
+    } e;
+
+    while (!quit)
+    {
+        e.event.type = 0;
+        e.event.length = sizeof(e.req);
+        if (ioctl(raw, USB_RAW_IOCTL_EVENT_FETCH, &e) < 0)
+            break;
+
+        if (e.event.type == USB_RAW_EVENT_CONNECT)
+            continue;
+        if (e.event.type == USB_RAW_EVENT_CONTROL && Ep0Setup(&e.req) < 0)
+            ioctl(raw, USB_RAW_IOCTL_EP0_STALL, 0);
+    }
+    return arg;
+}
+
+/***********************************************************************
+ * EP1 : one thread per direction, the calls block until the host polls
+ **********************************************************************/
+
+static void *OutThread(void *arg)
+{
+    RawIo io;
+
+    while (!quit)
+    {
+        io.io.ep = epOut;
+        io.io.flags = 0;
+        io.io.length = HID_INT_EP_SIZE;
+        if (ioctl(raw, USB_RAW_IOCTL_EP_READ, &io) < 0)
+        {
+            usleep(1000);               // not configured yet, or reset
+            continue;
+        }
+        Latency();
+
+        pthread_mutex_lock(&lock);
+        while (outFull && !quit)
+            pthread_cond_wait(&cond, &lock);
+        memcpy(outPacket, io.data, HID_INT_EP_SIZE);
+        outFull = 1;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+    }
+    return arg;
+}
+
+static void *InThread(void *arg)
+{
+    RawIo io;
+    int ret;
+
+    while (!quit)
+    {
+        pthread_mutex_lock(&lock);
+        while ((!inBusy || inDone) && !quit)
+            pthread_cond_wait(&cond, &lock);
+        memcpy(io.data, inPacket, HID_INT_EP_SIZE);
+        pthread_mutex_unlock(&lock);
+
+        Latency();
+        io.io.ep = epIn;
+        io.io.flags = 0;
+        io.io.length = HID_INT_EP_SIZE;
+        ret = ioctl(raw, USB_RAW_IOCTL_EP_WRITE, &io);
+
+        pthread_mutex_lock(&lock);
+        inDone = 1;
+        inError = (ret < 0);
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&lock);
+    }
+    return arg;
+}
+
+/***********************************************************************
+ * Firmware
+ **********************************************************************/
+
+static void Configure(void)
+{
+    SieInit();
+    CommandInit();
+    USBDeviceState = CONFIGURED_STATE;
+    USBEventHandler();
+}
+
+static void Firmware(void)
+{
+    struct timespec ts;
+    volatile int wasConfigured = 0;
+    int active;
+
+    if (setjmp(resetJump))
+    {
+        resets++;
+        wasConfigured = 0;
+    }
+
+    while (!quit)
+    {
+        pthread_mutex_lock(&lock);
+
+        if (configured != wasConfigured)
+        {
+            wasConfigured = configured;
+            if (configured)
+                Configure();
+            else
+                SieInit();
+        }
+        else if (!configured)
+        {
+            pthread_mutex_unlock(&lock);
+            usleep(1000);
+            continue;
+        }
+
+        active = 0;
+
+        // the host has read the IN packet, or gave up
+        if (inDone)
+        {
+            if (inError)
+                SieInDrop();
+            else
+                SieHostIn(inPacket);
+            inBusy = inDone = 0;
+            active = 1;
+        }
+
+        if (outFull && SieHostOut(outPacket))
+        {
+            commands[outPacket[0]]++;
+            outFull = 0;
+            active = 1;
+        }
+
+        if (!inBusy && SieInPeek(inPacket))
+        {
+            inBusy = 1;
+            active = 1;
+        }
+
+        if (active)
+            pthread_cond_broadcast(&cond);
+        else
+        {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 100000;
+            if (ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&cond, &lock, &ts);
+        }
+
+        pthread_mutex_unlock(&lock);
+
+        USBPacketHandler();
+    }
+}
+
+/***********************************************************************
+ * Totals
+ **********************************************************************/
+
+static void Report(void)
+{
+    UINT32 i, sep = 0;
+
+    printf("packets    : %u OUT, %u IN, %u dropped\n",
+        sieStats.out, sieStats.in, sieStats.dropped);
+
+    printf("commands   :");
+    for (i = 0; i < 256; i++)
+        if (commands[i])
+            printf("%s 0x%02X %u", sep++ ? "," : "", i, commands[i]);
+    printf("\n");
+
+    printf("flash ops  : %u erase, %u row, %u word, %u nop, %u error, %u overwrite\n",
+        nvmStats.erase, nvmStats.row, nvmStats.word,
+        nvmStats.nop, nvmStats.error, nvmStats.overwrite);
+
+    printf("flash time : %llu us, %u reset\n",
+        (unsigned long long)nvmStats.busy_us, resets);
+}
+
+static void Quit(int sig)
+{
+    quit = sig;
+}
+
+int main(int argc, char **argv)
+{
+    const char *driver = "dummy_udc", *udc = "dummy_udc.0";
+    struct usb_raw_init init;
+    pthread_t ep0, in, out;
+    int opt, usage = 0;
+
+    while ((opt = getopt(argc, argv, "w:r:e:l:p:i:d:u:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'w': nvmWordUs = atoi(optarg); break;
+            case 'r': nvmRowUs = atoi(optarg); break;
+            case 'e': nvmPageUs = atoi(optarg); break;
+            case 'l': latencyUs = atoi(optarg); break;
+            case 'p': frameUs = atoi(optarg); break;
+            case 'i': nvmImage = optarg; break;
+            case 'd': driver = optarg; break;
+            case 'u': udc = optarg; break;
+            default:  usage = 1; break;
+        }
+    }
+
+    if (usage || optind != argc)
+    {
+        fprintf(stderr, "usage: %s [-w us] [-r us] [-e us] [-l us] [-p us] [-i flash.bin] [-d driver] [-u device]\n", argv[0]);
+        return 1;
+    }
+
+    nvmSleep = 1;
+    if (NvmInit() < 0)
+    {
+        fprintf(stderr, "Unable to map the flash at 0x%08X\n", KSEG0_FLASH_MEM_START);
+        return 1;
+    }
+
+    raw = open("/dev/raw-gadget", O_RDWR);
+    if (raw < 0)
+    {
+        perror("/dev/raw-gadget (modprobe raw_gadget)");
+        return 1;
+    }
+
+    memset(&init, 0, sizeof(init));
+    strncpy((char*)init.driver_name, driver, UDC_NAME_LENGTH_MAX - 1);
+    strncpy((char*)init.device_name, udc, UDC_NAME_LENGTH_MAX - 1);
+    init.speed = USB_SPEED_FULL;
+    if (ioctl(raw, USB_RAW_IOCTL_INIT, &init) < 0 || ioctl(raw, USB_RAW_IOCTL_RUN, 0) < 0)
+    {
+        perror(udc);
+        return 1;
+    }
+
+    signal(SIGINT, Quit);
+    signal(SIGTERM, Quit);
+
+    pthread_create(&ep0, NULL, Ep0Thread, NULL);
+    pthread_create(&out, NULL, OutThread, NULL);
+    pthread_create(&in, NULL, InThread, NULL);
+
+    printf("PIC%s bootloader v%d.%d.%d attached to %s\n", SERIAL,
+        USB_MAJOR_VER, USB_MINOR_VER, USB_DEVPT_VER, udc);
+    fflush(stdout);
+
+    Firmware();
+
+    // the threads are blocked in raw_gadget, closing detaches the device
+    Report();
+    close(raw);
+    return 0;
+}
@@ -0,0 +1,228 @@
+/***********************************************************************
+    Title:  USB Pinguino Bootloader
+    File:   host/host.h
+    Descr.: native (Linux) stand-ins for the PIC32 headers used by command.c
+    Author: Régis Blanchot <rblanchot@gmail.com>
+
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+ **********************************************************************
+    Replaces typedefs.h, mem.h, flash.h, core.h, delay.h and usb.h when
+    command.c is built with -D__HOST__ (see host/Makefile) :
+    - the flash is mapped at its KSEG0 address (KSEG0_FLASH_MEM_START),
+      read-only, and only changes through the mock NVM controller (nvm.c),
+    - EP1 buffer descriptors and the SIE are mocked in sie.c,
+    - MemCopy, MemClear, Delayus, ReadCoreTimer and SoftReset are in
+      replay.c and gadget.c.
+ **********************************************************************/
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/***********************************************************************
+ * typedefs.h (UINT32 must be 32-bit on a 64-bit host)
+ **********************************************************************/
+
+#define WORDSIZE                4
+
+typedef uint8_t                 UINT8;
+typedef uint16_t                UINT16;
+typedef uint32_t                UINT32;
+typedef uint64_t                UINT64;
+
+#ifndef _DEBUG_ENABLE_
+#define _DEBUG_ENABLE_          0
+#endif
+
+#ifndef _TRACE_ENABLE_
+#define _TRACE_ENABLE_          0
+#endif
+
+/***********************************************************************
+ * mem.h and flash.h, same memory map as the target
+ **********************************************************************/
+
+#if defined(__32MX220F032B__)
+#define FLASH_TOTAL_LENGTH      0x8000
+#define BOOT_PROGRAM_LENGTH     0x3000
+#define DEVICE_ID               0x04A00053
+#elif defined(__32MX250F128B__)
+#define FLASH_TOTAL_LENGTH      0x20000
+#define BOOT_PROGRAM_LENGTH     0x3000
+#define DEVICE_ID               0x04D00053
+#elif defined(__32MX440F256H__)
+#define FLASH_TOTAL_LENGTH      0x40000
+#define BOOT_PROGRAM_LENGTH     0x5000
+#define DEVICE_ID               0x00952053
+#elif defined(__32MX470F512H__)
+#define FLASH_TOTAL_LENGTH      0x80000
+#define BOOT_PROGRAM_LENGTH     0x2000
+#define DEVICE_ID               0x0580A053
+#else //defined(__32MX270F256B__)
+#define FLASH_TOTAL_LENGTH      0x40000
+#define BOOT_PROGRAM_LENGTH     0x2000
+#define DEVICE_ID               0x06600053
+#endif
+
+// Flash page is 1 KB and row is 32 words on PIC32MX-1XX/2XX devices
+#if defined(__PIC32MX2__)
+#define FLASH_PAGE_SIZE         0x400
+#define FLASH_ROW_SIZE          0x80
+#else
+#define FLASH_PAGE_SIZE         0x1000
+#define FLASH_ROW_SIZE          0x200
+#endif
+
+#define KSEG0_FLASH_MEM_START   0x9D000000
+#define FLASH_MEM_END           (KSEG0_FLASH_MEM_START + FLASH_TOTAL_LENGTH)
+
+// DEVID register, read by uploader32.py with GET_DATA
+#define DEVID_ADDR              0xBF80F220
+
+#define RESET_VECTOR_MEM_LENGTH 0x10
+#define IVT_MEM_LENGTH          0x1000
+
+#define APP_EBASE_ADDR          (KSEG0_FLASH_MEM_START + BOOT_PROGRAM_LENGTH)
+#define APP_RESET_ADDR          (APP_EBASE_ADDR + IVT_MEM_LENGTH)
+#define APP_PROGRAM_ADDR_START  (APP_RESET_ADDR + RESET_VECTOR_MEM_LENGTH)
+#define APP_PROGRAM_ADDR_END    FLASH_MEM_END
+#define APP_PROGRAM_LENGTH      (APP_PROGRAM_ADDR_END - APP_PROGRAM_ADDR_START)
+
+#define APP_SIGN_ADDR           APP_EBASE_ADDR
+#define APP_SIGN_LENGTH         0x10
+#define APP_SIGN_MAGIC          0x474E4950      // "PING"
+
+#define FLASH_NOP               0
+#define FLASH_WORD_WRITE        1
+#define FLASH_ROW_WRITE         3
+#define FLASH_PAGE_ERASE        4
+
+#define _NVMCON_WR_MASK         0x00008000
+#define _NVMCON_WREN_MASK       0x00004000
+#define _NVMCON_WRERR_MASK      0x00002000
+#define _NVMCON_LVDERR_MASK     0x00001000
+
+// The addresses used by command.c are 32-bit virtual addresses
+#define KVA_TO_PA(va)           ( (UINT32) (uintptr_t) (va) & 0x1FFFFFFF )
+#define PA_TO_KVA0(pa)          ( (UINT32) (pa) | 0x80000000 )
+#define ConvertToPhysicalAddress(a)      KVA_TO_PA(a)
+#define ConvertFlashToVirtualAddress(a)  PA_TO_KVA0(a)
+
+extern volatile UINT32 NVMCON;
+extern volatile UINT32 NVMADDR;
+extern volatile UINT32 NVMDATA;
+extern void *NVMSRCPTR;                 // NVMSRCADDR, a host pointer
+
+UINT8 FlashOperation(UINT8);
+UINT8 FlashErasePage(void*);
+UINT8 FlashWriteWord(void*, UINT32);
+UINT8 FlashWriteRow(void*, void*);
+#define FlashError()        (NVMCON & (_NVMCON_WRERR_MASK | _NVMCON_LVDERR_MASK))
+#define FlashClearError()   FlashOperation(FLASH_NOP)
+
+/***********************************************************************
+ * Mock NVM controller (nvm.c)
+ **********************************************************************/
+
+typedef struct
+{
+    UINT32 nop;                         // FLASH_NOP operations
+    UINT32 word;                        // FLASH_WORD_WRITE operations
+    UINT32 row;                         // FLASH_ROW_WRITE operations
+    UINT32 erase;                       // FLASH_PAGE_ERASE operations
+    UINT32 error;                       // operations that set WRERR
+    UINT32 overwrite;                   // words programmed twice without erase
+    UINT64 busy_us;                     // time the CPU was stalled
+    UINT64 host_ns;                     // host time spent in the mock itself
+} NvmStats;
+
+extern NvmStats nvmStats;
+extern UINT32 nvmWordUs;                // word program time
+extern UINT32 nvmRowUs;                 // row program time
+extern UINT32 nvmPageUs;                // page erase time
+extern UINT32 nvmLvdUs;                 // LVD start-up wait (FlashOperation)
+extern const char *nvmImage;            // flash image file, NULL = memfd
+extern UINT8 nvmSleep;                  // sleep the stall times (gadget.c)
+
+int  NvmInit(void);
+void NvmErase(void);
+int  NvmDump(const char *);
+
+/***********************************************************************
+ * core.h and delay.h (replay.c, gadget.c)
+ **********************************************************************/
+
+#ifndef FCPUMHZ
+#define FCPUMHZ                 40
+#endif
+#define FCPU                    (FCPUMHZ * 1000000UL)
+#define FPB                     FCPU
+#define FCP0                    (FCPU / 2)
+
+void MemClear(void *, UINT32);
+void MemCopy (void *, void *, UINT32);
+void SoftReset(void);
+void Delayus(UINT32);
+UINT64 HostNow(void);                   // monotonic time in ns
+UINT32 ReadCoreTimer(void);             // device time, see replay.c
+
+/***********************************************************************
+ * usb.h, EP1 only (sie.c)
+ **********************************************************************/
+
+#define HID_EP                  1
+#define HID_INT_EP_SIZE         64
+#define OUT_FROM_HOST           0
+#define IN_TO_HOST              1
+
+#define USB_HANDSHAKE_ENABLED   0x01
+#define USB_OUT_ENABLED         0x08
+#define USB_IN_ENABLED          0x04
+#define USB_DISALLOW_SETUP      0x10
+
+typedef enum
+{
+    DETACHED_STATE   = 0x00,
+    CONFIGURED_STATE = 0x20
+} USB_DEVICE_STATE;
+
+// Same ownership bit as the target, ADR is a host pointer
+typedef struct
+{
+    struct
+    {
+        unsigned UOWN:1;                // 1 = owned by the SIE
+        unsigned DTS :1;
+    } STAT;
+    UINT16 CNT;
+    UINT8 *ADR;
+} BDT_ENTRY;
+
+#define USB_HANDLE void*
+#define USBHandleBusy(handle) (handle==0?0:((volatile BDT_ENTRY*)handle)->STAT.UOWN)
+
+typedef struct
+{
+    UINT32 out;                         // packets received from the host
+    UINT32 in;                          // packets sent to the host
+    UINT32 dropped;                     // IN packets never read by the host
+} SieStats;
+
+extern SieStats sieStats;
+extern volatile UINT32 U1CON;
+extern USB_DEVICE_STATE USBDeviceState;
+
+void SieInit(void);
+int  SieHostOut(const UINT8 *);
+int  SieHostIn(UINT8 *);
+int  SieInPeek(UINT8 *);
+int  SieOutArmed(void);
+int  SieInPending(void);
+void SieInDrop(void);
+void USBEnableEndpoint(UINT8, UINT8);
+USB_HANDLE USBTransferOnePacket(UINT8, UINT8*);
+
+#endif /* _HOST_H_ */
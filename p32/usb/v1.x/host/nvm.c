@@ -0,0 +1,247 @@
+/***********************************************************************
+    Title:  USB Pinguino Bootloader
+    File:   host/nvm.c
+    Descr.: mock NVM controller, flash.c API with page/row/word semantics
+    Author: Régis Blanchot <rblanchot@gmail.com>
+
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+ **********************************************************************
+    The flash is a memfd, or the file nvmImage, mapped twice :
+    - read-only at KSEG0_FLASH_MEM_START, the address command.c reads,
+      so that a direct write to the flash faults as it would on the chip,
+    - read-write anywhere, used by FlashOperation() only.
+    As on the chip, programming can only clear bits and a page erase
+    sets the whole page to 0xFF. Each operation stalls the CPU for the
+    configured time, accumulated in nvmStats.busy_us, and slept if
+    nvmSleep is set (gadget.c).
+ **********************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "host.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE     MAP_FIXED
+#endif
+
+#define FLASH_PA_START          KVA_TO_PA(KSEG0_FLASH_MEM_START)
+#define DEVID_PAGE              (DEVID_ADDR & ~0xFFF)
+
+volatile UINT32 NVMCON;
+volatile UINT32 NVMADDR;
+volatile UINT32 NVMDATA;
+void *NVMSRCPTR;
+
+NvmStats nvmStats;
+
+// PIC32MX datasheets, typical values
+UINT32 nvmWordUs = 20;
+UINT32 nvmRowUs  = 2000;
+UINT32 nvmPageUs = 20000;
+UINT32 nvmLvdUs  = 7;
+
+const char *nvmImage;                   // flash image file, NULL = memfd
+UINT8 nvmSleep;                         // sleep the stall times
+
+static UINT8 *nvmFlash;                 // read-write view
+
+/***********************************************************************
+ * Maps the flash and the DEVID register, returns 0 if successful
+ * An image file of the right size is kept as is, any other is blanked.
+ **********************************************************************/
+
+int NvmInit(void)
+{
+    struct stat st;
+    int fd, blank = 1;
+    void *p;
+
+    if (nvmImage)
+        fd = open(nvmImage, O_RDWR | O_CREAT, 0644);
+    else
+        fd = memfd_create("flash", 0);
+    if (fd < 0 || fstat(fd, &st) < 0)
+        return -1;
+    if (st.st_size == FLASH_TOTAL_LENGTH)
+        blank = 0;
+    else if (ftruncate(fd, 0) < 0 || ftruncate(fd, FLASH_TOTAL_LENGTH) < 0)
+        return -1;
+
+    p = mmap((void*)(uintptr_t)KSEG0_FLASH_MEM_START, FLASH_TOTAL_LENGTH,
+             PROT_READ, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (p != (void*)(uintptr_t)KSEG0_FLASH_MEM_START)
+        return -1;
+
+    nvmFlash = mmap(NULL, FLASH_TOTAL_LENGTH, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+    if (nvmFlash == MAP_FAILED)
+        return -1;
+    close(fd);
+
+    p = mmap((void*)(uintptr_t)DEVID_PAGE, 0x1000, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != (void*)(uintptr_t)DEVID_PAGE)
+        return -1;
+    *(UINT32*)(uintptr_t)DEVID_ADDR = DEVICE_ID;
+
+    if (blank)
+        NvmErase();
+    return 0;
+}
+
+/***********************************************************************
+ * Blank chip, the bootloader area included
+ **********************************************************************/
+
+void NvmErase(void)
+{
+    memset(nvmFlash, 0xFF, FLASH_TOTAL_LENGTH);
+    NVMCON = 0;
+}
+
+/***********************************************************************
+ * Writes the application area to a file, returns 0 if successful
+ **********************************************************************/
+
+int NvmDump(const char *filename)
+{
+    FILE *f;
+    size_t n, len = FLASH_TOTAL_LENGTH - BOOT_PROGRAM_LENGTH;
+
+    f = fopen(filename, "wb");
+    if (f == NULL)
+        return -1;
+    n = fwrite(nvmFlash + BOOT_PROGRAM_LENGTH, 1, len, f);
+    fclose(f);
+    return (n == len) ? 0 : -1;
+}
+
+/***********************************************************************
+ * Checks the target of an operation, returns its offset in the flash
+ * or -1 if it is out of the flash, misaligned or in the bootloader.
+ **********************************************************************/
+
+static long NvmOffset(UINT32 size)
+{
+    UINT32 pa = NVMADDR;
+
+    if (pa < FLASH_PA_START || pa >= FLASH_PA_START + FLASH_TOTAL_LENGTH)
+        return -1;
+    if (pa & (size - 1))
+        return -1;
+    if (pa - FLASH_PA_START < BOOT_PROGRAM_LENGTH)
+        return -1;
+    return pa - FLASH_PA_START;
+}
+
+static void NvmProgram(long offset, const UINT8 *data, UINT32 len)
+{
+    UINT32 i;
+
+    for (i = 0; i < len; i += WORDSIZE)
+    {
+        UINT32 old, new;
+
+        memcpy(&old, nvmFlash + offset + i, WORDSIZE);
+        memcpy(&new, data + i, WORDSIZE);
+        if (old != 0xFFFFFFFF)
+            nvmStats.overwrite++;
+        old &= new;
+        memcpy(nvmFlash + offset + i, &old, WORDSIZE);
+    }
+}
+
+/***********************************************************************
+ * Performs flash Write/Erase operation
+ **********************************************************************/
+
+UINT8 FlashOperation(UINT8 op)
+{
+    UINT64 t0 = HostNow();
+    long offset = 0;
+
+    NVMCON = _NVMCON_WREN_MASK | op;
+    nvmStats.busy_us += nvmLvdUs;
+
+    switch (op)
+    {
+        case FLASH_NOP:
+            nvmStats.nop++;
+            break;
+
+        case FLASH_WORD_WRITE:
+            nvmStats.word++;
+            nvmStats.busy_us += nvmWordUs;
+            offset = NvmOffset(WORDSIZE);
+            if (offset >= 0)
+                NvmProgram(offset, (const UINT8*)&NVMDATA, WORDSIZE);
+            break;
+
+        case FLASH_ROW_WRITE:
+            nvmStats.row++;
+            nvmStats.busy_us += nvmRowUs;
+            offset = NvmOffset(FLASH_ROW_SIZE);
+            if (offset >= 0)
+                NvmProgram(offset, NVMSRCPTR, FLASH_ROW_SIZE);
+            break;
+
+        case FLASH_PAGE_ERASE:
+            nvmStats.erase++;
+            nvmStats.busy_us += nvmPageUs;
+            offset = NvmOffset(FLASH_PAGE_SIZE);
+            if (offset >= 0)
+                memset(nvmFlash + offset, 0xFF, FLASH_PAGE_SIZE);
+            break;
+
+        default:
+            offset = -1;
+            break;
+    }
+
+    // WR is cleared by the hardware, WREN by FlashOperation()
+    NVMCON = op;
+    if (offset < 0)
+    {
+        NVMCON |= _NVMCON_WRERR_MASK;
+        nvmStats.error++;
+    }
+
+    nvmStats.host_ns += HostNow() - t0;
+
+    // the CPU really stalls
+    if (nvmSleep)
+        usleep(nvmLvdUs + (op == FLASH_WORD_WRITE ? nvmWordUs :
+                           op == FLASH_ROW_WRITE  ? nvmRowUs  :
+                           op == FLASH_PAGE_ERASE ? nvmPageUs : 0));
+
+    return FlashError() ? 1 : 0;
+}
+
+/***********************************************************************
+ * flash.c entry points
+ **********************************************************************/
+
+UINT8 FlashErasePage(void* address)
+{
+    NVMADDR = ConvertToPhysicalAddress(address);
+    return FlashOperation(FLASH_PAGE_ERASE);
+}
+
+UINT8 FlashWriteWord(void* address, UINT32 data)
+{
+    NVMADDR = ConvertToPhysicalAddress(address);
+    NVMDATA = data;
+    return FlashOperation(FLASH_WORD_WRITE);
+}
+
+UINT8 FlashWriteRow(void* address, void* data)
+{
+    NVMADDR = ConvertToPhysicalAddress(address);
+    NVMSRCPTR = data;
+    return FlashOperation(FLASH_ROW_WRITE);
+}
@@ -0,0 +1,325 @@
+/***********************************************************************
+    Title:  USB Pinguino Bootloader
+    File:   host/replay.c
+    Descr.: replays an uploader32.py session against command.c
+    Author: Régis Blanchot <rblanchot@gmail.com>
+
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+ **********************************************************************
+    usage: ./replay [-n count] [-w us] [-r us] [-e us] [-d flash.bin] session
+
+    A session is recorded with uploader32.py --record session, one line
+    per EP1 transaction, the 64 bytes of the packet in hex :
+        OUT 02020202...
+        IN  02380301...
+    Lines starting with # are comments.
+
+    Each OUT packet is ACKed as soon as the handler has armed the EP1 OUT
+    descriptor, then the handler runs until it is armed again, i.e. until
+    the command has been executed. IN packets are compared with the
+    recorded ones for GET_DATA only, the other replies carry the clock
+    and the signature of the board the session was recorded on.
+
+    The session is replayed count times from a blank flash, the figures
+    are given per upload :
+    - packets and commands sent by uploader32.py,
+    - calls of USBPacketHandler() and the host CPU time spent in it,
+      the mock NVM excluded,
+    - flash operations and the time the CPU would be stalled by them
+      (-w word write, -r row write, -e page erase, in us).
+    Dropped, stalled and mismatched packets and flash errors are totals,
+    any of them makes the exit status 1.
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include "host.h"
+#include "../command.h"
+
+#define MAXPACKETS              100000
+#define MAXCALLS                1000    // handler calls before giving up
+
+typedef struct
+{
+    UINT8 dir;                          // OUT_FROM_HOST or IN_TO_HOST
+    UINT8 data[HID_INT_EP_SIZE];
+} Transaction;
+
+static Transaction session[MAXPACKETS];
+static UINT32 npackets;
+
+static jmp_buf resetJump;
+static UINT64 delayUs;                  // Delayus()
+static UINT64 handlerNs;                // USBPacketHandler(), mock NVM excluded
+static UINT32 handlerCalls;
+static UINT32 commands[256];
+static UINT32 mismatch;
+static UINT32 stalled;                  // transactions never served
+static UINT32 resets;
+
+static const char *names[256] =
+{
+    [QUERY_DEVICE]       = "QUERY_DEVICE",
+    [UNLOCK_CONFIG]      = "UNLOCK_CONFIG",
+    [ERASE_DEVICE]       = "ERASE_DEVICE",
+    [PROGRAM_DEVICE]     = "PROGRAM_DEVICE",
+    [PROGRAM_COMPLETE]   = "PROGRAM_COMPLETE",
+    [GET_DATA]           = "GET_DATA",
+    [RESET_DEVICE]       = "RESET_DEVICE",
+    [SIGN_FLASH]         = "SIGN_FLASH",
+    [PROGRAM_COMPRESSED] = "PROGRAM_COMPRESSED",
+    [GET_STATS]          = "GET_STATS",
+};
+
+/***********************************************************************
+ * core.c and delay.c stand-ins
+ **********************************************************************/
+
+UINT64 HostNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void MemClear(void *address, UINT32 nbytes)
+{
+    memset(address, 0, nbytes & ~(WORDSIZE - 1));
+}
+
+void MemCopy(void *from, void *to, UINT32 nbytes)
+{
+    memcpy(to, from, nbytes & ~(WORDSIZE - 1));
+}
+
+void Delayus(UINT32 us)
+{
+    delayUs += us;
+}
+
+// Host time plus the time the device would have been stalled (GET_STATS)
+UINT32 ReadCoreTimer(void)
+{
+    UINT64 us = HostNow() / 1000 + nvmStats.busy_us + delayUs;
+
+    return (UINT32)(us * FCPUMHZ / 2);
+}
+
+// The bootloader would start again, end of the session
+void SoftReset(void)
+{
+    longjmp(resetJump, 1);
+}
+
+/***********************************************************************
+ * Session file
+ **********************************************************************/
+
+static int LoadSession(const char *filename)
+{
+    FILE *f;
+    char line[256], dir[4], hex[2 * HID_INT_EP_SIZE + 1];
+    UINT32 i, n = 0;
+
+    f = fopen(filename, "r");
+    if (f == NULL)
+        return -1;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        unsigned int byte;
+
+        if (line[0] == '#' || sscanf(line, "%3s %128s", dir, hex) != 2)
+            continue;
+        if (n == MAXPACKETS || strlen(hex) != 2 * HID_INT_EP_SIZE)
+            break;
+
+        session[n].dir = strcmp(dir, "IN") ? OUT_FROM_HOST : IN_TO_HOST;
+        for (i = 0; i < HID_INT_EP_SIZE; i++)
+        {
+            sscanf(hex + 2 * i, "%2x", &byte);
+            session[n].data[i] = byte;
+        }
+        n++;
+    }
+
+    i = feof(f);
+    fclose(f);
+    npackets = n;
+    return i ? 0 : -1;
+}
+
+/***********************************************************************
+ * Replay
+ **********************************************************************/
+
+static void Handler(void)
+{
+    UINT64 t0 = HostNow();
+    UINT64 nvm = nvmStats.host_ns;
+
+    handlerCalls++;
+    USBPacketHandler();
+    handlerNs += (HostNow() - t0) - (nvmStats.host_ns - nvm);
+}
+
+static void Replay(void)
+{
+    UINT8 packet[HID_INT_EP_SIZE];
+    UINT32 i, n;
+
+    NvmErase();
+    SieInit();
+    CommandInit();
+
+    // SET_CONFIGURATION
+    USBDeviceState = CONFIGURED_STATE;
+    USBEventHandler();
+
+    if (setjmp(resetJump))
+    {
+        resets++;
+        return;
+    }
+
+    for (i = 0; i < npackets; i++)
+    {
+        Transaction *t = &session[i];
+
+        if (t->dir == OUT_FROM_HOST)
+        {
+            // a reply the host never read blocks the handler
+            for (n = 0; n < MAXCALLS && !SieHostOut(t->data); n++)
+            {
+                Handler();
+                if (n == MAXCALLS / 2 && SieInPending())
+                    SieInDrop();
+            }
+            if (n == MAXCALLS)
+            {
+                stalled++;
+                continue;
+            }
+            commands[t->data[0]]++;
+
+            // copy the packet and arm the descriptor, then execute
+            for (n = 0; n < MAXCALLS && !SieOutArmed(); n++)
+            {
+                Handler();
+                if (n == MAXCALLS / 2 && SieInPending())
+                    SieInDrop();
+            }
+            Handler();
+        }
+        else
+        {
+            for (n = 0; n < MAXCALLS && !SieHostIn(packet); n++)
+                Handler();
+
+            if (n == MAXCALLS)
+                stalled++;
+            else if (packet[0] == GET_DATA && t->data[0] == GET_DATA &&
+                     memcmp(packet, t->data, HID_INT_EP_SIZE))
+                mismatch++;
+        }
+    }
+}
+
+/***********************************************************************
+ * Report, per upload
+ **********************************************************************/
+
+static void Report(const char *filename, UINT32 count)
+{
+    UINT32 i, sep = 0;
+
+    printf("session    : %s, %u upload(s)\n", filename, count);
+    printf("packets    : %u OUT, %u IN, %u dropped, %u stalled, %u mismatch\n",
+        sieStats.out / count, sieStats.in / count, sieStats.dropped,
+        stalled, mismatch);
+
+    printf("commands   :");
+    for (i = 0; i < 256; i++)
+    {
+        if (commands[i] == 0)
+            continue;
+        if (names[i])
+            printf("%s %s %u", sep++ ? "," : "", names[i], commands[i] / count);
+        else
+            printf("%s 0x%02X %u", sep++ ? "," : "", i, commands[i] / count);
+    }
+    printf("\n");
+
+    printf("handler    : %u calls, %llu us CPU (%.3f us per packet)\n",
+        handlerCalls / count,
+        (unsigned long long)(handlerNs / count / 1000),
+        sieStats.out ? (double)handlerNs / 1000 / sieStats.out : 0.0);
+
+    printf("flash ops  : %u erase, %u row, %u word, %u nop, %u error, %u overwrite\n",
+        nvmStats.erase / count, nvmStats.row / count, nvmStats.word / count,
+        nvmStats.nop / count, nvmStats.error, nvmStats.overwrite);
+
+    printf("flash time : %llu us (%llu cycles at %d MHz)\n",
+        (unsigned long long)(nvmStats.busy_us / count),
+        (unsigned long long)(nvmStats.busy_us / count * FCPUMHZ),
+        FCPUMHZ);
+
+    printf("delays     : %llu us, %u reset\n",
+        (unsigned long long)(delayUs / count), resets / count);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dump = NULL;
+    UINT32 i, count = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:r:e:d:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': count = atoi(optarg); break;
+            case 'w': nvmWordUs = atoi(optarg); break;
+            case 'r': nvmRowUs = atoi(optarg); break;
+            case 'e': nvmPageUs = atoi(optarg); break;
+            case 'd': dump = optarg; break;
+            default:  optind = argc; break;
+        }
+    }
+
+    if (optind != argc - 1 || count == 0)
+    {
+        fprintf(stderr, "usage: %s [-n count] [-w us] [-r us] [-e us] [-d flash.bin] session\n", argv[0]);
+        return 1;
+    }
+
+    if (LoadSession(argv[optind]) < 0)
+    {
+        fprintf(stderr, "Unable to read %s\n", argv[optind]);
+        return 1;
+    }
+
+    if (NvmInit() < 0)
+    {
+        fprintf(stderr, "Unable to map the flash at 0x%08X\n", KSEG0_FLASH_MEM_START);
+        return 1;
+    }
+
+    for (i = 0; i < count; i++)
+        Replay();
+
+    Report(argv[optind], count);
+
+    if (dump && NvmDump(dump) < 0)
+    {
+        fprintf(stderr, "Unable to write %s\n", dump);
+        return 1;
+    }
+
+    return (mismatch || stalled || nvmStats.error) ? 1 : 0;
+}
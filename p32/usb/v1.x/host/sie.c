@@ -0,0 +1,143 @@
+/***********************************************************************
+    Title:  USB Pinguino Bootloader
+    File:   host/sie.c
+    Descr.: mock EP1 buffer descriptors and Serial Interface Engine
+    Author: Régis Blanchot <rblanchot@gmail.com>
+
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+ **********************************************************************
+    EP1 uses full ping-pong as on the chip : the firmware arms the even
+    and odd buffer descriptors in turn (USBTransferOnePacket) and the SIE
+    serves them in the same order. A host transaction on a descriptor
+    the firmware doesn't own is NAKed.
+ **********************************************************************/
+
+#include "host.h"
+
+#define BD_EVEN                 0
+#define BD_ODD                  1
+
+static BDT_ENTRY BDTOut[2];
+static BDT_ENTRY BDTIn[2];
+static UINT8 fwOut, fwIn;               // next descriptor armed by the firmware
+static UINT8 sieOut, sieIn;             // next descriptor served by the SIE
+static UINT8 epEnabled;
+
+SieStats sieStats;
+volatile UINT32 U1CON;
+USB_DEVICE_STATE USBDeviceState;
+
+/***********************************************************************
+ * USB reset, the device is attached but not configured
+ **********************************************************************/
+
+void SieInit(void)
+{
+    memset(BDTOut, 0, sizeof(BDTOut));
+    memset(BDTIn, 0, sizeof(BDTIn));
+    fwOut = fwIn = BD_EVEN;
+    sieOut = sieIn = BD_EVEN;
+    epEnabled = 0;
+    U1CON = 1;
+    USBDeviceState = DETACHED_STATE;
+}
+
+/***********************************************************************
+ * usb.c entry points
+ **********************************************************************/
+
+void USBEnableEndpoint(UINT8 ep, UINT8 options)
+{
+    if (ep == HID_EP)
+        epEnabled = options;
+}
+
+USB_HANDLE USBTransferOnePacket(UINT8 dir, UINT8* data)
+{
+    BDT_ENTRY *handle;
+
+    if (dir == IN_TO_HOST)
+    {
+        handle = &BDTIn[fwIn];
+        fwIn ^= 1;
+    }
+    else
+    {
+        handle = &BDTOut[fwOut];
+        fwOut ^= 1;
+    }
+
+    handle->ADR = data;
+    handle->CNT = HID_INT_EP_SIZE;
+    handle->STAT.DTS ^= 1;
+    handle->STAT.UOWN = 1;
+
+    return (USB_HANDLE)handle;
+}
+
+/***********************************************************************
+ * Host side, return 1 if the transaction was ACKed, 0 if NAKed
+ **********************************************************************/
+
+int SieHostOut(const UINT8 *packet)
+{
+    BDT_ENTRY *bd = &BDTOut[sieOut];
+
+    // NAK
+    if (!(epEnabled & USB_OUT_ENABLED) || !bd->STAT.UOWN)
+        return 0;
+
+    memcpy(bd->ADR, packet, HID_INT_EP_SIZE);
+    bd->STAT.UOWN = 0;
+    sieOut ^= 1;
+    sieStats.out++;
+    return 1;
+}
+
+int SieHostIn(UINT8 *packet)
+{
+    BDT_ENTRY *bd = &BDTIn[sieIn];
+
+    // NAK
+    if (!(epEnabled & USB_IN_ENABLED) || !bd->STAT.UOWN)
+        return 0;
+
+    memcpy(packet, bd->ADR, bd->CNT);
+    bd->STAT.UOWN = 0;
+    sieIn ^= 1;
+    sieStats.in++;
+    return 1;
+}
+
+// Copies the IN packet waiting for the host, without serving it
+int SieInPeek(UINT8 *packet)
+{
+    BDT_ENTRY *bd = &BDTIn[sieIn];
+
+    if (!(epEnabled & USB_IN_ENABLED) || !bd->STAT.UOWN)
+        return 0;
+
+    memcpy(packet, bd->ADR, bd->CNT);
+    return 1;
+}
+
+// The firmware is ready for the next OUT packet
+int SieOutArmed(void)
+{
+    return BDTOut[sieOut].STAT.UOWN;
+}
+
+// An IN packet is waiting for the host
+int SieInPending(void)
+{
+    return BDTIn[sieIn].STAT.UOWN;
+}
+
+// The host gave up reading an IN packet
+void SieInDrop(void)
+{
+    BDTIn[sieIn].STAT.UOWN = 0;
+    sieIn ^= 1;
+    sieStats.dropped++;
+}
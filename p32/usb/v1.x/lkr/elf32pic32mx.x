@@ -598,6 +598,17 @@ SECTIONS
 
     _ramfunc_image_begin = LOADADDR(.ramfunc) ;
     _ramfunc_length = SIZEOF(.ramfunc) ;
+
+    /*
+    * The bootloader must end below the application IVT, i.e. fit in
+    * BOOT_PROGRAM_LENGTH (mem.h), whatever the options (DFU, MSC, ...).
+    * The .ramfunc image is the last one loaded into kseg0_program_mem.
+    */
+
+    _boot_program_end = _ramfunc_image_begin + _ramfunc_length ;
+    ASSERT (ORIGIN(kseg0_program_mem) > _ebase_address ||
+            _boot_program_end <= _ebase_address,
+    "Bootloader larger than BOOT_PROGRAM_LENGTH, it overlaps the application IVT.")
     _bmxdkpba_address = _ramfunc_begin - ORIGIN(kseg1_data_mem) ;
     _bmxdudba_address = LENGTH(kseg1_data_mem) ;
     _bmxdupba_address = LENGTH(kseg1_data_mem) ;
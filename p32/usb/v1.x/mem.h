@@ -81,6 +81,16 @@
 #define APP_PROGRAM_ADDR_END            FLASH_MEM_END
 #define APP_PROGRAM_LENGTH              (APP_PROGRAM_ADDR_END - APP_PROGRAM_ADDR_START)
 
+// The image signature record (magic, length, CRC-32, timestamp) written
+// after a successful upload takes the first 16 bytes of the application
+// IVT. Applications leave them blank : the general exception vector is at
+// ebase + 0x180 and the interrupt vectors from ebase + 0x200 on, the TLB
+// refill and cache error vectors below do not exist on the M4K core.
+// ERASE_DEVICE erases the record with the first page of the IVT.
+#define APP_SIGN_ADDR                   APP_EBASE_ADDR
+#define APP_SIGN_LENGTH                 0x10
+#define APP_SIGN_MAGIC                  0x474E4950      // "PING"
+
 #endif /* _MEM_H_ */
 
 
@@ -0,0 +1,609 @@
+/***********************************************************************
+    Title:  USB Pinguino Bootloader
+    File:   msc.c
+    Descr.: USB mass storage interface, UF2 upload (MSC=true)
+    Author: Régis Blanchot <rblanchot@gmail.com>
+
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+ **********************************************************************
+    The class requests are handled on EP0 by USBCheckMSCRequest(),
+    called from USBCtrlTrfSetupHandler(). The Bulk-Only Transport runs
+    on MSC_EP in MSCTasks(), called from the main loop (see msc.h).
+
+    Both ping-pong buffers of MSC_EP are used during the data stage :
+    the next packet is armed while the current one is on the bus. The
+    sectors go through MscBuffer, so the packets of a sector are all
+    done before the next sector is read or the last one is written.
+
+    Unsupported transfers are not stalled (no CLEAR_FEATURE(HALT) in
+    usb.c) : an IN data stage is ended with a short or zero-length
+    packet, OUT data are received and dropped, the residue is reported
+    in the CSW.
+ **********************************************************************/
+
+#include "p32xxxx.h"                    // Registers definitions
+#include "typedefs.h"                   // UINT8, UINT32, ...
+#include "boot.h"                       // USB_MAX_NUM_INT, firmware version
+#include "mem.h"                        // Pinguino memory regions description
+#include "flash.h"                      // Flash write and flash erase functions
+#include "core.h"                       // MemClear, SoftReset
+#include "delay.h"                      // Delayus
+#include "usb.h"                        // USB device framework definitions
+#include "msc.h"                        // MSC requests, SCSI commands, UF2 blocks
+
+#if (_DEBUG_ENABLE_)                    // defined in makefile
+#include "serial.h"                     // UART functions
+#endif
+
+#if (_MSC_ENABLE_)
+
+/***********************************************************************
+ * CONSTANTS
+ **********************************************************************/
+
+//MscState
+#define MSC_WAIT_CBW            0       //next command expected
+#define MSC_DATA_IN             1       //data stage, device to host
+#define MSC_DATA_OUT            2       //data stage, host to device
+
+#define UF2_NO_ROW              0xFFFFFFFF
+
+#define STR_(x)                 #x
+#define STR(x)                  STR_(x)
+#define LE16(x)                 ((x) & 0xFF), (((x) >> 8) & 0xFF)
+
+//Boot sector, up to the end of the extended BIOS parameter block
+static const UINT8 MscBootSector[] =
+{
+    0xEB, 0x3C, 0x90,                   // jump instruction
+    'P','I','N','G','U','I','N','O',    // OEM name
+    LE16(MSC_SECTOR_SIZE),              // bytes per sector
+    FAT_CLUSTER_SECTORS,                // sectors per cluster
+    LE16(FAT_RESERVED_SECTORS),         // reserved sectors
+    FAT_COPIES,                         // number of FATs
+    LE16(FAT_ROOT_ENTRIES),             // root directory entries
+    LE16(FAT_SECTORS),                  // total sectors
+    0xF8,                               // media descriptor, fixed disk
+    LE16(FAT_FAT_SECTORS),              // sectors per FAT
+    LE16(1),                            // sectors per track
+    LE16(1),                            // number of heads
+    0x00, 0x00, 0x00, 0x00,             // hidden sectors
+    0x00, 0x00, 0x00, 0x00,             // total sectors (32-bit), unused
+    0x80,                               // drive number
+    0x00,                               // reserved
+    0x29,                               // extended boot signature
+    0x42, 0x00, 0x42, 0x00,             // volume serial number
+    'P','I','N','G','U','I','N','O',' ',' ',' ',  // volume label
+    'F','A','T','1','2',' ',' ',' '     // file system type
+};
+
+//INQUIRY answer (36 bytes)
+static const char MscInquiry[] =
+    "\x00"                              // direct access block device
+    "\x80"                              // removable medium
+    "\x04"                              // SPC-2
+    "\x02"                              // response data format
+    "\x1F"                              // additional length
+    "\x00\x00\x00"
+    "Pinguino"                          // vendor (8)
+    "UF2 Bootloader  "                  // product (16)
+    STR(USB_MAJOR_VER) "." STR(USB_MINOR_VER) STR(USB_DEVPT_VER); // revision (4)
+
+//Files of the root directory, one cluster each
+static const char MscInfo[] =
+    "UF2 Bootloader v" STR(USB_MAJOR_VER) "." STR(USB_MINOR_VER) "." STR(USB_DEVPT_VER) "\r\n"
+    "Model: Pinguino 32\r\n"
+    "Board-ID: PIC32MX\r\n";
+
+static const char MscIndex[] =
+    "<!doctype html>\n"
+    "<html><head><meta http-equiv=\"refresh\" content=\"0; url=http://www.pinguino.cc/\"></head></html>\n";
+
+/***********************************************************************
+ * VARIABLES
+ **********************************************************************/
+
+extern USB_VOLATILE IN_PIPE inPipe;
+extern volatile CTRL_TRF_SETUP SetupPkt;
+
+static UINT32 MscCbwBuffer[MSC_EP_SIZE/WORDSIZE];       //last CBW
+#define MscCbw                  ((MSCCbw*)MscCbwBuffer)
+static UINT32 MscBuffer32[MSC_SECTOR_SIZE/WORDSIZE];    //sector or answer
+#define MscBuffer               ((UINT8*)MscBuffer32)
+static MSCCsw MscCsw;
+
+static USB_HANDLE MscOutHandle;         //CBW
+static USB_HANDLE MscCswHandle;         //CSW
+static USB_HANDLE MscHandle[2];         //data packets in flight
+static UINT8  MscFirst;                 //oldest of MscHandle[]
+static UINT8  MscBusy;                  //number of packets in flight
+
+static UINT8  MscState;                 //MSC_xxx
+static UINT8  MscWrite;                 //OUT data are sectors to write
+static UINT8  MscZlp;                   //end the IN data with a ZLP
+static UINT32 MscLba;                   //next sector to read or write
+static UINT32 MscLength;                //bytes of the data stage not armed yet
+static UINT16 MscChunk;                 //bytes of MscBuffer to transfer
+static UINT16 MscOffset;                //bytes of MscBuffer already armed
+static UINT8  MscSenseKey;              //REQUEST_SENSE answer
+static UINT8  MscSenseCode;
+static UINT8  MscMaxLun = 0;            //GET_MAX_LUN answer, one LUN
+static UINT8  MscReset;                 //reset once the last CSW is sent
+
+static UINT32 Uf2Row[FLASH_ROW_SIZE/WORDSIZE];          //row to write
+static UINT32 Uf2RowAddr;               //address of Uf2Row, UF2_NO_ROW if none
+static UINT32 Uf2Blocks;                //UF2 blocks received
+static UINT32 Uf2Erased[UF2_MAX_PAGES/32];              //erased pages
+
+/*******************************************************************************
+ * FUNCTION PROTOTYPES
+ ******************************************************************************/
+
+static void MSCCommand(void);
+static void MSCData(void);
+static void MSCSendStatus(void);
+static void MSCFail(UINT8, UINT8);
+static void MSCReadSector(UINT32);
+static UINT8 MSCWriteSector(void);
+static UINT8 MSCFlushRow(void);
+static void MSCCopy(const void*, UINT8*, UINT32);
+static void MSCDirEntry(UINT8*, const char*, UINT8, UINT8, UINT32);
+
+/***********************************************************************
+ * Enables MSC_EP and waits for the first command
+ * Called once the device is configured, cf. USBStdSetCfgHandler()
+ **********************************************************************/
+
+void MSCInitEP(void)
+{
+    USBEnableEndpoint(MSC_EP, USB_IN_ENABLED | USB_OUT_ENABLED |
+                              USB_HANDSHAKE_ENABLED | USB_DISALLOW_SETUP);
+
+    MscBusy = 0;
+    MscFirst = 0;
+    MscCswHandle = 0;
+    MscSenseKey = SCSI_SENSE_NONE;
+    MscSenseCode = 0;
+    MscState = MSC_WAIT_CBW;
+    MscOutHandle = USBTransferPacket(MSC_EP, OUT_FROM_HOST, (UINT8*)MscCbwBuffer, MSC_EP_SIZE);
+}
+
+/***********************************************************************
+ * Called on each pass of the main loop once the device is configured
+ **********************************************************************/
+
+void MSCTasks(void)
+{
+    if (MscState != MSC_WAIT_CBW)
+    {
+        MSCData();
+        return;
+    }
+
+    // Last UF2 block : same as RESET_DEVICE (see command.c), once
+    // its CSW is sent
+    if (MscReset && !USBHandleBusy(MscCswHandle))
+    {
+        #if (_TRACE_ENABLE_)
+        SerialTraceFlush();
+        #endif
+        U1CON = 0x00;
+        Delayus(1000);
+        SoftReset();
+    }
+
+    if (!USBHandleBusy(MscOutHandle))
+        MSCCommand();
+}
+
+/***********************************************************************
+ * A CBW is in MscCbwBuffer, prepares the data stage
+ **********************************************************************/
+
+static void MSCCommand(void)
+{
+    UINT8 *cb = MscCbw->CBWCB;
+    UINT8 *p = MscBuffer;
+    UINT32 host, length = 0, lba, blocks;
+    UINT8 buffered = TRUE;
+
+    if (USBHandleGetLength(MscOutHandle) != MSC_CBW_LENGTH ||
+        MscCbw->dCBWSignature != MSC_CBW_SIGNATURE)
+    {
+        // not a CBW, wait for the next one
+        MscOutHandle = USBTransferPacket(MSC_EP, OUT_FROM_HOST, (UINT8*)MscCbwBuffer, MSC_EP_SIZE);
+        return;
+    }
+
+    host = MscCbw->dCBWDataTransferLength;
+    MscCsw.dCSWTag = MscCbw->dCBWTag;
+    MscCsw.bCSWStatus = MSC_CSW_PASSED;
+    MscWrite = FALSE;
+    MemClear(MscBuffer32, MSC_EP_SIZE);
+
+    #if 0//(_DEBUG_ENABLE_)
+    SerialPrint("SCSI ");
+    SerialPrintNumber(cb[0], 16);
+    SerialPrint("\r\n");
+    #endif
+
+    switch (cb[0])
+    {
+        case SCSI_INQUIRY:
+            length = sizeof(MscInquiry) - 1;
+            MSCCopy(MscInquiry, p, length);
+            break;
+
+        case SCSI_REQUEST_SENSE:
+            length = 18;
+            p[0] = 0x70;                // current error, fixed format
+            p[2] = MscSenseKey;
+            p[7] = 10;                  // additional length
+            p[12] = MscSenseCode;
+            MscSenseKey = SCSI_SENSE_NONE;
+            MscSenseCode = 0;
+            break;
+
+        case SCSI_MODE_SENSE6:
+            length = 4;
+            p[0] = 3;                   // mode data length, not write protected
+            break;
+
+        case SCSI_READ_FORMAT_CAPACITIES:
+            length = 12;
+            p[3] = 8;                   // capacity list length
+            p[6] = FAT_SECTORS >> 8;    // number of blocks
+            p[7] = FAT_SECTORS & 0xFF;
+            p[8] = 0x02;                // formatted media
+            p[10] = MSC_SECTOR_SIZE >> 8;
+            break;
+
+        case SCSI_READ_CAPACITY10:
+            length = 8;
+            p[2] = (FAT_SECTORS - 1) >> 8;      // last block
+            p[3] = (FAT_SECTORS - 1) & 0xFF;
+            p[6] = MSC_SECTOR_SIZE >> 8;        // block length
+            break;
+
+        case SCSI_READ10:
+        case SCSI_WRITE10:
+            lba = (cb[2] << 24) | (cb[3] << 16) | (cb[4] << 8) | cb[5];
+            blocks = (cb[7] << 8) | cb[8];
+            if (lba + blocks > FAT_SECTORS)
+            {
+                MSCFail(SCSI_SENSE_ILLEGAL, SCSI_ASC_OUT_OF_RANGE);
+                break;
+            }
+            buffered = FALSE;
+            MscLba = lba;
+            length = blocks * MSC_SECTOR_SIZE;
+            if (cb[0] == SCSI_WRITE10)
+            {
+                // only whole sectors are written
+                if (length != host)
+                {
+                    MSCFail(SCSI_SENSE_ILLEGAL, SCSI_ASC_OUT_OF_RANGE);
+                    length = 0;
+                    break;
+                }
+                MscWrite = TRUE;
+            }
+            break;
+
+        case SCSI_TEST_UNIT_READY:
+        case SCSI_START_STOP_UNIT:
+        case SCSI_PREVENT_ALLOW:
+        case SCSI_VERIFY10:
+        case SCSI_SYNCHRONIZE_CACHE:
+            break;
+
+        default:
+            MSCFail(SCSI_SENSE_ILLEGAL, SCSI_ASC_INVALID_OPCODE);
+            break;
+    }
+
+    if (length > host)
+        length = host;
+
+    MscCsw.dCSWDataResidue = host - length;
+    MscChunk = 0;
+    MscOffset = 0;
+
+    if (MscCbw->bmCBWFlags & MSC_CBW_DATA_IN)
+    {
+        MscState = MSC_DATA_IN;
+        MscLength = length;
+        if (buffered)
+            MscChunk = length;
+        // a short data stage must end with a short packet
+        MscZlp = (MscCsw.dCSWDataResidue && length % MSC_EP_SIZE == 0);
+    }
+    else
+    {
+        // the host sends its data anyway
+        MscState = MSC_DATA_OUT;
+        MscLength = host;
+        MscZlp = FALSE;
+    }
+
+    MSCData();
+}
+
+/***********************************************************************
+ * Data stage, two packets in flight at most, done in order
+ **********************************************************************/
+
+static void MSCData(void)
+{
+    UINT8 dir = (MscState == MSC_DATA_IN) ? IN_TO_HOST : OUT_FROM_HOST;
+    UINT16 n;
+
+    while (MscBusy && !USBHandleBusy(MscHandle[MscFirst]))
+    {
+        MscFirst ^= 1;
+        MscBusy--;
+    }
+
+    // MscBuffer is done
+    if (MscBusy == 0 && MscOffset == MscChunk)
+    {
+        if (MscWrite && MscChunk == MSC_SECTOR_SIZE)
+        {
+            if (MSCWriteSector())
+                MSCFail(SCSI_SENSE_MEDIUM, SCSI_ASC_WRITE_ERROR);
+            MscLba++;
+        }
+
+        MscChunk = 0;
+        MscOffset = 0;
+
+        if (MscLength == 0)
+        {
+            if (MscZlp)
+            {
+                MscZlp = FALSE;
+                MscHandle[MscFirst] = USBTransferPacket(MSC_EP, IN_TO_HOST, MscBuffer, 0);
+                MscBusy = 1;
+                return;
+            }
+            MSCSendStatus();
+            return;
+        }
+
+        MscChunk = (MscLength < MSC_SECTOR_SIZE) ? MscLength : MSC_SECTOR_SIZE;
+        if (dir == IN_TO_HOST)
+            MSCReadSector(MscLba++);
+    }
+
+    while (MscBusy < 2 && MscOffset < MscChunk)
+    {
+        n = MscChunk - MscOffset;
+        if (n > MSC_EP_SIZE)
+            n = MSC_EP_SIZE;
+        MscHandle[(MscFirst + MscBusy) & 1] = USBTransferPacket(MSC_EP, dir, MscBuffer + MscOffset, n);
+        MscBusy++;
+        MscOffset += n;
+        MscLength -= n;
+    }
+}
+
+/***********************************************************************
+ * Sends the CSW and waits for the next CBW
+ **********************************************************************/
+
+static void MSCSendStatus(void)
+{
+    MscCsw.dCSWSignature = MSC_CSW_SIGNATURE;
+    MscCswHandle = USBTransferPacket(MSC_EP, IN_TO_HOST, (UINT8*)&MscCsw, MSC_CSW_LENGTH);
+    MscOutHandle = USBTransferPacket(MSC_EP, OUT_FROM_HOST, (UINT8*)MscCbwBuffer, MSC_EP_SIZE);
+    MscState = MSC_WAIT_CBW;
+}
+
+/***********************************************************************
+ * Command failed, the host asks REQUEST_SENSE why
+ **********************************************************************/
+
+static void MSCFail(UINT8 key, UINT8 code)
+{
+    MscCsw.bCSWStatus = MSC_CSW_FAILED;
+    MscSenseKey = key;
+    MscSenseCode = code;
+}
+
+/***********************************************************************
+ * Virtual FAT12 volume, anything else reads as zeros
+ **********************************************************************/
+
+static void MSCReadSector(UINT32 lba)
+{
+    UINT8 *p = MscBuffer;
+    UINT8 i;
+
+    MemClear(MscBuffer32, MSC_SECTOR_SIZE);
+
+    if (lba == 0)
+    {
+        MSCCopy(MscBootSector, p, sizeof(MscBootSector));
+        p[510] = 0x55;
+        p[511] = 0xAA;
+    }
+    else if (lba < FAT_ROOT_SECTOR)
+    {
+        // 1st sector of each FAT : media and end of chain entries,
+        // then one cluster per file (clusters 2 and 3)
+        if ((lba - FAT_RESERVED_SECTORS) % FAT_FAT_SECTORS == 0)
+        {
+            p[0] = 0xF8;
+            for (i = 1; i < 6; i++)
+                p[i] = 0xFF;
+        }
+    }
+    else if (lba == FAT_ROOT_SECTOR)
+    {
+        MSCDirEntry(p,      "PINGUINO   ", FAT_ATTR_VOLUME_ID, 0, 0);
+        MSCDirEntry(p + 32, "INFO_UF2TXT", FAT_ATTR_READ_ONLY, 2, sizeof(MscInfo) - 1);
+        MSCDirEntry(p + 64, "INDEX   HTM", FAT_ATTR_READ_ONLY, 3, sizeof(MscIndex) - 1);
+    }
+    else if (lba == FAT_DATA_SECTOR)
+    {
+        MSCCopy(MscInfo, p, sizeof(MscInfo) - 1);
+    }
+    else if (lba == FAT_DATA_SECTOR + FAT_CLUSTER_SECTORS)
+    {
+        MSCCopy(MscIndex, p, sizeof(MscIndex) - 1);
+    }
+}
+
+/***********************************************************************
+ * A sector is in MscBuffer, only UF2 blocks are kept
+ * Returns the NVM error, 0 if none.
+ **********************************************************************/
+
+static UINT8 MSCWriteSector(void)
+{
+    UF2Block *block = (UF2Block*)MscBuffer32;
+    UINT32 *data = (UINT32*)block->Data;
+    UINT32 address, size, i, n;
+    UINT8 error = 0;
+
+    if (block->MagicStart0 != UF2_MAGIC_START0 ||
+        block->MagicStart1 != UF2_MAGIC_START1 ||
+        block->MagicEnd != UF2_MAGIC_END)
+        return 0;
+
+    if (Uf2Blocks == 0)
+    {
+        // a new upload starts, the old signature is no longer valid,
+        // its page is erased as if a row had been written to it
+        FlashClearError();
+        MemClear(Uf2Erased, sizeof(Uf2Erased));
+        Uf2RowAddr = UF2_NO_ROW;
+        n = (APP_SIGN_ADDR - KSEG0_FLASH_MEM_START) / FLASH_PAGE_SIZE;
+        Uf2Erased[n / 32] |= 1 << (n % 32);
+        error = FlashErasePage((void*)(APP_SIGN_ADDR & ~(FLASH_PAGE_SIZE - 1)));
+    }
+    Uf2Blocks++;
+
+    // physical or KSEG0 address, the blocks out of the application
+    // (config words, boot flash) are skipped
+    address = PA_TO_KVA0(KVA_TO_PA(block->TargetAddr));
+    size = block->PayloadSize;
+
+    if (!(block->Flags & UF2_FLAG_NOT_MAIN_FLASH) &&
+        size <= UF2_PAYLOAD_SIZE && size % WORDSIZE == 0 &&
+        address % WORDSIZE == 0 &&
+        address >= APP_EBASE_ADDR && address + size <= APP_PROGRAM_ADDR_END)
+    {
+        for (i = 0; i < size / WORDSIZE; i++, address += WORDSIZE)
+        {
+            if ((address & ~(FLASH_ROW_SIZE - 1)) != Uf2RowAddr)
+            {
+                error |= MSCFlushRow();
+                Uf2RowAddr = address & ~(FLASH_ROW_SIZE - 1);
+                for (n = 0; n < FLASH_ROW_SIZE/WORDSIZE; n++)
+                    Uf2Row[n] = 0xFFFFFFFF;
+            }
+            Uf2Row[(address % FLASH_ROW_SIZE) / WORDSIZE] = data[i];
+        }
+    }
+
+    // the device resets once the CSW of this sector is sent
+    if (Uf2Blocks >= block->NumBlocks)
+    {
+        error |= MSCFlushRow();
+        MscReset = TRUE;
+    }
+
+    return error;
+}
+
+/***********************************************************************
+ * Writes Uf2Row, its page is erased first if it is not yet
+ **********************************************************************/
+
+static UINT8 MSCFlushRow(void)
+{
+    UINT32 page, n;
+    UINT8 error = 0;
+
+    if (Uf2RowAddr == UF2_NO_ROW)
+        return 0;
+
+    page = Uf2RowAddr & ~(FLASH_PAGE_SIZE - 1);
+    n = (page - KSEG0_FLASH_MEM_START) / FLASH_PAGE_SIZE;
+
+    if (!(Uf2Erased[n / 32] & (1 << (n % 32))))
+    {
+        Uf2Erased[n / 32] |= 1 << (n % 32);
+        error = FlashErasePage((void*)page);
+    }
+
+    error |= FlashWriteRow((void*)Uf2RowAddr, (void*)Uf2Row);
+    Uf2RowAddr = UF2_NO_ROW;
+
+    return error;
+}
+
+/***********************************************************************
+ * Byte copy, MemCopy() needs aligned buffers
+ **********************************************************************/
+
+static void MSCCopy(const void *from, UINT8 *to, UINT32 nbytes)
+{
+    const UINT8 *p = (const UINT8*)from;
+
+    while (nbytes--)
+        *to++ = *p++;
+}
+
+/***********************************************************************
+ * 32-byte directory entry, name is 8.3 without the dot
+ **********************************************************************/
+
+static void MSCDirEntry(UINT8 *p, const char *name, UINT8 attr, UINT8 cluster, UINT32 size)
+{
+    MSCCopy(name, p, 11);
+    p[11] = attr;
+    p[24] = FAT_DATE & 0xFF;            // last write date
+    p[25] = FAT_DATE >> 8;
+    p[26] = cluster;                    // first cluster
+    p[28] = size;
+    p[29] = size >> 8;
+    p[30] = size >> 16;
+    p[31] = size >> 24;
+}
+
+/********************************************************************
+ * Handles MSC specific request that happen on EP0.
+ *******************************************************************/
+
+void USBCheckMSCRequest(void)
+{
+    if (SetupPkt.Recipient != USB_SETUP_RECIPIENT_INTERFACE_BITFIELD)
+        return;
+
+    if (SetupPkt.bIntfID != MSC_INTF_ID)
+        return;
+
+    if (SetupPkt.RequestType != USB_SETUP_TYPE_CLASS_BITFIELD)
+        return;
+
+    switch (SetupPkt.bRequest)
+    {
+        case MSC_GET_MAX_LUN:
+            inPipe.pSrc.bRam = (UINT8*)&MscMaxLun;
+            inPipe.wCount.Val = 1;
+            inPipe.info.Val = USB_EP0_INCLUDE_ZERO | USB_EP0_BUSY | USB_EP0_RAM;
+            break;
+
+        // Bulk-Only Mass Storage Reset : acknowledged only, the packets
+        // in flight cannot be taken back. The host resets the port if
+        // the next command gets no answer.
+        case MSC_RESET:
+            inPipe.info.Val = USB_EP0_NO_DATA | USB_EP0_BUSY;
+            break;
+    }
+}
+
+#endif /* _MSC_ENABLE_ */
@@ -0,0 +1,147 @@
+/***********************************************************************
+    Title:  USB Pinguino Bootloader
+    File:   msc.h
+    Descr.: USB mass storage interface, UF2 upload (MSC=true)
+    Author: Régis Blanchot <rblanchot@gmail.com>
+
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+ **********************************************************************
+    Built with MSC=true, the bootloader also shows up as a small disk
+    (Bulk-Only Transport, SCSI) holding a virtual FAT12 volume named
+    PINGUINO, with INFO_UF2.TXT and INDEX.HTM. Nothing is stored : the
+    sectors are made up when they are read, and written sectors are
+    dropped unless they are UF2 blocks. The application is uploaded
+    with a plain copy, no host tool needed :
+
+        tools/uf2conv32.py app.hex app.uf2
+        cp app.uf2 /media/$USER/PINGUINO/
+
+    UF2 blocks
+    Each 512-byte sector of a UF2 file is one block : a header with
+    the target address and the payload size, up to 476 bytes of data,
+    and the magic numbers (https://github.com/microsoft/uf2). The
+    payload is gathered in a row buffer, a row is written once the
+    next block leaves it, the page of a row is erased before its first
+    row write. uf2conv32.py writes 256-byte payloads in address order,
+    so that each row is written once.
+
+    The first block also erases the signature (see APP_SIGN_ADDR).
+    Once NumBlocks blocks are in, the device resets and starts the
+    application.
+
+    Limits
+    The page erases and row writes are synchronous : the core stalls
+    until they are done, and meanwhile the bulk OUT endpoint NAKs. An
+    upload goes at the flash speed, it doesn't saturate full-speed
+    bulk. The code size with MSC=true, and MSC=true DFU=true, has not
+    been measured on an 8K bootloader part (32MX270F256B) : the link
+    fails if it doesn't fit in BOOT_PROGRAM_LENGTH (lkr/elf32pic32mx.x).
+
+    Virtual volume (512-byte sectors)
+    0                   boot sector
+    1 ...               FAT_COPIES FATs of FAT_FAT_SECTORS sectors
+    FAT_ROOT_SECTOR     root directory, FAT_ROOT_ENTRIES entries
+    FAT_DATA_SECTOR     clusters 2, 3, ... one file per cluster
+ **********************************************************************/
+
+#ifndef _MSC_H_
+#define _MSC_H_
+
+#include "typedefs.h"                   // UINT8, UINT32, ...
+
+// Class requests (Bulk-Only Transport 1.0, section 3)
+#define MSC_RESET               0xFF
+#define MSC_GET_MAX_LUN         0xFE
+
+// Command and status wrappers
+#define MSC_CBW_SIGNATURE       0x43425355      // "USBC"
+#define MSC_CSW_SIGNATURE       0x53425355      // "USBS"
+#define MSC_CBW_LENGTH          31
+#define MSC_CSW_LENGTH          13
+#define MSC_CBW_DATA_IN         0x80            // bmCBWFlags, device to host
+#define MSC_CSW_PASSED          0x00
+#define MSC_CSW_FAILED          0x01
+
+// SCSI commands
+#define SCSI_TEST_UNIT_READY    0x00
+#define SCSI_REQUEST_SENSE      0x03
+#define SCSI_INQUIRY            0x12
+#define SCSI_MODE_SENSE6        0x1A
+#define SCSI_START_STOP_UNIT    0x1B
+#define SCSI_PREVENT_ALLOW      0x1E
+#define SCSI_READ_FORMAT_CAPACITIES 0x23
+#define SCSI_READ_CAPACITY10    0x25
+#define SCSI_READ10             0x28
+#define SCSI_WRITE10            0x2A
+#define SCSI_VERIFY10           0x2F
+#define SCSI_SYNCHRONIZE_CACHE  0x35
+
+// SCSI sense keys and additional sense codes
+#define SCSI_SENSE_NONE         0x00
+#define SCSI_SENSE_MEDIUM       0x03
+#define SCSI_SENSE_ILLEGAL      0x05
+#define SCSI_ASC_WRITE_ERROR    0x0C
+#define SCSI_ASC_INVALID_OPCODE 0x20
+#define SCSI_ASC_OUT_OF_RANGE   0x21
+
+// Virtual FAT12 volume, 8 MB in 4 KB clusters
+#define MSC_SECTOR_SIZE         512
+#define FAT_SECTORS             16384
+#define FAT_CLUSTER_SECTORS     8
+#define FAT_RESERVED_SECTORS    1
+#define FAT_COPIES              2
+#define FAT_FAT_SECTORS         6       // (FAT_SECTORS / 8 clusters + 2) * 1.5 bytes
+#define FAT_ROOT_ENTRIES        64
+#define FAT_ROOT_SECTOR         (FAT_RESERVED_SECTORS + FAT_COPIES * FAT_FAT_SECTORS)
+#define FAT_DATA_SECTOR         (FAT_ROOT_SECTOR + FAT_ROOT_ENTRIES * 32 / MSC_SECTOR_SIZE)
+#define FAT_ATTR_READ_ONLY      0x01
+#define FAT_ATTR_VOLUME_ID      0x08
+#define FAT_DATE                0x4821  // 2016-01-01
+
+// UF2 block
+#define UF2_MAGIC_START0        0x0A324655      // "UF2\n"
+#define UF2_MAGIC_START1        0x9E5D5157
+#define UF2_MAGIC_END           0x0AB16F30
+#define UF2_FLAG_NOT_MAIN_FLASH 0x00000001
+#define UF2_PAYLOAD_SIZE        476
+#define UF2_MAX_PAGES           256     // erased pages bitmap, 256K in 1K pages
+
+typedef struct __attribute__((packed))
+{
+    UINT32 MagicStart0;
+    UINT32 MagicStart1;
+    UINT32 Flags;
+    UINT32 TargetAddr;                  // physical or KSEG0 address
+    UINT32 PayloadSize;
+    UINT32 BlockNo;
+    UINT32 NumBlocks;
+    UINT32 FamilyID;                    // not checked
+    UINT8  Data[UF2_PAYLOAD_SIZE];
+    UINT32 MagicEnd;
+} UF2Block;
+
+// Command Block Wrapper (BOT 1.0, section 5.1)
+typedef struct __attribute__((packed))
+{
+    UINT32 dCBWSignature;
+    UINT32 dCBWTag;
+    UINT32 dCBWDataTransferLength;
+    UINT8  bmCBWFlags;
+    UINT8  bCBWLUN;
+    UINT8  bCBWCBLength;
+    UINT8  CBWCB[16];                   // SCSI command, big endian fields
+} MSCCbw;
+
+// Command Status Wrapper (BOT 1.0, section 5.2)
+typedef struct __attribute__((packed))
+{
+    UINT32 dCSWSignature;
+    UINT32 dCSWTag;
+    UINT32 dCSWDataResidue;
+    UINT8  bCSWStatus;
+} MSCCsw;
+
+void MSCTasks(void);
+
+#endif /* _MSC_H_ */
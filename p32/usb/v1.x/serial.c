@@ -15,10 +15,165 @@
 #include "typedefs.h"
 #include "serial.h"
 #include "core.h"
+#if (_TRACE_ENABLE_)
+#include "flash.h"                  // KVA_TO_PA
+#endif
 
 // Compute the 16-bit baud rate divisor, given the bus frequency and baud rate.
 #define BaudRateDivisor(baud)	((( (FPB) / 8 + (baud) ) / (baud) / 2) - 1)
 
+#if (_TRACE_ENABLE_)
+
+/***********************************************************************
+ * Asynchronous trace (TRACE=true)
+ * The characters are written in a RAM ring buffer and DMA channel 0
+ * sends them to U1TXREG in the background, one byte each time the
+ * UART TX FIFO has room (U1TXIF, UTXISEL = 00). A full buffer drops
+ * the new lines instead of stalling the bootloader, their number is
+ * reported by the next line that fits.
+ **********************************************************************/
+
+#define TRACE_SIZE          1024    // must be a power of 2
+#define TRACE_MASK          (TRACE_SIZE - 1)
+#define TRACE_LINE          40      // room needed by a SerialTrace() line
+#define TRACE_BLOCK         255     // DCH0SSIZ is 8-bit on PIC32MX3-7
+
+static UINT8  TraceBuffer[TRACE_SIZE];
+static UINT32 TraceHead;            // next byte written by the CPU
+static UINT32 TraceTail;            // next byte sent by the DMA
+static UINT32 TraceNext;            // TraceTail once the current block is sent
+static UINT32 TraceLost;            // lines dropped since the last one sent
+static UINT8  TraceOn;
+
+static UINT32 TraceFree(void)
+{
+    return TRACE_SIZE - 1 - ((TraceHead - TraceTail) & TRACE_MASK);
+}
+
+static void TracePut(char c)
+{
+    TraceBuffer[TraceHead] = c;
+    TraceHead = (TraceHead + 1) & TRACE_MASK;
+}
+
+static void TracePutHex(UINT32 value)
+{
+    UINT8 i, d;
+
+    for (i = 0; i < 8; i++)
+    {
+        d = value >> 28;
+        TracePut(d < 10 ? d + '0' : d + 'A' - 10);
+        value <<= 4;
+    }
+}
+
+static void TraceLine(UINT32 time, const char *name, UINT32 value)
+{
+    TracePutHex(time);
+    TracePut(' ');
+    for (; *name; ++name)
+        TracePut(*name);
+    TracePut(' ');
+    TracePutHex(value);
+    TracePut('\r');
+    TracePut('\n');
+}
+
+/***********************************************************************
+ * Starts the DMA, SerialInit() must have been called before.
+ * From now on SerialPrint() and co. write in the ring buffer too.
+ **********************************************************************/
+
+void SerialTraceInit(void)
+{
+    TraceHead = TraceTail = TraceNext = 0;
+    TraceLost = 0;
+
+    U1STACLR  = _U1STA_UTXISEL_MASK;// U1TXIF while the TX FIFO has room
+
+    DMACONSET = _DMACON_ON_MASK;
+    DCH0CON   = 0;                  // priority 0, no auto-enable, no chaining
+    DCH0ECON  = (_UART1_TX_IRQ << _DCH0ECON_CHSIRQ_POSITION) | _DCH0ECON_SIRQEN_MASK;
+    DCH0DSA   = KVA_TO_PA(&U1TXREG);
+    DCH0DSIZ  = 1;
+    DCH0CSIZ  = 1;                  // 1 byte per U1TXIF
+    DCH0INT   = 0;
+
+    TraceOn = 1;
+}
+
+/***********************************************************************
+ * Sends the next block when the previous one is over, never waits.
+ * Called from the main loop and after each SerialTrace().
+ **********************************************************************/
+
+void SerialTraceTasks(void)
+{
+    UINT32 n;
+
+    // CHEN is cleared by the DMA at the end of the block
+    if (DCH0CON & _DCH0CON_CHEN_MASK)
+        return;
+
+    TraceTail = TraceNext;
+    if (TraceTail == TraceHead)
+        return;
+
+    // Up to the end of the buffer, the rest goes in the next block
+    n = ((TraceHead > TraceTail) ? TraceHead : TRACE_SIZE) - TraceTail;
+    if (n > TRACE_BLOCK)
+        n = TRACE_BLOCK;
+
+    DCH0SSA    = KVA_TO_PA(&TraceBuffer[TraceTail]);
+    DCH0SSIZ   = n;
+    DCH0INTCLR = 0xFF;
+    TraceNext  = (TraceTail + n) & TRACE_MASK;
+    DCH0CONSET = _DCH0CON_CHEN_MASK;
+    // U1TXIF may already be set, force the first byte
+    DCH0ECONSET = _DCH0ECON_CFORCE_MASK;
+}
+
+/***********************************************************************
+ * Waits until everything has been sent (before a reset)
+ **********************************************************************/
+
+void SerialTraceFlush(void)
+{
+    if (!TraceOn)
+        return;
+
+    while (TraceHead != TraceTail || (DCH0CON & _DCH0CON_CHEN_MASK))
+        SerialTraceTasks();
+    while (!(U1STA & _U1STA_TRMT_MASK));
+}
+
+/***********************************************************************
+ * Adds a line "time name value\r\n", time is the core timer (FCPU/2)
+ * and value are in hex. name is 20 char. max.
+ * About 100 instructions, whatever the baud rate.
+ **********************************************************************/
+
+void SerialTrace(const char *name, UINT32 value)
+{
+    UINT32 time = ReadCoreTimer();
+
+    if (TraceLost && TraceFree() >= 2 * TRACE_LINE)
+    {
+        TraceLine(time, "LOST", TraceLost);
+        TraceLost = 0;
+    }
+
+    if (TraceLost || TraceFree() < TRACE_LINE)
+        TraceLost++;
+    else
+        TraceLine(time, name, value);
+
+    SerialTraceTasks();
+}
+
+#endif // _TRACE_ENABLE_
+
 
 void SerialInit(UINT32 baudrate)
 {
@@ -99,6 +254,16 @@ void SerialInit(UINT32 baudrate)
 
 void SerialPrintChar(char c)
 {
+    // Once the trace is started the UART belongs to the DMA
+    #if (_TRACE_ENABLE_)
+    if (TraceOn)
+    {
+        if (TraceFree())
+            TracePut(c);
+        return;
+    }
+    #endif
+
     // Wait for transmitter shift register empty.
     while (!(U1STA & _U1STA_TRMT_MASK));
 
@@ -113,6 +278,11 @@ void SerialPrint(const char *s)
 {
     for (; *s; ++s)
         SerialPrintChar(*s);
+
+    #if (_TRACE_ENABLE_)
+    if (TraceOn)
+        SerialTraceTasks();
+    #endif
 }
 
 void SerialPrintNumber(INT32 value, UINT8 base)
@@ -16,4 +16,11 @@ void SerialPrintChar(char);
 void SerialPrint(const char *);
 void SerialPrintNumber(INT32, UINT8);
 
+#if (_TRACE_ENABLE_)
+void SerialTraceInit(void);
+void SerialTraceTasks(void);
+void SerialTraceFlush(void);
+void SerialTrace(const char *, UINT32);
+#endif
+
 #endif // _SERIAL_H_
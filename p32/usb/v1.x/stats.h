@@ -0,0 +1,45 @@
+/***********************************************************************
+    Title:  USB Pinguino Bootloader
+    File:   stats.h
+    Descr.: time spent per command and per NVM operation (GET_STATS)
+    Author: Régis Blanchot <rblanchot@gmail.com>
+
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+ **********************************************************************
+    Times are core timer ticks (FCPU/2, TickHz), they wrap after
+    2^32 ticks, i.e. 107 s at 80 MHz. The counters are cleared at
+    start-up and by ERASE_DEVICE, so that they cover one upload, and
+    are read with GET_STATS (see command.c and uploader32.py --stats).
+ **********************************************************************/
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#if defined(__HOST__)                   // Native build, see host/
+#include "host/host.h"
+#else
+#include "typedefs.h"                   // UINT32
+#endif
+
+#define STATS_COMMANDS          16      // command codes 0x00 to 0x0F
+#define STATS_NVMOPS            5       // FLASH_NOP to FLASH_PAGE_ERASE
+
+// Read as is by uploader32.py, append new fields at the end
+typedef struct
+{
+    UINT32 Length;                      // sizeof(BootStats)
+    UINT32 TickHz;                      // core timer frequency
+    UINT32 Elapsed;                     // since the counters were cleared
+    UINT32 UsbWait;                     // from the end of a command to the next packet
+    UINT32 MemCopy;                     // in MemCopy() (packets and GET_DATA)
+    UINT32 LvdWait;                     // LVD start-up delay (FlashOperation)
+    UINT32 NvmCount[STATS_NVMOPS];      // NVM operations, by FLASH_xxx code
+    UINT32 NvmTicks[STATS_NVMOPS];      // waiting for WR to clear, by FLASH_xxx code
+    UINT32 CmdCount[STATS_COMMANDS];    // commands done, by command code
+    UINT32 CmdTicks[STATS_COMMANDS];    // in USBPacketHandler(), by command code
+} BootStats;
+
+extern BootStats bootStats;
+
+#endif /* _STATS_H_ */
@@ -0,0 +1,94 @@
+#!/usr/bin/env python
+#  -*- coding: UTF-8 -*-
+
+"""-----------------------------------------------------------------------------
+	uf2conv32
+	author : 2017 - regis blanchot <rblanchot@gmail.com>
+	descr. : convert a PIC32 hex file to a UF2 file for the mass storage
+	         interface of the bootloader (MSC=true, cf. msc.h)
+	usage  : ./uf2conv32.py app.hex app.uf2
+	         cp app.uf2 /media/$USER/PINGUINO/
+
+	Only the program flash is kept (config words and boot flash are
+	programmed by the bootloader only), in 256-byte blocks written in
+	address order, the order the bootloader expects them. The block
+	addresses are physical ones.
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+	--------------------------------------------------------------------------"""
+
+import sys
+import struct
+
+UF2_MAGIC_START0    = 0x0A324655
+UF2_MAGIC_START1    = 0x9E5D5157
+UF2_MAGIC_END       = 0x0AB16F30
+UF2_PAYLOAD         = 256
+
+FLASH_START         = 0x1D000000            # program flash, physical address
+FLASH_END           = 0x1D080000            # 512K max.
+
+def read_hex(filename):
+    """ returns {address: byte} of the program flash """
+    memory = {}
+    upper = 0
+    for line in open(filename):
+        line = line.strip()
+        if not line.startswith(':'):
+            continue
+        record = bytearray.fromhex(line[1:])
+        if sum(record) & 0xFF:
+            sys.exit("%s: checksum error in %s" % (filename, line))
+        count = record[0]
+        address = (record[1] << 8) | record[2]
+        rtype = record[3]
+        data = record[4:4 + count]
+        if rtype == 0x00:                   # data
+            for i in range(count):
+                a = (upper + address + i) & 0x1FFFFFFF  # KSEG0/KSEG1 to physical
+                if FLASH_START <= a < FLASH_END:
+                    memory[a] = data[i]
+        elif rtype == 0x01:                 # end of file
+            break
+        elif rtype == 0x02:                 # extended segment address
+            upper = ((data[0] << 8) | data[1]) << 4
+        elif rtype == 0x04:                 # extended linear address
+            upper = ((data[0] << 8) | data[1]) << 16
+    return memory
+
+def write_uf2(memory, filename):
+    blocks = sorted(set(a & ~(UF2_PAYLOAD - 1) for a in memory))
+    out = bytearray()
+    for n, address in enumerate(blocks):
+        payload = bytearray(memory.get(address + i, 0xFF) for i in range(UF2_PAYLOAD))
+        header = struct.pack("<8I", UF2_MAGIC_START0, UF2_MAGIC_START1,
+                             0, address, UF2_PAYLOAD, n, len(blocks), 0)
+        padding = bytearray(476 - UF2_PAYLOAD)
+        out += header + payload + padding + struct.pack("<I", UF2_MAGIC_END)
+    open(filename, "wb").write(out)
+    return len(blocks)
+
+if __name__ == "__main__":
+
+    if len(sys.argv) != 3:
+        sys.exit("usage: %s app.hex app.uf2" % sys.argv[0])
+
+    memory = read_hex(sys.argv[1])
+    if not memory:
+        sys.exit("%s: no program flash data" % sys.argv[1])
+
+    n = write_uf2(memory, sys.argv[2])
+    print("%s: %d blocks, 0x%08X to 0x%08X" % (sys.argv[2], n,
+          min(memory), max(memory)))
@@ -41,6 +41,9 @@ import sys
 import os
 import usb
 import time
+import zlib
+import json
+import bisect
 import platform
 
 # PyUSB Core module switch
@@ -48,12 +51,35 @@ import platform
 
 PYUSB_USE_CORE                  =    1  # (0=legacy, 1=core)
 
+# Session recording (--record), replayed by ../host/replay
+# ------------------------------------------------------------------
+
+RECORD                          =    None
+
+# Phase and packet timing (--timing, --timing-json)
+# ------------------------------------------------------------------
+
+TIMING                          =    None      # Timing object when asked
+TIMING_BUCKETS                  =    (125, 250, 500, 1000, 2000, 4000,
+                                      8000, 16000, 64000) # us, histogram
+
+# time.monotonic() since Python 3.3, the wall clock before
+clock = getattr(time, "monotonic", time.time)
+
 # Globales
 #-----------------------------------------------------------------------
 
 #memstart                        =    0    # bootloader offset
 #memend                          =    0    # get its value later
 
+# Application area (see mem.h), the hex data must lie between ebase
+# (the IVT, memstart - APP_IVT_LENGTH) and memend
+# ----------------------------------------------------------------------
+
+APP_IVT_LENGTH                  =    0x1010    # IVT and reset vector
+APP_SIGN_LENGTH                 =    0x10      # image signature at ebase (bootloader v1.5.0 and later)
+BOOT_FLASH_START                =    0x1FC00000 # boot flash and config words, physical address
+
 # Hex format record types
 # ----------------------------------------------------------------------
 
@@ -120,6 +146,10 @@ BOOT_VER_MAJOR                  =    22
 BOOT_VER_MINOR                  =    26
 BOOT_VER_DEVPT                  =    30
 
+BOOT_IMG_LEN                    =    35     # long = 4 bytes
+BOOT_IMG_CRC                    =    39     # long = 4 bytes
+BOOT_IMG_TIME                   =    43     # long = 4 bytes
+
 # Sent packet structure
 # ----------------------------------------------------------------------
 
@@ -142,6 +172,11 @@ BOOT_ADDR_MSBHI                 =    4
 BOOT_CMD_SIZE                   =    5
 BOOT_CMD_PAD                    =    6
 BOOT_CMD_DATA                   =    7
+
+BOOT_SIGN_LEN                   =    1      # SIGN_FLASH packet
+BOOT_SIGN_CRC                   =    5
+BOOT_SIGN_TIME                  =    9
+BOOT_STATS_DATA                 =    8      # GET_STATS reply, Data32 is word aligned
     
 # Command Definitions
 # ----------------------------------------------------------------------
@@ -155,6 +190,9 @@ PROGRAM_DEVICE_CMD              =    0x05    # to send a full RequestDataBlockSi
 PROGRAM_COMPLETE_CMD            =    0x06    # if host send less than a RequestDataBlockSize to be programmed, or if it wished to program whatever was left in the buffer, it uses this command
 GET_DATA_CMD                    =    0x07    # the host sends this command in order to read out memory from the device. Used during verify (and read/export hex operations)
 RESET_DEVICE_CMD                =    0x08    # resets the microcontroller, so it can update the config bits (if they were programmed, and so as to leave the bootloader (and potentially go back into the main application)
+SIGN_FLASH_CMD                  =    0x09    # stores the length, CRC-32 and timestamp of the uploaded image (bootloader v1.5.0 and later)
+PROGRAM_COMPRESSED_CMD          =    0x0A    # same as PROGRAM_DEVICE with LZ compressed data (bootloader v1.6.0 and later)
+GET_STATS_CMD                   =    0x0B    # same as GET_DATA, reads the time counters of stats.h (bootloader v1.7.0 and later)
 
 # Query Device Response
 # ----------------------------------------------------------------------
@@ -230,8 +268,142 @@ commands_table = \
     PROGRAM_COMPLETE_CMD: "PROGRAM_COMPLETE",
     GET_DATA_CMD: "GET_DATA_DEVICE",
     RESET_DEVICE_CMD: "RESET_DEVICE",
+    SIGN_FLASH_CMD: "SIGN_FLASH",
+    PROGRAM_COMPRESSED_CMD: "PROGRAM_COMPRESSED",
+    GET_STATS_CMD: "GET_STATS",
 }
 
+# LZ compression (cf. LzDecode in main.c)
+# ----------------------------------------------------------------------
+
+LZ_WINDOW_SIZE                  =    1024
+LZ_MIN_MATCH                    =    3
+LZ_MAX_MATCH                    =    66
+LZ_MAX_CHAIN                    =    32      # candidates tried per position
+
+# ----------------------------------------------------------------------
+class Timing(object):
+# ----------------------------------------------------------------------
+    """ times the phases of a session and each packet on the monotonic
+        clock (--timing, --timing-json). A phase lasts until the next
+        one starts, a packet is one sendPacket() or getResponse(). """
+
+    def __init__(self):
+        self.info = {}
+        self.phases = []
+        self.started = clock()
+        self.stopped = None
+
+    def phase(self, name):
+        """ ends the current phase and starts the next one """
+        self.stop()
+        self.stopped = None
+        self.phases.append({"name": name, "start": clock(),
+                            "seconds": 0.0, "data": 0,
+                            "out": [0, []], "in": [0, []]})
+
+    def stop(self):
+        """ ends the current phase """
+        now = clock()
+        if self.phases and self.stopped is None:
+            self.phases[-1]["seconds"] = now - self.phases[-1]["start"]
+        self.stopped = now
+
+    def packet(self, direction, nbytes, seconds):
+        """ counts a packet of the current phase, direction "out" or "in" """
+        if self.phases:
+            counters = self.phases[-1][direction]
+            counters[0] = counters[0] + nbytes
+            counters[1].append(seconds)
+
+    def data(self, nbytes):
+        """ counts nbytes of program data of the current phase """
+        if self.phases:
+            self.phases[-1]["data"] = self.phases[-1]["data"] + nbytes
+
+    @staticmethod
+    def latency(seconds):
+        """ min., avg., 95th percentile, max. and histogram, in us """
+        us = sorted([s * 1e6 for s in seconds])
+        histogram = [0] * (len(TIMING_BUCKETS) + 1)
+        for t in us:
+            histogram[bisect.bisect_right(TIMING_BUCKETS, t)] += 1
+        if not us:
+            return {"count": 0, "histogram": histogram}
+        return {"count": len(us), "min_us": us[0],
+                "avg_us": sum(us) / len(us),
+                "p95_us": us[min(len(us) - 1, int(len(us) * 0.95))],
+                "max_us": us[-1], "histogram": histogram}
+
+    def results(self):
+        """ returns the figures as a dict """
+        self.stop()
+        phases = []
+        out, inp = [], []
+        for p in self.phases:
+            out.extend(p["out"][1])
+            inp.extend(p["in"][1])
+            phase = {"name": p["name"],
+                     "start_s": p["start"] - self.started,
+                     "seconds": p["seconds"],
+                     "out": dict(self.latency(p["out"][1]), bytes=p["out"][0]),
+                     "in": dict(self.latency(p["in"][1]), bytes=p["in"][0])}
+            if p["data"]:
+                phase["data_bytes"] = p["data"]
+                phase["data_bytes_per_s"] = p["data"] / p["seconds"] if p["seconds"] else None
+            phases.append(phase)
+        return {"info": self.info,
+                "buckets_us": list(TIMING_BUCKETS),
+                "total_s": self.stopped - self.started,
+                "phases": phases,
+                "out": self.latency(out),
+                "in": self.latency(inp)}
+
+    def summary(self, results):
+        """ prints the figures """
+        print("Timing (monotonic clock)")
+        print("  %-10s %10s %8s %9s %12s %22s" % ("phase", "ms", "packets",
+              "bytes", "data B/s", "latency us avg/max"))
+        for p in results["phases"]:
+            count = p["out"]["count"] + p["in"]["count"]
+            rate = p.get("data_bytes_per_s")
+            latency = ""
+            if count:
+                worst = max(p["out"].get("max_us", 0), p["in"].get("max_us", 0))
+                avg = (p["out"].get("avg_us", 0) * p["out"]["count"] +
+                       p["in"].get("avg_us", 0) * p["in"]["count"]) / count
+                latency = "%.0f/%.0f" % (avg, worst)
+            print("  %-10s %10.1f %8d %9d %12s %22s" % (p["name"],
+                  p["seconds"] * 1000, count, p["out"]["bytes"] + p["in"]["bytes"],
+                  "%.0f" % rate if rate else "", latency))
+        print("  %-10s %10.1f" % ("total", results["total_s"] * 1000))
+        labels = ["<%d" % b for b in TIMING_BUCKETS] + [">=%d" % TIMING_BUCKETS[-1]]
+        print("  %-10s %s" % ("latency us", " ".join(["%6s" % l for l in labels])))
+        for direction in ("out", "in"):
+            print("  %-10s %s" % (direction, " ".join(["%6d" % n
+                  for n in results[direction]["histogram"]])))
+
+    def report(self, filename, summary):
+        """ prints and/or writes the figures to a .json file """
+        if not self.phases:
+            return
+        results = self.results()
+        if summary:
+            self.summary(results)
+        if filename:
+            fichier = open(filename, 'w')
+            json.dump(results, fichier, indent=4)
+            fichier.write("\n")
+            fichier.close()
+
+# ----------------------------------------------------------------------
+def timingPhase(name):
+# ----------------------------------------------------------------------
+    """ starts a timed phase if --timing or --timing-json was given """
+
+    if TIMING is not None:
+        TIMING.phase(name)
+
 # ----------------------------------------------------------------------
 def getDevice(vendor, product):
 # ----------------------------------------------------------------------
@@ -257,7 +429,8 @@ def getDevice(vendor, product):
 # ----------------------------------------------------------------------
 def initDevice(device):
 # ----------------------------------------------------------------------
-    """ Init pinguino device """
+    """ Init pinguino device, raises UploaderError if it can't be
+        claimed """
 
     if platform.system() == 'Linux':
         if device.idProduct == PRODUCT_ID: #self.P32_ID:
@@ -281,12 +454,12 @@ def initDevice(device):
         try:
             device.set_configuration(ACTIVE_CONFIG)
         except usb.core.USBError as e:
-            sys.exit("Could not set configuration: %s" % str(e))
+            raise UploaderError(ERR_USB_INIT2, "Could not set configuration: %s" % str(e))
 
         try:
             usb.util.claim_interface(device, INTERFACE_ID)
-        except:
-            sys.exit("Could not claim the device: %s" % str(e))
+        except usb.core.USBError as e:
+            raise UploaderError(ERR_USB_INIT2, "Could not claim the device: %s" % str(e))
 
         return device
 
@@ -322,6 +495,7 @@ def sendPacket(handle, usbBuf):
 
     #print("Command = %s" % commands_table[usbBuf[BOOT_CMD]])
 
+    start = clock()
     try:
         if PYUSB_USE_CORE:
             sent_bytes = handle.write(OUT_EP, usbBuf, TIMEOUT)
@@ -334,6 +508,10 @@ def sendPacket(handle, usbBuf):
 
     if sent_bytes == len(usbBuf):
         #print("%d bytes successfully sent." % sent_bytes)
+        if RECORD:
+            RECORD.write("OUT %s\n" % "".join(["%02X" % b for b in usbBuf]))
+        if TIMING:
+            TIMING.packet("out", sent_bytes, clock() - start)
         return ERR_NONE
 
     else:
@@ -353,11 +531,17 @@ def getResponse(handle):
 # ----------------------------------------------------------------------
     """ Send a command and get a response from the bootloader """
 
+    start = clock()
     if PYUSB_USE_CORE:
         usbBuf = handle.read(IN_EP, MAXPACKETSIZE, TIMEOUT)
     else:
         usbBuf = handle.interruptRead(IN_EP, MAXPACKETSIZE, TIMEOUT)
 
+    if RECORD:
+        RECORD.write("IN  %s\n" % "".join(["%02X" % b for b in usbBuf]))
+    if TIMING:
+        TIMING.packet("in", len(usbBuf), clock() - start)
+
     #print usbBuf
     return usbBuf
 
@@ -462,6 +646,82 @@ def getVersion(handle):
     else:
         return str(major) + "." + str(minor) + "." + str(devpt)
 
+# ----------------------------------------------------------------------
+def getImageSign(handle):
+# ----------------------------------------------------------------------
+    """ get length, CRC-32 and timestamp of the image already in flash """
+
+    if sendCommand(handle, QUERY_DEVICE_CMD) == ERR_USB_WRITE:
+        return ERR_USB_READ
+
+    usbBuf = getResponse(handle)
+
+    sign = []
+    for offset in (BOOT_IMG_LEN, BOOT_IMG_CRC, BOOT_IMG_TIME):
+        sign.append((usbBuf[offset + 0]      ) | \
+                    (usbBuf[offset + 1] <<  8) | \
+                    (usbBuf[offset + 2] << 16) | \
+                    (usbBuf[offset + 3] << 24))
+
+    # length is 0 if there is no valid signature
+    return sign[0], sign[1], sign[2]
+
+# ----------------------------------------------------------------------
+def signFlash(handle, length, crc, timestamp):
+# ----------------------------------------------------------------------
+    """ store the image signature once the image has been programmed """
+
+    usbBuf = [0] * MAXPACKETSIZE
+    usbBuf[BOOT_CMD] = SIGN_FLASH_CMD
+
+    for i in range(4):
+        usbBuf[BOOT_SIGN_LEN  + i] = (length    >> (8 * i)) & 0xFF
+        usbBuf[BOOT_SIGN_CRC  + i] = (crc       >> (8 * i)) & 0xFF
+        usbBuf[BOOT_SIGN_TIME + i] = (timestamp >> (8 * i)) & 0xFF
+
+    return sendPacket(handle, usbBuf)
+
+# ----------------------------------------------------------------------
+def getSegments(image):
+# ----------------------------------------------------------------------
+    """ the contiguous segments [(address, data), ...] of the image, in
+        blocks of DATABLOCKSIZE bytes from min_address. The blank blocks
+        (0xFF only) are left out, the flash is already erased. """
+
+    min_address, max_address, program_memory, codesize = image
+    segments = []
+    blank = True
+
+    for addr in range(min_address, max_address, DATABLOCKSIZE):
+        index = addr - min_address
+        block = program_memory[index:index+DATABLOCKSIZE]
+        # the bootloader ignores incomplete words
+        block = block[:len(block) - len(block) % 4]
+        if block.count(0xFF) == len(block):
+            blank = True
+            continue
+        if blank:
+            segments.append((addr, []))
+            blank = False
+        segments[-1][1].extend(block)
+
+    return segments
+
+# ----------------------------------------------------------------------
+def getImageCRC(image):
+# ----------------------------------------------------------------------
+    """ length and CRC-32 of the words the bootloader will program """
+
+    length = 0
+    crc = 0
+
+    # same segments as writeHex
+    for address, data in getSegments(image):
+        crc = zlib.crc32(bytes(bytearray(data)), crc)
+        length = length + len(data)
+
+    return length, crc & 0xFFFFFFFF
+
 # ----------------------------------------------------------------------
 def eraseFlash(handle):
 # ----------------------------------------------------------------------
@@ -506,6 +766,93 @@ def writeFlash(handle, address, block):
 
     return status
 
+# ----------------------------------------------------------------------
+def compressLZ(data):
+# ----------------------------------------------------------------------
+    """ LZ compress a list of bytes, groups of 1 flag byte + 8 items
+        bit = 0 : literal byte
+        bit = 1 : [(length-3) << 2 | (offset-1) >> 8] [(offset-1) & 0xFF] """
+
+    out = bytearray()
+    chains = {}
+    length = len(data)
+    i = 0
+
+    while i < length:
+        flagpos = len(out)
+        out.append(0)
+        flags = 0
+        for bit in range(8):
+            if i >= length:
+                break
+
+            # longest match among the last positions with the same 3 bytes
+            best_len = 0
+            best_off = 0
+            for j in reversed(chains.get(tuple(data[i:i+LZ_MIN_MATCH]), [])):
+                if i - j > LZ_WINDOW_SIZE:
+                    break
+                l = 0
+                while l < LZ_MAX_MATCH and i + l < length and data[j + l] == data[i + l]:
+                    l = l + 1
+                if l > best_len:
+                    best_len = l
+                    best_off = i - j
+                    if l == LZ_MAX_MATCH:
+                        break
+
+            if best_len >= LZ_MIN_MATCH:
+                flags = flags | (1 << bit)
+                out.append(((best_len - LZ_MIN_MATCH) << 2) | ((best_off - 1) >> 8))
+                out.append((best_off - 1) & 0xFF)
+                step = best_len
+            else:
+                out.append(data[i])
+                step = 1
+
+            for k in range(i, min(i + step, length - LZ_MIN_MATCH + 1)):
+                key = tuple(data[k:k+LZ_MIN_MATCH])
+                chain = chains.setdefault(key, [])
+                chain.append(k)
+                if len(chain) > LZ_MAX_CHAIN:
+                    del chain[0]
+            i = i + step
+
+        out[flagpos] = flags
+
+    return out
+
+# ----------------------------------------------------------------------
+def writeCompressed(handle, address, data):
+# ----------------------------------------------------------------------
+    """ write a contiguous segment (multiple of 4 bytes) of compressed code """
+
+    for i in range(0, len(data), DATABLOCKSIZE):
+        block = data[i:i+DATABLOCKSIZE]
+        length = len(block)
+
+        usbBuf = [PROGRAM_COMPRESSED_CMD] * MAXPACKETSIZE
+
+        # segment's address, the same for all packets
+        usbBuf[BOOT_ADDR + 0] = (address      ) & 0xFF
+        usbBuf[BOOT_ADDR + 1] = (address >> 8 ) & 0xFF
+        usbBuf[BOOT_ADDR + 2] = (address >> 16) & 0xFF
+        usbBuf[BOOT_ADDR + 3] = (address >> 24) & 0xFF
+
+        # data's length
+        usbBuf[BOOT_CMD_SIZE] = length
+
+        # add data 'right justified' within packet
+        for j in range(length):
+            usbBuf[MAXPACKETSIZE - length + j] = block[j]
+
+        status = sendPacket(handle, usbBuf)
+        if status != ERR_NONE:
+            return status
+
+    # flush the last words and close the segment
+    return sendCommand(handle, PROGRAM_COMPLETE_CMD)
+
 # ----------------------------------------------------------------------
 def readFlash(handle, address, length):
 # ----------------------------------------------------------------------
@@ -527,9 +874,79 @@ def readFlash(handle, address, length):
         return ERR_USB_READ
 
 # ----------------------------------------------------------------------
-def writeHex(handle, filename, memstart, memend):
+def getStats(handle):
 # ----------------------------------------------------------------------
-    """ Parse the Hex File Format and send data to usb device """
+    """ read the BootStats structure (cf. stats.h) as a list of words """
+
+    words = []
+    length = 4
+    offset = 0
+    while offset < length:
+        size = min(DATABLOCKSIZE, length - offset)
+        usbBuf = [0] * MAXPACKETSIZE
+        usbBuf[BOOT_CMD] = GET_STATS_CMD
+        usbBuf[BOOT_ADDR + 0] = (offset     ) & 0xFF
+        usbBuf[BOOT_ADDR + 1] = (offset >> 8) & 0xFF
+        usbBuf[BOOT_CMD_SIZE] = size
+        if sendPacket(handle, usbBuf) != ERR_NONE:
+            return ERR_USB_WRITE
+        usbBuf = getResponse(handle)
+        if usbBuf[BOOT_CMD_SIZE] != size:
+            return ERR_USB_READ
+        for i in range(BOOT_STATS_DATA, BOOT_STATS_DATA + size, 4):
+            words.append((usbBuf[i + 0]      ) | \
+                         (usbBuf[i + 1] <<  8) | \
+                         (usbBuf[i + 2] << 16) | \
+                         (usbBuf[i + 3] << 24))
+        # the first word is the length of the structure
+        length = words[0] & ~3
+        offset = offset + size
+
+    return words
+
+# ----------------------------------------------------------------------
+def printStats(stats):
+# ----------------------------------------------------------------------
+    """ time spent by the bootloader since the erase, per phase """
+
+    STATS_NVMOPS   = 5
+    STATS_COMMANDS = 16
+
+    tickhz, elapsed, usbwait, memcopy, lvdwait = stats[1:6]
+    nvmcount = stats[6:6 + STATS_NVMOPS]
+    nvmticks = stats[6 + STATS_NVMOPS:6 + 2 * STATS_NVMOPS]
+    base     = 6 + 2 * STATS_NVMOPS
+    cmdcount = stats[base:base + STATS_COMMANDS]
+    cmdticks = stats[base + STATS_COMMANDS:base + 2 * STATS_COMMANDS]
+
+    def line(name, count, ticks):
+        ms = 1000.0 * ticks / tickhz
+        pc = 100.0 * ticks / elapsed if elapsed else 0.0
+        if count is None:
+            print "   %-20s %8s %10.3f ms %5.1f %%" % (name, "", ms, pc)
+        else:
+            print "   %-20s %8d %10.3f ms %5.1f %%" % (name, count, ms, pc)
+
+    print "Bootloader time (%d Hz core timer, wraps after %d s)" % \
+        (tickhz, 0x100000000 / tickhz)
+    line("elapsed", None, elapsed)
+    line("waiting for USB", None, usbwait)
+    line("MemCopy", None, memcopy)
+    line("LVD start-up", None, lvdwait)
+    # FLASH_xxx codes of flash.h
+    for op, name in ((4, "page erase"), (3, "row write"), (1, "word write")):
+        line(name, nvmcount[op], nvmticks[op])
+    for cmd in range(STATS_COMMANDS):
+        if cmdcount[cmd]:
+            name = commands_table.get(cmd, "0x%02X" % cmd)
+            line(name, cmdcount[cmd], cmdticks[cmd])
+
+# ----------------------------------------------------------------------
+def readHex(filename, memstart, memend):
+# ----------------------------------------------------------------------
+    """ Parse the Hex File Format and returns the flash image of the
+        data from memstart to memend, ERR_HEX_RECORD if some program
+        flash data is out of this range """
 
     """
     [0]        Start code, one character, an ASCII colon ':'.
@@ -559,7 +976,7 @@ def writeHex(handle, filename, memstart, memend):
     # determine the range of flash used
     # --------------------------------------------------------------
 
-    memstart = 0x9D000000
+    skipped = 0
 
     for line in lines:
 
@@ -596,11 +1013,24 @@ def writeHex(handle, filename, memstart, memend):
             address = address_Hi + address_Lo
 
             # min program address
-            if (address >= memstart) and (address < memend):
+            if (address >= memstart) and (address + byte_count <= memend):
                 #print("0x%08X" % address)
                 if (min_address > address):
                     min_address = address
 
+            # boot flash and config words are not written by the bootloader
+            elif (address & 0x1FFFFFFF) >= BOOT_FLASH_START:
+                skipped = skipped + byte_count
+
+            # anything else would be lost, or overwrite the bootloader
+            else:
+                print("Error : data out of the application area (0x%08X to 0x%08X)" % (memstart, memend))
+                print("Line %s" % line.strip())
+                return ERR_HEX_RECORD
+
+    if skipped:
+        print("Caution : %d bytes of boot flash or config words skipped" % skipped)
+
     memstart = min_address
     
     #print("memstart = 0x%08X" % memstart)
@@ -694,30 +1124,305 @@ def writeHex(handle, filename, memstart, memend):
             print("Line %s" % line)
             #print "ERR_HEX_RECORD"
 
-    # write blocks of DATABLOCKSIZE bytes
-    # --------------------------------------------------------------
+    return min_address, max_address, program_memory, codesize
 
-    #print("min address = 0x%X" % min_address);
-    #print("max address = 0x%X" % max_address);
+# ----------------------------------------------------------------------
+def writeHex(handle, image, compress=False):
+# ----------------------------------------------------------------------
+    """ Send the flash image to usb device """
 
-    for addr in range(min_address, max_address, DATABLOCKSIZE):
-        index = addr - min_address
-        #print("0x%X : " % (index+memstart));
-        #print("data = %s" % program_memory[index:index+DATABLOCKSIZE])
-        status = writeFlash(handle, addr, program_memory[index:index+DATABLOCKSIZE])
-        if (status != ERR_NONE):
-            return status
+    min_address, max_address, program_memory, codesize = image
 
-    # end
-    # --------------------------------------------------------------
+    for address, data in getSegments(image):
+
+        # a segment is compressed only if it takes less packets
+        # ----------------------------------------------------------
+
+        if compress:
+            packed = compressLZ(data)
+            raw_packets = (len(data) + DATABLOCKSIZE - 1) // DATABLOCKSIZE
+            lz_packets  = (len(packed) + DATABLOCKSIZE - 1) // DATABLOCKSIZE
+            if lz_packets < raw_packets:
+                print("0x%08X : %d bytes compressed to %d (%d packets instead of %d)" % \
+                      (address, len(data), len(packed), lz_packets, raw_packets))
+                status = writeCompressed(handle, address, packed)
+                if status != ERR_NONE:
+                    return status
+                continue
+
+        # write blocks of DATABLOCKSIZE bytes
+        # ----------------------------------------------------------
+
+        for i in range(0, len(data), DATABLOCKSIZE):
+            status = writeFlash(handle, address + i, data[i:i+DATABLOCKSIZE])
+            if (status != ERR_NONE):
+                return status
+
+        # end of the segment, writeFlash() flushes the short blocks
+        if len(data) % DATABLOCKSIZE == 0:
+            status = sendCommand(handle, PROGRAM_COMPLETE_CMD)
+            if (status != ERR_NONE):
+                return status
 
     print("%d bytes written" % codesize)
-    status = sendCommand(handle, PROGRAM_COMPLETE_CMD)
+    if TIMING:
+        TIMING.data(codesize)
 
-    return status
+    return ERR_NONE
+
+# ----------------------------------------------------------------------
+class UploaderError(Exception):
+# ----------------------------------------------------------------------
+    """ raised by Session and initDevice(), code is one of the ERR_xxx
+        codes above """
+
+    def __init__(self, code, message):
+        Exception.__init__(self, message)
+        self.code = code
 
 # ----------------------------------------------------------------------
-def main(filename):
+class Session(object):
+# ----------------------------------------------------------------------
+    """ a bootloader found and claimed once, for any number of
+        operations on the same handle, e.g. :
+
+            import uploader32
+            with uploader32.Session() as session:
+                session.open()
+                session.query()
+                session.write("Blink250.hex")
+                session.verify("Blink250.hex")
+                session.reset()
+
+        The errors raise UploaderError, the USB ones usb.core.USBError
+        as pyusb does. query() sets proc, device_id, device_rev,
+        memstart, memend (KSEG0 addresses) and version. """
+
+    def __init__(self):
+        self.handle     = None
+        self.cached     = None      # (filename, mtime), image
+        self.proc       = None
+        self.device_id  = None
+        self.device_rev = None
+        self.memstart   = None
+        self.memend     = None
+        self.version    = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def claimed(self):
+        """ returns the handle, raises if the session is not open """
+        if self.handle is None:
+            raise UploaderError(ERR_USB_OPEN, "no bootloader open")
+        return self.handle
+
+    def queried(self):
+        """ raises if query() was not called """
+        self.claimed()
+        if self.memstart is None:
+            raise UploaderError(ERR_CMD_ARG, "device not queried")
+
+    def since(self, major, minor, devpt):
+        """ True if the bootloader is at least vmajor.minor.devpt """
+        return bool(self.version) and \
+            [int(v) for v in self.version.split(".")] >= [major, minor, devpt]
+
+    def ebase(self):
+        """ start of the application area, the IVT less the image
+            signature that the bootloader keeps there since v1.5.0 """
+        ebase = self.memstart - APP_IVT_LENGTH
+        if self.since(1, 5, 0):
+            ebase = ebase + APP_SIGN_LENGTH
+        return ebase
+
+    def open(self):
+        """ finds the bootloader and claims it """
+
+        timingPhase("discovery")
+        device = getDevice(VENDOR_ID, PRODUCT_ID)
+        if device == ERR_DEVICE_NOT_FOUND:
+            raise UploaderError(ERR_DEVICE_NOT_FOUND, "Pinguino not found\n" \
+                "Is your device connected and/or in bootloader mode ?")
+
+        timingPhase("init")
+        handle = initDevice(device)
+        if handle == ERR_USB_INIT1:
+            raise UploaderError(ERR_USB_INIT1, "Upload is not possible.\n" \
+                "Press the Reset button and try again.")
+        elif handle == None:
+            raise UploaderError(ERR_USB_INIT2, "Device is not working properly.")
+        self.handle = handle
+
+        if TIMING:
+            # bus-port.port..., as in /sys/bus/usb/devices
+            ports = getattr(device, "port_numbers", None)
+            if ports:
+                TIMING.info["port"] = "%d-%s" % (device.bus,
+                                       ".".join([str(n) for n in ports]))
+
+    def close(self):
+        """ releases the bootloader, if still open """
+        if self.handle is not None:
+            closeDevice(self.handle)
+            self.handle = None
+
+    def query(self):
+        """ reads the device ID, the flash memory free and the
+            bootloader version """
+
+        handle = self.claimed()
+        timingPhase("id")
+
+        if getDeviceFamily(handle) != DEVICE_FAMILY_PIC32:
+            raise UploaderError(ERR_DEVICE_NOT_FOUND, "not a PIC32 family device")
+
+        self.device_id, self.device_rev = getDeviceID(handle)
+        self.proc = getDeviceName(self.device_id)
+
+        memstart, memfree = getDeviceFlash(handle)
+        if memstart >= 0xBD000000:
+            memstart = memstart - 0x20000000
+        self.memstart = memstart | 0x80000000
+        self.memend   = self.memstart + memfree
+
+        self.version = getVersion(handle)
+        self.cached  = None
+
+        if TIMING:
+            TIMING.info["proc"] = self.proc
+            TIMING.info["version"] = self.version
+
+    def image(self, filename):
+        """ returns the program image of a hex file, cf. readHex(),
+            parsed once per session """
+
+        self.queried()
+        try:
+            key = (filename, os.path.getmtime(filename))
+        except OSError:
+            raise UploaderError(ERR_HEX_OPEN, "Unable to open %s" % filename)
+        if self.cached is not None and self.cached[0] == key:
+            return self.cached[1]
+
+        timingPhase("parse")
+        try:
+            image = readHex(filename, self.ebase(), self.memend)
+        except IOError:
+            raise UploaderError(ERR_HEX_OPEN, "Unable to open %s" % filename)
+        if image == ERR_HEX_CHECKSUM:
+            raise UploaderError(image, "Hex file checksum error!")
+        if image == ERR_HEX_RECORD:
+            raise UploaderError(image, "Hex file doesn't fit the application area!")
+        self.cached = key, image
+        return image
+
+    def uploaded(self, filename):
+        """ returns the date of the upload if the same program is
+            already in flash (image signature, since v1.5.0), or None """
+
+        image = self.image(filename)
+        if not self.since(1, 5, 0):
+            return None
+        timingPhase("verify")
+        length, crc = getImageCRC(image)
+        sign_length, sign_crc, sign_time = getImageSign(self.handle)
+        if sign_length == length and sign_crc == crc:
+            return sign_time
+        return None
+
+    def erase(self):
+        """ erases the whole flash memory of the user program """
+
+        handle = self.claimed()
+        timingPhase("erase")
+        if eraseFlash(handle) != ERR_NONE:
+            raise UploaderError(ERR_USB_ERASE, "Erase Error!")
+
+    def write(self, filename, erase=True):
+        """ erases the flash memory, unless erase is False, writes the
+            program, compressed since v1.6.0, signs it since v1.5.0 and
+            returns its size in bytes """
+
+        image = self.image(filename)
+        if erase:
+            self.erase()
+
+        timingPhase("write")
+        status = writeHex(self.handle, image, self.since(1, 6, 0))
+        if status != ERR_NONE:
+            raise UploaderError(status, "Write Error!")
+        if TIMING:
+            TIMING.data(image[3])
+
+        if self.since(1, 5, 0):
+            timingPhase("sign")
+            length, crc = getImageCRC(image)
+            timestamp = int(os.path.getmtime(filename))
+            if signFlash(self.handle, length, crc, timestamp) != ERR_NONE:
+                raise UploaderError(ERR_USB_WRITE, "Sign Error!")
+            # the bootloader doesn't sign an image it failed to program
+            sign_length, sign_crc, sign_time = getImageSign(self.handle)
+            if sign_length != length or sign_crc != crc:
+                raise UploaderError(ERR_VERIFY, "Verify Error! The program has not been written as sent.")
+
+        return image[3]
+
+    def read(self, address, length):
+        """ returns length bytes of memory from address (GET_DATA) """
+
+        handle = self.claimed()
+        data = []
+        while len(data) < length:
+            size = min(DATABLOCKSIZE, length - len(data))
+            usbBuf = readFlash(handle, address + len(data), size)
+            if usbBuf == ERR_USB_READ:
+                raise UploaderError(ERR_USB_READ, "Read Error!")
+            # Data32 is word aligned, as in the GET_STATS reply
+            data.extend([int(b) for b in usbBuf[BOOT_STATS_DATA:BOOT_STATS_DATA + size]])
+        return data
+
+    def verify(self, filename):
+        """ reads the program back and compares it with the hex file,
+            the words written by writeHex() """
+
+        image = self.image(filename)
+        timingPhase("verify")
+
+        for address, data in getSegments(image):
+            for i in range(0, len(data), DATABLOCKSIZE):
+                block = data[i:i+DATABLOCKSIZE]
+                if self.read(address + i, len(block)) != block:
+                    raise UploaderError(ERR_VERIFY, "Verify Error at 0x%08X!" % (address + i))
+
+    def stats(self):
+        """ returns the BootStats words (cf. stats.h), since v1.7.0 """
+
+        handle = self.claimed()
+        if not self.since(1, 7, 0):
+            raise UploaderError(ERR_CMD_UNKNOWN, "Bootloader v%s has no " \
+                "time counters (--stats needs v1.7.0)" % self.version)
+        timingPhase("stats")
+        words = getStats(handle)
+        if words in (ERR_USB_WRITE, ERR_USB_READ):
+            raise UploaderError(words, "Stats Error!")
+        return words
+
+    def reset(self):
+        """ starts the user program, the session is over """
+
+        handle = self.claimed()
+        timingPhase("reset")
+        status = resetDevice(handle)
+        if status != ERR_NONE:
+            raise UploaderError(status, "Reset Error!")
+        self.close()
+
+# ----------------------------------------------------------------------
+def main(filename, stats=False):
 # ----------------------------------------------------------------------
 
     print
@@ -737,124 +1442,116 @@ def main(filename):
         print "No program to write"
         sys.exit(0)
 
-    hexfile = open(filename, 'r')
-    if hexfile == "":
-        print "Unable to open %s" % filename
-        sys.exit(0)
-    hexfile.close()
+    # the session is closed by any sys.exit() below
+    with Session() as session:
+        try:
+            upload(session, filename, stats)
+        except UploaderError as e:
+            print str(e)
+            sys.exit(0)
+
+# ----------------------------------------------------------------------
+def upload(session, filename, stats):
+# ----------------------------------------------------------------------
+    """ the steps of main(), with an open session """
 
     # search for a Pinguino board
     # --------------------------------------------------------------
 
-    device = getDevice(VENDOR_ID, PRODUCT_ID)
-    if device == ERR_DEVICE_NOT_FOUND:
-        print "Pinguino not found"
-        print "Is your device connected and/or in bootloader mode ?"
-        sys.exit(0)
-    else:
-        print "Pinguino found ..."
-
-    handle = initDevice(device)
-
-    if handle == ERR_USB_INIT1:
-        print "... but upload is not possible."
-        print "Press the Reset button and try again."
-        sys.exit(0)
-
-    elif handle == None:
-        print("... but device is not working properly.")
-        sys.exit(0)
-
-    #print "%s - %s" % (handle.getString(device.iProduct, 30), handle.getString(device.iManufacturer, 30))
-    #print "%s" % handle.getString(device.iProduct, 30)
+    session.open()
+    print "Pinguino found ..."
 
-    # find out the processor
+    # find out the processor, flash memory and bootloader version
     # --------------------------------------------------------------
 
-    if getDeviceFamily(handle) != DEVICE_FAMILY_PIC32:
-        print "Error: not a PIC32 family device"
-        closeDevice(handle)
-        sys.exit(0)
-
-    device_id, device_rev = getDeviceID(handle)
-    proc = getDeviceName(device_id)
-    print " - with PIC%s (id=0x%08X, rev.%01X)" % (proc, device_id, device_rev)
-
-    """
-    if proc != self.board.proc:
-        self.add_report("Error: Program compiled for %s but device has %s" % (self.board.proc, proc))
-        self.closeDevice()
-        return
-    """
-
-    # --------------------------------------------------------------
-    #sys.exit(0)
-    # --------------------------------------------------------------
-    
-    # find out flash memory size
-    # ------------------------------------------------------------------
-    
-    memstart, memfree  = getDeviceFlash(handle)
-    if memstart >= 0xBD000000:
-        memstart = memstart - 0x20000000
-    memstart = memstart | 0x80000000
-    memend   = memstart + memfree
-    #memstart = memstart + 0x80000000
-    #memend   = memend   + 0x80000000
+    session.query()
+    print " - with PIC%s (id=0x%08X, rev.%01X)" % (session.proc,
+        session.device_id, session.device_rev)
+    memfree = session.memend - session.memstart
     print " - with %d bytes free (%d KB)" % (memfree, memfree/1024)
-    print " - from 0x%08X to 0x%08X" % (memstart, memend)
+    print " - from 0x%08X to 0x%08X" % (session.memstart, session.memend)
+    print(" - with Pinguino USB HID Bootloader v%s" % session.version)
 
-    # find out bootloader version
+    # time counters are supported since v1.7.0
+    if stats and not session.since(1, 7, 0):
+        print "Bootloader v%s has no time counters (--stats needs v1.7.0)" % session.version
+        stats = False
+
+    # compare with the program already in flash
     # --------------------------------------------------------------
 
-    version = getVersion(handle)
-    print(" - with Pinguino USB HID Bootloader v%s" % version)
+    sign_time = session.uploaded(filename)
+    if sign_time is not None:
+        print "%s already uploaded on %s" % (os.path.basename(filename),
+            time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(sign_time)))
+        print "Starting user program ..."
+        session.reset()
+        print "Ready."
+        return
 
-    # start erasing
+    # erase and write
     # --------------------------------------------------------------
 
     print "Erasing flash memory ..."
-    status = eraseFlash(handle)
-    if status != ERR_NONE:
-        print "Erase Error!"
-        closeDevice(handle)
-        sys.exit(0)
-
-    # start writing
-    # --------------------------------------------------------------
+    session.erase()
 
     print "Uploading user program ..."
-    status = writeHex(handle, filename, memstart, memend)
-    if status != ERR_NONE:
-        print "Write Error!"
-        closeDevice(handle)
-        sys.exit(0)
-
+    session.write(filename, erase=False)
     print "%s successfully uploaded" % os.path.basename(filename)
 
+    if stats:
+        try:
+            printStats(session.stats())
+        except UploaderError as e:
+            print str(e)
+
     # reset and start start user's app.
     # --------------------------------------------------------------
 
     #print "Resetting ..."
     print "Starting user program ..."
-    status = resetDevice(handle)
-    if status != ERR_NONE:
-        print "Reset Error!"
-        closeDevice(handle)
-        sys.exit(0)
-
+    session.reset()
     print "Ready."
-    sys.exit(0)
 
 # ----------------------------------------------------------------------
 
 if __name__ == "__main__":
-    i = -1
-    for arg in sys.argv:
-        i = i + 1
-    if i == 1:
-        main(sys.argv[1])
-    else:
-        print "Usage: uploader32.py path/filename.hex"
+    args = []
+    stats = False
+    summary = False
+    timing_json = None
+    record = None
+    # options in any order, before or after the hex file
+    argv = sys.argv[1:]
+    while argv:
+        arg = argv.pop(0)
+        if arg in ("--timing-json", "--record") and not argv:
+            args = []                   # no value, print the usage
+            break
+        if arg == "--timing":
+            summary = True
+        elif arg == "--timing-json":
+            timing_json = argv.pop(0)
+        elif arg == "--stats":
+            stats = True
+        elif arg == "--record":
+            record = argv.pop(0)
+        else:
+            args.append(arg)
+    if summary or timing_json:
+        TIMING = Timing()
+    if record and len(args) == 1:
+        RECORD = open(record, 'w')
+        RECORD.write("# uploader32.py session, %s\n" % os.path.basename(args[0]))
+    # the figures are reported whatever the outcome, sys.exit() included
+    try:
+        if len(args) == 1:
+            main(args[0], stats)
+        else:
+            print "Usage: uploader32.py [--timing] [--timing-json timing.json] [--stats]\n" \
+                  "                     [--record session.txt] path/filename.hex"
+    finally:
+        if TIMING:
+            TIMING.report(timing_json, summary)
 
 # ----------------------------------------------------------------------
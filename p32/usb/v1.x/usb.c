@@ -848,6 +848,12 @@ static void USBCtrlTrfSetupHandler(void)
     USBCheckStdRequest();
     //Check for USB device class specific requests
     USBCheckHIDRequest();
+    #if (_DFU_ENABLE_)
+    USBCheckDFURequest();
+    #endif
+    #if (_MSC_ENABLE_)
+    USBCheckMSCRequest();
+    #endif
     
     //--------------------------------------------------------------------------
     //3. Re-arm EP0 IN and EP0 OUT endpoints, based on the control transfer in
@@ -1074,11 +1080,16 @@ static void USBCheckStdRequest(void)
             #endif
             //USB_SET_DESCRIPTOR_HANDLER(EVENT_SET_DESCRIPTOR,0,0);
             break;
+        #endif
 
+        // dfu-util selects the DFU interface alternate setting
+        #if (_DFU_ENABLE_)
         case USB_REQUEST_GET_INTERFACE:
             #if 0//(_DEBUG_ENABLE_)
             SerialPrint("interface.\r\n");
             #endif
+            if (SetupPkt.bIntfID >= USB_MAX_NUM_INT)
+                break;
             // Set source
             inPipe.pSrc.bRam = (UINT8*)&USBAlternateInterface[SetupPkt.bIntfID];
             // Set memory type
@@ -1092,10 +1103,15 @@ static void USBCheckStdRequest(void)
             #if 0//(_DEBUG_ENABLE_)
             SerialPrint("SET_INTERFACE\r\n");
             #endif
+            // Only one alternate setting per interface
+            if (SetupPkt.bIntfID >= USB_MAX_NUM_INT || SetupPkt.bAltID != 0)
+                break;
             inPipe.info.bits.busy = 1;
             USBAlternateInterface[SetupPkt.bIntfID] = SetupPkt.bAltID;
             break;
+        #endif
 
+        #if 0
         case USB_REQUEST_SYNCH_FRAME:
             #if 0//(_DEBUG_ENABLE_)
             SerialPrint("SYNCH_FRAME\r\n");
@@ -1994,6 +2010,9 @@ static void USBStdSetCfgHandler(void)
     //Clear all of the endpoint control registers
     //DisableNonZeroEndpoints(USB_MAX_EP_NUMBER);
     U1EP1 = 0x00;
+    #if (_MSC_ENABLE_)
+    U1EP2 = 0x00;
+    #endif
 
     //Clear all of the BDT entries
     for (i=0;i<(sizeof(BDT)/sizeof(BDT_ENTRY));i++)
@@ -2044,6 +2063,9 @@ static void USBStdSetCfgHandler(void)
         //USB_SET_CONFIGURATION_HANDLER(EVENT_CONFIGURED,(void*)&USBActiveConfiguration,1);
         //USBEventHandler(EVENT_CONFIGURED);//,(void*)&USBActiveConfiguration,1);
         USBEventHandler();
+        #if (_MSC_ENABLE_)
+        MSCInitEP();
+        #endif
 
         //Otherwise go to the configured state.  Update the state variable last,
         //after performing all of the set configuration related initialization
@@ -2240,17 +2262,27 @@ static void USBStallEndpoint(UINT8 ep, UINT8 dir)
 
 //USB_HANDLE USBTransferOnePacket(UINT8 ep, UINT8 dir, UINT8* data, UINT8 len)
 USB_HANDLE USBTransferOnePacket(UINT8 dir, UINT8* data)
+{
+    return USBTransferPacket(HID_EP, dir, data, HID_INT_EP_SIZE);
+}
+
+/********************************************************************
+ * Same as USBTransferOnePacket() on any endpoint (see msc.c), len is
+ * the number of bytes to send, or the size of the buffer for OUT.
+ *******************************************************************/
+
+USB_HANDLE USBTransferPacket(UINT8 ep, UINT8 dir, UINT8* data, UINT8 len)
 {
     volatile BDT_ENTRY *handle;
 
     //If the direction is IN point to the IN BDT of the specified endpoint
     if (dir == IN_TO_HOST)
     {
-        handle = pBDTEntryIn[HID_EP];
+        handle = pBDTEntryIn[ep];
     }
     else // OUT_FROM_HOST
     {
-        handle = pBDTEntryOut[HID_EP];
+        handle = pBDTEntryOut[ep];
     }
 
     //Error checking code.
@@ -2263,20 +2295,20 @@ USB_HANDLE USBTransferOnePacket(UINT8 dir, UINT8* data)
 
     //Set the data pointer, data length, and enable the endpoint
     handle->ADR = ConvertToPhysicalAddress(data);
-    handle->CNT = HID_INT_EP_SIZE;
+    handle->CNT = len;
     handle->STAT.Val &= _DTSMASK;
     handle->STAT.Val |= _USIE | _DTSEN;
 
     //Point to the next buffer for ping pong purposes.
     if (dir == IN_TO_HOST)
     {
-        //USBAdvancePingPongBuffer(&pBDTEntryIn[HID_EP]);
-        ((BYTE_VAL*)&pBDTEntryIn[HID_EP])->Val ^= USB_NEXT_PING_PONG;
+        //USBAdvancePingPongBuffer(&pBDTEntryIn[ep]);
+        ((BYTE_VAL*)&pBDTEntryIn[ep])->Val ^= USB_NEXT_PING_PONG;
     }
     else
     {
-        //USBAdvancePingPongBuffer(&pBDTEntryOut[HID_EP]);
-        ((BYTE_VAL*)&pBDTEntryOut[HID_EP])->Val ^= USB_NEXT_PING_PONG;
+        //USBAdvancePingPongBuffer(&pBDTEntryOut[ep]);
+        ((BYTE_VAL*)&pBDTEntryOut[ep])->Val ^= USB_NEXT_PING_PONG;
     }
     
     return (USB_HANDLE)handle;
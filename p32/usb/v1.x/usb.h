@@ -92,6 +92,21 @@
 #define HID_OUTPUT_REPORT           0x02
 #define HID_FEATURE_REPORT          0x03
 
+/* DFU, see dfu.h */
+#define DFU_INTF                    0xFE    // Application Specific Class Code
+#define DFU_INTF_SUBCLASS           0x01    // Device Firmware Upgrade
+#define DFU_PROTOCOL_DFU            0x02    // DFU mode (0x01 is run-time mode)
+#define DSC_DFU                     0x21    // DFU functional descriptor type
+#define DFU_INTF_ID                 0x01
+
+/* MSC, see msc.h */
+#define MSC_INTF                    0x08    // Mass Storage Class Code
+#define MSC_INTF_SUBCLASS           0x06    // SCSI transparent command set
+#define MSC_PROTOCOL_BOT            0x50    // Bulk-Only Transport
+#define MSC_INTF_ID                 (USB_MAX_NUM_INT - 1)   // last interface
+#define MSC_EP                      2
+#define MSC_EP_SIZE                 64
+
 /********************************************************************
  * Standard Request Codes
  * USB 2.0 Spec Ref Table 9-4
@@ -753,6 +768,22 @@ typedef struct __attribute__ ((packed)) _USB_HID_DESCRIPTOR
     UINT16 wDescriptorLength;    //
 } USB_HID_DESCRIPTOR;
 
+// ******************************************************************
+// Section: USB DFU Functional Descriptor Structure
+// ******************************************************************
+// USB DFU Functional Descriptor as detailed in section "4.1.3 Run-Time
+// DFU Functional Descriptor" of the DFU 1.1 class specification
+
+typedef struct __attribute__ ((packed)) _USB_DFU_FUNCTIONAL_DESCRIPTOR
+{
+    UINT8  bLength;              // Length of this descriptor
+    UINT8  bDescriptorType;      // DFU FUNCTIONAL descriptor type
+    UINT8  bmAttributes;         // DFU_CAN_DNLOAD, DFU_CAN_UPLOAD, ...
+    UINT16 wDetachTimeOut;       // ms
+    UINT16 wTransferSize;        // max. bytes per DFU_DNLOAD/DFU_UPLOAD
+    UINT16 bcdDFUVersion;        //
+} USB_DFU_FUNCTIONAL_DESCRIPTOR;
+
 // ******************************************************************
 // Section: USB Setup Packet Structure
 // ******************************************************************
@@ -988,20 +1019,48 @@ typedef struct
     USB_HID_DESCRIPTOR hid;
     USB_ENDPOINT_DESCRIPTOR ep_out;
     USB_ENDPOINT_DESCRIPTOR ep_in;
+    #if (_DFU_ENABLE_)
+    USB_INTERFACE_DESCRIPTOR dfu_interface;
+    USB_DFU_FUNCTIONAL_DESCRIPTOR dfu;
+    #endif
+    #if (_MSC_ENABLE_)
+    USB_INTERFACE_DESCRIPTOR msc_interface;
+    USB_ENDPOINT_DESCRIPTOR msc_ep_in;
+    USB_ENDPOINT_DESCRIPTOR msc_ep_out;
+    #endif
 } USB_CONFIG_DESCRIPTOR;
 
+// Optional interfaces
+#if (_DFU_ENABLE_)
+#define DFU_DESCRIPTORS_LENGTH     (sizeof(USB_INTERFACE_DESCRIPTOR) + \
+                                    sizeof(USB_DFU_FUNCTIONAL_DESCRIPTOR) )
+#else
+#define DFU_DESCRIPTORS_LENGTH     0
+#endif
+
+#if (_MSC_ENABLE_)
+#define MSC_DESCRIPTORS_LENGTH     (sizeof(USB_INTERFACE_DESCRIPTOR) + \
+                                    sizeof(USB_ENDPOINT_DESCRIPTOR) +  \
+                                    sizeof(USB_ENDPOINT_DESCRIPTOR) )
+#else
+#define MSC_DESCRIPTORS_LENGTH     0
+#endif
+
 // Total length in chars of data returned
 #define CONFIGURATION_TOTAL_LENGTH (sizeof(USB_CONFIGURATION_DESCRIPTOR) + \
                                     sizeof(USB_INTERFACE_DESCRIPTOR) + \
                                     sizeof(USB_HID_DESCRIPTOR) +       \
                                     sizeof(USB_ENDPOINT_DESCRIPTOR) +  \
-                                    sizeof(USB_ENDPOINT_DESCRIPTOR) )
+                                    sizeof(USB_ENDPOINT_DESCRIPTOR) +  \
+                                    DFU_DESCRIPTORS_LENGTH +           \
+                                    MSC_DESCRIPTORS_LENGTH )
 
 /*******************************************************************************
  Macros
 *******************************************************************************/
 
 #define USBHandleBusy(handle) (handle==0?0:((volatile BDT_ENTRY*)handle)->STAT.UOWN)
+#define USBHandleGetLength(handle) (((volatile BDT_ENTRY*)handle)->CNT)
 
 // advance the passed pointer to the next buffer state
 //#define USBAdvancePingPongBuffer(buffer) ((BYTE_VAL*)buffer)->Val ^= USB_NEXT_PING_PONG;
@@ -1034,8 +1093,16 @@ void USBDeviceInit(void);
 void USBCheckCable(void);
 void USBDeviceTasks(void);
 void USBCheckHIDRequest(void);
+#if (_DFU_ENABLE_)
+void USBCheckDFURequest(void);     // defined in dfu.c
+#endif
+#if (_MSC_ENABLE_)
+void USBCheckMSCRequest(void);     // defined in msc.c
+void MSCInitEP(void);              // defined in msc.c
+#endif
 void USBEnableEndpoint(UINT8, UINT8);
 USB_HANDLE USBTransferOnePacket(UINT8, UINT8*);
+USB_HANDLE USBTransferPacket(UINT8, UINT8, UINT8*, UINT8);
 //USB_HANDLE USBTransferOnePacket(UINT8, UINT8, UINT8*, UINT8);
 //BOOL USBHandleBusy(USB_HANDLE);
 
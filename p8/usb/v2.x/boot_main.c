@@ -29,17 +29,24 @@
 #include "usb.h"
 #include "usb_descriptors.h"
 #include "application_iface.h"
+#include "config.h"
 #include <delay.h>
 
 void init_boot(void)
 {
     static ulong count;
 
-    
-    count = 0x80000;
-    while(count)
+    // After a software reset (RESET_CMD or run mode EP1 OUT), stay
+    // detached long enough for the host to notice it. Not needed at
+    // power-up, the board was never attached.
+    if(RCONbits.NOT_RI == 0)
     {
-        count--;
+        RCONbits.NOT_RI = 1;
+        count = 0x80000;
+        while(count)
+        {
+            count--;
+        }
     }
 
     if(application_data.invalid == 0)
@@ -70,6 +77,58 @@ void init_boot(void)
 
 }
 
+void start_application(void)
+{
+    TRISA = TRISA & 0xEF;
+    PORTAbits.RA4 = 0;
+    application_data.main();
+    while (1);
+}
+
+// Start policy (see config.h) : returns 0 when no host is there to
+// upload, i.e. VBUS is low or no SETUP packet arrived in time.
+uchar host_present(void)
+{
+    uint ticks;
+
+#ifdef VBUS_SENSE
+    if(!VBUS_SENSE)
+    {
+        debug("no VBUS\n");
+        return 0;
+    }
+#endif
+
+    // Timer 0 : 16-bit, Fosc/4, 1:256 prescaler
+    T0CON = 0x07;
+    TMR0H = 0;
+    TMR0L = 0;
+    T0CONbits.TMR0ON = 1;
+
+    while(!usb_setup_received)
+    {
+        usb_sleep();
+        dispatch_usb_event();
+
+        // reading TMR0L latches TMR0H
+        ticks  = TMR0L;
+        ticks |= (uint)TMR0H << 8;
+        if(ticks >= (uint)BOOT_SETUP_WINDOW * BOOT_TMR0_PER_MS)
+        {
+            debug("no SETUP\n");
+            break;
+        }
+    }
+
+    // back to the reset state for the application
+    T0CON = 0xFF;
+    TMR0H = 0;
+    TMR0L = 0;
+    INTCONbits.TMR0IF = 0;
+
+    return usb_setup_received;
+}
+
 void main(void)
 {
     unsigned char appvalid;
@@ -80,20 +139,24 @@ void main(void)
     init_boot();
     init_usb();
 
+    appvalid = (application_data.invalid == 0)||(application_data.invalid == 1);
+
+    if(appvalid && !host_present())
+    {
+        start_application();
+    }
+
     while(1)
     {
         usb_sleep();
         dispatch_usb_event();
 
-        if((application_data.invalid == 0)||(application_data.invalid == 1))
+        if(appvalid)
 		{
             i--;
             if (i==0)
             {
-                TRISA = TRISA & 0xEF;
-                PORTAbits.RA4 = 0;
-                application_data.main();
-                while (1);
+                start_application();
             }
         }
     }
@@ -40,6 +40,21 @@
 /* Application data address */
 #define APPLICATION_DATA_ADDRESS 0x2000
 
+/* Start policy (boot_main.c)
+   A valid application is started at once when VBUS_SENSE is defined
+   and low, or when no SETUP packet arrives within BOOT_SETUP_WINDOW ms
+   after the USB attach. Once a host has enumerated the board, the
+   bootloader stays resident for about 5 s, waiting for the uploader.
+   BOOT_SETUP_WINDOW is 1390 ms at most (16-bit Timer 0). */
+#define BOOT_SETUP_WINDOW 500
+
+/* Timer 0 ticks per ms, Fosc = 48 MHz, Fosc/4 and 1:256 prescaler */
+#define BOOT_TMR0_PER_MS 47
+
+/* VBUS input, 1 when the board is plugged into a host (not wired on
+   the reference board) */
+/* #define VBUS_SENSE PORTAbits.RA1 */
+
 /* Memory sections for flash operations */
 extern const uchar section_descriptor [22];
 
@@ -45,6 +45,9 @@ uchar __at(0x005e) usb_active_cfg;
 #pragma udata access usb_active_alt_setting
 uchar __at(0x005d) usb_active_alt_setting; 
 
+/* Set by the first SETUP packet (start policy, see boot_main.c) */
+uchar usb_setup_received;
+
 void init_usb(void)
 {
     UIE  = 0;
@@ -53,6 +56,7 @@ void init_usb(void)
     while(UCONbits.SE0);
     UIR  = 0;
     UIE  = 0x11;
+    usb_setup_received = 0;
     
     // Put the device in powered state
     SET_DEVICE_STATE(POWERED_STATE);
@@ -165,6 +169,7 @@ void dispatch_usb_event(void)
             if(EP_OUT_BD(USTATbits.ENDP).Stat.PID == SETUP_TOKEN)
             {
                 // SETUP packet has been received
+                usb_setup_received = 1;
                 ep_setup[GET_ACTIVE_CONFIGURATION()][USTATbits.ENDP]();
             }
             else
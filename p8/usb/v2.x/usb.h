@@ -144,6 +144,7 @@ extern volatile BufferDescriptorTable __at (0x400) ep_bdt[32];
 extern uchar __at(0x005f) usb_device_state;
 extern uchar __at(0x005e) usb_active_cfg;
 extern uchar __at(0x005d) usb_active_alt_setting;
+extern uchar usb_setup_received;
 
 extern const USB_Device_Descriptor *device_descriptor;
 extern const void **configuration_descriptor;
@@ -0,0 +1,389 @@
+#!/usr/bin/env python
+#  -*- coding: UTF-8 -*-
+
+"""---------------------------------------------------------------------
+    bench8
+    instruction cycles of the 8-bit USB bootloader under gpsim
+    usage: ./bench8.py cpu filename (without .cod/.cof extension)
+
+    PROTOTYPE : this script has not been run against gpsim yet, neither
+    the SIE emulation nor the figures have been validated, and it only
+    knows the 18F2455/2550/4455/4550. It stays out of tools/ until a
+    run has been checked in.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc.
+    51 Franklin Street, Fifth Floor
+    Boston, MA  02110-1301  USA
+---------------------------------------------------------------------"""
+
+#-----------------------------------------------------------------------
+# Usage: bench8.py cpu path/filename [--json results.json]
+#                                    [--compare reference.json]
+#                                    [--flash-us 2000]
+# Ex :   make --makefile=Makefile.linux PROC=18f4550 OSC=20 BOOT_USE_GPSIM=1
+#        proto/bench8.py 18f4550 hex/Pinguino_Bootloader_v5.2.0_SDCC_18f4550_X20MHz
+#
+# filename without extension, .cod (SDCC/gplink) or .cof (XC8) is loaded.
+# The bootloader must be built with BOOT_USE_GPSIM=1 (no button needed).
+#-----------------------------------------------------------------------
+
+# gpsim doesn't simulate the USB SIE. This script plays its part :
+# - the USB SFR and the buffer descriptors are plain registers in gpsim,
+# - a transaction is injected by filling the endpoint buffer and its BD,
+#   then USTAT and UIR.TRNIF are set, exactly as the SIE would do,
+# - the firmware runs until it comes back to the top of the main loop
+#   (breakpoint on UsbUpdate), the cycle counter gives the cost of the
+#   transaction.
+# An idle pass of the main loop is measured first, the "net" columns
+# don't include it.
+# Flash erase/write times are not simulated : the "+flash" column adds
+# --flash-us per erase or write operation (Tiw, 2 ms on PIC18F4550).
+#-----------------------------------------------------------------------
+
+import sys
+import os
+import re
+import json
+import select
+import subprocess
+
+# Supported PIC
+#-----------------------------------------------------------------------
+
+# USB SFR and BDT addresses, size of a flash write operation
+CPU = {
+    "18f2455"   : { "UIR" : 0xF68, "USTAT" : 0xF6C, "BDT" : 0x400,
+                    "WRITEBLOCK" : 32 },
+}
+CPU["18f2550"]  = CPU["18f2455"]
+CPU["18f4455"]  = CPU["18f2455"]
+CPU["18f4550"]  = CPU["18f2455"]
+CPU["18lf2550"] = CPU["18f2455"]
+CPU["18lf4550"] = CPU["18f2455"]
+
+FCY                             =    12       # instruction cycles per us
+
+# USB
+#-----------------------------------------------------------------------
+
+OUT                             =    0
+IN                              =    1
+PID_OUT                         =    0x1
+PID_SETUP                       =    0xD
+UIR_URSTIF                      =    0x01
+UIR_TRNIF                       =    0x08
+BDS_UOWN                        =    0x80
+
+# Bootloader commands (cf. uploader8.py)
+#-----------------------------------------------------------------------
+
+READ_VERSION_CMD                =    0x00
+READ_FLASH_CMD                  =    0x01
+WRITE_FLASH_CMD                 =    0x02
+ERASE_FLASH_CMD                 =    0x03
+
+# ----------------------------------------------------------------------
+class Gpsim:
+# ----------------------------------------------------------------------
+    """ gpsim command line interface through a pipe """
+
+    PROMPT  = "**gpsim> "
+    TIMEOUT = 30                        # seconds
+
+    def __init__(self, cpu, filename):
+        if os.path.exists(filename + ".cod"):
+            args = ["gpsim", "-i", "-s", filename + ".cod"]
+        elif os.path.exists(filename + ".cof"):
+            args = ["gpsim", "-i", "-p", "p" + cpu, filename + ".cof"]
+        else:
+            sys.exit("Aborting: no %s.cod or %s.cof" % (filename, filename))
+
+        try:
+            self.process = subprocess.Popen(args,
+                stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                stderr=subprocess.STDOUT)
+        except OSError:
+            sys.exit("Aborting: gpsim not found")
+
+        self.read()
+
+    def read(self):
+        """ output of the last command, until the next prompt """
+        fd = self.process.stdout.fileno()
+        output = ""
+        while not output.endswith(self.PROMPT):
+            ready = select.select([fd], [], [], self.TIMEOUT)[0]
+            if not ready:
+                self.close()
+                sys.exit("Aborting: gpsim doesn't answer (firmware stuck ?)")
+            data = os.read(fd, 1024)
+            if not data:
+                sys.exit("Aborting: gpsim exited\n" + output)
+            output = output + data.decode("latin-1")
+        return output[:-len(self.PROMPT)]
+
+    def command(self, line):
+        self.process.stdin.write((line + "\n").encode("latin-1"))
+        self.process.stdin.flush()
+        return self.read()
+
+    def value(self, line):
+        """ last number printed by a command """
+        numbers = re.findall(r"0x[0-9A-Fa-f]+|\b\d+\b", self.command(line))
+        if not numbers:
+            sys.exit("Aborting: gpsim returned no value for '%s'" % line)
+        return int(numbers[-1], 0)
+
+    def peek(self, address):
+        return self.value("reg(0x%X)" % address) & 0xFF
+
+    def poke(self, address, value):
+        self.command("reg(0x%X) = 0x%X" % (address, value & 0xFF))
+
+    def cycles(self):
+        return self.value("cycles")
+
+    def close(self):
+        try:
+            self.process.stdin.write(b"quit\n")
+            self.process.stdin.flush()
+        except IOError:
+            pass
+        self.process.wait()
+
+# ----------------------------------------------------------------------
+class Sie:
+# ----------------------------------------------------------------------
+    """ USB Serial Interface Engine, as seen by the firmware """
+
+    def __init__(self, sim, cpu):
+        self.sim = sim
+        self.reg = CPU[cpu]
+        self.ep0size = 8
+
+    def bd(self, ep, direction):
+        return self.reg["BDT"] + (ep << 3) + (direction << 2)
+
+    def armed(self, ep, direction):
+        return self.sim.peek(self.bd(ep, direction)) & BDS_UOWN
+
+    def run(self):
+        """ one pass of the main loop, returns the cycles used """
+        start = self.sim.cycles()
+        self.sim.command("run")
+        return self.sim.cycles() - start
+
+    def event(self, flag):
+        self.sim.poke(self.reg["UIR"], self.sim.peek(self.reg["UIR"]) | flag)
+        return self.run()
+
+    def transaction(self, ep, direction, pid=PID_OUT, data=[]):
+        """ returns (cycles, data sent by the device) """
+        bd = self.bd(ep, direction)
+        stat = self.sim.peek(bd)
+        if not (stat & BDS_UOWN):
+            sys.exit("Aborting: EP%d %s not armed" % (ep, "IN" if direction else "OUT"))
+
+        address = self.sim.peek(bd + 2) | (self.sim.peek(bd + 3) << 8)
+
+        if direction == OUT:
+            for i in range(len(data)):
+                self.sim.poke(address + i, data[i])
+            self.sim.poke(bd + 1, len(data))
+            self.sim.poke(bd, pid << 2)
+            reply = []
+        else:
+            count = self.sim.peek(bd + 1) | ((stat & 0x03) << 8)
+            reply = [self.sim.peek(address + i) for i in range(count)]
+            self.sim.poke(bd, stat & ~BDS_UOWN)
+
+        self.sim.poke(self.reg["USTAT"], (ep << 3) | (direction << 2))
+        return self.event(UIR_TRNIF), reply
+
+    def control(self, setup, length):
+        """ control transfer on EP0, returns (cycles, transactions, data) """
+        cycles, unused = self.transaction(0, OUT, PID_SETUP, setup)
+        count = 1
+        data = []
+
+        # data stage (IN only) and status stage
+        if setup[0] & 0x80:
+            while True:
+                c, packet = self.transaction(0, IN)
+                cycles, count, data = cycles + c, count + 1, data + packet
+                if len(packet) < self.ep0size or len(data) >= length:
+                    break
+            c, unused = self.transaction(0, OUT, PID_OUT)
+        else:
+            c, unused = self.transaction(0, IN)
+
+        return cycles + c, count + 1, data
+
+    def bulk(self, packet):
+        """ bootloader command on EP1, returns (cycles, transactions, reply) """
+        cycles, unused = self.transaction(1, OUT, PID_OUT, packet)
+        count = 1
+        reply = []
+        if self.armed(1, IN):
+            c, reply = self.transaction(1, IN)
+            cycles, count = cycles + c, count + 1
+        return cycles, count, reply
+
+# ----------------------------------------------------------------------
+def request(bmRequestType, bRequest, wValue, wIndex, wLength):
+# ----------------------------------------------------------------------
+    return [bmRequestType, bRequest,
+            wValue & 0xFF, wValue >> 8,
+            wIndex & 0xFF, wIndex >> 8,
+            wLength & 0xFF, wLength >> 8]
+
+# ----------------------------------------------------------------------
+def command(cmd, length, address, data=[]):
+# ----------------------------------------------------------------------
+    packet = [cmd, length,
+              address & 0xFF, (address >> 8) & 0xFF, (address >> 16) & 0xFF]
+    return packet + data
+
+# ----------------------------------------------------------------------
+def bench(cpu, filename, flash_us):
+# ----------------------------------------------------------------------
+    sim = Gpsim(cpu, filename)
+    sie = Sie(sim, cpu)
+    results = []
+
+    # The 1st pass enables the USB module (ATTACHED), the 2nd one sees
+    # SE0 = 0 (POWERED), the 3rd one is idle
+
+    sim.command("break e _UsbUpdate")
+    sim.command("run")
+    sie.run()
+    idle = sie.run()
+
+    def record(name, cycles, passes, ops=0):
+        net = cycles - idle * passes
+        results.append({ "name" : name, "cycles" : cycles, "net" : net,
+                         "passes" : passes,
+                         "flash" : net + ops * flash_us * FCY })
+
+    # Enumeration
+    # ------------------------------------------------------------------
+
+    total = [0, 0]
+    def step(name, cycles, passes):
+        record(name, cycles, passes)
+        total[0], total[1] = total[0] + cycles, total[1] + passes
+
+    step("bus reset", sie.event(UIR_URSTIF), 1)
+    c, n, data = sie.control(request(0x80, 6, 0x0100, 0, 64), 64)
+    if len(data) >= 8:
+        sie.ep0size = data[7]
+    step("GET_DESCRIPTOR device", c, n)
+    c, n, data = sie.control(request(0x00, 5, 5, 0, 0), 0)
+    step("SET_ADDRESS", c, n)
+    c, n, data = sie.control(request(0x80, 6, 0x0200, 0, 9), 9)
+    step("GET_DESCRIPTOR config. (9)", c, n)
+    length = (data[2] | (data[3] << 8)) if len(data) >= 4 else 9
+    c, n, data = sie.control(request(0x80, 6, 0x0200, 0, length), length)
+    step("GET_DESCRIPTOR config. (%d)" % length, c, n)
+    c, n, data = sie.control(request(0x00, 9, 1, 0, 0), 0)
+    step("SET_CONFIGURATION", c, n)
+    record("enumeration", total[0], total[1])
+
+    # Bootloader commands
+    # ------------------------------------------------------------------
+
+    reg = CPU[cpu]
+    address = 0x2000
+
+    c, n, reply = sie.bulk(command(READ_VERSION_CMD, 0, 0))
+    record("READ_VERSION", c, n)
+    c, n, reply = sie.bulk(command(READ_FLASH_CMD, 2, 0x3FFFFE))
+    record("READ_FLASH (device ID)", c, n)
+    c, n, reply = sie.bulk(command(READ_FLASH_CMD, 32, address))
+    record("READ_FLASH (32 bytes)", c, n)
+    c, n, reply = sie.bulk(command(ERASE_FLASH_CMD, 1, address))
+    record("ERASE_FLASH (1 block)", c, n, 1)
+    c, n, reply = sie.bulk(command(ERASE_FLASH_CMD, 16, address))
+    record("ERASE_FLASH (16 blocks)", c, n, 16)
+    c, n, reply = sie.bulk(command(WRITE_FLASH_CMD, 32, address, list(range(32))))
+    record("WRITE_FLASH (32 bytes)", c, n, 32 // reg["WRITEBLOCK"])
+    c, n, reply = sie.bulk(command(READ_FLASH_CMD, 32, address))
+    record("READ_FLASH (check)", c, n)
+    if reply[5:] != list(range(32)):
+        print("Warning: flash read back differs from the written data")
+
+    sim.close()
+    return { "cpu" : cpu, "file" : os.path.basename(filename),
+             "idle" : idle, "flash_us" : flash_us, "results" : results }
+
+# ----------------------------------------------------------------------
+def report(data, reference=None):
+# ----------------------------------------------------------------------
+    print("%s (%s), idle pass : %d cycles" % (data["file"], data["cpu"], data["idle"]))
+    print("%-28s %8s %8s %10s %8s" % ("", "cycles", "net", "+flash", "delta"))
+
+    base = {}
+    if reference is not None:
+        print("compared to %s" % reference["file"])
+        for r in reference["results"]:
+            base[r["name"]] = r["net"]
+
+    for r in data["results"]:
+        delta = ""
+        if r["name"] in base:
+            delta = "%+d" % (r["net"] - base[r["name"]])
+        print("%-28s %8d %8d %10d %8s" % (r["name"], r["cycles"], r["net"], r["flash"], delta))
+
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+
+if __name__ == "__main__":
+
+    args = sys.argv[1:]
+    options = { "--json" : None, "--compare" : None, "--flash-us" : "2000" }
+    for option in options:
+        if option in args:
+            i = args.index(option)
+            if i + 1 >= len(args):
+                sys.exit("Aborting: %s needs a value" % option)
+            options[option] = args[i + 1]
+            del args[i:i + 2]
+
+    if len(args) != 2:
+        sys.exit("Usage ex: bench8.py 18f4550 hex/Pinguino_Bootloader_v5.2.0_SDCC_18f4550_X20MHz\n" \
+                 "          bench8.py 18f4550 hex/<XC8 build> --compare sdcc.json")
+
+    print("bench8 is a prototype, the figures have not been validated")
+
+    cpu = args[0].lower()
+    if cpu not in CPU:
+        sys.exit("Aborting: %s is not supported (%s)" % (cpu, ", ".join(sorted(CPU))))
+
+    data = bench(cpu, args[1], int(options["--flash-us"]))
+
+    reference = None
+    if options["--compare"]:
+        fichier = open(options["--compare"], 'r')
+        reference = json.load(fichier)
+        fichier.close()
+
+    report(data, reference)
+
+    if options["--json"]:
+        fichier = open(options["--json"], 'w')
+        json.dump(data, fichier, indent=4)
+        fichier.write("\n")
+        fichier.close()
@@ -0,0 +1,100 @@
+/***********************************************************************
+	Title:	USB Pinguino Bootloader
+	File:	boot_entry.h
+	Descr.: bootloader entry requested by the user application (BOOT_USE_MAGIC)
+	Author:	Régis Blanchot <rblanchot@gmail.com>
+
+	This file is part of Pinguino (http://www.pinguino.cc)
+	Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+************************************************************************
+    This file is shared with the applications.
+
+    Without buttons, an application starts the bootloader with :
+
+        BootEnter();
+
+    which writes BOOT_MAGIC at BOOT_MAGIC_ADDR and executes a RESET
+    instruction. The RAM content survives a RESET and the instruction
+    clears the RI flag (RCON on PIC18F, PCON on PIC16F), so main() only
+    starts the bootloader if both are found. It clears them before the
+    button test, the next reset starts the application again.
+
+    The application should detach from the USB (UCON = 0) and wait for
+    the host to notice it (about 30 ms) before calling BootEnter(), as
+    the bootloader does in UsbBootExit().
+
+    BOOT_MAGIC_ADDR is reserved in main.c, as an absolute variable it
+    is not cleared by the start-up code. It is the top of bank 0 on
+    PIC18F (bank 1 is the SDCC stack, USB RAM starts at bank 2 or more)
+    and of the bank 0 GPR on PIC16F (0x70 to 0x7F is the common RAM).
+
+    On the host side, "uploader8.py mcu --wait s file.hex" waits up to
+    s seconds for the bootloader to enumerate.
+
+    "uploader8.py mcu --auto file.hex" asks the running application to
+    call BootEnter(), then waits for the bootloader :
+    - with the vendor request BOOT_ENTRY_REQUEST (device recipient,
+      wValue = BOOT_MAGIC, no data). The bootloader handles it for the
+      applications using its USB stack (cf. UsbIfaceSetup),
+    - or, if it is stalled, with a "1200-baud touch" on the CDC
+      interface : SET_LINE_CODING to BOOT_ENTRY_BAUDRATE, then
+      SET_CONTROL_LINE_STATE with DTR low. A CDC application calls
+      BootEnterOnTouch() when the line state changes.
+    The device resets before the status stage of these requests.
+***********************************************************************/
+
+#ifndef _BOOT_ENTRY_H
+#define _BOOT_ENTRY_H
+
+#include "types.h"
+
+#define BOOT_MAGIC                  0xB007
+#define BOOT_ENTRY_REQUEST          0xB0    // vendor request (uploader8.py --auto)
+#define BOOT_ENTRY_BAUDRATE         1200    // CDC 1200-baud touch
+
+#if defined(__16f1459)
+    #define BOOT_MAGIC_ADDR         0x06E
+#else
+    #define BOOT_MAGIC_ADDR         0x0FE
+#endif
+
+// Application side
+#ifdef __XC8__
+    #define BootReset()             asm("RESET")
+#else
+    #define BootReset()             __asm__("reset")
+#endif
+
+#define BootEnter()                                                     \
+    do {                                                                \
+        *(volatile u16 *)BOOT_MAGIC_ADDR = BOOT_MAGIC;                  \
+        BootReset();                                                    \
+    } while (0)
+
+#define BootEnterOnTouch(baudrate, dtr)                                 \
+    do {                                                                \
+        if ((baudrate) == BOOT_ENTRY_BAUDRATE && !(dtr))                \
+            BootEnter();                                                \
+    } while (0)
+
+// Bootloader side
+#if (BOOT_USE_MAGIC)
+
+extern volatile u16 bootMagic;
+
+#if defined(__16f1459)
+    #define BootEntryRequested()    (bootMagic == BOOT_MAGIC && !PCONbits.nRI)
+    #define BootEntryClear()        do { bootMagic = 0; PCONbits.nRI = 1; } while (0)
+#else
+    #define BootEntryRequested()    (bootMagic == BOOT_MAGIC && !RCONbits.NOT_RI)
+    #define BootEntryClear()        do { bootMagic = 0; RCONbits.NOT_RI = 1; } while (0)
+#endif
+
+#else
+
+#define BootEntryRequested()        0
+#define BootEntryClear()
+
+#endif /* BOOT_USE_MAGIC */
+
+#endif /* _BOOT_ENTRY_H */
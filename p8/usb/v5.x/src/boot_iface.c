@@ -0,0 +1,223 @@
+/***********************************************************************
+    Title:	USB Pinguino Bootloader
+    File:	boot_iface.c
+    Descr.: USB stack exported to the user application (BOOT_USE_IFACE)
+    Author:	Régis Blanchot <rblanchot@gmail.com>
+************************************************************************
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+************************************************************************
+    Same idea as boot_goto_table in the 2.x bootloader : a versioned
+    table of GOTO at a fixed address, so that the applications can
+    reuse the resident USB stack instead of linking their own.
+    Cf. boot_iface.h for the application side.
+***********************************************************************/
+
+#include "compiler.h"
+#include "types.h"
+#include "hardware.h"
+#include "usb.h"
+#include "boot_iface.h"
+#include "boot_entry.h"
+
+#if (BOOT_USE_IFACE)
+
+#if !defined(__18f2455)  && !defined(__18f4455)  && \
+    !defined(__18f2550)  && !defined(__18f4550)  && \
+    !defined(__18lf2550) && !defined(__18lf4550) && \
+    !defined(__18f25k50) && !defined(__18f45k50)
+    #error "    BOOT_USE_IFACE needs the USB RAM at 0x400-0x7FF"
+#endif
+
+#ifdef __XC8__
+    #error "    BOOT_USE_IFACE needs SDCC (compiled stack, cf. boot_iface.h)"
+#endif
+
+#if (BOOT_USE_TRACE) || (BOOT_USE_LOWPOWER)
+    #error "    BOOT_USE_IFACE can't use BOOT_USE_TRACE or BOOT_USE_LOWPOWER"
+#endif
+
+#if (APPSTART != 0x0C00)
+    #error "    Jump table address (0x0BE0) must be updated"
+#endif
+
+extern u8 deviceState;
+extern u8 currentConfiguration;
+extern u8 requestHandled;
+extern u8 *pBufferToHost;
+extern u8 *pBufferFromHost;
+extern u16 wCount;
+extern setupPacketStruct SetupPacket;
+extern u8 controlTransferBuffer[EP0_BUFFER_SIZE];
+
+/***********************************************************************
+ * Shared data (cf. boot_iface.h)
+ * NB : absolute variables are not cleared at startup
+ **********************************************************************/
+
+UsbIfaceData __at BOOT_IFACE_RAM usbIface;
+
+/***********************************************************************
+ * Jump table
+ **********************************************************************/
+
+#pragma code BootIfaceTable 0x0BE0
+
+void BootIfaceTable(void) __naked
+{
+    __asm
+
+    extern  _UsbIfaceInit
+    extern  _UsbUpdate
+    extern  _UsbProcessEvents
+
+    DW      BOOT_IFACE_VERSION
+    goto    _UsbIfaceInit
+    goto    _UsbUpdate
+    goto    _UsbProcessEvents
+
+    __endasm;
+}
+
+/***********************************************************************
+ * Read a word in flash
+ **********************************************************************/
+
+static u16 UsbIfaceRead(u16 address)
+{
+    u8 low;
+
+    TBLPTRU = 0;
+    TBLPTRH = (u8)(address >> 8);
+    TBLPTRL = (u8)address;
+    __asm__("TBLRD*+");
+    low = TABLAT;
+    __asm__("TBLRD*+");
+    return ((u16)TABLAT << 8) | low;
+}
+
+/***********************************************************************
+ * Copy count bytes from usbIface.source (flash) to dest (RAM)
+ * Called by UsbDataInStage() to send the application descriptors
+ **********************************************************************/
+
+void UsbIfaceCopy(u8 *dest, u8 count)
+{
+    TBLPTRU = 0;
+    TBLPTRH = (u8)(usbIface.source >> 8);
+    TBLPTRL = (u8)usbIface.source;
+
+    while (count--)
+    {
+        // TBLPTR is incremented after the read
+        __asm__("TBLRD*+");
+        *dest++ = TABLAT;
+    }
+
+    usbIface.source = ((u16)TBLPTRH << 8) | TBLPTRL;
+}
+
+/***********************************************************************
+ * Call an application hook
+ **********************************************************************/
+
+void UsbIfaceCall(u16 hook)
+{
+    void (*f)(void);
+
+    if (hook)
+    {
+        f = (void (*)(void))hook;
+        f();
+    }
+}
+
+/***********************************************************************
+ * Entry point : the application takes the USB stack over
+ **********************************************************************/
+
+void UsbIfaceInit(void)
+{
+    usbIface.version = BOOT_IFACE_VERSION;
+    usbIface.flags   = BOOT_IFACE_ACTIVE;
+    usbIface.source  = 0;
+
+    #if (SPEED == LOW_SPEED)
+    UCFG = _UPUEN;
+    #else
+    UCFG = _UPUEN | _FSEN;
+    #endif
+
+    // The bootloader startup code didn't run
+    currentConfiguration = 0;
+    deviceState = DETACHED;
+}
+
+/***********************************************************************
+ * Class and vendor requests
+ * IN replies and OUT data stay in controlTransferBuffer
+ **********************************************************************/
+
+void UsbIfaceSetup(void)
+{
+    #if (BOOT_USE_MAGIC)
+    // Reset into the bootloader (cf. boot_entry.h), no status stage
+    if (SetupPacket.bmRequestType == 0x40 &&
+        SetupPacket.bRequest == BOOT_ENTRY_REQUEST &&
+        SetupPacket.wValue0 == (u8)BOOT_MAGIC &&
+        SetupPacket.wValue1 == (u8)(BOOT_MAGIC >> 8))
+        BootEnter();
+    #endif
+
+    usbIface.handled = 0;
+    usbIface.length  = 0;
+
+    UsbIfaceCall(usbIface.setupHook);
+
+    if (usbIface.handled)
+    {
+        requestHandled  = 1;
+        pBufferToHost   = (u8*)&controlTransferBuffer;
+        pBufferFromHost = (u8*)&controlTransferBuffer;
+        wCount          = usbIface.length;
+    }
+}
+
+/***********************************************************************
+ * Application descriptors
+ * Data are read from flash by UsbDataInStage() (usbIface.source)
+ **********************************************************************/
+
+void UsbIfaceGetDescriptor(void)
+{
+    u16 address = 0;
+
+    if (SetupPacket.bmRequestType != 0x80)
+        return;
+
+    if (SetupPacket.wValue1 == DEVICE_DESCRIPTOR)
+        address = usbIface.deviceDescriptor;
+
+    else if (SetupPacket.wValue1 == CONFIGURATION_DESCRIPTOR)
+        address = usbIface.configDescriptor;
+
+    else if (SetupPacket.wValue1 == STRING_DESCRIPTOR)
+    {
+        if (SetupPacket.wValue0 < usbIface.stringCount)
+            address = UsbIfaceRead(usbIface.stringTable + (SetupPacket.wValue0 << 1));
+    }
+
+    if (address == 0)
+        return;
+
+    // wTotalLength for a configuration descriptor, bLength otherwise
+    if (SetupPacket.wValue1 == CONFIGURATION_DESCRIPTOR)
+        wCount = UsbIfaceRead(address + 2);
+    else
+        wCount = (u8)UsbIfaceRead(address);
+
+    requestHandled = 1;
+    usbIface.source = address;
+}
+
+#endif /* BOOT_USE_IFACE */
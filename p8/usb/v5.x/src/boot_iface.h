@@ -0,0 +1,130 @@
+/***********************************************************************
+	Title:	USB Pinguino Bootloader
+	File:	boot_iface.h
+	Descr.: USB stack exported to the user application (BOOT_USE_IFACE)
+	Author:	Régis Blanchot <rblanchot@gmail.com>
+
+	This file is part of Pinguino (http://www.pinguino.cc)
+	Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+************************************************************************
+    This file is shared with the applications.
+
+    The bootloader exports its USB stack through a jump table placed at
+    BOOT_IFACE_ADDR, just below APPSTART :
+
+    BOOT_IFACE_ADDR + 0x00  DW      BOOT_IFACE_VERSION (BCD)
+    BOOT_IFACE_ADDR + 0x02  GOTO    UsbIfaceInit
+    BOOT_IFACE_ADDR + 0x06  GOTO    UsbUpdate
+    BOOT_IFACE_ADDR + 0x0A  GOTO    UsbProcessEvents
+
+    BOOT_USE_IFACE is SDCC only, and the application must be built with
+    SDCC too. The entries and the hooks are plain void f(void) calls
+    between two binaries : they share the software stack (FSR1/FSR2) and
+    SDCC saves the r0x temporaries it uses on this stack. XC8 keeps its
+    locals in a compiled stack at addresses chosen when each binary is
+    linked, so it can't be used on either side.
+    Parameters are exchanged through the UsbIfaceData structure at
+    BOOT_IFACE_RAM :
+
+    1/ fill usbIface.deviceDescriptor ... usbIface.endpointHook with
+       the flash addresses of the application descriptors and hooks,
+    2/ call BootIfaceInit(),
+    3/ call BootIfaceUpdate() and BootIfaceProcessEvents() in the main
+       loop (or in the USB interrupt routine).
+
+    Hooks are void f(void) and are called by the bootloader :
+    - setupHook     : class and vendor requests (but BOOT_ENTRY_REQUEST,
+                      cf. boot_entry.h), SetupPacket is at
+                      BOOT_IFACE_SETUP. An IN reply (64 bytes max.) must
+                      be written in BOOT_IFACE_CTRLBUF, then set
+                      usbIface.handled to 1 and usbIface.length to the
+                      reply size. OUT data are received in BOOT_IFACE_CTRLBUF
+                      and endpointHook is called with usbIface.ustat = 0.
+    - configureHook : SET_CONFIGURATION, the application sets up the
+                      UEPn registers and the buffer descriptors of its
+                      own endpoints (BDT at 0x400).
+    - endpointHook  : a transfer completed on EP1 to EP15, usbIface.ustat
+                      holds the USTAT value of this transaction.
+
+    Everything the bootloader reads or writes once the application owns
+    the USB is at a fixed address, from 0x400 to 0x5FF :
+
+    0x400   BDT
+    0x500   SetupPacket                 (BOOT_IFACE_SETUP)
+    0x540   controlTransferBuffer       (BOOT_IFACE_CTRLBUF)
+    0x580   usbIface                    (BOOT_IFACE_RAM)
+    0x5A0   USB stack state             (BOOT_IFACE_STATE, cf. usb.c)
+
+    BOOT_USE_TRACE and BOOT_USE_LOWPOWER are off in these builds, they
+    would use bootloader variables placed by the linker. So an
+    application doesn't depend on a particular bootloader build, only on
+    BOOT_IFACE_VERSION : it must leave 0x400 to 0x5FF alone and can place
+    its own endpoint buffers from 0x600 to 0x7FF.
+
+    UsbIfaceData __at BOOT_IFACE_RAM usbIface;
+    ...
+    if (BootIfaceVersion() == BOOT_IFACE_VERSION)
+    {
+        usbIface.deviceDescriptor = (u16)&myDeviceDescriptor;
+        ...
+        BootIfaceInit();
+    }
+***********************************************************************/
+
+#ifndef _BOOT_IFACE_H
+#define _BOOT_IFACE_H
+
+#include "types.h"
+
+// BCD, major.minor
+#define BOOT_IFACE_VERSION          0x0200
+
+// Jump table just below the user application
+#define BOOT_IFACE_ADDR             (APPSTART - 0x20)
+#define BOOT_IFACE_INIT             (BOOT_IFACE_ADDR + 0x02)
+#define BOOT_IFACE_UPDATE           (BOOT_IFACE_ADDR + 0x06)
+#define BOOT_IFACE_PROCESS          (BOOT_IFACE_ADDR + 0x0A)
+
+// Fixed RAM locations
+#define BOOT_IFACE_SETUP            0x500   // setupPacketStruct SetupPacket
+#define BOOT_IFACE_CTRLBUF          0x540   // u8 controlTransferBuffer[64]
+#define BOOT_IFACE_RAM              0x580   // UsbIfaceData usbIface
+#define BOOT_IFACE_STATE            0x5A0   // USB stack variables (cf. usb.c)
+
+// usbIface.flags
+#define BOOT_IFACE_ACTIVE           0x01    // the application owns the USB
+
+typedef struct
+{
+    u16 version;                    // BOOT_IFACE_VERSION, set by UsbIfaceInit
+    u8  flags;                      // BOOT_IFACE_ACTIVE
+    u8  ustat;                      // USTAT of the last transfer (endpointHook)
+    u8  handled;                    // set to 1 by setupHook if it did
+    u8  stringCount;                // number of entries in stringTable
+    u16 length;                     // IN reply size (setupHook)
+    u16 source;                     // flash address of the data being sent
+    u16 deviceDescriptor;           // flash address of the device descriptor
+    u16 configDescriptor;           // flash address of the configuration descriptor
+    u16 stringTable;                // flash address of an array of u16 string descriptor addresses
+    u16 setupHook;                  // flash address of void f(void)
+    u16 configureHook;              // flash address of void f(void)
+    u16 endpointHook;               // flash address of void f(void)
+} UsbIfaceData;
+
+// Application side
+#define BootIfaceVersion()          (*(__code u16 *)BOOT_IFACE_ADDR)
+#define BootIfaceInit()             ((void (*)(void))BOOT_IFACE_INIT)()
+#define BootIfaceUpdate()           ((void (*)(void))BOOT_IFACE_UPDATE)()
+#define BootIfaceProcessEvents()    ((void (*)(void))BOOT_IFACE_PROCESS)()
+
+// Bootloader side
+#if (BOOT_USE_IFACE)
+extern UsbIfaceData usbIface;
+void UsbIfaceInit(void);
+void UsbIfaceSetup(void);
+void UsbIfaceGetDescriptor(void);
+void UsbIfaceCall(u16);
+void UsbIfaceCopy(u8 *, u8);
+#endif
+
+#endif /* _BOOT_IFACE_H */
@@ -0,0 +1,124 @@
+/***********************************************************************
+	Title:	USB Pinguino Bootloader
+	File:	eeprom.c
+	Descr.: data EEPROM read/write commands (BOOT_USE_EEPROM)
+	Author:	Régis Blanchot <rblanchot@gmail.com>
+************************************************************************
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+************************************************************************
+    Cf. eeprom.h for the commands and the background writes.
+***********************************************************************/
+
+#include "compiler.h"
+#include "types.h"
+#include "flash.h"
+#include "usb.h"
+#include "eeprom.h"
+
+#if (BOOT_USE_EEPROM)
+
+extern allcmd bootCmd;
+
+u8 eeCount = 0;                     // bytes left to write
+static u8 eeAddr;                   // EEPROM address of the next one
+static u8 eeIndex;                  // and its index in eeBuffer
+static u8 eeBuffer[EP1_BUFFER_SIZE - 5];
+
+/***********************************************************************
+ * Reads the EEPROM byte at EEADR
+ **********************************************************************/
+
+static u8 EepromReadByte(void)
+{
+    EECON1bits.EEPGD = 0;           // Access data EEPROM
+    EECON1bits.CFGS = 0;
+    EECON1bits.RD = 1;
+    return EEDATA;
+}
+
+/***********************************************************************
+ * BOOT_READ_EEDATA, LEN bytes from ADDRL to DATA
+ **********************************************************************/
+
+void EepromRead(void)
+{
+    u8 n = bootCmd.len;
+    u8 *pdata = (u8*)bootCmd.xdat;
+
+    EEADR = bootCmd.addrl;
+    while (n--)
+    {
+        *pdata++ = EepromReadByte();
+        EEADR++;
+    }
+}
+
+/***********************************************************************
+ * Starts the write of the next byte which is not already right
+ * The write goes on by itself, EECON1bits.WR is cleared at the end.
+ **********************************************************************/
+
+static void EepromWriteNext(void)
+{
+    while (eeCount)
+    {
+        eeCount--;
+        EEADR = eeAddr++;
+        if (EepromReadByte() != eeBuffer[eeIndex])
+        {
+            EEDATA = eeBuffer[eeIndex++];
+            EECON1bits.WREN = 1;
+            Unlock();
+            return;
+        }
+        eeIndex++;
+    }
+    EECON1bits.WREN = 0;
+}
+
+/***********************************************************************
+ * BOOT_WRITE_EEDATA, LEN bytes of DATA from ADDRL
+ * Only the first write is started, the next ones by EepromTasks().
+ **********************************************************************/
+
+void EepromWrite(void)
+{
+    u8 n = bootCmd.len;
+    u8 *pdata = (u8*)bootCmd.xdat;
+    u8 *pbuf = eeBuffer;
+
+    if (n > sizeof(eeBuffer))
+        n = sizeof(eeBuffer);
+
+    eeAddr = bootCmd.addrl;
+    eeIndex = 0;
+    eeCount = n;
+    while (n--)
+        *pbuf++ = *pdata++;
+
+    EepromWriteNext();
+}
+
+/***********************************************************************
+ * Called on each pass of the main loop
+ **********************************************************************/
+
+void EepromTasks(void)
+{
+    if (eeCount && !EECON1bits.WR)
+        EepromWriteNext();
+}
+
+/***********************************************************************
+ * Waits for the end of the pending writes, before any command
+ **********************************************************************/
+
+void EepromFlush(void)
+{
+    while (EepromBusy())
+        EepromTasks();
+    EECON1bits.WREN = 0;
+}
+
+#endif /* BOOT_USE_EEPROM */
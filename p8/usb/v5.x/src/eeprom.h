@@ -0,0 +1,51 @@
+/***********************************************************************
+	Title:	USB Pinguino Bootloader
+	File:	eeprom.h
+	Descr.: data EEPROM read/write commands (BOOT_USE_EEPROM)
+	Author:	Régis Blanchot <rblanchot@gmail.com>
+
+	This file is part of Pinguino (http://www.pinguino.cc)
+	Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+************************************************************************
+    BOOT_READ_EEDATA and BOOT_WRITE_EEDATA move up to 59 bytes of data
+    EEPROM per packet, ADDRL is the first EEPROM address, LEN the
+    number of bytes (cf. main.c). The PIC18F with a data EEPROM have
+    256 bytes, the address wraps around.
+
+    A byte write takes up to 4 ms (TWE). BOOT_WRITE_EEDATA only copies
+    the bytes and starts the first write, the reply is sent at once
+    and the next bytes are written from the main loop while the host
+    sends the next packet. Any command then waits for the last writes
+    to be over first, the EEPROM and the flash share EECON1. The bytes
+    which already have the right value are not written again.
+
+    READ_VERSION tells the host whether the commands are there
+    (BOOT_FEATURE_EEPROM, cf. main.c).
+***********************************************************************/
+
+#ifndef _EEPROM_H
+#define _EEPROM_H
+
+#include "types.h"
+
+#if (BOOT_USE_EEPROM)
+
+#if defined(__16f1459) || \
+    defined(__18f26j50) || defined(__18f46j50) || \
+    defined(__18f26j53) || defined(__18f46j53) || \
+    defined(__18f27j53) || defined(__18f47j53)
+#error "No data EEPROM on this chip, BOOT_USE_EEPROM must be 0"
+#endif
+
+extern u8 eeCount;
+
+#define EepromBusy()                (eeCount || EECON1bits.WR)
+
+extern void EepromRead(void);
+extern void EepromWrite(void);
+extern void EepromTasks(void);
+extern void EepromFlush(void);
+
+#endif /* BOOT_USE_EEPROM */
+
+#endif /* _EEPROM_H */
@@ -160,6 +160,16 @@
 #define UsbOff()                    (!(VBUS_PORT & VBUS_MASK))
 #define UsbOn()                     (VBUS_PORT & VBUS_MASK)
 
+/***********************************************************************
+    Timer 1 tempo.
+    All supported PIC run at 48 MHz when USB is enabled
+    Timer 1 is clocked by FOSC/4 with a 1:8 prescaler (T1CON = 0x31)
+***********************************************************************/
+
+#define FOSC                        48000000UL
+#define TMR1_TICKS_PER_MS           (FOSC / 4 / 8 / 1000)           // 1500
+#define TMR1H_PER_MS                ((TMR1_TICKS_PER_MS + 255) / 256)
+
 /**********************************************************************/
 
 #endif //_HARDWARE_H
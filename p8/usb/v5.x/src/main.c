@@ -25,6 +25,11 @@
 #include "flash.h"
 #include "usb.h"
 #include "vectors.h"
+#include "boot_iface.h"
+#include "boot_entry.h"
+#include "trace.h"
+#include "uart.h"
+#include "eeprom.h"
 #if (BOOT_USE_DEBUG)                    // cf. Makefile
 #include "serial.h"
 #endif
@@ -44,6 +49,23 @@ extern BufferDescriptorTable ep_bdt[2*NB_ENDPOINTS];
 extern setupPacketStruct SetupPacket;
 extern allcmd bootCmd;
 
+#if (BOOT_USE_MAGIC)                    // cf. boot_entry.h
+#ifdef __XC8__
+volatile u16 bootMagic @ BOOT_MAGIC_ADDR;
+#else
+volatile u16 __at BOOT_MAGIC_ADDR bootMagic;
+#endif
+#endif
+
+#if (BOOT_USE_DUMP)
+u16 dumpCount = 0;                      // Number of packets left to stream
+u8  dumpAddrl, dumpAddrh, dumpAddru;    // Address of the next packet
+#endif
+
+#if (BOOT_USE_UART)
+void UartBootCmd(void);
+#endif
+
 /***********************************************************************
     BOOTLOADER COMMANDS
     General Data Packet Structure:
@@ -61,6 +83,24 @@ extern allcmd bootCmd;
     |                |   62
     |________________|   63
 
+    BOOT_DUMP_FLASH uses DATA[0] (low) and DATA[1] (high) as the number
+    of 64-byte packets to stream from ADDR. These packets are raw data,
+    without any command header.
+
+    BOOT_READ_VERSION returns MINOR, MAJOR at offsets 2 and 3, then the
+    user application address (APPSTART) at offsets 4 (low) and 5 (high)
+    and the optional commands built in (BOOT_FEATURE_xxx) at offset 6.
+
+    BOOT_READ_EEDATA and BOOT_WRITE_EEDATA move LEN bytes of data EEPROM
+    from address ADDRL (cf. eeprom.h).
+
+    BOOT_READ_TRACE returns LEN bytes of the trace buffer (cf. trace.h)
+    from offset ADDRL, as BOOT_READ_FLASH does. The trace is frozen
+    until the next command of another type.
+
+    BOOT_SET_BAUD is only valid on the UART (cf. uart.h), ADDRL and
+    ADDRH are the new SPBRG value.
+
 ***********************************************************************/
 
 enum
@@ -69,9 +109,23 @@ enum
     BOOT_READ_FLASH,
     BOOT_WRITE_FLASH,
     BOOT_ERASE_FLASH,
+    BOOT_READ_EEDATA,
+    BOOT_WRITE_EEDATA,
+    BOOT_DUMP_FLASH = 0x08,
+    BOOT_READ_TRACE = 0x09,
+    BOOT_SET_BAUD = 0x0A,
     BOOT_RESET_DEVICE = 0xFF
 };
 
+// BOOT_READ_VERSION offset 6
+#define BOOT_FEATURE_EEPROM     0x01
+
+#if (BOOT_USE_EEPROM)
+#define BOOT_FEATURES           BOOT_FEATURE_EEPROM
+#else
+#define BOOT_FEATURES           0
+#endif
+
 /***********************************************************************
  * Jump to user application
 
@@ -99,32 +153,109 @@ void UserApp(void)
 }
 #endif
 
+/***********************************************************************
+ * Wake-up sources back to their reset state (BOOT_USE_INTERRUPT)
+ * The user application must not inherit them from the bootloader.
+ **********************************************************************/
+
+#if (BOOT_USE_INTERRUPT) && !defined(__16f1459)
+void BootIntRestore(void)
+{
+    UIE = 0;
+    USB_INT_ENABLE = 0;
+    PIE1bits.TMR1IE = 0;
+    #if (BOOT_USE_UART)
+    UART_RCIE = 0;
+    #endif
+    OSCCONbits.IDLEN = 0;
+}
+#endif
+
+/***********************************************************************
+ * Start the user application after a reset
+ * If it's not a MCLR then it could be because a POR or a BOR.
+ * Their flags must be cleared by software to allow a new detection.
+ * Note : When POR  RCON = 0b10111100
+ *        When MCLR RCON = 0b00111111
+ *        bit 7 : IPEN
+ *        bit 1 : POR
+ *        bit 0 : BOR
+ **********************************************************************/
+
+void BootStartApp(void)
+{
+/**********************************************************************/
+    #if defined(__16F1459)
+/**********************************************************************/
+
+        PCONbits.nPOR = 1;
+        PCONbits.nBOR = 1;
+
+/**********************************************************************/
+    #else 
+/**********************************************************************/
+
+        RCONbits.NOT_POR = 1;
+        RCONbits.NOT_BOR = 1;
+        RCONbits.IPEN = 1;          // Enables priority levels on
+                                    // interrupts (cf. vectors.c/.h)
+                                    // MUST BE SET OR INTERRUPT WON'T WORK !
+                                    // NB: MCLR clears this bit
+        
+/**********************************************************************/
+    #endif
+/**********************************************************************/
+
+    #if (BOOT_USE_INTERRUPT) && !defined(__16f1459)
+    BootIntRestore();
+    #endif
+
+    UserApp();                  // Jump to user app. (reset vector)
+                                // Reset if no app.
+}
+
 /***********************************************************************
  * Prepare jump to user application
  * When disabling the USB module, make sure the SUSPND bit (UCON<1>)
  * is clear prior to clearing the USBEN bit. Clearing the USBEN bit
  * when the module is in the suspended state may prevent the module
  * from fully powering down.
+ * The host must see the detach before the application attaches again
+ * (NB : if too short CDC won't work). Once the pull-up is disabled, we
+ * wait for the host pull-down to bring D+ (D- at low speed) low, then
+ * hold this SE0 state for BOOT_EXIT_DELAY ms timed with Timer 1.
  **********************************************************************/
 
 void UsbBootExit(void)
 {
-    u16 counter = 0xFFFF;
+    u8 ms = BOOT_EXIT_DELAY;
+
+    #if (BOOT_USE_INTERRUPT) && !defined(__16f1459)
+    BootIntRestore();
+    #endif
 
-    T1CON = 0;                      // Disable timer 1
     UCONbits.SUSPND = 0;            // Unsuspend first
     UCONbits.USBEN  = 0;            // Then disable USB
 
-    while (counter--);              // Force timeout on USB
-                                    // NB : if too short CDC won't work
+    TMR1H = 0;
+    TMR1L = 0;
+    PIR1bits.TMR1IF = 0;
+    T1CON = 0x31;                   // Fosc/4, prescaler 8, timer 1 On 
+
+    // Wait for SE0 (or for a 43.7 ms overflow if the line stays high)
+    while (UsbOn() && !PIR1bits.TMR1IF);
 
+    // Hold the detached state
+    while (ms--)
+    {
+        TMR1H = 0;
+        TMR1L = 0;
+        while (TMR1H < TMR1H_PER_MS);
+    }
+
+    T1CON = 0;                      // Disable timer 1
     UserLedOff();                   // Led Off
 
-    #if 0//(BOOT_USE_DEBUG)
-    SerialPrintLN("Bootloader disabled");
-    SerialPrintLN("Starting user app.");
-    #endif
-    
     UserApp();                      // Jump to user app. (reset vector)
 }
 
@@ -142,6 +273,28 @@ void main(void)
 
     #endif
 
+    u8 entry;
+
+    // Entry requested by the user application (cf. boot_entry.h)
+    // Checked and cleared first, so that the next reset starts the
+    // application again.
+    // -----------------------------------------------------------------
+
+    entry = BootEntryRequested();
+    BootEntryClear();
+
+    // Fast handoff
+    // Only a MCLR or BootEnter() can start the bootloader. After a POR
+    // or a BOR, the user application is started right now, before any
+    // oscillator, I/O, LED or USB setup. The application must then
+    // configure its own clock.
+    // -----------------------------------------------------------------
+
+    #if (BOOT_USE_FASTBOOT)
+    if (!entry && ResetButtonNotPressed())
+        BootStartApp();
+    #endif
+
     // Init. oscillator and I/O
     // -----------------------------------------------------------------
 
@@ -333,31 +486,25 @@ void main(void)
 
     //VBUS_TRIS |= VBUS_MASK;         // VBUS Pin as Input
 
-    #if 0//(BOOT_USE_DEBUG)
-    SerialPrint("VBUS = ");
-    SerialPrintNumber(VBUS_PORT & VBUS_MASK, 2);
-    SerialPrint("\r\n");
-    #endif
-
     // The bootloader starts if :
-    // - Reset and User buttons have been pressed
+    // - the user application asked for it (BootEnter)
+    // - or Reset and User buttons have been pressed
     // - there is no user application
     // - USB is On
     // -----------------------------------------------------------------
 
     //if (UsbOff() || ResetButtonNotPressed() || UserButtonNotPressed())
     //if (UsbOn() && ResetButtonPressed() && UserButtonPressed())
-    if (ResetButtonPressed() && UserButtonPressed())
+    #if (BOOT_USE_GPSIM)
+    if (1)                          // no button in the simulator
+    #else
+    if (entry || (ResetButtonPressed() && UserButtonPressed()))
+    #endif
     {
 
         // USB bootloader's code start here
         // -----------------------------------------------------------------
         
-        #if 0//(BOOT_USE_DEBUG)
-        //SerialPrint("Reset detected\r\n");
-        SerialPrint("Starting boot.\r\n");
-        #endif
-
         /* bit 4   UPUEN    = 1  : USB On-Chip Pull-up Enable bit
          * bit 3   UTRDIS   = 0  : On-Chip Transceiver Disable bit
          * bit 2   FSEN     = 1  : Full-Speed Enable bit
@@ -385,9 +532,14 @@ void main(void)
         #endif
 
         EP_IN_BD(1).ADDR = (u16)&bootCmd;
+        TraceInit();
         currentConfiguration = 0;
         deviceState = DETACHED;
 
+        #if (BOOT_USE_IFACE)
+        usbIface.flags = 0;             // The bootloader owns the USB
+        #endif
+
         // Init. timer1 to overroll after 65536*8/12000 = 43.7 ms
         // -----------------------------------------------------------------
 
@@ -405,75 +557,175 @@ void main(void)
         T1CON = 0x31; //0b00110001;     // clock source is Fosc/4 (0b00)
                                         // prescaler 8 (0b11), timer 1 On 
 
+        // Idle between USB events
+        // GIE stays cleared : the interrupt vectors belong to the user
+        // application, an enabled interrupt source only wakes the core
+        // up and the execution goes on after the SLEEP instruction.
+        // -----------------------------------------------------------------
+
+        #if (BOOT_USE_INTERRUPT) && !defined(__16f1459)
+
+        OSCCONbits.IDLEN = 1;           // SLEEP enters Idle mode, peripherals
+                                        // (USB and Timer 1) keep running
+        UIE = USB_INT_EVENTS;           // USB events (reset, transfer, stall)
+        USB_INT_ENABLE = 1;             // wake the core up
+        PIE1bits.TMR1IE = 1;            // so does Timer 1 (led blinking)
+        #if (BOOT_USE_UART)
+        UART_RCIE = 1;                  // and the EUSART
+        #endif
+
+        #endif
+
+        #if (BOOT_USE_UART)
+        UartInit();                     // Wait for UART_SYNC too (cf. uart.h)
+        #endif
+
         // Wait for request from host
         // -----------------------------------------------------------------
 
         while (1)
         {
+            #if (BOOT_USE_INTERRUPT) && !defined(__16f1459)
+            USB_INT_FLAG = 0;           // Events set it again from now
+            #endif
+
             UsbUpdate();                // Check the USB bus
             UsbProcessEvents();         // Service USB interrupts
 
+            #if (BOOT_USE_UART)
+            UartBootCmd();              // Service the UART
+            #endif
+
+            #if (BOOT_USE_EEPROM)
+            EepromTasks();              // Next EEPROM byte
+            #endif
+
             if (PIR1bits.TMR1IF)        // If timer 1 has overflowed
             {
                 PIR1bits.TMR1IF = 0;    // Allow interrupt source again
                 UserLedToggle();        // Toggle the led
             }
+
+            #if (BOOT_USE_INTERRUPT) && !defined(__16f1459)
+            // Until the device is powered, UsbUpdate() has to poll the bus.
+            // If an event occured since USB_INT_FLAG was cleared, SLEEP
+            // acts as a NOP and the loop runs again immediately.
+            // The end of an EEPROM write doesn't wake the core up.
+            #if (BOOT_USE_EEPROM)
+            if (deviceState >= POWERED && !eeCount)
+            #else
+            if (deviceState >= POWERED)
+            #endif
+                __asm__("SLEEP");
+            #endif
         }
     }
 
-    // If it's not a MCLR then it could be because a POR or a BOR.
-    // Their flags must be cleared by software to allow a new detection.
-    // Note : When POR  RCON = 0b10111100
-    //        When MCLR RCON = 0b00111111
-    //        bit 7 : IPEN
-    //        bit 1 : POR
-    //        bit 0 : BOR
+    BootStartApp();             // Jump to user app.
+    /*
+    #if (BOOT_USE_DEBUG)
+    SerialPrintLN("No app.");
+    #endif
+    
+    #if (BOOT_USE_LOWPOWER)
+    userApp = FALSE;            // Otherwise, go on with the bootloader
+    #endif
+    */
+}
+
+#if (BOOT_USE_DUMP)
+/** --------------------------------------------------------------------
+    Read the next 64-byte packet of a BOOT_DUMP_FLASH command in bootCmd
+    -----------------------------------------------------------------**/
 
+void BootDump(void)
+{
 /**********************************************************************/
     #if defined(__16F1459)
 /**********************************************************************/
 
-        PCONbits.nPOR = 1;
-        PCONbits.nBOR = 1;
+    u8  counter = EP1_BUFFER_SIZE >> 1;
+    u16 *pdata  = (u16*)bootCmd.buffer;
+
+    PMADRH = dumpAddrh;
+    PMADRL = dumpAddrl;
+    PMCON1bits.CFGS = 0;            // Access program memory
+
+    while (counter--)
+    {
+        PMCON1bits.RD = 1;
+        asm("NOP");
+        asm("NOP");
+        *pdata++ = PMDAT;
+        PMADR++;
+    }
+
+    dumpAddrh = PMADRH;
+    dumpAddrl = PMADRL;
 
 /**********************************************************************/
-    #else 
+    #else
 /**********************************************************************/
 
-        RCONbits.NOT_POR = 1;
-        RCONbits.NOT_BOR = 1;
-        RCONbits.IPEN = 1;          // Enables priority levels on
-                                    // interrupts (cf. vectors.c/.h)
-                                    // MUST BE SET OR INTERRUPT WON'T WORK !
-                                    // NB: MCLR clears this bit
-        
+    u8  counter = EP1_BUFFER_SIZE;
+    u8  *pdata  = (u8*)bootCmd.buffer;
+
+    // TBLPTR may have been used to read the descriptors meanwhile
+    TBLPTRU = dumpAddru;
+    TBLPTRH = dumpAddrh;
+    TBLPTRL = dumpAddrl;
+
+    while (counter--)
+    {
+        // TBLPTR is incremented after the read
+        __asm__("TBLRD*+");
+        *pdata++ = TABLAT;
+    }
+
+    dumpAddru = TBLPTRU;
+    dumpAddrh = TBLPTRH;
+    dumpAddrl = TBLPTRL;
+
 /**********************************************************************/
     #endif
 /**********************************************************************/
 
-    #if 0//(BOOT_USE_DEBUG)
-    SerialPrint("Starting app.\r\n");
-    #endif
+    dumpCount--;
+}
 
-    UserApp();                  // Jump to user app. (reset vector)
-                                // Reset if no app.
-    /*
-    #if (BOOT_USE_DEBUG)
-    SerialPrintLN("No app.");
-    #endif
-    
-    #if (BOOT_USE_LOWPOWER)
-    userApp = FALSE;            // Otherwise, go on with the bootloader
-    #endif
-    */
+/** --------------------------------------------------------------------
+    Stream the next 64-byte packet of a BOOT_DUMP_FLASH command on EP1 IN
+    Called once by UsbBootCmd() then each time EP1 IN has been sent.
+    EP1 OUT is not re-armed before the last packet because IN and OUT
+    share the same buffer (bootCmd).
+    -----------------------------------------------------------------**/
+
+void UsbBootDump(void)
+{
+    BootDump();
+
+    EP_IN_BD(1).CNT = EP1_BUFFER_SIZE;
+    BdArmToggle(EP_IN_BD(1));       // data packet toggle
+
+    if (dumpCount == 0)             // last packet, ready for a new command
+    {
+        EP_OUT_BD(1).CNT = EP1_BUFFER_SIZE;
+        EP_OUT_BD(1).STAT.val = BDS_UOWN;
+    }
 }
+#endif
 
 /** --------------------------------------------------------------------
     bootloader commands management
+    Runs the command in bootCmd, received on EP1 OUT or on the UART, and
+    returns the number of bytes of the reply left in bootCmd. No BD is
+    touched here, cf. UsbBootCmd() and UartBootCmd().
     -----------------------------------------------------------------**/
     
-void UsbBootCmd(void)
+u8 BootCmd(void)
 {
+    u8  count = 0;                  // number of byte(s) to return
+
 /**********************************************************************/
     #if defined(__16F1459)
 /**********************************************************************/
@@ -496,9 +748,16 @@ void UsbBootCmd(void)
     
     UserLedOn();                    // Whatever the command, keep Led On
     //T1CON = 0;                    // and disable timer 1
- 
-    EP_IN_BD(1).CNT = 0;            // Clears the number of byte(s) to return
 
+    #if (BOOT_USE_EEPROM)
+    EepromFlush();                  // EECON1 is needed from now
+    #endif
+
+    #if (BOOT_USE_TRACE)
+    trace.on = (bootCmd.cmd != BOOT_READ_TRACE);
+    #endif
+    Trace(TRACE_CMD, bootCmd.cmd);
+ 
     // Address of the block to deal with
     // -----------------------------------------------------------------
 
@@ -552,12 +811,6 @@ void UsbBootCmd(void)
     #endif
 /**********************************************************************/
 
-    #if 0 //(BOOT_USE_DEBUG)
-    SerialPrint("CMD=");
-    SerialPrintNumber(bootCmd.cmd, 10);
-    SerialPrint("\r\n");
-    #endif
-
 ///---------------------------------------------------------------------
     if (bootCmd.cmd ==  BOOT_RESET_DEVICE)
 ///---------------------------------------------------------------------
@@ -568,22 +821,17 @@ void UsbBootCmd(void)
     else if (bootCmd.cmd == BOOT_READ_VERSION)
 ///---------------------------------------------------------------------
     {
-        #if 0 //(BOOT_USE_DEBUG)
-        SerialPrint("READ_VERSION\r\n");
-        #endif
-
         bootCmd.buffer[2] = MINOR_VERSION;
         bootCmd.buffer[3] = MAJOR_VERSION;
-        EP_IN_BD(1).CNT = 4;        // 4 byte(s) to return
+        bootCmd.buffer[4] = (u8)(APPSTART);     // user app. address
+        bootCmd.buffer[5] = (u8)(APPSTART >> 8);// since v5.1
+        bootCmd.buffer[6] = BOOT_FEATURES;
+        count = 7;                  // 7 byte(s) to return
     }
 ///---------------------------------------------------------------------
     else if (bootCmd.cmd == BOOT_READ_FLASH)
 ///---------------------------------------------------------------------
     {
-        #if 0 //(BOOT_USE_DEBUG)
-        SerialPrint("READ_FLASH\r\n");
-        #endif
-
 /**********************************************************************/
         #if defined(__16F1459)
 /**********************************************************************/
@@ -601,19 +849,18 @@ void UsbBootCmd(void)
         }
 
 /**********************************************************************/
-        #elif defined(__18f13k50) || defined(__18f14k50) || \
-              defined(__18f2455)  || defined(__18f4455)  || \
-              defined(__18f2550)  || defined(__18f4550)  || \
-              defined(__18lf2550) || defined(__18lf4550) || \
-              defined(__18f25k50) || defined(__18f45k50)
+        #else
 /**********************************************************************/
             
         // Access Configuration registers regardless of EEPGD
+        // (CFGS is unimplemented on J PIC)
+        #if !defined(__18f26j50) && !defined(__18f46j50) && \
+            !defined(__18f26j53) && !defined(__18f46j53) && \
+            !defined(__18f27j53) && !defined(__18f47j53)
         //EECON1bits.CFGS = (bootCmd.addru & 0x20) ? 1:0;
         EECON1bits.CFGS = 1;
+        #endif
 
-        //#endif
-        
         // Table reads from program memory are performed one byte at a time.
         //for (counter=0; counter < bootCmd.len; counter++)
         while (counter--)
@@ -624,34 +871,69 @@ void UsbBootCmd(void)
         }
 
 /**********************************************************************/
-        #elif defined(__18f26j50) || defined(__18f46j50) || \
-              defined(__18f26j53) || defined(__18f46j53) || \
-              defined(__18f27j53) || defined(__18f47j53)
+        #endif
 /**********************************************************************/
 
-        // Table reads from program memory are performed one byte at a time.
-        //for (counter=0; counter < bootCmd.len; counter++)
-        while (counter--)
-        {
-            // TBLPTR is incremented after the read
-            __asm__("TBLRD*+");
-            *pdata++ = TABLAT;
-        }
+        count = 5 + bootCmd.len;// Number of byte(s) to return
+    }
+#if (BOOT_USE_DUMP)
+///---------------------------------------------------------------------
+    else if (bootCmd.cmd == BOOT_DUMP_FLASH)
+///---------------------------------------------------------------------
+    {
+        dumpCount = bootCmd.xdat[0] | (bootCmd.xdat[1] << 8);
+        dumpAddrl = bootCmd.addrl;
+        dumpAddrh = bootCmd.addrh;
+        dumpAddru = bootCmd.addru;
 
-/**********************************************************************/
-        #endif
-/**********************************************************************/
+        if (dumpCount)              // 1st packet sent below
+            count = EP1_BUFFER_SIZE;
+    }
+#endif
+#if (BOOT_USE_EEPROM)
+///---------------------------------------------------------------------
+    else if (bootCmd.cmd == BOOT_READ_EEDATA)
+///---------------------------------------------------------------------
+    {
+        EepromRead();
+        count = 5 + bootCmd.len;// Number of byte(s) to return
+    }
+///---------------------------------------------------------------------
+    else if (bootCmd.cmd == BOOT_WRITE_EEDATA)
+///---------------------------------------------------------------------
+    {
+        EepromWrite();              // the next bytes are written while
+        count = 1;                  // the host sends the next packet
+    }
+#endif
+#if (BOOT_USE_TRACE)
+///---------------------------------------------------------------------
+    else if (bootCmd.cmd == BOOT_READ_TRACE)
+///---------------------------------------------------------------------
+    {
+        u8 *ptrace;
+        u8 *pxdat  = (u8*)bootCmd.xdat;
+
+        // Stay inside trace and inside the packet
+        if (bootCmd.addrl > sizeof(trace))
+            bootCmd.addrl = sizeof(trace);
+        if (bootCmd.len > sizeof(trace) - bootCmd.addrl)
+            bootCmd.len = sizeof(trace) - bootCmd.addrl;
+        if (bootCmd.len > sizeof(bootCmd.xdat))
+            bootCmd.len = sizeof(bootCmd.xdat);
+
+        ptrace  = (u8*)&trace + bootCmd.addrl;
+        counter = bootCmd.len;
+        while (counter--)
+            *pxdat++ = *ptrace++;
 
-        EP_IN_BD(1).CNT = 5 + bootCmd.len;// Number of byte(s) to return
+        count = 5 + bootCmd.len;// Number of byte(s) to return
     }
+#endif
 ///---------------------------------------------------------------------
     else if (bootCmd.cmd == BOOT_ERASE_FLASH)
 ///---------------------------------------------------------------------
     {
-        #if 0 //(BOOT_USE_DEBUG)
-        SerialPrint("ERASE_FLASH\r\n");
-        #endif
-
         #if defined(__16F1459)
         counter = bootCmd.len;
         #endif
@@ -665,16 +947,12 @@ void UsbBootCmd(void)
             __asm__("NOP");         // proc. can forget to execute the first operation on some PIC
             NextBlock();            // += FLASHBLOCKSIZE;
         }
-        EP_IN_BD(1).CNT = 1;        // number of byte(s) to return
+        count = 1;                  // number of byte(s) to return
     }
 ///---------------------------------------------------------------------
     else if (bootCmd.cmd == BOOT_WRITE_FLASH)
 ///---------------------------------------------------------------------
     {
-        #if 0 //(BOOT_USE_DEBUG)
-        SerialPrint("WRITE_FLASH\r\n");
-        #endif
-
 /**********************************************************************/
         #if defined(__16F1459)
 /**********************************************************************/
@@ -759,21 +1037,94 @@ void UsbBootCmd(void)
         #endif
 /**********************************************************************/
 
-        EP_IN_BD(1).CNT = 1;        // number of byte(s) to return
+        count = 1;                  // number of byte(s) to return
     }
 
 ///---------------------------------------------------------------------
 
-    if (EP_IN_BD(1).CNT > 0)        // is there something to return ?
+    Trace(TRACE_DONE, count);
+
+    return count;
+}
+
+/** --------------------------------------------------------------------
+    bootloader commands received on EP1 OUT
+    The reply is sent on EP1 IN, then EP1 OUT is armed again.
+    -----------------------------------------------------------------**/
+
+void UsbBootCmd(void)
+{
+    EP_IN_BD(1).CNT = BootCmd();
+
+    #if (BOOT_USE_DUMP)
+    if (bootCmd.cmd == BOOT_DUMP_FLASH && dumpCount)
     {
-        if (EP_IN_BD(1).STAT.DTS)   // data packet toggle
-            EP_IN_BD(1).STAT.val = BDS_UOWN | BDS_DTSEN;
-        else
-            EP_IN_BD(1).STAT.val = BDS_UOWN | BDS_DTSEN | BDS_DTS;
+        UsbBootDump();              // arms EP1 IN, the next packets are
+        return;                     // sent from UsbTransferEvent()
     }
+    #endif
+
+    if (EP_IN_BD(1).CNT > 0)        // is there something to return ?
+        BdArmToggle(EP_IN_BD(1));   // data packet toggle
 
     // reset size
     EP_OUT_BD(1).CNT = EP1_BUFFER_SIZE;
 
     EP_OUT_BD(1).STAT.val = BDS_UOWN;// free the BD and its corresponding buffer
 }
+
+#if (BOOT_USE_UART)
+/** --------------------------------------------------------------------
+    bootloader commands received on the UART (cf. uart.h)
+    Frames are ignored while the USB is configured : bootCmd is then the
+    EP1 OUT buffer and belongs to the SIE. The host gets no reply.
+    -----------------------------------------------------------------**/
+
+void UartBootCmd(void)
+{
+    u8 status;
+
+    if (deviceState == CONFIGURED)
+        return;
+
+    status = UartReceive();
+
+    if (status == UART_NONE)
+        return;
+
+    if (status == UART_ERROR)
+    {
+        UartSend(0);                // NAK
+        return;
+    }
+
+    if (bootCmd.cmd == BOOT_SET_BAUD)
+    {
+        UartSend(1);                // acknowledged at the current rate
+        UartSetBaud(bootCmd.addrl | (bootCmd.addrh << 8));
+        return;
+    }
+
+    if (bootCmd.cmd == BOOT_RESET_DEVICE)
+    {
+        UartSend(1);                // BootCmd() won't return
+        UartDisable();
+    }
+
+    status = BootCmd();
+
+    #if (BOOT_USE_DUMP)
+    if (bootCmd.cmd == BOOT_DUMP_FLASH && dumpCount)
+    {
+        while (dumpCount)
+        {
+            BootDump();
+            UartSend(EP1_BUFFER_SIZE);
+        }
+        return;
+    }
+    #endif
+
+    UartSend(status);               // once the flash is written
+}
+#endif
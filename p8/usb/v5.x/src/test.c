@@ -1,31 +1,414 @@
 /**********************************************************************
     Title:  Pinguino USB Bootloader
     File:   test.c
-    Descr.: 8-bit PIC USB bootloader
+    Descr.: 8-bit PIC self-benchmark (BOOT_USE_TEST)
     Author: Rgis Blanchot <rblanchot@gmail.com>
 ***********************************************************************
     This file is part of Pinguino (http://www.pinguino.cc)
     Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+***********************************************************************
+    Built with BOOT_USE_TEST=1, this program replaces the bootloader
+    and measures, on the chip and with the crystal it runs on :
+
+    - the erase time of a FLASHBLOCKSIZE block,
+    - the write time of a row (BENCH_ROWSIZE) and, on the J PIC18F, of
+      a single word (WPROG),
+    - the time to read BENCH_READ_PACKETS 64-byte packets from flash,
+      with the loop of UsbBootDump() (TBLRD*+ on PIC18F, RD on PIC16F),
+    - the USB command turnaround, i.e. the time between 2 successive
+      BENCH_PING commands of the host, in Timer 1 ticks (min., max.)
+      and in SOF frames (total).
+
+    The first block at APPSTART is used as scratch area : the user
+    application must be uploaded again once the bootloader is back.
+    Times are in Timer 1 ticks (FOSC/4/8, TMR1_TICKS_PER_MS per ms),
+    the CPU stalls during an erase or a write but Timer 1 goes on.
+
+    Results (benchResults, little endian)
+    +0      version     BENCH_VERSION
+    +1      crystal     CRYSTAL in MHz, 0 = INTOSC
+    +2      devid       DEVID2:DEVID1 (PIC18F), DEVID (PIC16F)
+    +4      blocksize   FLASHBLOCKSIZE (erase block)
+    +6      rowsize     BENCH_ROWSIZE (write block)
+    +8      ticks       TMR1_TICKS_PER_MS
+    +10     erase       block erase
+    +12     row         row write
+    +14     word        word write, 0 if not supported
+    +16     readsize    bytes read
+    +18     read        time to read them
+    +20     cmdcount    number of BENCH_PING since BENCH_CLEAR
+    +22     cmdmin      shortest time between 2 BENCH_PING
+    +24     cmdmax      longest one, 0xFFFF if >= 43 ms
+    +26     cmdframes   SOF frames over the cmdcount-1 intervals
+    (byte sizes are in words on PIC16F)
+
+    USB : same VID/PID and EP1 as the bootloader, BENCH_READ returns
+    the results at offset 5 (as BOOT_READ_FLASH does), BENCH_PING and
+    BENCH_CLEAR return 1 byte. cf. tools/selftest8.py
+    UART (BOOT_USE_DEBUG=1) : the results are printed once the flash
+    has been measured, as one line of hex fields in the order above :
+    "BENCH 01 14 1200 0040 0020 05DC 0BB8 0BB8 0000 0400 01A4 0000 ..."
 ***********************************************************************/
 
 #include "compiler.h"
 #include "types.h"
 #include "config.h"
 #include "hardware.h"
+#include "flash.h"
+#include "usb.h"
 #include "vectors.h"
 #if (BOOT_USE_DEBUG)                    // cf. Makefile
 #include "serial.h"
 #endif
 
 #if defined(__XC8__) 
-u8 __section("usbram") dummy; // to prevent a compilation error
 #if defined(__18f46j50) || defined(__18f47j53)
 u8 _mediumconst=0;
 u8 _smallconst=0;
 #endif
 #endif
 
-u8 i=0;
+extern u8 deviceState;
+extern u8 currentConfiguration;
+extern BufferDescriptorTable ep_bdt[2*NB_ENDPOINTS];
+extern allcmd bootCmd;
+
+/***********************************************************************
+ * BENCHMARK
+ **********************************************************************/
+
+#define BENCH_VERSION           1
+#define BENCH_ADDR              APPSTART    // scratch block
+#define BENCH_READ_PACKETS      16          // 1 KB
+#define BENCH_MAX_FRAMES        43          // Timer 1 overflows after 43.7 ms
+
+// Commands, apart from the bootloader ones
+#define BENCH_READ              0x10
+#define BENCH_PING              0x11
+#define BENCH_CLEAR             0x12
+
+// Write block
+#if defined(__16f1459)
+    #define BENCH_ROWSIZE       32          // 32 words, write latches
+#elif defined(__18f13k50) || defined(__18f14k50)
+    #define BENCH_ROWSIZE       16
+#elif defined(__18f2455)  || defined(__18f4455)  || \
+      defined(__18f2550)  || defined(__18f4550)  || \
+      defined(__18lf2550) || defined(__18lf4550)
+    #define BENCH_ROWSIZE       32
+#else                                       // x5k50 and J PIC18F
+    #define BENCH_ROWSIZE       64
+#endif
+
+#if defined(__18f26j50) || defined(__18f46j50) || \
+    defined(__18f26j53) || defined(__18f46j53) || \
+    defined(__18f27j53) || defined(__18f47j53)
+    #define BENCH_WORD          1           // WPROG, 2-byte write
+#else
+    #define BENCH_WORD          0
+#endif
+
+// Timer 1 is stopped to be read in one go (RD16 differs from a PIC to another)
+#define BenchStart()            {                                   \
+                                    T1CONbits.TMR1ON = 0;           \
+                                    TMR1H = 0;                      \
+                                    TMR1L = 0;                      \
+                                    PIR1bits.TMR1IF = 0;            \
+                                    T1CONbits.TMR1ON = 1;           \
+                                }
+
+#define BenchStop(x)            {                                   \
+                                    T1CONbits.TMR1ON = 0;           \
+                                    x = PIR1bits.TMR1IF ? 0xFFFF :  \
+                                        ((u16)TMR1H << 8) | TMR1L;  \
+                                    T1CONbits.TMR1ON = 1;           \
+                                }
+
+typedef struct
+{
+    u8  version;
+    u8  crystal;
+    u16 devid;
+    u16 blocksize;
+    u16 rowsize;
+    u16 ticks;
+    u16 erase;
+    u16 row;
+    u16 word;
+    u16 readsize;
+    u16 read;
+    u16 cmdcount;
+    u16 cmdmin;
+    u16 cmdmax;
+    u16 cmdframes;
+} benchResults;
+
+benchResults bench;
+u16 benchTmr1;                          // Timer 1 at the last BENCH_PING
+u16 benchFrame;                         // and USB frame number
+
+/***********************************************************************
+ * Flash erase, write and read times
+ **********************************************************************/
+
+void BenchFlash(void)
+{
+/**********************************************************************/
+    #if defined(__16f1459)
+/**********************************************************************/
+
+    u8  counter, packets;
+    u16 *pdata;
+
+    // Device ID
+    PMCON1bits.CFGS = 1;            // Access Configuration registers
+    PMADR = 0x0006;
+    PMCON1bits.RD = 1;
+    asm("NOP");
+    asm("NOP");
+    bench.devid = PMDAT;
+
+    // Block erase
+    PMCON1bits.CFGS = 0;            // Access program memory
+    PMADR = BENCH_ADDR;
+    PMCON1bits.WREN = 1;
+    EraseOn();
+    BenchStart();
+    Unlock();
+    BenchStop(bench.erase);
+    EraseOff();
+
+    // Row write, the latches are loaded first
+    PMCON1bits.LWLO = 1;
+    counter = BENCH_ROWSIZE;
+    while (counter-- > 1)
+    {
+        PMDAT = counter;
+        Unlock();
+        PMADR++;
+    }
+    PMDAT = 0;
+    PMCON1bits.LWLO = 0;            // Write Latches to Flash
+    BenchStart();
+    Unlock();
+    BenchStop(bench.row);
+    PMCON1bits.WREN = 0;
+
+    // Flash read, as UsbBootDump() does
+    PMADR = 0;
+    packets = BENCH_READ_PACKETS;
+    BenchStart();
+    while (packets--)
+    {
+        counter = EP1_BUFFER_SIZE >> 1;
+        pdata   = (u16*)bootCmd.buffer;
+        while (counter--)
+        {
+            PMCON1bits.RD = 1;
+            asm("NOP");
+            asm("NOP");
+            *pdata++ = PMDAT;
+            PMADR++;
+        }
+    }
+    BenchStop(bench.read);
+    bench.readsize = BENCH_READ_PACKETS * (EP1_BUFFER_SIZE >> 1);
+
+/**********************************************************************/
+    #else
+/**********************************************************************/
+
+    u8  counter, packets;
+    u8  *pdata;
+
+    // Device ID, DEVID1 then DEVID2
+    #if !BENCH_WORD
+    EECON1bits.CFGS = 1;            // Access Configuration registers
+    #endif
+    TBLPTRU = 0x3F;
+    TBLPTRH = 0xFF;
+    TBLPTRL = 0xFE;
+    __asm__("TBLRD*+");
+    bench.devid = TABLAT;
+    __asm__("TBLRD*");
+    bench.devid |= (u16)TABLAT << 8;
+
+    // Block erase
+    EECON1 = 0x84;                  // EEPGD = 1, WREN = 1
+    TBLPTRU = 0;
+    TBLPTRH = BENCH_ADDR >> 8;
+    TBLPTRL = BENCH_ADDR & 0xFF;
+    EraseOn();
+    BenchStart();
+    Unlock();
+    BenchStop(bench.erase);
+    EraseOff();
+    __asm__("NOP");                 // proc. can forget to execute the first operation on some PIC
+
+    // Row write, the holding registers are loaded first
+    counter = BENCH_ROWSIZE;
+    while (counter--)
+    {
+        TABLAT = counter;
+        __asm__("TBLWT*+");
+    }
+    __asm__("TBLRD*-");             // start block write one step back
+    BenchStart();
+    Unlock();
+    BenchStop(bench.row);
+    __asm__("NOP");
+
+    #if BENCH_WORD
+    // Word write, right after the row (still erased)
+    TBLPTRH = (BENCH_ADDR + BENCH_ROWSIZE) >> 8;
+    TBLPTRL = (BENCH_ADDR + BENCH_ROWSIZE) & 0xFF;
+    EECON1bits.WPROG = 1;
+    TABLAT = 0x55;
+    __asm__("TBLWT*+");
+    TABLAT = 0xAA;
+    __asm__("TBLWT*");              // TBLPTR must point to the MSB
+    BenchStart();
+    Unlock();
+    BenchStop(bench.word);
+    EECON1bits.WPROG = 0;
+    #endif
+
+    EECON1bits.WREN = 0;
+
+    // Flash read, as UsbBootDump() does
+    TBLPTRH = 0;
+    TBLPTRL = 0;
+    packets = BENCH_READ_PACKETS;
+    BenchStart();
+    while (packets--)
+    {
+        counter = EP1_BUFFER_SIZE;
+        pdata   = (u8*)bootCmd.buffer;
+        while (counter--)
+        {
+            __asm__("TBLRD*+");
+            *pdata++ = TABLAT;
+        }
+    }
+    BenchStop(bench.read);
+    bench.readsize = BENCH_READ_PACKETS * EP1_BUFFER_SIZE;
+
+/**********************************************************************/
+    #endif
+/**********************************************************************/
+
+    bench.version   = BENCH_VERSION;
+    #if (CRYSTAL == INTOSC)
+    bench.crystal   = 0;
+    #else
+    bench.crystal   = CRYSTAL;
+    #endif
+    bench.blocksize = FLASHBLOCKSIZE;
+    bench.rowsize   = BENCH_ROWSIZE;
+    bench.ticks     = TMR1_TICKS_PER_MS;
+}
+
+/***********************************************************************
+ * Results on the UART, "BENCH" then one hex field per member
+ **********************************************************************/
+
+#if (BOOT_USE_DEBUG)
+void BenchPrintHex(u16 value, u8 digits)
+{
+    u8 d;
+
+    SerialPrintChar(' ');
+    while (digits--)
+    {
+        d = (value >> (digits << 2)) & 0x0F;
+        SerialPrintChar(d < 10 ? d + '0' : d + 'A' - 10);
+    }
+}
+
+void BenchPrint(void)
+{
+    u8  counter = (sizeof(benchResults) - 2) >> 1;
+    u16 *pfield = &bench.devid;
+
+    SerialPrint("BENCH");
+    BenchPrintHex(bench.version, 2);
+    BenchPrintHex(bench.crystal, 2);
+    while (counter--)
+        BenchPrintHex(*pfield++, 4);
+    SerialPrint("\r\n");
+}
+#endif
+
+void BenchClear(void)
+{
+    bench.cmdcount  = 0;
+    bench.cmdmin    = 0xFFFF;
+    bench.cmdmax    = 0;
+    bench.cmdframes = 0;
+}
+
+/***********************************************************************
+ * Commands from the host (EP1 OUT), called by UsbTransferEvent()
+ **********************************************************************/
+
+void UsbBootCmd(void)
+{
+    u8  hi, counter;
+    u8  *pdata;
+    u16 tmr1, frame, ticks, frames;
+
+    // Timer 1 keeps running, TMR1H must not change while TMR1L is read
+    do {
+        hi   = TMR1H;
+        tmr1 = TMR1L;
+    } while (hi != TMR1H);
+    tmr1 |= (u16)hi << 8;
+    frame = ((u16)(UFRMH & 0x07) << 8) | UFRML;
+
+    UserLedOn();
+    EP_IN_BD(1).CNT = 1;            // 1 byte to return by default
+
+    if (bootCmd.cmd == BENCH_PING)
+    {
+        if (bench.cmdcount++)       // interval since the previous one
+        {
+            frames = (frame - benchFrame) & 0x07FF;
+            ticks  = tmr1 - benchTmr1;
+            if (frames >= BENCH_MAX_FRAMES)
+                ticks = 0xFFFF;
+            if (ticks < bench.cmdmin)
+                bench.cmdmin = ticks;
+            if (ticks > bench.cmdmax)
+                bench.cmdmax = ticks;
+            bench.cmdframes += frames;
+        }
+        benchTmr1  = tmr1;
+        benchFrame = frame;
+    }
+
+    else if (bootCmd.cmd == BENCH_CLEAR)
+    {
+        BenchClear();
+    }
+
+    else if (bootCmd.cmd == BENCH_READ)
+    {
+        u8 *pbench = (u8*)&bench;
+
+        pdata   = (u8*)bootCmd.xdat;
+        counter = sizeof(benchResults);
+        while (counter--)
+            *pdata++ = *pbench++;
+
+        bootCmd.len = sizeof(benchResults);
+        EP_IN_BD(1).CNT = 5 + sizeof(benchResults);
+    }
+
+    BdArmToggle(EP_IN_BD(1));       // data packet toggle
+
+    EP_OUT_BD(1).CNT = EP1_BUFFER_SIZE;
+    EP_OUT_BD(1).STAT.val = BDS_UOWN;// free the BD and its corresponding buffer
+}
 
 /***********************************************************************
  * MAIN
@@ -212,6 +595,13 @@ void main(void)
     SerialPrint("*** TEST ***\r\n");
     #endif
 
+    // Init. LED and Switch
+    // -----------------------------------------------------------------
+
+    UserLedInit();                  // USERLED Pin Output
+    UserLedOn();                    // USERLED On
+    UserButtonInit();               // USERBUTTON Pin Input
+
     // Init. timer1 to overroll after 65536*8/12000 = 43.7 ms
     // -----------------------------------------------------------------
 
@@ -228,36 +618,55 @@ void main(void)
     TMR1H = 0;                      // counter get an unknown value at reset
     T1CON = 0x31; //0b00110001;     // clock source is Fosc/4 (0b00)
                                     // prescaler 8 (0b11), timer 1 On 
-    // Init. LED and Switch
+                                    // BenchStart() only stops/starts it
+
+    // Flash times
     // -----------------------------------------------------------------
 
-    UserLedInit();                  // USERLED Pin Output
-    UserLedOn();                    // USERLED On
-    UserButtonInit();               // USERBUTTON Pin Input
+    BenchFlash();
+    BenchClear();
+
+    #if (BOOT_USE_DEBUG)
+    BenchPrint();
+    #endif
 
-    // TEST STARTS HERE
+    // USB, as the bootloader does
     // -----------------------------------------------------------------
 
-    SerialPrint("RCON=0b");
-    SerialPrintNumber(RCON, 2);
-    SerialPrint("\r\n");
+    #if (SPEED == LOW_SPEED)
 
-    if (ResetButtonPressed() && UserButtonPressed())
-    //if (ResetButtonPressed())
+        #ifdef __XC8__
+        UCFG = _UCFG_UPUEN_MASK;
+        #else
+        UCFG = _UPUEN;
+        #endif
+
+    #else
+
+        #ifdef __XC8__
+        UCFG = _UCFG_UPUEN_MASK | _UCFG_FSEN_MASK;
+        #else
+        UCFG = _UPUEN | _FSEN;
+        #endif
+
+    #endif
+
+    EP_IN_BD(1).ADDR = (u16)&bootCmd;
+    currentConfiguration = 0;
+    deviceState = DETACHED;
+
+    // Wait for BENCH_xxx commands
+    // -----------------------------------------------------------------
+
+    while (1)
     {
-        while (1)
+        UsbUpdate();                // Check the USB bus
+        UsbProcessEvents();         // Service USB interrupts
+
+        if (PIR1bits.TMR1IF)        // If timer 1 has overflowed
         {
-            if (PIR1bits.TMR1IF)        // If timer 1 has overflowed
-            {
-                PIR1bits.TMR1IF = 0;    // Allow interrupt source again
-                UserLedToggle();        // Toggle the led
-            }
+            PIR1bits.TMR1IF = 0;    // Allow interrupt source again
+            UserLedToggle();        // Toggle the led
         }
     }
-    else // It was a POR or a BOR
-    {
-        RCONbits.IPEN = 1;
-        RCONbits.NOT_POR = 1;
-        RCONbits.NOT_BOR = 1;
-    }
 }
@@ -0,0 +1,39 @@
+/***********************************************************************
+	Title:	USB Pinguino Bootloader
+	File:	trace.c
+	Descr.: binary event trace in RAM (BOOT_USE_TRACE)
+	Author:	Régis Blanchot <rblanchot@gmail.com>
+************************************************************************
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+************************************************************************
+    Cf. trace.h for the event format.
+***********************************************************************/
+
+#include "compiler.h"
+#include "types.h"
+#include "trace.h"
+
+#if (BOOT_USE_TRACE)
+
+traceBuffer trace;
+
+/***********************************************************************
+ * Empty and start the trace, code 0 marks the unused slots
+ **********************************************************************/
+
+void TraceInit(void)
+{
+    u8 i = 0;
+
+    do {
+        trace.data[i] = 0;
+    } while (++i & TRACE_MASK);
+
+    trace.head = 0;
+    trace.size = TRACE_SIZE;
+    trace.version = MINOR_VERSION;
+    trace.on = 1;
+}
+
+#endif /* BOOT_USE_TRACE */
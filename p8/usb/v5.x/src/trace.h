@@ -0,0 +1,92 @@
+/***********************************************************************
+	Title:	USB Pinguino Bootloader
+	File:	trace.h
+	Descr.: binary event trace in RAM (BOOT_USE_TRACE)
+	Author:	Régis Blanchot <rblanchot@gmail.com>
+
+	This file is part of Pinguino (http://www.pinguino.cc)
+	Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+************************************************************************
+    SerialPrint() blocks for ~1 ms per character at 9600 bauds, far too
+    long for the USB stack. Trace() only stores 4 bytes in a RAM ring
+    buffer :
+
+    +0  code    TRACE_xxx below (0 = empty slot)
+    +1  arg     depends on the code
+    +2  TMR1L   Timer 1, 1 tick = 8 * 4 / FOSC = 0.667 us,
+    +3  TMR1H   overflows every 43.7 ms
+
+    The buffer is read with the BOOT_READ_TRACE command, cf. main.c and
+    tools/trace8.py. The first BOOT_READ_TRACE freezes it, so that the
+    readout doesn't overwrite the events, any other command resumes it.
+***********************************************************************/
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "types.h"
+
+#if (BOOT_USE_TRACE)
+
+// Event codes
+#define TRACE_RESET                 0x01    // USB reset, arg = 0
+#define TRACE_SETUP                 0x02    // SETUP packet, arg = bRequest
+#define TRACE_REQSTALL              0x03    // request not handled, arg = bRequest
+#define TRACE_TRNIF                 0x04    // transaction, arg = USTAT
+#define TRACE_BD                    0x05    // its buffer descriptor, arg = STAT
+#define TRACE_CMD                   0x06    // bootloader command, arg = cmd
+#define TRACE_DONE                  0x07    // command done, arg = IN byte count
+#define TRACE_STALLIF               0x08    // STALLIF, arg = UEP0
+
+// Number of events, a power of 2
+#if defined(__16f1459)
+#define TRACE_SIZE                  16
+#else
+#define TRACE_SIZE                  32
+#endif
+
+#define TRACE_EVENT_SIZE            4
+#define TRACE_MASK                  (TRACE_SIZE * TRACE_EVENT_SIZE - 1)
+
+// Read as is by tools/trace8.py, keep the header 4-byte long
+typedef struct
+{
+    u8 head;                        // offset of the next event in data
+    u8 on;                          // 0 = frozen by BOOT_READ_TRACE
+    u8 size;                        // TRACE_SIZE
+    u8 version;                     // MINOR_VERSION
+    u8 data[TRACE_SIZE * TRACE_EVENT_SIZE];
+} traceBuffer;
+
+extern traceBuffer trace;
+
+extern void TraceInit(void);
+
+// Inline, no call
+// RD16 = 0, TMR1H is read again in case TMR1L rolled over (cf. test.c)
+#define Trace(c, a)                                                     \
+    do {                                                                \
+        if (trace.on)                                                   \
+        {                                                               \
+            u8 pos = trace.head;                                        \
+            u8 hi, lo;                                                  \
+            do {                                                        \
+                hi = TMR1H;                                             \
+                lo = TMR1L;                                             \
+            } while (hi != TMR1H);                                      \
+            trace.data[pos++] = (c);                                    \
+            trace.data[pos++] = (a);                                    \
+            trace.data[pos++] = lo;                                     \
+            trace.data[pos++] = hi;                                     \
+            trace.head = pos & TRACE_MASK;                              \
+        }                                                               \
+    } while (0)
+
+#else
+
+#define TraceInit()
+#define Trace(c, a)
+
+#endif /* BOOT_USE_TRACE */
+
+#endif /* _TRACE_H */
@@ -0,0 +1,177 @@
+/***********************************************************************
+	Title:	USB Pinguino Bootloader
+	File:	uart.c
+	Descr.: bootloader commands on the EUSART (BOOT_USE_UART)
+	Author:	Régis Blanchot <rblanchot@gmail.com>
+************************************************************************
+    This file is part of Pinguino (http://www.pinguino.cc)
+    Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+************************************************************************
+    Cf. uart.h for the synchronisation and the frame format.
+***********************************************************************/
+
+#include "compiler.h"
+#include "types.h"
+#include "usb.h"
+#include "uart.h"
+
+#if (BOOT_USE_UART)
+
+extern allcmd bootCmd;
+
+static u8 uartAutobaud;             // the next byte is the auto-baud one
+
+#define UartPut(c)                                                      \
+    do {                                                                \
+        while (!UART_TXIF);                                             \
+        UART_TXREG = (c);                                               \
+    } while (0)
+
+// Waits for a byte, gives up after UART_TIMEOUT Timer 1 overflows.
+// RCIF is usually set already, the timer is only tested while waiting.
+#define UartWait()                                                      \
+    while (!UART_RCIF)                                                  \
+    {                                                                   \
+        if (PIR1bits.TMR1IF)                                            \
+        {                                                               \
+            PIR1bits.TMR1IF = 0;                                        \
+            if (--ticks == 0)                                           \
+                return UartError();                                     \
+        }                                                               \
+    }
+
+/***********************************************************************
+ * 8-bit asynchronous mode, 16-bit BRG, auto-baud detection armed
+ * 16F1459 : RB5 = RX, RB7 = TX, PIC18F : RC7 = RX, RC6 = TX
+ **********************************************************************/
+
+void UartInit(void)
+{
+    UART_RCSTA = 0;                 // 8-bit RX (RX9=0)
+    UART_TXSTA = 0;                 // 8-bit TX (TX9=0), asynchronous (SYNC=0)
+    UART_BAUDCON = 0;               // polarity : non-inverted
+
+    UART_TXSTAbits.BRGH = 1;        // High Baud Rate
+    UART_BAUDCONbits.BRG16 = 1;     // Use 16-bit baud rate generator
+
+    UART_TXSTAbits.TXEN = 1;        // Transmit enabled
+    UART_RCSTAbits.CREN = 1;        // Receive enabled
+    UART_RCSTAbits.SPEN = 1;        // Serial Port enabled (RX/TX pins)
+
+    UART_BAUDCONbits.ABDEN = 1;     // measure the next UART_SYNC byte
+    uartAutobaud = 1;
+}
+
+/***********************************************************************
+ * Clears an overrun and drops the frame
+ **********************************************************************/
+
+static u8 UartError(void)
+{
+    if (UART_RCSTAbits.OERR)
+    {
+        UART_RCSTAbits.CREN = 0;
+        UART_RCSTAbits.CREN = 1;
+    }
+    return UART_ERROR;
+}
+
+/***********************************************************************
+ * Called on each pass of the main loop
+ * Answers the sync bytes, receives a whole frame in bootCmd once its
+ * first byte is there.
+ **********************************************************************/
+
+u8 UartReceive(void)
+{
+    u8 n, c, sum;
+    u8 ticks = UART_TIMEOUT;
+    u8 *p = bootCmd.buffer;
+
+    if (UART_BAUDCONbits.ABDOVF)    // rollover, not a UART_SYNC byte
+    {
+        UART_BAUDCONbits.ABDOVF = 0;
+        UART_BAUDCONbits.ABDEN = 1;
+        return UART_NONE;
+    }
+
+    if (!UART_RCIF)
+        return UART_NONE;
+
+    if (UART_RCSTAbits.OERR)        // a frame we were too slow for
+    {
+        UartError();
+        return UART_NONE;
+    }
+
+    n = UART_RCREG;                 // also clears RCIF after the detection
+
+    if (uartAutobaud || n == UART_SYNC)
+    {
+        uartAutobaud = 0;
+        UartPut(UART_ACK);
+        return UART_NONE;
+    }
+
+    if (n == 0 || n > EP1_BUFFER_SIZE)
+        return UART_NONE;           // noise, the host syncs again
+
+    sum = n;
+    do {
+        UartWait();
+        c = UART_RCREG;
+        *p++ = c;
+        sum += c;
+    } while (--n);
+
+    UartWait();                     // checksum
+    sum += UART_RCREG;
+
+    if (sum || UART_RCSTAbits.OERR)
+        return UartError();
+
+    return UART_FRAME;
+}
+
+/***********************************************************************
+ * Sends the first n bytes of bootCmd as a frame, n = 0 is a NAK
+ **********************************************************************/
+
+void UartSend(u8 n)
+{
+    u8 *p = bootCmd.buffer;
+    u8 sum = n;
+
+    UartPut(n);
+    while (n--)
+    {
+        sum += *p;
+        UartPut(*p++);
+    }
+    UartPut(-sum);
+}
+
+/***********************************************************************
+ * New baud rate (BOOT_SET_BAUD), once the last byte is out
+ **********************************************************************/
+
+void UartSetBaud(u16 spbrg)
+{
+    while (!UART_TXSTAbits.TRMT);
+    UART_SPBRGH = spbrg >> 8;
+    UART_SPBRGL = spbrg;
+}
+
+/***********************************************************************
+ * Gives the EUSART back in its reset state to the user application
+ **********************************************************************/
+
+void UartDisable(void)
+{
+    while (!UART_TXSTAbits.TRMT);
+    UART_RCSTA = 0;
+    UART_TXSTA = 0;
+    UART_BAUDCON = 0;
+}
+
+#endif /* BOOT_USE_UART */
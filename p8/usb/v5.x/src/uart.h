@@ -0,0 +1,119 @@
+/***********************************************************************
+	Title:	USB Pinguino Bootloader
+	File:	uart.h
+	Descr.: bootloader commands on the EUSART (BOOT_USE_UART)
+	Author:	Régis Blanchot <rblanchot@gmail.com>
+
+	This file is part of Pinguino (http://www.pinguino.cc)
+	Released under the LGPL license (http://www.gnu.org/licenses/lgpl.html)
+************************************************************************
+    The UART transport carries the same commands as EP1 (cf. main.c)
+    for the boards without USB connector. It is polled in the main
+    loop, next to the USB, one host at a time : frames are ignored
+    while the USB is configured, bootCmd is then the EP1 OUT buffer.
+
+    Synchronisation
+    The EUSART starts with the auto-baud detection armed (ABDEN). The
+    host sends UART_SYNC (0x55) until it gets UART_ACK back : the first
+    one sets the baud rate, the next ones are only acknowledged. The
+    detection counts 8 bit times at FOSC/32, i.e. +/- 1 on SPBRG, which
+    is fine up to 115200 bauds (SPBRG = 103). Faster rates are then set
+    with BOOT_SET_BAUD, ADDRL/ADDRH holding the exact SPBRG value :
+
+        SPBRG = 48 MHz / (4 * baudrate) - 1     (BRG16 = BRGH = 1)
+
+    e.g. 1 Mbaud = 11, 1.5 Mbaud = 7, 2 Mbaud = 5, 3 Mbaud = 3. The
+    acknowledgement is sent at the current rate, the new one applies
+    from the next byte on, and the host syncs again to check it.
+
+    Frames
+    +0      n       1 to 64, number of bytes of the packet
+    +1      packet  the 64-byte EP1 packet, only its first n bytes
+    +n+1    chk     n + packet + chk = 0 (mod 256)
+
+    The reply is a frame with the bytes BootCmd() returns (n = 1 for
+    BOOT_WRITE_FLASH and BOOT_ERASE_FLASH, n = 64 for each packet of
+    BOOT_DUMP_FLASH). An empty frame (n = 0) is a NAK : timeout, overrun
+    or checksum error, the command was not executed.
+
+    Stop-and-wait, not streaming
+    The reply is only sent once the command is done, and the host must
+    wait for it before sending the next frame. Streaming the frames
+    would need a receive buffer : the core stalls for a few ms per flash
+    row write (no instruction, no RCREG read) while the EUSART only
+    holds 2 bytes, i.e. 20 bit times, and bootCmd is the only 64-byte
+    buffer. Only the BOOT_DUMP_FLASH replies are sent back to back.
+
+    RX must idle high (pull-up) if nothing is connected, otherwise the
+    noise may trigger the auto-baud detection.
+***********************************************************************/
+
+#ifndef _UART_H
+#define _UART_H
+
+#include "types.h"
+
+#if (BOOT_USE_UART)
+
+#if (BOOT_USE_DEBUG)
+#error "BOOT_USE_UART and BOOT_USE_DEBUG share the EUSART"
+#endif
+
+#define UART_SYNC                   0x55    // auto-baud / sync byte
+#define UART_ACK                    0x06    // sync acknowledgement
+#define UART_TIMEOUT                3       // Timer 1 overflows (87 to 131 ms) per frame
+
+// UartReceive() status
+#define UART_NONE                   0       // nothing to do
+#define UART_FRAME                  1       // a packet is in bootCmd
+#define UART_ERROR                  2       // bad frame, send a NAK
+
+#if defined(__18f26j50) || defined(__18f46j50) || \
+    defined(__18f26j53) || defined(__18f46j53) || \
+    defined(__18f27j53) || defined(__18f47j53)
+
+    #define UART_RCSTA              RCSTA1
+    #define UART_RCSTAbits          RCSTA1bits
+    #define UART_TXSTA              TXSTA1
+    #define UART_TXSTAbits          TXSTA1bits
+    #define UART_BAUDCON            BAUDCON1
+    #define UART_BAUDCONbits        BAUDCON1bits
+    #define UART_SPBRGH             SPBRGH1
+    #define UART_SPBRGL             SPBRG1
+    #define UART_RCREG              RCREG1
+    #define UART_TXREG              TXREG1
+    #define UART_RCIF               PIR1bits.RC1IF
+    #define UART_RCIE               PIE1bits.RC1IE
+    #define UART_TXIF               PIR1bits.TX1IF
+
+#else
+
+    #define UART_RCSTA              RCSTA
+    #define UART_RCSTAbits          RCSTAbits
+    #define UART_TXSTA              TXSTA
+    #define UART_TXSTAbits          TXSTAbits
+    #define UART_BAUDCON            BAUDCON
+    #define UART_BAUDCONbits        BAUDCONbits
+    #define UART_SPBRGH             SPBRGH
+    #if defined(__16f1459)
+    #define UART_SPBRGL             SPBRGL
+    #else
+    #define UART_SPBRGL             SPBRG
+    #endif
+    #define UART_RCREG              RCREG
+    #define UART_TXREG              TXREG
+    #define UART_RCIF               PIR1bits.RCIF
+    #define UART_RCIE               PIE1bits.RCIE
+    #define UART_TXIF               PIR1bits.TXIF
+
+#endif
+
+extern void UartInit(void);
+extern u8   UartReceive(void);
+extern void UartSend(u8);
+extern void UartSetBaud(u16);
+extern void UartDisable(void);
+
+#endif /* BOOT_USE_UART */
+
+#endif /* _UART_H */
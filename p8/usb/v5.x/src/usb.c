@@ -21,13 +21,17 @@
 //#include "boot.h"
 #include "hardware.h"
 #include "usb.h"
-#if 0//(BOOT_USE_DEBUG)
-#include "serial.h"
-#endif
+#include "boot_iface.h"
+#include "trace.h"
 
 extern void UsbBootCmd(void);
 extern void UsbBootExit(void);
 
+#if (BOOT_USE_DUMP)
+extern u16 dumpCount;
+extern void UsbBootDump(void);
+#endif
+
 #if (BOOT_USE_LOWPOWER)
 extern u8 userApp;
 #endif
@@ -63,9 +67,15 @@ const USB_Device_Descriptor device_descriptor =
     VENDORID,                                   // Vendor ID, microchip=0x04D8, generic=0x05f9, test=0x067b
     PRODUCTID,                                  // Product ID 0x00A für CDC, generic=0xffff, test=0x2303
     (BCD(MAJOR_VERSION)<<8)|BCD(MINOR_VERSION), // Device release number in BCD format-->0
+    #if (STRING)
     1,                                          // Manufacturer string index (0=no string descriptor)
     2,                                          // Product string index (0=no string descriptor)
     3,                                          // Device serial number string index
+    #else
+    0,                                          // Manufacturer string index (0=no string descriptor)
+    0,                                          // Product string index (0=no string descriptor)
+    0,                                          // Device serial number string index
+    #endif
     1                                           // Number of possible configurations
 };
 
@@ -137,6 +147,8 @@ const USB_Configuration_Descriptor configuration_descriptor =
     }
 };
 
+#if (STRING)
+
 // Language code string descriptor (english)
 //const USB_String_Descriptor lang  =
 #if defined(__XC8__) 
@@ -191,6 +203,17 @@ const struct {u8  bLength; u8  bDescriptorType; u16 string[8];} seri =
     SERIAL
 };
 
+// Array of string descriptors
+const void * const string_descriptor[] =
+{
+    &lang,
+    &manu,
+    &prod,
+    &seri
+};
+
+#endif // STRING
+
 /*    
 // Language code string descriptor (english)
 const USB_String_Descriptor iLang = 
@@ -235,6 +258,18 @@ const u8 * const string_descriptor[] =
 */
 
 // Global variables
+#if (BOOT_USE_IFACE)
+// Fixed addresses, shared with the application (cf. boot_iface.h)
+// NB : not initialized, cf. main() and UsbIfaceInit()
+u8  __at (BOOT_IFACE_STATE + 0x00) deviceState;
+u8  __at (BOOT_IFACE_STATE + 0x01) deviceAddress;
+u8  __at (BOOT_IFACE_STATE + 0x02) currentConfiguration;
+u8  __at (BOOT_IFACE_STATE + 0x03) ctrlTransferStage;
+u8  __at (BOOT_IFACE_STATE + 0x04) requestHandled;
+u16 __at (BOOT_IFACE_STATE + 0x06) wCount;
+u8 * __at (BOOT_IFACE_STATE + 0x08) pBufferToHost;     // generic, 3 bytes
+u8 * __at (BOOT_IFACE_STATE + 0x0B) pBufferFromHost;   // generic, 3 bytes
+#else
 u8 deviceState = DETACHED;
 u8 deviceAddress;// = 0;
 u8 currentConfiguration;// = 0;
@@ -243,6 +278,7 @@ u8 requestHandled;                  // Set to 1 if request was understood and pr
 u8 *pBufferToHost;                  // Data to send to the host
 u8 *pBufferFromHost;                // Data from the host
 u16 wCount;                         // Number of bytes of data
+#endif
 
 /***********************************************************************
  * Buffer Descriptors Table (see datasheet p171) must be placed at
@@ -267,6 +303,10 @@ u16 wCount;                         // Number of bytes of data
     #if defined(__16f1459)
         setupPacketStruct __at 0x2010 SetupPacket;
         u8 __at 0x2050 controlTransferBuffer[EP0_BUFFER_SIZE];
+    #elif (BOOT_USE_IFACE)
+        // Fixed addresses, shared with the application (cf. boot_iface.h)
+        setupPacketStruct __at BOOT_IFACE_SETUP SetupPacket;
+        u8 __at BOOT_IFACE_CTRLBUF controlTransferBuffer[EP0_BUFFER_SIZE];
     #else
         #pragma udata usbram SetupPacket controlTransferBuffer
         setupPacketStruct SetupPacket;
@@ -280,34 +320,18 @@ allcmd bootCmd;
  * Returns string descriptors and size
  **********************************************************************/
 
+#if (STRING)
 u16 UsbGetString(u8 string_number, const void **ptr)
 {
-    if (string_number == 0)
-    {
-        *ptr = &lang;
-        return sizeof(lang);
-    }
-
-    else if (string_number == 1)
+    if (string_number < sizeof(string_descriptor) / sizeof(string_descriptor[0]))
     {
-        *ptr = &manu;
-        return sizeof(manu);
-    }
-
-    else if (string_number == 2)
-    {
-        *ptr = &prod;
-        return sizeof(prod);
-    }
-
-    else if (string_number == 3)
-    {
-        *ptr = &seri;
-        return sizeof(seri);
+        *ptr = string_descriptor[string_number];
+        return *(const u8 *)*ptr;       // bLength
     }
 
     return -1;
 }
+#endif
 
 /***********************************************************************
  * Configures the buffer descriptor for endpoint 0
@@ -316,10 +340,6 @@ u16 UsbGetString(u8 string_number, const void **ptr)
   
 void UsbPrepareSetupStage(void)
 {
-    #if 0//(BOOT_USE_DEBUG)
-    SerialPrint("Setup\r\n");
-    #endif
-
     ctrlTransferStage = SETUP_STAGE;
 
     // SIE owns this buffer
@@ -338,19 +358,14 @@ void UsbPrepareSetupStage(void)
 void UsbDataInStage(void)
 {
     // bufferSize <= EP0_BUFFER_SIZE <= 64
-    //#if (BOOT_USE_LARGE_EP)
-    u16 bufferSize;
-    //#else
-    //u8 bufferSize;
-    //#endif
+    // so BC8 and BC9 are always 0 and a 8-bit counter is enough
+    u8 bufferSize;
+    u8 *pSrc;
+    u8 *pDst;
     
-    #if 0//(BOOT_USE_DEBUG)
-    SerialPrint("Data IN\r\n");
-    #endif
-
     // Determine how many bytes are going to the host
     if (wCount < EP0_BUFFER_SIZE)
-        bufferSize = wCount;
+        bufferSize = (u8)wCount;
     else
         bufferSize = EP0_BUFFER_SIZE;
         
@@ -359,22 +374,29 @@ void UsbDataInStage(void)
 
     // Clear BC8 and BC9
     EP_IN_BD(0).STAT.val &= ~(BDS_BC8 | BDS_BC9);
-
-    //#if (BOOT_USE_LARGE_EP)
-    // Load the high two bits of the byte count into BC8:BC9
-    EP_IN_BD(0).STAT.val |= (u8)((bufferSize & 0x0300) >> 8);
-    EP_IN_BD(0).CNT = (u8)(bufferSize & 0xFF);
-    //#else
-    //EP_IN_BD(0).CNT = bufferSize;
-    //#endif
-    
+    EP_IN_BD(0).CNT = bufferSize;
     EP_IN_BD(0).ADDR = (u16)&controlTransferBuffer;
 
     // Move data to the USB output buffer
-    pBufferFromHost = (u8*)&controlTransferBuffer;
+    // The SIE can only read from the USB RAM, the descriptors stored
+    // in flash have to be copied. Local pointers avoid a bank switch
+    // on each byte.
+    pSrc = pBufferToHost;
+    pDst = (u8*)&controlTransferBuffer;
+
+    #if (BOOT_USE_IFACE)
+    // Application descriptors are read with the table pointer
+    if (usbIface.source)
+    {
+        UsbIfaceCopy(pDst, bufferSize);
+        return;
+    }
+    #endif
 
     while (bufferSize--)
-        *pBufferFromHost++ = *pBufferToHost++;
+        *pDst++ = *pSrc++;
+
+    pBufferToHost = pSrc;
 }
 
 /***********************************************************************
@@ -385,10 +407,6 @@ void UsbDataOutStage(void)
 {
     u16 bufferSize;
 
-    #if 0//(BOOT_USE_DEBUG)
-    SerialPrint("Data OUT\r\n");
-    #endif
-
     //#if (BOOT_USE_LARGE_EP)
     bufferSize = ((0x03 & EP_OUT_BD(0).STAT.val) << 8) | EP_OUT_BD(0).CNT;
     //#else
@@ -403,26 +421,18 @@ void UsbDataOutStage(void)
     while (bufferSize--)
         *pBufferFromHost++ = *pBufferToHost++;
     
-    // Turn control over to the SIE and toggle the data bit
-    if(EP_OUT_BD(0).STAT.DTS)
-        EP_OUT_BD(0).STAT.val = BDS_UOWN | BDS_DTSEN;
-    else
-        EP_OUT_BD(0).STAT.val = BDS_UOWN | BDS_DTSEN | BDS_DTS;
-}
-
-/***********************************************************************
- * Display the USB error
- **********************************************************************/
+    #if (BOOT_USE_IFACE)
+    // OUT data of a class or vendor request are in controlTransferBuffer
+    if (usbIface.flags & BOOT_IFACE_ACTIVE)
+    {
+        usbIface.ustat = 0;
+        UsbIfaceCall(usbIface.endpointHook);
+    }
+    #endif
 
-#if 0//(BOOT_USE_DEBUG)
-void UsbErrorEvent(void)
-{
-    SerialPrint("ERROR : UEIR=0b");
-    SerialPrintNumber(UEIR, 2);
-    SerialPrint("\r\n");
-    UEIR = 0x00;                    // reset error flags
+    // Turn control over to the SIE and toggle the data bit
+    BdArmToggle(EP_OUT_BD(0));
 }
-#endif
 
 /***********************************************************************
  * Reset the USB bus
@@ -433,12 +443,14 @@ void UsbErrorEvent(void)
  
 void UsbResetEvent(void)
 {
-    #if 0//(BOOT_USE_DEBUG)
-    SerialPrint("Reseted\r\n");
-    #endif
+    Trace(TRACE_RESET, 0);
 
     // UIE : — SOFIE STALLIE IDLEIE TRNIE ACTVIE UERRIE URSTIE
+    #if (BOOT_USE_INTERRUPT)
+    UIE   = USB_INT_EVENTS;         // USB INTERRUPT ENABLE REGISTER (0x7B)
+    #else
     UIE   = 0;                      // USB INTERRUPT ENABLE REGISTER (0x7B)
+    #endif
     // UIR : — SOFIF STALLIF IDLEIF TRNIF ACTVIF UERRIF URSTIF
     UIR   = 0;                      // USB INTERRUPT STATUS REGISTER
     // UEIE : BTSEE — — BTOEE DFN8EE CRC16EE CRC5EE PIDEE
@@ -477,17 +489,9 @@ void UsbResetEvent(void)
 #if (BOOT_USE_LOWPOWER)
 void UsbSuspendEvent(void)
 {
-    #if 0//(BOOT_USE_DEBUG)
-    SerialPrint("Suspended\r\n");
-    #endif
-
     UCONbits.SUSPND = 1;            // Switch to suspended mode
     LedOff();                       // Led Off
 
-    #if 0//(BOOT_USE_DEBUG)
-    SerialDisable();
-    #endif
-
     // Enable USB interrupt
     #if defined(__18f25k50) || defined(__18f45k50)
     PIR3bits.USBIF = 0;
@@ -506,10 +510,6 @@ void UsbSuspendEvent(void)
     PIE2bits.USBIE = 0;
     #endif
 
-    #if 0//(BOOT_USE_DEBUG)
-    SerialInit(9600);
-    SerialPrint("Woken up\r\n");
-    #endif
 }
 #endif
 
@@ -519,10 +519,9 @@ void UsbProcessStandardRequest(void)
     // Class or Vendor requests have to be handled seperately.
     if (SetupPacket.bmRequestType & 0x60)
     {
-        #if 0//(BOOT_USE_DEBUG)
-        SerialPrint("NOSTDREQ:");
-        //SerialPrintNumber((SetupPacket.bmRequestType & 0x60)>>5, 10);
-        SerialPrint("\r\n");
+        #if (BOOT_USE_IFACE)
+        if (usbIface.flags & BOOT_IFACE_ACTIVE)
+            UsbIfaceSetup();
         #endif
         return;
     }
@@ -533,9 +532,6 @@ void UsbProcessStandardRequest(void)
     // transaction uses address 0.
     if (SetupPacket.bRequest == SET_ADDRESS)
     {
-        #if 0//(BOOT_USE_DEBUG)
-        SerialPrint("SET_ADDR\r\n");
-        #endif
         requestHandled = 1;
         deviceState = ADDRESS;
         deviceAddress = SetupPacket.wValue0;
@@ -548,10 +544,6 @@ void UsbProcessStandardRequest(void)
 
     else if (SetupPacket.bRequest == SET_CONFIGURATION)
     {
-        #if 0//(BOOT_USE_DEBUG)
-        SerialPrint("SET_CONF\r\n");
-        #endif
-
         requestHandled = 1;
 
         // If configuration value is zero, put device in address state
@@ -574,6 +566,15 @@ void UsbProcessStandardRequest(void)
                 //UsbCDCInitEndpoint();
             #endif      
             
+            #if (BOOT_USE_IFACE)
+            if (usbIface.flags & BOOT_IFACE_ACTIVE)
+            {
+                UsbIfaceCall(usbIface.configureHook);
+                deviceState = CONFIGURED;
+                return;
+            }
+            #endif
+
             #if (BOOT_USE_BULK)
                 //UsbBulkInitEndpoint();
                 //UEP1 = 0b00011110;
@@ -596,9 +597,6 @@ void UsbProcessStandardRequest(void)
 
     else if (SetupPacket.bRequest == GET_CONFIGURATION)
     {
-        #if 0//(BOOT_USE_DEBUG)
-        SerialPrint("GET_CONF\r\n");
-        #endif
         requestHandled = 1;
         pBufferToHost = (u8*)&currentConfiguration;
         wCount = 1;
@@ -606,9 +604,6 @@ void UsbProcessStandardRequest(void)
 
     else if (SetupPacket.bRequest == GET_INTERFACE)
     {
-        #if 0//(BOOT_USE_DEBUG)
-        SerialPrint("GET_INTF\r\n");
-        #endif
         // No support for alternate interfaces.
         // Send zero back to the host.
         requestHandled = 1;
@@ -650,27 +645,40 @@ void UsbTransferEvent(void)
     u8 pid, ep = USTAT >> 3;            // Get encoded number (bit 6-3)
                                         // of the last active Endpoint
 
+    #if (BOOT_USE_IFACE)
+    // EP1 to EP15 belong to the application
+    if (ep && (usbIface.flags & BOOT_IFACE_ACTIVE))
+    {
+        usbIface.ustat = USTAT;
+        UsbIfaceCall(usbIface.endpointHook);
+        return;
+    }
+    #endif
+
+    // No ping-pong, the BD index is USTAT<3:2> (EP0 or EP1, DIR)
+    Trace(TRACE_TRNIF, USTAT);
+    Trace(TRACE_BD, ep_bdt[(USTAT >> 2) & 0x03].STAT.val);
+
     if (ep == 1)                        // EndPoint 1
     {
         //if (USTATbits.DIR == OUT)
         if (!USTATbits.DIR)
         {
-            #if 0//(BOOT_USE_DEBUG)
-            SerialPrint("EP1 OUT\r\n");
-            #endif
-
             UsbBootCmd();
         }
+
+        #if (BOOT_USE_DUMP)
+        else if (dumpCount)             // EP1 IN, stream the next packet
+        {
+            UsbBootDump();
+        }
+        #endif
     }
 
     else //if (ep == 0)                   // Endpoint 0
     {
         if (USTATbits.DIR == OUT)
         {
-            #if 0//(BOOT_USE_DEBUG)
-            SerialPrint("EP0 OUT\r\n");
-            #endif
-
             // Pull PID from middle of BD0STAT
             pid = (EP_OUT_BD(0).STAT.val & 0x3C) >> 2;
 
@@ -684,9 +692,7 @@ void UsbTransferEvent(void)
 
             if (pid == PID_SETUP)
             {
-                #if 0//(BOOT_USE_DEBUG)
-                SerialPrint("PID SETUP\r\n");
-                #endif
+                Trace(TRACE_SETUP, SetupPacket.bRequest);
                 // Note: Microchip says to turn off the UOWN bit on
                 // the IN direction as soon as possible after detecting
                 // that a SETUP has been received.
@@ -697,6 +703,9 @@ void UsbTransferEvent(void)
                 ctrlTransferStage = SETUP_STAGE;
                 requestHandled = 0;     // request hasn't been handled yet
                 wCount = 0;             // No bytes transferred
+                #if (BOOT_USE_IFACE)
+                usbIface.source = 0;    // Data come from RAM
+                #endif
 
                 UsbProcessStandardRequest();
 
@@ -705,6 +714,7 @@ void UsbTransferEvent(void)
 
                 if (!requestHandled)
                 {
+                    Trace(TRACE_REQSTALL, SetupPacket.bRequest);
                     EP_OUT_BD(0).CNT = EP0_BUFFER_SIZE;
                     EP_OUT_BD(0).ADDR = (u16)&SetupPacket;
                     EP_OUT_BD(0).STAT.val = BDS_UOWN | BDS_BSTALL;
@@ -761,10 +771,6 @@ void UsbTransferEvent(void)
 
         else // if(USTATbits.DIR == IN)
         {
-            #if 0//(BOOT_USE_DEBUG)
-            SerialPrint("EP0 IN\r\n");
-            #endif
-
             if ((UADDR == 0) && (deviceState == ADDRESS))
             {
                 // The new address come in through a SET_ADDRESS
@@ -782,10 +788,7 @@ void UsbTransferEvent(void)
                 UsbDataInStage();
 
                 // Turn control over to the SIE and toggle the data bit
-                if(EP_IN_BD(0).STAT.DTS)
-                    EP_IN_BD(0).STAT.val = BDS_UOWN | BDS_DTSEN;
-                else
-                    EP_IN_BD(0).STAT.val = BDS_UOWN | BDS_DTSEN | BDS_DTS;
+                BdArmToggle(EP_IN_BD(0));
             }
 
             else
@@ -798,6 +801,14 @@ void UsbTransferEvent(void)
 
 void UsbGetDescriptor(void)
 {
+    #if (BOOT_USE_IFACE)
+    if (usbIface.flags & BOOT_IFACE_ACTIVE)
+    {
+        UsbIfaceGetDescriptor();
+        return;
+    }
+    #endif
+
     if(SetupPacket.bmRequestType == 0x80)
     {
         //u8 descriptorType  = SetupPacket.wValue1;
@@ -805,9 +816,6 @@ void UsbGetDescriptor(void)
 
         if (SetupPacket.wValue1 == DEVICE_DESCRIPTOR)
         {
-            #if 0//(BOOT_USE_DEBUG)
-            SerialPrint("DEV_DESC\r\n");
-            #endif
             requestHandled = 1;
             pBufferToHost = (u8*)&device_descriptor;
             wCount = sizeof(USB_Device_Descriptor);
@@ -815,24 +823,20 @@ void UsbGetDescriptor(void)
 
         else if (SetupPacket.wValue1 == CONFIGURATION_DESCRIPTOR)
         {
-            #if 0//(BOOT_USE_DEBUG)
-            SerialPrint("CONF_DESC\r\n");
-            #endif
             requestHandled = 1;
             pBufferToHost = (u8*)&configuration_descriptor;
             wCount = configuration_descriptor.Header.wTotalLength;
         }
 
+        #if (STRING)
         else if (SetupPacket.wValue1 == STRING_DESCRIPTOR)
         {
-            #if 0//(BOOT_USE_DEBUG)
-            SerialPrint("STR_DESC\r\n");
-            #endif
             requestHandled = 1;
             //pBufferToHost = (u8*)string_descriptor[SetupPacket.wValue0];
             //wCount = *pBufferToHost;
             wCount = UsbGetString(SetupPacket.wValue0, (const void *)&pBufferToHost);
         }
+        #endif
         
         /*
         else if (SetupPacket.wValue1 == DEVICE_QUALIFIER_DESCRIPTOR)
@@ -861,12 +865,6 @@ void UsbUpdate(void)
     // TRIS bits will always read as ‘1’
     //VBUS_TRIS |= VBUS_MASK;             // VBUS Pin as Input
 
-    #if 0//(BOOT_USE_DEBUG)
-    SerialPrint("VBUS = 0b");
-    SerialPrintNumber(VBUS_PORT, 2);
-    SerialPrint("\r\n");
-    #endif
-
     // Check for transitions between DETACHED and ATTACHED states
     //if (UsbOn())                        // 1 = Not attached, 0 = Attached
     //{
@@ -880,10 +878,6 @@ void UsbUpdate(void)
             UCONbits.USBEN = 1;
         
             deviceState = ATTACHED;
-
-            #if 0//(BOOT_USE_DEBUG)
-            SerialPrint("Attached\r\n");
-            #endif
         }
     //}
     
@@ -896,30 +890,14 @@ void UsbUpdate(void)
             UCON = 0;
             deviceState = DETACHED;
 
-            #if 0//(BOOT_USE_DEBUG)
-            SerialPrint("Detached\r\n");
-            #endif
-
             // No USB, No User App. so let's go to sleep mode
             if (userApp == FALSE)
             {
-                #if 0//(BOOT_USE_DEBUG)
-                SerialPrint("Sleep mode\r\n");
-                #endif
-                
                 UsbSuspendEvent();
-                
-                #if 0//(BOOT_USE_DEBUG)
-                SerialPrint("Woken up\r\n");
-                #endif
             }
             
             else
             {
-                #if 0//(BOOT_USE_DEBUG)
-                SerialPrint("User app\r\n");
-                #endif
-                
                 UsbBootExit();                  // Jump to user app.
             }
         }
@@ -933,10 +911,6 @@ void UsbUpdate(void)
         // UIR : — SOFIF STALLIF IDLEIF TRNIF ACTVIF UERRIF URSTIF
         UIR = 0;
         deviceState = POWERED;
-        
-        #if 0//(BOOT_USE_DEBUG)
-        SerialPrint("Powered\r\n");
-        #endif
     }
 }
 
@@ -960,10 +934,6 @@ void UsbProcessEvents(void)
 
     if (UIRbits.ACTVIF)
     {
-        #if 0//(BOOT_USE_DEBUG)
-        SerialPrint("Activated\r\n");
-        #endif
-
         UCONbits.SUSPND = 0;            // exit from suspended mode
         while (UIRbits.ACTVIF)
             UIRbits.ACTVIF = 0;
@@ -973,10 +943,6 @@ void UsbProcessEvents(void)
     #if (BOOT_USE_LOWPOWER)
     if (UIRbits.RESUMEIF)
     {
-        #if 0//(BOOT_USE_DEBUG)
-        SerialPrint("Resumed\r\n");
-        #endif
-
         UCONbits.SUSPND = 0;            // exit from suspended mode
         UIRbits.RESUMEIF = 0;
         //return;
@@ -1020,9 +986,7 @@ void UsbProcessEvents(void)
     // In response to the code stalling an endpoint.
     if (UIRbits.STALLIF)
     {
-        #if 0//(BOOT_USE_DEBUG)
-        SerialPrint("EP error\r\n");
-        #endif
+        Trace(TRACE_STALLIF, UEP0);
 
         // Prepare for the Setup stage of a control transfer
         if (UEP0bits.EPSTALL)
@@ -1035,25 +999,16 @@ void UsbProcessEvents(void)
         //return;
     }
 
-    // Display error
-    #if 0//(BOOT_USE_DEBUG)
-    if (UIRbits.UERRIF)
-    {
-        UsbErrorEvent();
-        UIRbits.UERRIF = 0;
-        return;
-    }
-    #endif
-    
     // Unless we have been reset by the host, no need to keep processing
     if (deviceState < DEFAULT)
         return;
 
     // Check for pending USB transactions
-    if (UIRbits.TRNIF)
+    // USTAT is a 4-deep FIFO : clearing TRNIF advances it and TRNIF
+    // is set again if another transaction is pending, drain them all.
+    while (UIRbits.TRNIF)
     {
         UsbTransferEvent();
         UIRbits.TRNIF = 0;              // Clear the transfer interrupt
-        //return;
     }
 }
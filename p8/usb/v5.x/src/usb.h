@@ -29,7 +29,6 @@ u16  UsbGetString(u8, const void **);
 void UsbUpdate(void);
 void UsbResetEvent(void);
 void UsbSuspendEvent(void);
-void UsbErrorEvent(void);
 void UsbProcessEvents(void);
 void UsbTransferEvent(void);
 void UsbProcessStandardRequest(void);
@@ -49,7 +48,15 @@ void UsbDataOutStage(void);
 #endif
 
 #define NB_ENDPOINTS                2   // EP0 & EP1
-#define EP0_BUFFER_SIZE             8   // MAX_PACKET_SIZE
+
+// Low speed devices are limited to 8-byte control packets.
+// Full speed devices with a 64-byte EP0 send the device and
+// configuration descriptors in a single packet each.
+#if (SPEED == LOW_SPEED) || !(BOOT_USE_LARGE_EP)
+    #define EP0_BUFFER_SIZE         8
+#else
+    #define EP0_BUFFER_SIZE         64
+#endif
 #define EP1_BUFFER_SIZE             MAX_PACKET_SIZE
 
 // USB RAM / Buffer Descriptor Table
@@ -107,6 +114,19 @@ void UsbDataOutStage(void);
 #define HSHK_EN                     0x10 // Enable handshake packet
                                          // Handshake should be disable for isoch
 
+// USB interrupt flag and enable bits (cf. BOOT_USE_INTERRUPT)
+#if defined(__18f25k50) || defined(__18f45k50)
+    #define USB_INT_FLAG            PIR3bits.USBIF
+    #define USB_INT_ENABLE          PIE3bits.USBIE
+#else
+    #define USB_INT_FLAG            PIR2bits.USBIF
+    #define USB_INT_ENABLE          PIE2bits.USBIE
+#endif
+
+// UIE events allowed to wake the core up
+// (SOF and bus activity are left out, they would fire every ms)
+#define USB_INT_EVENTS              0x29 // STALLIE | TRNIE | URSTIE
+
 // Standard Request Codes (USB 2.0 Spec Ref Table 9-4)
 #define GET_STATUS                  0
 #define CLEAR_FEATURE               1
@@ -143,6 +163,10 @@ void UsbDataOutStage(void);
 #define BDS_BC9                     0x02 // Byte count bit 9
 #define BDS_BC8                     0x01 // Byte count bit 8
 
+// Give a buffer descriptor back to the SIE with the next data toggle
+// (smaller than testing STAT.DTS in an if/else)
+#define BdArmToggle(bd)             (bd).STAT.val = (((bd).STAT.val ^ BDS_DTS) & BDS_DTS) | BDS_UOWN | BDS_DTSEN
+
 // Device states (Chap 9.1.1)
 #define DETACHED                    0
 #define ATTACHED                    1
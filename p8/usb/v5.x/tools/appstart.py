@@ -0,0 +1,140 @@
+#!/usr/bin/env python
+#  -*- coding: UTF-8 -*-
+
+"""-----------------------------------------------------------------------------
+	appstart
+	smallest user application address (APPSTART) of a bootloader build
+	usage: ./appstart.py filename cpu compiler appstart
+	       ./appstart.py --manifest filename cpu compiler appstart crystal version
+	(filename without .hex extension)
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+	--------------------------------------------------------------------------"""
+
+#-------------------------------------------------------------------------------
+# 1st form : print the smallest APPSTART for a bootloader built with the
+#            given APPSTART, i.e. the end of the bootloader rounded up to the
+#            erase block of the cpu.
+#            SDCC places the code from 0 : the end is the highest address used.
+#            XC8 spreads the psects over the --rom range : the end is the
+#            number of bytes used, the 2nd build (--rom=0-APPSTART-1) packs them.
+# 2nd form : check that the bootloader fits below APPSTART and write the
+#            filename.json manifest read by the IDE and by uploader8.py.
+#
+# APPSTART and the erase block are in words on PIC16F (2 bytes in the .hex)
+#-------------------------------------------------------------------------------
+
+import sys
+import json
+
+def eraseBlock(cpu):
+    """ erase block size in words (16F) or bytes (18F) """
+    if "16f" in cpu:
+        return 32
+    if "j5" in cpu:
+        return 1024
+    return 64
+
+def isConfig(cpu, address):
+    """ config. words, id locations, ... (byte address) """
+    if "16f" in cpu:
+        return address >= 0x10000
+    if "j5" in cpu:
+        # config. words in the last 8 bytes of the flash
+        return (address & 0xFFFF) >= 0xFFF8
+    return address >= 0x200000
+
+def bootSize(filename, cpu):
+    """ highest address used and number of bytes used by the code """
+    address_Hi = 0
+    max_address = 0
+    codesize = 0
+
+    fichier = open(filename + ".hex", 'r')
+    for line in fichier.readlines():
+
+        byte_count = int(line[1:3], 16)
+        address_Lo = int(line[3:7], 16)
+        record_type= int(line[7:9], 16)
+
+        # extended linear address record
+        if record_type == 4:
+            address_Hi = int(line[9:13], 16) << 16
+
+        # data
+        if record_type == 0:
+            address = address_Hi + address_Lo
+            if not isConfig(cpu, address):
+                codesize = codesize + byte_count
+                max_address = max(max_address, address + byte_count)
+
+    fichier.close()
+    return max_address, codesize
+
+if __name__ == "__main__":
+
+    manifest = (len(sys.argv) > 1) and (sys.argv[1] == "--manifest")
+    args = sys.argv[2:] if manifest else sys.argv[1:]
+
+    if len(args) != (6 if manifest else 4):
+        print(__doc__.split("\n")[3].strip())
+        print(__doc__.split("\n")[4].strip())
+        sys.exit(1)
+
+    filename = args[0]
+    cpu      = args[1].lower()
+    compiler = args[2].upper()
+    appstart = int(args[3], 0)
+
+    # .hex addresses are byte addresses
+    scale = 2 if "16f" in cpu else 1
+    block = eraseBlock(cpu)
+
+    max_address, codesize = bootSize(filename, cpu)
+
+    if not manifest:
+        used  = codesize if compiler == "XC8" else max_address
+        words = (used + scale - 1) // scale
+        start = ((words + block - 1) // block) * block
+        # never above the address the bootloader was built for
+        print("0x%04X" % min(max(start, block), appstart))
+        sys.exit(0)
+
+    if (appstart % block) != 0:
+        sys.exit("APPSTART 0x%X is not a multiple of the erase block (%d)" % (appstart, block))
+
+    # the linker fails first, but the .hex of a previous build may remain
+    if max_address > appstart * scale:
+        sys.exit("Bootloader doesn't fit below APPSTART 0x%X" % appstart)
+
+    data = {
+        "cpu"        : cpu,
+        "compiler"   : compiler,
+        "crystal"    : args[4],
+        "version"    : args[5],
+        "appstart"   : appstart,
+        "eraseblock" : block,
+        "codesize"   : codesize,
+        "free"       : appstart * scale - codesize,
+        "unit"       : "word" if scale == 2 else "byte"
+    }
+
+    fichier = open(filename + ".json", 'w')
+    json.dump(data, fichier, indent=4, sort_keys=True)
+    fichier.write("\n")
+    fichier.close()
+
+    print("APPSTART : 0x%04X (%d bytes used, %d bytes free)" % \
+        (appstart, codesize, appstart * scale - codesize))
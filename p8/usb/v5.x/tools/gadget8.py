@@ -0,0 +1,618 @@
+#!/usr/bin/env python
+#  -*- coding: UTF-8 -*-
+
+"""---------------------------------------------------------------------
+    gadget8
+    runs the v5 bootloader protocol as a Linux USB gadget, so that the
+    unmodified uploader8.py can be tested on any Linux box
+    usage: sudo ./gadget8.py [--proc 18f4550] [--image flash.bin]
+                             [--erase-us 2000] [--write-us 2000]
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc.
+    51 Franklin Street, Fifth Floor
+    Boston, MA  02110-1301  USA
+---------------------------------------------------------------------"""
+
+#-----------------------------------------------------------------------
+# Usage: gadget8.py [--proc 18f4550] [--appstart 0xC00]
+#                   [--image flash.bin] [--eeimage eeprom.bin]
+#                   [--erase-us 2000] [--write-us 2000] [--eeprom-us 4000]
+#                   [--latency-us 0] [--frame-us 0]
+#                   [--driver dummy_udc] [--udc dummy_udc.0]
+# Ex :   sudo modprobe dummy_hcd
+#        sudo modprobe raw_gadget
+#        sudo ./gadget8.py --proc 18f4550 --image 4550.bin &
+#        ./uploader8.py 18f4550 Blink4550.hex
+#
+# The gadget enumerates as the bootloader (04D8:FEAA, EP1 OUT/IN bulk,
+# 64 bytes) through raw_gadget and dummy_hcd : uploader8.py goes through
+# libusb, usbfs and the host controller driver as with the real board.
+# raw_gadget rather than FunctionFS as the endpoint addresses must be
+# 0x01 and 0x81, FunctionFS lets the UDC choose them (0x02 on dummy_udc).
+#
+# The commands are those of src/main.c, BOOT_USE_DUMP and
+# BOOT_USE_EEPROM included, on a flash image kept in --image (blank if
+# it doesn't exist yet) and a data EEPROM image kept in --eeimage :
+# - erase and write stall the bootloader --erase-us per erase block and
+#   --write-us per BOOT_WRITE_FLASH, EEPROM bytes are written in the
+#   background, --eeprom-us each (cf. selftest8.py for measured values),
+# - each packet is delayed by --latency-us (hub, host controller) and,
+#   with --frame-us 1000, held until the next full-speed frame,
+# - the OUT endpoint is not armed while a command runs (NAK), and a
+#   reply the host hasn't read is replaced by the next one as on the
+#   chip (EP1 IN and OUT share the same buffer).
+# BOOT_RESET_DEVICE detaches the device, it comes back in bootloader
+# mode one second later. Ctrl-C prints the totals.
+#-----------------------------------------------------------------------
+
+import sys
+import os
+import time
+import mmap
+import ctypes
+import signal
+import struct
+import threading
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import uploader8 as up
+
+# raw_gadget (linux/usb/raw_gadget.h)
+#-----------------------------------------------------------------------
+
+def _IOC(direction, nr, size):
+    return (direction << 30) | (size << 16) | (ord('U') << 8) | nr
+
+USB_RAW_IOCTL_INIT              =    _IOC(1,  0, 257)
+USB_RAW_IOCTL_RUN               =    _IOC(0,  1, 0)
+USB_RAW_IOCTL_EVENT_FETCH       =    _IOC(2,  2, 8)
+USB_RAW_IOCTL_EP0_WRITE         =    _IOC(1,  3, 8)
+USB_RAW_IOCTL_EP0_READ          =    _IOC(3,  4, 8)
+USB_RAW_IOCTL_EP_ENABLE         =    _IOC(1,  5, 9)
+USB_RAW_IOCTL_EP_WRITE          =    _IOC(1,  7, 8)
+USB_RAW_IOCTL_EP_READ           =    _IOC(3,  8, 8)
+USB_RAW_IOCTL_CONFIGURE         =    _IOC(0,  9, 0)
+USB_RAW_IOCTL_VBUS_DRAW         =    _IOC(1, 10, 4)
+USB_RAW_IOCTL_EP0_STALL         =    _IOC(0, 12, 0)
+
+USB_RAW_EVENT_CONNECT           =    1
+USB_RAW_EVENT_CONTROL           =    2
+USB_SPEED_FULL                  =    2
+
+# Descriptors, the same as src/usb.c
+#-----------------------------------------------------------------------
+
+EP0_BUFFER_SIZE                 =    64     # BOOT_USE_LARGE_EP
+MAX_POWER                       =    125    # 2 mA units
+
+DEVICE_DESCRIPTOR = struct.pack("<BBHBBBBHHHBBBB", 18, 0x01, 0x0200,
+    0xFF, 0xFF, 0xFF, EP0_BUFFER_SIZE, up.VENDOR_ID, up.PRODUCT_ID,
+    0x0501, 1, 2, 3, 1)
+
+CONFIGURATION_DESCRIPTOR = \
+    struct.pack("<BBHBBBBB", 9, 0x02, 32, 1, 1, 0, 0xA0, MAX_POWER) + \
+    struct.pack("<BBBBBBBBB", 9, 0x04, 0, 0, 2, 0xFF, 0xFF, 0xFF, 0)
+
+EP1_OUT_DESCRIPTOR = struct.pack("<BBBBHB", 7, 0x05, up.OUT_EP, 0x02, up.MAXPACKETSIZE, 0)
+EP1_IN_DESCRIPTOR  = struct.pack("<BBBBHB", 7, 0x05, up.IN_EP,  0x02, up.MAXPACKETSIZE, 0)
+
+CONFIGURATION_DESCRIPTOR += EP1_OUT_DESCRIPTOR + EP1_IN_DESCRIPTOR
+
+# Chips
+#-----------------------------------------------------------------------
+
+PIC16F_ROW                      =    32     # words
+PIC18F_BLOCK                    =    64     # bytes
+PIC18FJ_BLOCK                   =    1024   # bytes
+PIC18F_DEVID                    =    0x3FFFFE
+PIC16F_REVID                    =    0x8005
+PIC16F_DEVID                    =    0x8006
+
+# ----------------------------------------------------------------------
+class RawGadget:
+# ----------------------------------------------------------------------
+    """ /dev/raw-gadget, through the C library so that a blocked
+        transfer can be interrupted by a signal (EINTR) """
+
+    libc = ctypes.CDLL(None, use_errno=True)
+    libc.ioctl.argtypes = [ctypes.c_int, ctypes.c_ulong, ctypes.c_void_p]
+
+    def __init__(self, driver, udc):
+        self.fd = os.open("/dev/raw-gadget", os.O_RDWR)
+        init = ctypes.create_string_buffer(257)
+        init[0:len(driver)] = driver.encode()
+        init[128:128 + len(udc)] = udc.encode()
+        init[256] = bytes(bytearray([USB_SPEED_FULL]))
+        self.ioctl(USB_RAW_IOCTL_INIT, init)
+        self.ioctl(USB_RAW_IOCTL_RUN, None)
+
+    def ioctl(self, request, arg):
+        """ returns the ioctl result, raises OSError on failure """
+        if isinstance(arg, ctypes.Array):
+            arg = ctypes.addressof(arg)
+        ret = self.libc.ioctl(self.fd, request, arg)
+        if ret < 0:
+            errno = ctypes.get_errno()
+            raise OSError(errno, os.strerror(errno))
+        return ret
+
+    def io(self, request, ep, data=b"", length=0):
+        """ struct usb_raw_ep_io, returns the data read """
+        size = max(len(data), length)
+        buf = ctypes.create_string_buffer(8 + size)
+        struct.pack_into("<HHI", buf, 0, ep, 0, size)
+        buf[8:8 + len(data)] = bytes(data)
+        ret = self.ioctl(request, buf)
+        return bytearray(buf.raw[8:8 + ret])
+
+    def fetch(self):
+        """ returns the event type and the control request """
+        buf = ctypes.create_string_buffer(16)
+        struct.pack_into("<II", buf, 0, 0, 8)
+        self.ioctl(USB_RAW_IOCTL_EVENT_FETCH, buf)
+        return struct.unpack_from("<I", buf.raw)[0], buf.raw[8:16]
+
+    def enable(self, descriptor):
+        buf = ctypes.create_string_buffer(descriptor + b"\x00\x00")
+        return self.ioctl(USB_RAW_IOCTL_EP_ENABLE, buf)
+
+    def close(self):
+        os.close(self.fd)
+
+# ----------------------------------------------------------------------
+class Bootloader:
+# ----------------------------------------------------------------------
+    """ the commands of src/main.c on a flash and an EEPROM image """
+
+    def __init__(self, proc, appstart, image, eeimage, options):
+        self.proc = proc
+        self.appstart = appstart
+        self.pic16 = proc.startswith("16")
+        self.devid = [i for i in sorted(up.devices_table)
+                      if up.devices_table[i][0] == proc][0]
+        size = up.getDeviceFlash(self.devid)
+        if self.pic16:
+            self.block = PIC16F_ROW
+            size *= 2
+        elif "j" in proc:
+            self.block = PIC18FJ_BLOCK
+        else:
+            self.block = PIC18F_BLOCK
+        self.flash = self.mapImage(image, size)
+        self.eeprom = self.mapImage(eeimage, max(up.getDeviceEeprom(self.devid), 1))
+        self.features = up.BOOT_FEATURE_EEPROM if up.getDeviceEeprom(self.devid) else 0
+        self.eraseUs = options["erase"]
+        self.writeUs = options["write"]
+        self.eepromUs = options["eeprom"]
+        self.eeBusy = 0.0
+        self.stats = {"commands" : {}, "erase" : 0, "write" : 0,
+                      "overwrite" : 0, "eeprom" : 0}
+
+    @staticmethod
+    def mapImage(filename, size):
+        """ the image file, blank if it is new or of another size """
+        if filename is None:
+            return bytearray(b"\xFF" * size)
+        fd = os.open(filename, os.O_RDWR | os.O_CREAT, 0o644)
+        if os.fstat(fd).st_size != size:
+            os.ftruncate(fd, 0)
+            os.write(fd, b"\xFF" * size)
+        image = mmap.mmap(fd, size)
+        os.close(fd)
+        return image
+
+    def stall(self, us):
+        if us:
+            time.sleep(us * 1e-6)
+
+    # program memory, byte offsets in the image
+    # ------------------------------------------------------------------
+
+    def program(self, offset, data):
+        """ programming can only clear bits """
+        for i, byte in enumerate(data):
+            if offset + i >= len(self.flash):
+                break
+            if self.flash[offset + i] != 0xFF:
+                self.stats["overwrite"] += 1
+            self.flash[offset + i] &= byte
+
+    def readConfig(self, address, length):
+        """ configuration space, where READ_FLASH gets the device ID """
+        data = bytearray()
+        if self.pic16:
+            address = 0x8000 | (address & 0x7FFF)
+            for word in range(address, address + length // 2):
+                if word == PIC16F_REVID:
+                    value = 0x2002
+                elif word == PIC16F_DEVID:
+                    value = self.devid
+                else:
+                    value = 0x3FFF
+                data += struct.pack("<H", value)
+        else:
+            for byte in range(address, address + length):
+                if byte == PIC18F_DEVID:
+                    data.append(self.devid & 0xFF | 0x01)
+                elif byte == PIC18F_DEVID + 1:
+                    data.append(self.devid >> 8)
+                elif byte < len(self.flash):
+                    data.append(self.flash[byte])
+                else:
+                    data.append(0x00)
+        return data
+
+    # commands, return the list of packets to send back
+    # ------------------------------------------------------------------
+
+    def command(self, packet):
+
+        cmd = packet[up.BOOT_CMD]
+        length = packet[up.BOOT_CMD_LEN]
+        address = packet[up.BOOT_ADDR_LO] | (packet[up.BOOT_ADDR_HI] << 8) | \
+                  (packet[up.BOOT_ADDR_UP] << 16)
+        if self.pic16:
+            address &= 0x7FFF           # PMADR, word address
+        counts = self.stats["commands"]
+        counts[cmd] = counts.get(cmd, 0) + 1
+
+        # EepromFlush()
+        wait = self.eeBusy - time.monotonic()
+        if wait > 0:
+            time.sleep(wait)
+
+        reply = bytearray(packet)
+
+        if cmd == up.READ_VERSION_CMD:
+            reply[up.BOOT_VER_MINOR] = 2
+            reply[up.BOOT_VER_MAJOR] = 5
+            reply[up.BOOT_APPSTART_LO] = self.appstart & 0xFF
+            reply[up.BOOT_APPSTART_HI] = self.appstart >> 8
+            reply[up.BOOT_FEATURES] = self.features
+            return [reply[:7]]
+
+        if cmd == up.READ_FLASH_CMD:
+            data = self.readConfig(address, length)
+            reply[up.BOOT_DATA_START:up.BOOT_DATA_START + len(data)] = data
+            return [reply[:up.BOOT_DATA_START + length]]
+
+        if cmd == up.DUMP_FLASH_CMD:
+            count = packet[up.BOOT_DATA_START] | (packet[up.BOOT_DATA_START + 1] << 8)
+            offset = address * 2 if self.pic16 else address
+            packets = []
+            for i in range(count):
+                data = bytearray(self.flash[offset:offset + up.MAXPACKETSIZE])
+                data += b"\x00" * (up.MAXPACKETSIZE - len(data))
+                packets.append(data)
+                offset += up.MAXPACKETSIZE
+            return packets
+
+        if cmd == up.READ_EEDATA_CMD and self.features:
+            offset = address & 0xFF
+            data = bytearray(self.eeprom[offset:offset + length])
+            reply[up.BOOT_DATA_START:up.BOOT_DATA_START + len(data)] = data
+            return [reply[:up.BOOT_DATA_START + length]]
+
+        if cmd == up.WRITE_EEDATA_CMD and self.features:
+            offset = address & 0xFF
+            data = packet[up.BOOT_DATA_START:up.BOOT_DATA_START + length]
+            self.eeprom[offset:offset + len(data)] = bytes(data)
+            self.stats["eeprom"] += len(data)
+            # the reply once the first byte is being written
+            self.eeBusy = time.monotonic() + len(data) * self.eepromUs * 1e-6
+            return [reply[:1]]
+
+        if cmd == up.ERASE_FLASH_CMD:
+            offset = address * 2 if self.pic16 else address
+            size = self.block * 2 if self.pic16 else self.block
+            offset -= offset % size
+            for i in range(length):
+                end = min(offset + size, len(self.flash))
+                if offset < end:
+                    if self.pic16:
+                        self.flash[offset:end] = b"\xFF\x3F" * ((end - offset) // 2)
+                    else:
+                        self.flash[offset:end] = b"\xFF" * (end - offset)
+                self.stats["erase"] += 1
+                self.stall(self.eraseUs)
+                offset += size
+            return [reply[:1]]
+
+        if cmd == up.WRITE_FLASH_CMD:
+            data = packet[up.BOOT_DATA_START:up.BOOT_DATA_START + length]
+            if self.pic16:
+                data = bytearray(data)
+                for i in range(1, len(data), 2):
+                    data[i] &= 0x3F     # 14-bit words
+                self.program(address * 2, data)
+            else:
+                self.program(address, data)
+            self.stats["write"] += 1
+            self.stall(self.writeUs)
+            return [reply[:1]]
+
+        # BOOT_READ_TRACE, BOOT_SET_BAUD, ... nothing to return
+        return []
+
+# ----------------------------------------------------------------------
+class Gadget:
+# ----------------------------------------------------------------------
+    """ ep0, EP1 OUT (the bootloader) and EP1 IN, one thread each """
+
+    def __init__(self, boot, options):
+        self.boot = boot
+        self.options = options
+        self.serial = (boot.proc.upper() + " " * 8)[:8]
+        self.lock = threading.Condition()
+        self.running = True
+        self.reset = False
+        self.configured = threading.Event()
+        self.epOut = self.epIn = None
+        self.reply = None               # next IN packet
+        self.replyGen = 0
+        self.sentGen = 0
+        self.writing = None             # IN packet being sent
+        self.packets = {"out" : 0, "in" : 0, "replaced" : 0}
+
+    def latency(self):
+        if self.options["latency"]:
+            time.sleep(self.options["latency"] * 1e-6)
+        frame = self.options["frame"]
+        if frame:
+            now = int(time.monotonic() * 1e6)
+            time.sleep((frame - now % frame) * 1e-6)
+
+    # ep0
+    # ------------------------------------------------------------------
+
+    def string(self, index):
+        if index == 0:
+            return b"\x04\x03\x09\x04"
+        text = ["SeaIceLab", "Pinguino", self.serial][index - 1]
+        data = text.encode("utf-16-le")
+        return bytes(bytearray([2 + len(data), 0x03])) + data
+
+    def setup(self, request):
+        """ returns the data to send, b"" for a status stage, None to stall """
+        bmRequestType, bRequest, wValue, wIndex, wLength = struct.unpack("<BBHHH", request)
+
+        if bmRequestType == 0x80 and bRequest == 0x06:      # GET_DESCRIPTOR
+            kind, index = wValue >> 8, wValue & 0xFF
+            if kind == 0x01:
+                return DEVICE_DESCRIPTOR[:wLength]
+            if kind == 0x02:
+                return CONFIGURATION_DESCRIPTOR[:wLength]
+            if kind == 0x03 and index <= 3:
+                return self.string(index)[:wLength]
+            return None                 # device qualifier, full speed only
+
+        if bmRequestType == 0x00 and bRequest == 0x09:      # SET_CONFIGURATION
+            if self.epOut is None:
+                self.epOut = self.raw.enable(EP1_OUT_DESCRIPTOR)
+                self.epIn = self.raw.enable(EP1_IN_DESCRIPTOR)
+                self.raw.ioctl(USB_RAW_IOCTL_VBUS_DRAW, MAX_POWER)
+                self.raw.ioctl(USB_RAW_IOCTL_CONFIGURE, None)
+            self.configured.set()
+            return b""
+
+        if bmRequestType == 0x01 and bRequest == 0x0B:      # SET_INTERFACE
+            return b""
+
+        return None
+
+    def ep0Loop(self):
+        while self.running:
+            try:
+                event, request = self.raw.fetch()
+                if event != USB_RAW_EVENT_CONTROL:
+                    continue
+                data = self.setup(request)
+                if data is None:
+                    self.raw.ioctl(USB_RAW_IOCTL_EP0_STALL, None)
+                elif request[0] & 0x80:
+                    self.raw.io(USB_RAW_IOCTL_EP0_WRITE, 0, data)
+                else:
+                    self.raw.io(USB_RAW_IOCTL_EP0_READ, 0, length=0)
+            except OSError:
+                pass
+
+    # EP1
+    # ------------------------------------------------------------------
+
+    def send(self, packet, wait):
+        """ arms EP1 IN with packet, a pending reply is replaced """
+        with self.lock:
+            if self.reply is not None:
+                self.packets["replaced"] += 1
+            self.reply = packet
+            self.replyGen += 1
+            gen = self.replyGen
+            self.lock.notify_all()
+            # take a stale packet back from raw_gadget
+            while self.running and self.writing is not None and self.writing != gen:
+                signal.pthread_kill(self.inThread.ident, signal.SIGUSR1)
+                self.lock.wait(0.001)
+            while wait and self.running and self.sentGen < gen:
+                self.lock.wait(0.1)
+
+    def outLoop(self):
+        self.configured.wait()
+        while self.running:
+            try:
+                packet = self.raw.io(USB_RAW_IOCTL_EP_READ, self.epOut,
+                                     length=up.MAXPACKETSIZE)
+            except OSError:
+                time.sleep(0.001)
+                continue
+            self.latency()
+            self.packets["out"] += 1
+            if len(packet) > up.BOOT_CMD and packet[up.BOOT_CMD] == up.RESET_CMD:
+                with self.lock:
+                    self.reset = True
+                    self.running = False
+                    self.lock.notify_all()
+                break
+            packet += b"\x00" * (up.MAXPACKETSIZE - len(packet))
+            replies = self.boot.command(packet)
+            # OUT is re-armed with the last packet of a dump only
+            for i, reply in enumerate(replies):
+                self.send(reply, i < len(replies) - 1)
+
+    def inLoop(self):
+        self.configured.wait()
+        while self.running:
+            with self.lock:
+                while self.running and self.reply is None:
+                    self.lock.wait(0.1)
+                if not self.running:
+                    break
+                packet, gen = self.reply, self.replyGen
+                self.writing = gen
+            self.latency()
+            try:
+                self.raw.io(USB_RAW_IOCTL_EP_WRITE, self.epIn, packet)
+                done = True
+            except OSError:
+                done = False            # replaced (EINTR), or disconnected
+                time.sleep(0.001)
+            with self.lock:
+                self.writing = None
+                if done:
+                    self.packets["in"] += 1
+                    self.sentGen = gen
+                    if self.replyGen == gen:
+                        self.reply = None
+                self.lock.notify_all()
+
+    # ------------------------------------------------------------------
+
+    def run(self):
+        """ attached until a reset or Ctrl-C, returns True after a reset """
+        self.raw = RawGadget(self.options["driver"], self.options["udc"])
+        threads = [threading.Thread(target=self.ep0Loop),
+                   threading.Thread(target=self.outLoop),
+                   threading.Thread(target=self.inLoop)]
+        self.inThread = threads[2]
+        for thread in threads:
+            thread.daemon = True
+            thread.start()
+        try:
+            with self.lock:
+                while self.running:
+                    self.lock.wait(0.1)
+        except KeyboardInterrupt:
+            self.running = False
+        self.configured.set()
+        # the threads blocked in raw_gadget, closing detaches the device
+        for thread in threads:
+            if thread.is_alive():
+                signal.pthread_kill(thread.ident, signal.SIGUSR1)
+        self.raw.close()
+        return self.reset
+
+# ----------------------------------------------------------------------
+def report(boot, packets):
+# ----------------------------------------------------------------------
+    """ totals of all the sessions """
+
+    names = { up.READ_VERSION_CMD : "READ_VERSION", up.READ_FLASH_CMD : "READ_FLASH",
+              up.WRITE_FLASH_CMD : "WRITE_FLASH", up.ERASE_FLASH_CMD : "ERASE_FLASH",
+              up.READ_EEDATA_CMD : "READ_EEDATA", up.WRITE_EEDATA_CMD : "WRITE_EEDATA",
+              up.DUMP_FLASH_CMD : "DUMP_FLASH" }
+    stats = boot.stats
+    print("packets    : %d OUT, %d IN, %d replaced" %
+          (packets["out"], packets["in"], packets["replaced"]))
+    print("commands   : %s" % ", ".join(["%s %d" % (names.get(c, "0x%02X" % c),
+          stats["commands"][c]) for c in sorted(stats["commands"])]))
+    print("flash ops  : %d erase, %d write, %d overwrite, %d EEPROM bytes" %
+          (stats["erase"], stats["write"], stats["overwrite"], stats["eeprom"]))
+
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+def main(options):
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+
+    proc = options["--proc"].lower()
+    if proc not in [up.devices_table[i][0] for i in up.devices_table]:
+        sys.exit("Aborting: unknown PIC %s" % proc)
+    if options["--appstart"]:
+        appstart = int(options["--appstart"], 0)
+    else:
+        appstart = 0x500 if proc.startswith("16") else 0xC00   # cf. Makefile.linux
+
+    timing = { "erase"   : int(options["--erase-us"]),
+               "write"   : int(options["--write-us"]),
+               "eeprom"  : int(options["--eeprom-us"]),
+               "latency" : int(options["--latency-us"]),
+               "frame"   : int(options["--frame-us"]),
+               "driver"  : options["--driver"],
+               "udc"     : options["--udc"] }
+
+    boot = Bootloader(proc, appstart, options["--image"], options["--eeimage"], timing)
+
+    # interrupts the blocked transfers, without any other effect
+    signal.signal(signal.SIGUSR1, lambda signum, frame: None)
+
+    packets = {"out" : 0, "in" : 0, "replaced" : 0}
+    print("PIC%s bootloader v5.2, APPSTART 0x%X, attached to %s" %
+          (proc.upper(), appstart, options["--udc"]))
+    try:
+        while True:
+            gadget = Gadget(boot, timing)
+            try:
+                reset = gadget.run()
+            except OSError as e:
+                sys.exit("Aborting: /dev/raw-gadget %s (modprobe dummy_hcd raw_gadget ?)" % str(e))
+            for key in packets:
+                packets[key] += gadget.packets[key]
+            if not reset:
+                break
+            time.sleep(1.0)             # the user app. would run meanwhile
+    except KeyboardInterrupt:
+        pass
+
+    # the threads may still be signalled
+    signal.signal(signal.SIGUSR1, signal.SIG_IGN)
+    report(boot, packets)
+
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+
+if __name__ == "__main__":
+
+    args = sys.argv[1:]
+    options = { "--proc" : "18f4550", "--appstart" : None,
+                "--image" : None, "--eeimage" : None,
+                "--erase-us" : "2000", "--write-us" : "2000", "--eeprom-us" : "4000",
+                "--latency-us" : "0", "--frame-us" : "0",
+                "--driver" : "dummy_udc", "--udc" : "dummy_udc.0" }
+    for option in options:
+        if option in args:
+            i = args.index(option)
+            if i + 1 >= len(args):
+                sys.exit("Aborting: %s needs a value" % option)
+            options[option] = args[i + 1]
+            del args[i:i + 2]
+
+    if args:
+        sys.exit("Usage: gadget8.py [--proc 18f4550] [--appstart 0xC00]\n" \
+                 "                  [--image flash.bin] [--eeimage eeprom.bin]\n" \
+                 "                  [--erase-us 2000] [--write-us 2000] [--eeprom-us 4000]\n" \
+                 "                  [--latency-us 0] [--frame-us 0]\n" \
+                 "                  [--driver dummy_udc] [--udc dummy_udc.0]")
+
+    main(options)
@@ -0,0 +1,223 @@
+#!/usr/bin/env python
+#  -*- coding: UTF-8 -*-
+
+"""---------------------------------------------------------------------
+    selftest8
+    reads the results of the 8-bit self-benchmark (BOOT_USE_TEST=1)
+    usage: ./selftest8.py [--count 200] [--json results.json]
+           ./selftest8.py --line "BENCH 01 14 ..."
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc.
+    51 Franklin Street, Fifth Floor
+    Boston, MA  02110-1301  USA
+---------------------------------------------------------------------"""
+
+#-----------------------------------------------------------------------
+# Usage: selftest8.py [--count 200] [--json results.json]
+#        selftest8.py --line "BENCH ..." [--json results.json]
+# Ex :   make --makefile=Makefile.linux PROC=18f4550 OSC=20 BOOT_USE_TEST=1
+#        make --makefile=Makefile.linux PROC=18f4550 OSC=20 BOOT_USE_TEST=1 upload
+#        selftest8.py --json 18f4550_X20MHz.json
+#
+# The self-benchmark replaces the bootloader (cf. src/test.c). It times
+# the flash operations once at startup, then answers BENCH_PING as fast
+# as it can : --count pings are sent and timed on both sides. Built
+# with BOOT_USE_DEBUG=1, it prints the same results on the UART, as a
+# "BENCH ..." line that --line decodes (no USB turnaround there).
+#
+# The JSON file gives the host its transfer plan figures : erase and
+# write times per block, read throughput, command round trip. row_us
+# is also the --flash-us value of proto/bench8.py for this part.
+#-----------------------------------------------------------------------
+
+import sys
+import os
+import json
+import time
+import struct
+import usb
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import uploader8 as up
+
+# Commands (cf. src/test.c)
+#-----------------------------------------------------------------------
+
+BENCH_READ                      =    0x10
+BENCH_PING                      =    0x11
+BENCH_CLEAR                     =    0x12
+
+BENCH_VERSION                   =    1
+
+# Results, little endian, in the order of the "BENCH" line
+#-----------------------------------------------------------------------
+
+FIELDS = ("version", "crystal", "devid", "blocksize", "rowsize", "ticks",
+          "erase", "row", "word", "readsize", "read",
+          "cmdcount", "cmdmin", "cmdmax", "cmdframes")
+FORMAT                          =    "<BB13H"
+
+# ----------------------------------------------------------------------
+def command(handle, cmd):
+# ----------------------------------------------------------------------
+    """ sends a BENCH_xxx command, returns the answer """
+
+    usbBuf = [0] * up.MAXPACKETSIZE
+    usbBuf[up.BOOT_CMD] = cmd
+    return up.sendCommand(handle, usbBuf)
+
+# ----------------------------------------------------------------------
+def readResults(handle):
+# ----------------------------------------------------------------------
+    """ returns the results as a dict """
+
+    usbBuf = command(handle, BENCH_READ)
+    size = struct.calcsize(FORMAT)
+    data = bytes(bytearray(usbBuf[up.BOOT_DATA_START:up.BOOT_DATA_START + size]))
+    return dict(zip(FIELDS, struct.unpack(FORMAT, data)))
+
+# ----------------------------------------------------------------------
+def parseLine(line):
+# ----------------------------------------------------------------------
+    """ returns the results of a "BENCH ..." UART line as a dict """
+
+    words = line.split()
+    if not words or words[0] != "BENCH" or len(words) != len(FIELDS) + 1:
+        sys.exit("Aborting: not a BENCH line (%d fields expected)" % len(FIELDS))
+    return dict(zip(FIELDS, [int(w, 16) for w in words[1:]]))
+
+# ----------------------------------------------------------------------
+def ping(handle, count):
+# ----------------------------------------------------------------------
+    """ sends count BENCH_PING, returns the host round trips in s """
+
+    rtt = []
+    command(handle, BENCH_CLEAR)
+    for i in range(count):
+        start = time.monotonic()
+        command(handle, BENCH_PING)
+        rtt.append(time.monotonic() - start)
+    return rtt
+
+# ----------------------------------------------------------------------
+def report(results, rtt):
+# ----------------------------------------------------------------------
+    """ prints the results, times in us, and returns them with the
+        derived figures """
+
+    if results["version"] != BENCH_VERSION:
+        sys.exit("Aborting: results v%d, v%d expected" %
+                 (results["version"], BENCH_VERSION))
+
+    us = 1000.0 / results["ticks"]               # Timer 1 tick
+    name = up.getDeviceName(results["devid"])   # PIC16F, DEVID as is
+    if name == up.ERR_DEVICE_NOT_FOUND:         # PIC18F, without revision
+        name = up.getDeviceName(results["devid"] & 0xFFE0)
+    if name == up.ERR_DEVICE_NOT_FOUND:
+        name = "unknown"
+    unit = "words" if name.startswith("16") else "bytes"
+    data = dict(results)
+    data["name"] = name
+    data["erase_us"] = results["erase"] * us
+    data["row_us"] = results["row"] * us
+    data["word_us"] = results["word"] * us if results["word"] else None
+    data["read_bytes_per_s"] = results["readsize"] / (results["read"] * us * 1e-6)
+
+    crystal = "X%dMHz" % results["crystal"] if results["crystal"] else "INTOSC"
+    print("PIC%s (0x%04X), %s" % (name.upper(), results["devid"], crystal))
+    print("Block erase (%4d %s) %10.1f us" % (results["blocksize"], unit, data["erase_us"]))
+    print("Row write   (%4d %s) %10.1f us" % (results["rowsize"], unit, data["row_us"]))
+    if data["word_us"] is not None:
+        print("Word write              %10.1f us" % data["word_us"])
+    print("Flash read  (%4d %s) %10.1f us, %.0f %s/s" % (results["readsize"], unit,
+          results["read"] * us, data["read_bytes_per_s"], unit))
+
+    intervals = results["cmdcount"] - 1
+    if intervals > 0:
+        data["cmd_min_us"] = results["cmdmin"] * us
+        data["cmd_max_us"] = results["cmdmax"] * us if results["cmdmax"] != 0xFFFF else None
+        data["cmd_avg_ms"] = float(results["cmdframes"]) / intervals
+        print("Command turnaround      %10.1f us min., %s max., %.2f ms (SOF) avg. over %d" %
+              (data["cmd_min_us"],
+               "%.1f us" % data["cmd_max_us"] if data["cmd_max_us"] else ">= 43 ms",
+               data["cmd_avg_ms"], intervals))
+
+    if rtt:
+        data["host_rtt_min_us"] = min(rtt) * 1e6
+        data["host_rtt_max_us"] = max(rtt) * 1e6
+        data["host_rtt_avg_us"] = sum(rtt) * 1e6 / len(rtt)
+        print("Host round trip         %10.1f us min., %.1f us max., %.1f us avg." %
+              (data["host_rtt_min_us"], data["host_rtt_max_us"], data["host_rtt_avg_us"]))
+
+    return data
+
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+def main(count, line=None):
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+
+    if line:
+        return report(parseLine(line), [])
+
+    device = up.getDevice(up.VENDOR_ID, up.PRODUCT_ID)
+    if device == up.ERR_DEVICE_NOT_FOUND:
+        sys.exit("Aborting: Pinguino not found. Is the self-benchmark (BOOT_USE_TEST=1) running ?")
+
+    try:
+        handle = up.initDevice(device)
+    except up.UploaderError as e:
+        sys.exit("Aborting: %s" % str(e))
+    if handle == up.ERR_USB_INIT1:
+        sys.exit("Aborting: unable to open the device")
+
+    try:
+        rtt = ping(handle, count)
+        results = readResults(handle)
+    except usb.core.USBError as e:
+        up.closeDevice(handle)
+        sys.exit("Aborting: no results (a bootloader is running, not the self-benchmark ?) %s" % str(e))
+
+    up.closeDevice(handle)
+
+    return report(results, rtt)
+
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+
+if __name__ == "__main__":
+
+    args = sys.argv[1:]
+    options = { "--json" : None, "--count" : "200", "--line" : None }
+    for option in options:
+        if option in args:
+            i = args.index(option)
+            if i + 1 >= len(args):
+                sys.exit("Aborting: %s needs a value" % option)
+            options[option] = args[i + 1]
+            del args[i:i + 2]
+
+    if args:
+        sys.exit("Usage: selftest8.py [--count 200] [--json results.json]\n" \
+                 "       selftest8.py --line \"BENCH ...\" [--json results.json]")
+
+    data = main(int(options["--count"]), options["--line"])
+
+    if options["--json"]:
+        fichier = open(options["--json"], 'w')
+        json.dump(data, fichier, indent=4)
+        fichier.write("\n")
+        fichier.close()
@@ -0,0 +1,209 @@
+#!/usr/bin/env python
+#  -*- coding: UTF-8 -*-
+
+"""---------------------------------------------------------------------
+    trace8
+    reads and decodes the event trace of the 8-bit USB bootloader
+    usage: ./trace8.py [--raw]
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the
+    Free Software Foundation, Inc.
+    51 Franklin Street, Fifth Floor
+    Boston, MA  02110-1301  USA
+---------------------------------------------------------------------"""
+
+#-----------------------------------------------------------------------
+# Usage: trace8.py [--raw]
+# Ex :   make --makefile=Makefile.linux PROC=18f4550 OSC=20 BOOT_USE_TRACE=1
+#        uploader8.py 18f4550 Blink4550.hex     (or whatever to profile)
+#        trace8.py
+#
+# The bootloader must be built with BOOT_USE_TRACE=1 (cf. src/trace.h).
+# The trace is read with the READ_TRACE command, which freezes it until
+# the next command. Events are printed from the oldest one, with their
+# time from the first event and from the previous one.
+#-----------------------------------------------------------------------
+
+# Timer 1 runs at FOSC/4/8 = 1.5 MHz and overflows every 43.7 ms, the
+# time between 2 events is known modulo 43.7 ms only. The bootloader
+# waits for the host between the commands, so expect wrong deltas there.
+
+import sys
+import os
+import usb
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import uploader8 as up
+
+TICK_US                         =    8 * 4 / 48.0    # Timer 1 tick
+TRACE_HEADER                    =    4               # head, on, size, version
+TRACE_EVENT                     =    4               # code, arg, TMR1L, TMR1H
+TRACE_CHUNK                     =    56              # bytes per READ_TRACE
+
+# Event codes (cf. src/trace.h)
+#-----------------------------------------------------------------------
+
+TRACE_RESET                     =    0x01
+TRACE_SETUP                     =    0x02
+TRACE_REQSTALL                  =    0x03
+TRACE_TRNIF                     =    0x04
+TRACE_BD                        =    0x05
+TRACE_CMD                       =    0x06
+TRACE_DONE                      =    0x07
+TRACE_STALLIF                   =    0x08
+
+EVENTS = {
+    TRACE_RESET     : "RESET",
+    TRACE_SETUP     : "SETUP",
+    TRACE_REQSTALL  : "REQSTALL",
+    TRACE_TRNIF     : "TRNIF",
+    TRACE_BD        : "BD",
+    TRACE_CMD       : "CMD",
+    TRACE_DONE      : "DONE",
+    TRACE_STALLIF   : "STALLIF" }
+
+REQUESTS = {
+    0: "GET_STATUS", 1: "CLEAR_FEATURE", 3: "SET_FEATURE",
+    5: "SET_ADDRESS", 6: "GET_DESCRIPTOR", 7: "SET_DESCRIPTOR",
+    8: "GET_CONFIGURATION", 9: "SET_CONFIGURATION",
+    10: "GET_INTERFACE", 11: "SET_INTERFACE", 12: "SYNCH_FRAME" }
+
+COMMANDS = {
+    up.READ_VERSION_CMD : "READ_VERSION",
+    up.READ_FLASH_CMD   : "READ_FLASH",
+    up.WRITE_FLASH_CMD  : "WRITE_FLASH",
+    up.ERASE_FLASH_CMD  : "ERASE_FLASH",
+    up.DUMP_FLASH_CMD   : "DUMP_FLASH",
+    up.READ_TRACE_CMD   : "READ_TRACE",
+    up.RESET_CMD        : "RESET" }
+
+PIDS = { 0x1: "OUT", 0x9: "IN", 0x5: "SOF", 0xD: "SETUP" }
+
+# ----------------------------------------------------------------------
+def decodeArg(code, arg):
+# ----------------------------------------------------------------------
+    """ returns a readable form of the event argument """
+
+    if code in (TRACE_SETUP, TRACE_REQSTALL):
+        return REQUESTS.get(arg, "bRequest 0x%02X" % arg)
+
+    if code == TRACE_TRNIF:
+        # USTAT : - ENDP3 ENDP2 ENDP1 ENDP0 DIR PPBI -
+        return "EP%d %s" % ((arg >> 3) & 0x0F, "IN" if arg & 0x04 else "OUT")
+
+    if code == TRACE_BD:
+        # STAT : UOWN DTS PID3 PID2 PID1 PID0 BC9 BC8 (written by the SIE)
+        return "%s DATA%d PID %s" % ("UOWN" if arg & 0x80 else "COWN",
+            (arg >> 6) & 1, PIDS.get((arg >> 2) & 0x0F, "?"))
+
+    if code == TRACE_CMD:
+        return COMMANDS.get(arg, "0x%02X" % arg)
+
+    if code == TRACE_DONE:
+        return "%d byte(s)" % arg
+
+    if code == TRACE_STALLIF:
+        return "UEP0 0x%02X" % arg
+
+    return ""
+
+# ----------------------------------------------------------------------
+def readTrace(handle):
+# ----------------------------------------------------------------------
+    """ returns the trace header and the events, oldest first """
+
+    usbBuf = up.readTrace(handle, 0, TRACE_HEADER)
+    head, on, size, version = usbBuf[up.BOOT_DATA_START:up.BOOT_DATA_START + 4]
+
+    data = []
+    length = size * TRACE_EVENT
+    offset = 0
+    while offset < length:
+        chunk = min(TRACE_CHUNK, length - offset)
+        usbBuf = up.readTrace(handle, TRACE_HEADER + offset, chunk)
+        data += usbBuf[up.BOOT_DATA_START:up.BOOT_DATA_START + chunk]
+        offset += chunk
+
+    # head is the offset of the oldest event once the ring is full
+    data = data[head:] + data[:head]
+    events = []
+    for i in range(0, length, TRACE_EVENT):
+        code, arg, tmr1l, tmr1h = data[i:i + TRACE_EVENT]
+        if code:
+            events.append((code, arg, tmr1l | (tmr1h << 8)))
+
+    return size, version, events
+
+# ----------------------------------------------------------------------
+def printTrace(events, raw):
+# ----------------------------------------------------------------------
+
+    print("  time (us)  delta (us)  event")
+    time = 0
+    last = None
+    for code, arg, tmr1 in events:
+        if last is not None:
+            delta = (tmr1 - last) & 0xFFFF
+            time = time + delta
+        else:
+            delta = 0
+        last = tmr1
+
+        if raw:
+            desc = "0x%02X 0x%02X" % (code, arg)
+        else:
+            desc = "%-8s %s" % (EVENTS.get(code, "0x%02X" % code),
+                                decodeArg(code, arg))
+
+        print("%11.1f %11.1f  %s" % (time * TICK_US, delta * TICK_US, desc))
+
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+def main(raw=False):
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+
+    device = up.getDevice(up.VENDOR_ID, up.PRODUCT_ID)
+    if device == up.ERR_DEVICE_NOT_FOUND:
+        sys.exit("Aborting: Pinguino not found. Is your device connected and/or in bootloader mode ?")
+
+    try:
+        handle = up.initDevice(device)
+    except up.UploaderError as e:
+        sys.exit("Aborting: %s" % str(e))
+    if handle == up.ERR_USB_INIT1:
+        sys.exit("Aborting: unable to open the device")
+
+    try:
+        size, version, events = readTrace(handle)
+    except usb.core.USBError as e:
+        up.closeDevice(handle)
+        sys.exit("Aborting: no trace (bootloader built without BOOT_USE_TRACE ?) %s" % str(e))
+
+    up.closeDevice(handle)
+
+    print("Bootloader v5.%d, %d/%d event(s)" % (version, len(events), size))
+    printTrace(events, raw)
+
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+
+if __name__ == "__main__":
+    if len(sys.argv) == 1:
+        main()
+    elif len(sys.argv) == 2 and sys.argv[1] == "--raw":
+        main(True)
+    else:
+        sys.exit("Usage: trace8.py [--raw]")
@@ -50,7 +50,56 @@
 
 #-----------------------------------------------------------------------
 # Usage: uploader8.py mcu path/filename.hex
+#        uploader8.py mcu --dump path/filename.hex
+#        uploader8.py mcu --manifest path/bootloader.json path/filename.hex
+#        uploader8.py mcu --wait seconds path/filename.hex
+#        uploader8.py mcu --auto [--device VID:PID|bus-port] path/filename.hex
+#        uploader8.py mcu --uart port [--baud bauds] path/filename.hex
+#        uploader8.py mcu --eeprom path/eeprom.hex path/filename.hex
+#        uploader8.py mcu --timing [--timing-json path/timing.json] ...
 # Ex :   uploader8.py 16F1459 tools/Blink1459.hex
+#        uploader8.py 18F47J53 --dump golden.hex
+#        uploader8.py 18F4550 --manifest hex/Pinguino_Bootloader_v5.2.0_SDCC_18f4550_X20MHz.json Blink4550.hex
+#        uploader8.py 18F25K50 --wait 5 Blink45k50.hex
+#        uploader8.py 18F4550 --uart /dev/ttyUSB0 --baud 1000000 Blink4550.hex
+#        uploader8.py 18F4550 --eeprom unit42.hex Blink4550.hex
+#        uploader8.py 18F4550 --timing --timing-json ci.json Blink4550.hex
+#
+# --wait polls the USB bus until the bootloader shows up, e.g. right
+# after the application was asked to call BootEnter() (cf. src/boot_entry.h).
+#
+# --auto asks the running application to call BootEnter() itself, with
+# a vendor request or a 1200-baud touch on its CDC interface, waits for
+# the bootloader, uploads and waits for the application to come back.
+# The waits use libusb hotplug events when python-libusb1 is installed.
+# Only the known Pinguino applications (APP_IDS, e.g. 04D8:FEAB for
+# CDC) are reset, any other one must be named with --device, by its
+# VID:PID or its USB port path (bus-port.port..., cf. /sys/bus/usb/devices).
+#
+# --uart talks to a bootloader built with BOOT_USE_UART=1 through a
+# serial port (needs pyserial, cf. src/uart.h). The auto-baud detection
+# runs at 115200 bauds, the bootloader then switches to --baud bauds,
+# up to 3 Mbauds if the USB/serial adapter can.
+#
+# The data EEPROM records of the program (from 0xF00000 in the hex
+# file) are written after the program, then read back, if the
+# bootloader was built with BOOT_USE_EEPROM=1 (cf. src/eeprom.h).
+# --eeprom adds those of a second hex file, e.g. per-unit calibration
+# data, in the same session.
+#
+# --timing prints the time of each phase (discovery, init, id, parse,
+# erase, write, eeprom, verify, read, reset) on the monotonic clock, the
+# packets and bytes sent and received, the program or EEPROM bytes/s and
+# a latency histogram of the packets. --timing-json writes the same
+# figures, per packet direction and phase, e.g. for a CI job, and the
+# USB port path of the board to tell the hubs apart.
+#
+# The options can come in any order, before or after the mcu.
+#
+# uploader8.py is also a module : Session (open, query, erase, write,
+# verify, read, writeEeprom, reset) runs any number of operations on a
+# bootloader found and claimed once, and raises UploaderError instead
+# of exiting, e.g. for write + verify + EEPROM provisioning scripts.
 #-----------------------------------------------------------------------
 
 # This class is based on :
@@ -65,6 +114,9 @@
 
 import sys
 import os
+import json
+import time
+import bisect
 import usb
 #import usb.core
 #import usb.util
@@ -122,6 +174,11 @@ BOOT_SIZE                       =    1
 
 BOOT_VER_MINOR                  =    2
 BOOT_VER_MAJOR                  =    3
+BOOT_APPSTART_LO                =    4    # since v5.2
+BOOT_APPSTART_HI                =    5
+BOOT_FEATURES                   =    6    # since v5.2
+
+BOOT_FEATURE_EEPROM             =    0x01 # READ/WRITE_EEDATA_CMD
 
 BOOT_REV1                       =    5
 BOOT_REV2                       =    6
@@ -135,16 +192,22 @@ READ_VERSION_CMD                =    0x00
 READ_FLASH_CMD                  =    0x01
 WRITE_FLASH_CMD                 =    0x02
 ERASE_FLASH_CMD                 =    0x03
-#READ_EEDATA_CMD                =    0x04
-#WRITE_EEDATA_CMD               =    0x05
+READ_EEDATA_CMD                 =    0x04    # since v5.2, BOOT_USE_EEPROM
+WRITE_EEDATA_CMD                =    0x05    # since v5.2, BOOT_USE_EEPROM
 #READ_CONFIG_CMD                =    0x06
 #WRITE_CONFIG_CMD               =    0x07
+DUMP_FLASH_CMD                  =    0x08    # since v5.1
+READ_TRACE_CMD                  =    0x09    # since v5.2, BOOT_USE_TRACE
+SET_BAUD_CMD                    =    0x0A    # since v5.2, BOOT_USE_UART only
 RESET_CMD                       =    0xFF
 
 # USB Max. Packet size
 #-----------------------------------------------------------------------
 
 MAXPACKETSIZE                   =    64
+DUMPCHUNKSIZE                   =    64 * MAXPACKETSIZE # bytes per bulk read
+EEBLOCKSIZE                     =    MAXPACKETSIZE - 5  # EEPROM bytes per packet
+EEPROM_HEX_ADDRESS              =    0xF00000  # data EEPROM in PIC18F hex files
 
 # Bulk endpoints
 #-----------------------------------------------------------------------
@@ -158,6 +221,42 @@ OUT_EP                          =    0x01    # endpoint for Bulk writes
 ACTIVE_CONFIG                   =    0x01
 INTERFACE_ID                    =    0x00
 TIMEOUT                         =    10000
+WAIT_POLL                       =    0.05      # s between 2 searches (--wait)
+
+# Automatic reset into the bootloader (--auto, cf. src/boot_entry.h)
+#-----------------------------------------------------------------------
+
+BOOT_MAGIC                      =    0xB007
+BOOT_ENTRY_REQUEST              =    0xB0      # vendor request, wValue = BOOT_MAGIC
+BOOT_ENTRY_BAUDRATE             =    1200      # CDC 1200-baud touch
+CDC_COMM_CLASS                  =    0x02
+CDC_SET_LINE_CODING             =    0x20
+CDC_SET_CONTROL_LINE_STATE      =    0x22
+ENUM_TIMEOUT                    =    10        # s, bootloader or app. enumeration
+
+# known Pinguino applications (vendor, product), the other ones are
+# reset only when named with --device
+APP_IDS                         =    ((0x04D8, 0xFEAB),)   # Pinguino CDC
+
+# UART transport (--uart, cf. src/uart.h)
+#-----------------------------------------------------------------------
+
+UART_SYNC                       =    0x55      # auto-baud / sync byte
+UART_ACK                        =    0x06      # sync acknowledgement
+UART_SYNC_BAUDRATE              =    115200    # auto-baud detection rate
+UART_SYNC_TRIES                 =    20        # 0.1 s each
+UART_RETRIES                    =    3         # a NAKed frame is sent again
+UART_FOSC                       =    48000000  # EUSART clock
+
+# Phase and packet timing (--timing, --timing-json)
+#-----------------------------------------------------------------------
+
+TIMING                          =    None      # Timing object when asked
+TIMING_BUCKETS                  =    (125, 250, 500, 1000, 2000, 4000,
+                                      8000, 16000, 64000) # us, histogram
+
+# clock() since Python 3.3, the wall clock before
+clock = getattr(time, "monotonic", time.time)
 
 # Error codes returned by various functions
 #-----------------------------------------------------------------------
@@ -196,24 +295,24 @@ devices_table = \
         0x3027: ['16lf1459'     , 0x02000, 0x00 ],
 
         # 18F
-        0x4740: ['18f13k50'     , 0x02000, 0x80 ],
-        0x4700: ['18lf13k50'    , 0x02000, 0x80 ],
+        0x4740: ['18f13k50'     , 0x02000, 0x100],
+        0x4700: ['18lf13k50'    , 0x02000, 0x100],
 
-        0x4760: ['18f14k50'     , 0x04000, 0xff ],
-        0x4720: ['18f14k50'     , 0x04000, 0xff ],
+        0x4760: ['18f14k50'     , 0x04000, 0x100],
+        0x4720: ['18f14k50'     , 0x04000, 0x100],
 
         0x2420: ['18f2450'      , 0x04000, 0x00 ],
-        0x1260: ['18f2455'      , 0x06000, 0xff ],
-        0x2a60: ['18f2458'      , 0x06000, 0xff ],
+        0x1260: ['18f2455'      , 0x06000, 0x100],
+        0x2a60: ['18f2458'      , 0x06000, 0x100],
         0x4c00: ['18f24j50'     , 0x04000, 0x00 ],
         0x4cc0: ['18lf24j50'    , 0x04000, 0x00 ],
         
-        0x1240: ['18f2550'      , 0x08000, 0xff ],
-        0x2a40: ['18f2553'      , 0x08000, 0xff ],
+        0x1240: ['18f2550'      , 0x08000, 0x100],
+        0x2a40: ['18f2553'      , 0x08000, 0x100],
         0x4c20: ['18f25j50'     , 0x08000, 0x00 ],
         0x4ce0: ['18lf25j50'    , 0x08000, 0x00 ],
-        0x5c20: ['18f25k50'     , 0x08000, 0xff ],
-        0x5ca0: ['18lf25k50'    , 0x08000, 0xff ],
+        0x5c20: ['18f25k50'     , 0x08000, 0x100],
+        0x5ca0: ['18lf25k50'    , 0x08000, 0x100],
 
         0x4c40: ['18f26j50'     , 0x10000, 0x00 ],
         0x4d00: ['18lf26j50'    , 0x10000, 0x00 ],
@@ -221,17 +320,17 @@ devices_table = \
         0x5860: ['18f27j53'     , 0x20000, 0x00 ],
 
         0x1200: ['18f4450'      , 0x04000, 0x00 ],
-        0x1220: ['18f4455'      , 0x06000, 0x00 ],
-        0x2a20: ['18f4458'      , 0x06000, 0xff ],
+        0x1220: ['18f4455'      , 0x06000, 0x100],
+        0x2a20: ['18f4458'      , 0x06000, 0x100],
         0x4c60: ['18f44j50'     , 0x04000, 0x00 ],
         0x4d20: ['18lf44j50'    , 0x04000, 0x00 ],
         
-        0x1200: ['18f4550'      , 0x08000, 0xff ],
-        0x2a00: ['18f4553'      , 0x08000, 0xff ],
+        0x1200: ['18f4550'      , 0x08000, 0x100],
+        0x2a00: ['18f4553'      , 0x08000, 0x100],
         0x4c80: ['18f45j50'     , 0x08000, 0x00 ],
         0x4d40: ['18lf45j50'    , 0x08000, 0x00 ],
-        0x5C00: ['18f45k50'     , 0x08000, 0xff ],
-        0x5C80: ['18lf45k50'    , 0x08000, 0xff ],
+        0x5C00: ['18f45k50'     , 0x08000, 0x100],
+        0x5C80: ['18lf45k50'    , 0x08000, 0x100],
         
         0x4ca0: ['18f46j50'     , 0x10000, 0x00 ],
         0x4d60: ['18f46j50'     , 0x10000, 0x00 ],
@@ -274,24 +373,463 @@ def getDevice(vendor, product):
                     return device
         return ERR_DEVICE_NOT_FOUND
 
+# ----------------------------------------------------------------------
+def waitDevice(vendor, product, seconds):
+# ----------------------------------------------------------------------
+    """ search USB device for up to seconds, returns as getDevice() """
+
+    deadline = time.time() + seconds
+    while True:
+        device = getDevice(vendor, product)
+        if device != ERR_DEVICE_NOT_FOUND or time.time() >= deadline:
+            return device
+        time.sleep(WAIT_POLL)
+
+# ----------------------------------------------------------------------
+def waitArrival(match, seconds):
+# ----------------------------------------------------------------------
+    """ waits up to seconds for a device, match(vendor, product) is True
+        for the expected one. Sleeps on libusb hotplug events when
+        python-libusb1 is installed, polls the bus otherwise. """
+
+    deadline = time.time() + seconds
+
+    try:
+        import usb1
+        context = usb1.USBContext()
+        if hasattr(context, "open"):        # python-libusb1 2.x
+            context.open()
+        hotplug = context.hasCapability(usb1.CAP_HAS_HOTPLUG)
+    except (ImportError, AttributeError):
+        hotplug = False
+
+    if hotplug:
+        found = []
+
+        def callback(context, device, event):
+            if match(device.getVendorID(), device.getProductID()):
+                found.append(device)
+                return True                 # deregister
+            return False
+
+        # HOTPLUG_ENUMERATE reports the devices already there too
+        context.hotplugRegisterCallback(callback,
+            events=usb1.HOTPLUG_EVENT_DEVICE_ARRIVED,
+            flags=usb1.HOTPLUG_ENUMERATE)
+        while not found and time.time() < deadline:
+            context.handleEventsTimeout(deadline - time.time())
+        context.close()
+        return len(found) > 0
+
+    while time.time() < deadline:
+        if usb.core.find(custom_match=lambda d: match(d.idVendor, d.idProduct)):
+            return True
+        time.sleep(WAIT_POLL)
+    return False
+
+# ----------------------------------------------------------------------
+def devicePort(device):
+# ----------------------------------------------------------------------
+    """ bus-port.port... of a pyusb device, as in /sys/bus/usb/devices,
+        or None if pyusb doesn't tell """
+
+    ports = getattr(device, "port_numbers", None)
+    if not ports:
+        return None
+    return "%d-%s" % (device.bus, ".".join([str(n) for n in ports]))
+
+# ----------------------------------------------------------------------
+def parseSelector(selector):
+# ----------------------------------------------------------------------
+    """ checks a --device selector, VID:PID (hex) or bus-port, returns
+        (vendor, product) or the port string, None if it is malformed """
+
+    if ":" in selector:
+        try:
+            vendor, product = [int(v, 16) for v in selector.split(":")]
+        except ValueError:
+            return None
+        if vendor > 0xFFFF or product > 0xFFFF:
+            return None
+        return vendor, product
+
+    bus, sep, ports = selector.partition("-")
+    if not sep or not bus.isdigit() or \
+       not all([n.isdigit() for n in ports.split(".")]):
+        return None
+    return selector
+
+# ----------------------------------------------------------------------
+def isApplication(selector, vendor, product, port=None):
+# ----------------------------------------------------------------------
+    """ True if the device is the application to reset : the one named
+        by selector (cf. parseSelector), or one of APP_IDS if None """
+
+    if selector is None:
+        return (vendor, product) in APP_IDS
+    target = parseSelector(selector)
+    if isinstance(target, tuple):
+        return (vendor, product) == target
+    return port is not None and port == target
+
+# ----------------------------------------------------------------------
+def findApplication(vendor, product, selector=None):
+# ----------------------------------------------------------------------
+    """ returns the running application, cf. isApplication(), and its
+        CDC interface (or None). The bootloader never matches, and any
+        other device is left alone : its drivers are not detached. """
+
+    for device in usb.core.find(find_all=True):
+        if (device.idVendor, device.idProduct) == (vendor, product):
+            continue
+        if not isApplication(selector, device.idVendor, device.idProduct,
+                             devicePort(device)):
+            continue
+        comm = None
+        try:
+            for interface in device.get_active_configuration():
+                if interface.bInterfaceClass == CDC_COMM_CLASS:
+                    comm = interface.bInterfaceNumber
+                    break
+        except usb.core.USBError:
+            pass
+        return device, comm
+
+    return None, None
+
+# ----------------------------------------------------------------------
+def enterBootloader(device, comm):
+# ----------------------------------------------------------------------
+    """ asks the application to call BootEnter(), returns False if it
+        can't be asked. The device resets before the status stage, so
+        only a STALL (EPIPE) means that the request is not supported. """
+
+    try:
+        device.ctrl_transfer(0x40, BOOT_ENTRY_REQUEST, BOOT_MAGIC, 0, None, 1000)
+        return True
+    except usb.core.USBError as e:
+        if e.errno != 32:
+            return True
+
+    if comm is None:
+        return False
+
+    # the cdc_acm driver owns the interface
+    try:
+        if device.is_kernel_driver_active(comm):
+            device.detach_kernel_driver(comm)
+    except (usb.core.USBError, NotImplementedError):
+        pass
+
+    # 1200 bauds, 1 stop bit, no parity, 8 bits, then DTR low
+    coding = [BOOT_ENTRY_BAUDRATE & 0xFF, BOOT_ENTRY_BAUDRATE >> 8, 0, 0, 0, 0, 8]
+    try:
+        device.ctrl_transfer(0x21, CDC_SET_LINE_CODING, 0, comm, coding, 1000)
+        device.ctrl_transfer(0x21, CDC_SET_CONTROL_LINE_STATE, 0, comm, None, 1000)
+    except usb.core.USBError:
+        pass
+
+    return True
+
+# ----------------------------------------------------------------------
+def autoReset(vendor, product, selector=None):
+# ----------------------------------------------------------------------
+    """ resets the running application (cf. findApplication) into the
+        bootloader, returns the bootloader device and the application
+        ids (vendor, product) """
+
+    if not PYUSB_USE_CORE:
+        return ERR_DEVICE_NOT_FOUND, None
+
+    app, comm = findApplication(vendor, product, selector)
+    if app is None:
+        return ERR_DEVICE_NOT_FOUND, None
+
+    appid = (app.idVendor, app.idProduct)
+    print("Application %04X:%04X found, resetting into the bootloader ..." % appid)
+    start = time.time()
+    if not enterBootloader(app, comm):
+        return ERR_DEVICE_NOT_FOUND, appid
+
+    if waitArrival(lambda v, p: (v, p) == (vendor, product), ENUM_TIMEOUT):
+        # udev may not have set the permissions yet
+        device = waitDevice(vendor, product, 1)
+        if device != ERR_DEVICE_NOT_FOUND:
+            print("Bootloader ready in %d ms" % ((time.time() - start) * 1000))
+        return device, appid
+
+    return ERR_DEVICE_NOT_FOUND, appid
+
+# ----------------------------------------------------------------------
+class SerialHandle(object):
+# ----------------------------------------------------------------------
+    """ bootloader on a serial port (cf. src/uart.h), with the read and
+        write methods of a pyusb device so that the commands below work
+        unchanged """
+
+    def __init__(self, port, baudrate):
+        import serial
+        self.serial = serial.Serial(port, UART_SYNC_BAUDRATE,
+                                    timeout=TIMEOUT / 1000.0)
+        self.reply = None
+        if not self.sync():
+            self.serial.close()
+            raise IOError("no answer on %s" % port)
+        if baudrate != UART_SYNC_BAUDRATE:
+            self.setBaudrate(baudrate)
+
+    def sync(self):
+        """ sends UART_SYNC until the bootloader acknowledges it,
+            the first one sets its baud rate """
+        timeout = self.serial.timeout
+        self.serial.timeout = 0.1
+        try:
+            for i in range(UART_SYNC_TRIES):
+                self.serial.reset_input_buffer()
+                self.serial.write(bytearray([UART_SYNC]))
+                if bytearray(self.serial.read(1)) == bytearray([UART_ACK]):
+                    return True
+        finally:
+            self.serial.timeout = timeout
+        return False
+
+    def setBaudrate(self, baudrate):
+        """ switches both sides to baudrate (BOOT_SET_BAUD) """
+        spbrg = int(round(UART_FOSC / (4.0 * baudrate))) - 1
+        if spbrg < 0 or spbrg > 0xFFFF:
+            raise ValueError("%d bauds out of range" % baudrate)
+        usbBuf = [0] * MAXPACKETSIZE
+        usbBuf[BOOT_CMD] = SET_BAUD_CMD
+        usbBuf[BOOT_ADDR_LO] = (spbrg     ) & 0xFF
+        usbBuf[BOOT_ADDR_HI] = (spbrg >> 8) & 0xFF
+        self.write(OUT_EP, usbBuf, TIMEOUT)
+        self.serial.baudrate = baudrate
+        if not self.sync():
+            raise IOError("no answer at %d bauds" % baudrate)
+
+    def readFrame(self):
+        """ returns the bytes of the next frame, [] for a NAK """
+        head = bytearray(self.serial.read(1))
+        if len(head) != 1:
+            raise IOError("UART timeout")
+        n = head[0]
+        data = bytearray(self.serial.read(n + 1))
+        if len(data) != n + 1:
+            raise IOError("UART timeout")
+        if (n + sum(data)) & 0xFF:
+            raise IOError("UART checksum error")
+        return list(data[:n])
+
+    def write(self, endpoint, usbBuf, timeout):
+        """ sends usbBuf and, except for a dump, waits for the reply :
+            the next frame must not arrive during a flash write """
+        cmd = usbBuf[BOOT_CMD]
+        # only the meaningful part of the packet
+        if cmd == WRITE_FLASH_CMD or cmd == WRITE_EEDATA_CMD:
+            n = BOOT_DATA_START + usbBuf[BOOT_CMD_LEN]
+        elif cmd == DUMP_FLASH_CMD:
+            n = BOOT_DATA_START + 2
+        else:
+            n = BOOT_DATA_START
+        frame = [n] + [int(b) for b in usbBuf[:n]]
+        frame.append(-sum(frame) & 0xFF)
+
+        for i in range(UART_RETRIES):
+            self.serial.write(bytearray(frame))
+            if cmd == DUMP_FLASH_CMD:
+                self.reply = None
+                return len(usbBuf)
+            self.reply = self.readFrame()
+            if self.reply:
+                return len(usbBuf)
+            self.sync()
+        raise IOError("UART command 0x%02X not acknowledged" % cmd)
+
+    def read(self, endpoint, size, timeout):
+        """ returns the reply, or size bytes of a dump """
+        if self.reply is not None:
+            reply, self.reply = self.reply, None
+            return reply
+        data = []
+        while len(data) < size:
+            frame = self.readFrame()
+            if not frame:
+                raise IOError("UART dump not acknowledged")
+            data.extend(frame)
+        return data
+
+    def bulkWrite(self, endpoint, usbBuf, timeout):
+        return self.write(endpoint, usbBuf, timeout)
+
+    def bulkRead(self, endpoint, size, timeout):
+        return self.read(endpoint, size, timeout)
+
+    def close(self):
+        self.serial.close()
+
+# ----------------------------------------------------------------------
+class Timing(object):
+# ----------------------------------------------------------------------
+    """ times the phases of a session and each packet on the monotonic
+        clock (--timing, --timing-json). A phase lasts until the next
+        one starts, a packet is one write or read call on the handle
+        (a whole chunk for a dump). """
+
+    def __init__(self):
+        self.info = {}
+        self.phases = []
+        self.started = clock()
+        self.stopped = None
+
+    def phase(self, name):
+        """ ends the current phase and starts the next one """
+        self.stop()
+        self.stopped = None
+        self.phases.append({"name": name, "start": clock(),
+                            "seconds": 0.0, "data": 0,
+                            "out": [0, []], "in": [0, []]})
+
+    def stop(self):
+        """ ends the current phase """
+        now = clock()
+        if self.phases and self.stopped is None:
+            self.phases[-1]["seconds"] = now - self.phases[-1]["start"]
+        self.stopped = now
+
+    def packet(self, direction, nbytes, seconds):
+        """ counts a packet of the current phase, direction "out" or "in" """
+        if self.phases:
+            counters = self.phases[-1][direction]
+            counters[0] = counters[0] + nbytes
+            counters[1].append(seconds)
+
+    def data(self, nbytes):
+        """ counts nbytes of program or EEPROM data of the current phase """
+        if self.phases:
+            self.phases[-1]["data"] = self.phases[-1]["data"] + nbytes
+
+    def attach(self, handle):
+        """ times the packets of the handle, returns it """
+
+        def timed(method, direction):
+            def call(endpoint, arg, timeout):
+                start = clock()
+                result = method(endpoint, arg, timeout)
+                nbytes = result if direction == "out" else len(result)
+                self.packet(direction, nbytes, clock() - start)
+                return result
+            return call
+
+        if PYUSB_USE_CORE:
+            names = ("write", "read")
+        else:
+            names = ("bulkWrite", "bulkRead")
+        setattr(handle, names[0], timed(getattr(handle, names[0]), "out"))
+        setattr(handle, names[1], timed(getattr(handle, names[1]), "in"))
+        return handle
+
+    @staticmethod
+    def latency(seconds):
+        """ min., avg., 95th percentile, max. and histogram, in us """
+        us = sorted([s * 1e6 for s in seconds])
+        histogram = [0] * (len(TIMING_BUCKETS) + 1)
+        for t in us:
+            histogram[bisect.bisect_right(TIMING_BUCKETS, t)] += 1
+        if not us:
+            return {"count": 0, "histogram": histogram}
+        return {"count": len(us), "min_us": us[0],
+                "avg_us": sum(us) / len(us),
+                "p95_us": us[min(len(us) - 1, int(len(us) * 0.95))],
+                "max_us": us[-1], "histogram": histogram}
+
+    def results(self):
+        """ returns the figures as a dict """
+        self.stop()
+        phases = []
+        out, inp = [], []
+        for p in self.phases:
+            out.extend(p["out"][1])
+            inp.extend(p["in"][1])
+            phase = {"name": p["name"],
+                     "start_s": p["start"] - self.started,
+                     "seconds": p["seconds"],
+                     "out": dict(self.latency(p["out"][1]), bytes=p["out"][0]),
+                     "in": dict(self.latency(p["in"][1]), bytes=p["in"][0])}
+            if p["data"]:
+                phase["data_bytes"] = p["data"]
+                phase["data_bytes_per_s"] = p["data"] / p["seconds"] if p["seconds"] else None
+            phases.append(phase)
+        return {"info": self.info,
+                "buckets_us": list(TIMING_BUCKETS),
+                "total_s": self.stopped - self.started,
+                "phases": phases,
+                "out": self.latency(out),
+                "in": self.latency(inp)}
+
+    def summary(self, results):
+        """ prints the figures """
+        print("Timing (monotonic clock)")
+        print("  %-10s %10s %8s %9s %12s %22s" % ("phase", "ms", "packets",
+              "bytes", "data B/s", "latency us avg/max"))
+        for p in results["phases"]:
+            count = p["out"]["count"] + p["in"]["count"]
+            rate = p.get("data_bytes_per_s")
+            latency = ""
+            if count:
+                worst = max(p["out"].get("max_us", 0), p["in"].get("max_us", 0))
+                avg = (p["out"].get("avg_us", 0) * p["out"]["count"] +
+                       p["in"].get("avg_us", 0) * p["in"]["count"]) / count
+                latency = "%.0f/%.0f" % (avg, worst)
+            print("  %-10s %10.1f %8d %9d %12s %22s" % (p["name"],
+                  p["seconds"] * 1000, count, p["out"]["bytes"] + p["in"]["bytes"],
+                  "%.0f" % rate if rate else "", latency))
+        print("  %-10s %10.1f" % ("total", results["total_s"] * 1000))
+        labels = ["<%d" % b for b in TIMING_BUCKETS] + [">=%d" % TIMING_BUCKETS[-1]]
+        print("  %-10s %s" % ("latency us", " ".join(["%6s" % l for l in labels])))
+        for direction in ("out", "in"):
+            print("  %-10s %s" % (direction, " ".join(["%6d" % n
+                  for n in results[direction]["histogram"]])))
+
+    def report(self, filename, summary):
+        """ prints and/or writes the figures to a .json file """
+        if not self.phases:
+            return
+        results = self.results()
+        if summary:
+            self.summary(results)
+        if filename:
+            fichier = open(filename, 'w')
+            json.dump(results, fichier, indent=4)
+            fichier.write("\n")
+            fichier.close()
+
+# ----------------------------------------------------------------------
+def timingPhase(name):
+# ----------------------------------------------------------------------
+    """ starts a timed phase if --timing or --timing-json was given """
+
+    if TIMING is not None:
+        TIMING.phase(name)
+
 # ----------------------------------------------------------------------
 def initDevice(device):
 # ----------------------------------------------------------------------
-    """ init pinguino device """
+    """ init pinguino device, raises UploaderError if it can't be
+        claimed """
     
     if PYUSB_USE_CORE:
         if os.getenv("PINGUINO_OS_NAME") == "linux":
             try:
                 active = device.is_kernel_driver_active(INTERFACE_ID)
             except usb.core.USBError as e:
-                sys.exit("Aborting: could not detach kernel driver: %s" % str(e))
+                raise UploaderError(ERR_USB_INIT2, "could not detach kernel driver: %s" % str(e))
 
             if active :
                 #print("Kernel driver detached")
                 try:
                     device.detach_kernel_driver(INTERFACE_ID)
                 except usb.core.USBError as e:
-                    sys.exit("Aborting: could not detach kernel driver: %s" % str(e))
+                    raise UploaderError(ERR_USB_INIT2, "could not detach kernel driver: %s" % str(e))
             #else:
                 #print("No kernel driver attached")
 
@@ -301,12 +839,12 @@ def initDevice(device):
         try:
             device.set_configuration(ACTIVE_CONFIG)
         except usb.core.USBError as e:
-            sys.exit("Aborting: could not set configuration: %s" % str(e))
+            raise UploaderError(ERR_USB_INIT2, "could not set configuration: %s" % str(e))
 
         try:
             usb.util.claim_interface(device, INTERFACE_ID)
         except usb.core.USBError as e:
-            sys.exit("Aborting: could not claim interface: %s" % str(e))
+            raise UploaderError(ERR_USB_INIT2, "could not claim interface: %s" % str(e))
 
         return device
 
@@ -323,7 +861,7 @@ def initDevice(device):
             try:
                 handle.setConfiguration(ACTIVE_CONFIG)
             except:
-                sys.exit("Aborting: could not set configuration")
+                raise UploaderError(ERR_USB_INIT2, "could not set configuration")
             try:
                 handle.claimInterface(INTERFACE_ID)
             except:
@@ -337,7 +875,9 @@ def closeDevice(handle):
 # ----------------------------------------------------------------------
     """ Close currently-open USB device """
 
-    if PYUSB_USE_CORE:
+    if isinstance(handle, SerialHandle):
+        handle.close()
+    elif PYUSB_USE_CORE:
         usb.util.release_interface(handle, INTERFACE_ID)
     else:
         handle.releaseInterface()
@@ -394,6 +934,61 @@ def getVersion(handle):
         return  str(usbBuf[BOOT_VER_MAJOR]) + "." + \
                 str(usbBuf[BOOT_VER_MINOR])
 
+# ----------------------------------------------------------------------
+def getMemStart(handle, proc):
+# ----------------------------------------------------------------------
+    """ get the user application address (APPSTART)
+        returned with the version since v5.2 """
+
+    usbBuf = [0] * MAXPACKETSIZE
+    # command code
+    usbBuf[BOOT_CMD] = READ_VERSION_CMD
+    # write data packet and get response
+    usbBuf = sendCommand(handle, usbBuf)
+    if usbBuf != ERR_USB_WRITE and len(usbBuf) > BOOT_APPSTART_HI:
+        return usbBuf[BOOT_APPSTART_LO] | (usbBuf[BOOT_APPSTART_HI] << 8)
+
+    # older bootloaders
+    if ("16f" in proc):
+        return 0x800
+    else:
+        return 0xC00
+
+# ----------------------------------------------------------------------
+def getFeatures(handle):
+# ----------------------------------------------------------------------
+    """ get the optional commands of the bootloader (BOOT_FEATURE_xxx)
+        returned with the version since v5.2 """
+
+    usbBuf = [0] * MAXPACKETSIZE
+    # command code
+    usbBuf[BOOT_CMD] = READ_VERSION_CMD
+    # write data packet and get response
+    usbBuf = sendCommand(handle, usbBuf)
+    if usbBuf != ERR_USB_WRITE and len(usbBuf) > BOOT_FEATURES:
+        return usbBuf[BOOT_FEATURES]
+
+    # older bootloaders
+    return 0
+
+# ----------------------------------------------------------------------
+def getManifest(filename, proc):
+# ----------------------------------------------------------------------
+    """ APPSTART of the bootloader build, from the .json manifest
+        written by "make auto" (cf. tools/appstart.py) """
+
+    try:
+        fichier = open(filename, 'r')
+        manifest = json.load(fichier)
+        fichier.close()
+    except (IOError, ValueError):
+        return None
+
+    if manifest.get("cpu") != proc:
+        return None
+
+    return manifest.get("appstart")
+
 # ----------------------------------------------------------------------
 def getDeviceID(handle, proc):
 # ----------------------------------------------------------------------
@@ -444,6 +1039,16 @@ def getDeviceFlash(device_id):
             return devices_table[n][1]            
     return ERR_DEVICE_NOT_FOUND
 
+# ----------------------------------------------------------------------
+def getDeviceEeprom(device_id):
+# ----------------------------------------------------------------------
+    """ get data EEPROM size """
+
+    for n in devices_table:
+        if n == device_id:
+            return devices_table[n][2]
+    return 0
+
 # ----------------------------------------------------------------------
 def getDeviceName(device_id):
 # ----------------------------------------------------------------------
@@ -493,6 +1098,118 @@ def readFlash(handle, address, length):
     # send request to the bootloader
     return sendCommand(handle, usbBuf)
 
+# ----------------------------------------------------------------------
+def readEeprom(handle, address, length):
+# ----------------------------------------------------------------------
+    """ read up to EEBLOCKSIZE bytes of data EEPROM """
+
+    usbBuf = [0] * MAXPACKETSIZE
+    # command code
+    usbBuf[BOOT_CMD] = READ_EEDATA_CMD
+    # size of block
+    usbBuf[BOOT_CMD_LEN] = length
+    # address
+    usbBuf[BOOT_ADDR_LO] = address & 0xFF
+    # send request to the bootloader
+    return sendCommand(handle, usbBuf)
+
+# ----------------------------------------------------------------------
+def writeEeprom(handle, address, datablock):
+# ----------------------------------------------------------------------
+    """ write up to EEBLOCKSIZE bytes of data EEPROM
+        the bootloader replies once the first byte is being written,
+        the next ones are written while the next packet is on its way """
+
+    usbBuf = [0xFF] * MAXPACKETSIZE
+    # command code
+    usbBuf[BOOT_CMD] = WRITE_EEDATA_CMD
+    # size of block
+    usbBuf[BOOT_CMD_LEN] = len(datablock)
+    # address
+    usbBuf[BOOT_ADDR_LO] = address & 0xFF
+    # add data to the packet
+    usbBuf[BOOT_DATA_START:BOOT_DATA_START + len(datablock)] = datablock
+    # send request to the bootloader
+    return sendCommand(handle, usbBuf)
+
+# ----------------------------------------------------------------------
+def readTrace(handle, offset, length):
+# ----------------------------------------------------------------------
+    """ read a block of the trace buffer (cf. trace8.py) """
+
+    usbBuf = [0] * MAXPACKETSIZE
+    # command code
+    usbBuf[BOOT_CMD] = READ_TRACE_CMD
+    # size of block
+    usbBuf[BOOT_CMD_LEN] = length
+    # offset in the trace buffer
+    usbBuf[BOOT_ADDR_LO] = offset & 0xFF
+    # send request to the bootloader
+    return sendCommand(handle, usbBuf)
+
+# ----------------------------------------------------------------------
+def dumpFlash(handle, address, length):
+# ----------------------------------------------------------------------
+    """ read length bytes (multiple of MAXPACKETSIZE) of flash
+        the bootloader streams them without any command header """
+
+    numPackets = length // MAXPACKETSIZE
+
+    usbBuf = [0] * MAXPACKETSIZE
+    # command code
+    usbBuf[BOOT_CMD] = DUMP_FLASH_CMD
+    # address
+    usbBuf[BOOT_ADDR_LO] = (address      ) & 0xFF
+    usbBuf[BOOT_ADDR_HI] = (address >> 8 ) & 0xFF
+    usbBuf[BOOT_ADDR_UP] = (address >> 16) & 0xFF
+    # number of packets to stream
+    usbBuf[BOOT_DATA_START + 0] = (numPackets     ) & 0xFF
+    usbBuf[BOOT_DATA_START + 1] = (numPackets >> 8) & 0xFF
+
+    data = []
+    try:
+        if PYUSB_USE_CORE:
+            handle.write(OUT_EP, usbBuf, TIMEOUT)
+        else:
+            handle.bulkWrite(OUT_EP, usbBuf, TIMEOUT)
+
+        while len(data) < length:
+            size = min(length - len(data), DUMPCHUNKSIZE)
+            if PYUSB_USE_CORE:
+                data.extend(handle.read(IN_EP, size, TIMEOUT))
+            else:
+                data.extend(handle.bulkRead(IN_EP, size, TIMEOUT))
+
+    except Exception as e:
+        print(e)
+        return ERR_USB_READ
+
+    return data
+
+# ----------------------------------------------------------------------
+def hexDump(filename, data, address):
+# ----------------------------------------------------------------------
+    """ write data to an Intel Hex file, from (byte) address """
+
+    def record(record_type, offset, payload):
+        line = [len(payload), (offset >> 8) & 0xFF, offset & 0xFF, record_type] + payload
+        checksum = (0x100 - (sum(line) & 0xFF)) & 0xFF
+        return ":" + "".join(["%02X" % b for b in line + [checksum]]) + "\n"
+
+    address_Hi = -1
+    hexfile = open(filename, 'w')
+
+    for i in range(0, len(data), 16):
+        if ((address + i) >> 16) != address_Hi:
+            address_Hi = (address + i) >> 16
+            hexfile.write(record(Extended_Linear_Address_Record, 0,
+                                 [(address_Hi >> 8) & 0xFF, address_Hi & 0xFF]))
+        hexfile.write(record(Data_Record, (address + i) & 0xFFFF,
+                             [int(b) for b in data[i:i+16]]))
+
+    hexfile.write(record(End_Of_File_Record, 0, []))
+    hexfile.close()
+
 # ----------------------------------------------------------------------
 def writeFlash(handle, address, datablock):
 # ----------------------------------------------------------------------
@@ -524,9 +1241,39 @@ def writeFlash(handle, address, datablock):
     #return sendCommand(handle, usbBuf)
 
 # ----------------------------------------------------------------------
-def hexWrite(handle, filename, proc, memstart, memend):
+def getBlockSizes(proc):
 # ----------------------------------------------------------------------
-    """     Parse the Hex File Format and send data to usb device
+    """ returns the write and erase block sizes in bytes """
+
+    # size of write block
+    # ------------------------------------------------------------------
+
+    if   "13k50" in proc :
+        writeBlockSize = 8
+    elif "14k50" in proc :
+        writeBlockSize = 16
+    else :
+        writeBlockSize = 32
+
+    # size of erase block
+    # --------------------------------------------------------------
+
+    # Pinguino x6j50 or x7j53, erased blocks are 1024-byte long
+    if ("j" in proc):
+        eraseBlockSize = 1024
+
+    # Pinguino x455, x550 or x5k50, erased blocks are 64-byte long
+    else:
+        eraseBlockSize = 64
+
+    return writeBlockSize, eraseBlockSize
+
+# ----------------------------------------------------------------------
+def hexRead(filename, proc, memstart, memend):
+# ----------------------------------------------------------------------
+    """     Parse the Hex File Format, returns the program image
+            (min_address, max_address, data, codesize) with the
+            addresses of the file, or an ERR_HEX_xxx code
 
     [0]     Start code, one character, an ASCII colon ':'.
     [1:3]   Byte count, two hex digits.
@@ -574,27 +1321,7 @@ def hexWrite(handle, filename, proc, memstart, memend):
     address_Hi  = 0
     codesize    = 0
 
-    # size of write block
-    # ------------------------------------------------------------------
-
-    if   "13k50" in proc :
-        writeBlockSize = 8
-    elif "14k50" in proc :
-        writeBlockSize = 16
-    else :
-        writeBlockSize = 32
-
-    # size of erase block
-    # --------------------------------------------------------------
-
-    # Pinguino x6j50 or x7j53, erased blocks are 1024-byte long
-    if ("j" in proc):
-        eraseBlockSize = 1024
-
-    # Pinguino x455, x550 or x5k50, erased blocks are 64-byte long
-    else:
-        eraseBlockSize = 64
-
+    writeBlockSize, eraseBlockSize = getBlockSizes(proc)
     #print("eraseBlockSize = %d" % eraseBlockSize
 
     # image of the whole PIC memory (above memstart)
@@ -606,9 +1333,12 @@ def hexWrite(handle, filename, proc, memstart, memend):
     # read hex file
     # ------------------------------------------------------------------
 
-    hexfile = open(filename,'r')
-    lines = hexfile.readlines()
-    hexfile.close()
+    try:
+        hexfile = open(filename,'r')
+        lines = hexfile.readlines()
+        hexfile.close()
+    except IOError:
+        return ERR_HEX_OPEN
 
     # calculate checksum, code size and memmax
     # ------------------------------------------------------------------
@@ -691,11 +1421,26 @@ def hexWrite(handle, filename, proc, memstart, memend):
     #print("min_address = 0x%X" % min_address
     #print("max_address = 0x%X" % max_address
 
+    return min_address, max_address, data, codesize
+
+# ----------------------------------------------------------------------
+def hexErase(handle, proc, memstart, memend, max_address):
+# ----------------------------------------------------------------------
+    """ erase the flash memory from memstart to max_address,
+        an address of the hex file (doubled on PIC16F) """
+
+    # Addresses are doubled in the PIC16F HEX file
+    if ("16f" in proc):
+        memstart = memstart * 2
+        memend   = memend   * 2
+
+    writeBlockSize, eraseBlockSize = getBlockSizes(proc)
+
     # erase memory from memstart to max_address 
     # ------------------------------------------------------------------
 
-    numBlocksMax = (memend - memstart) / eraseBlockSize
-    numBlocks    = (max_address - memstart) / eraseBlockSize
+    numBlocksMax = (memend - memstart) // eraseBlockSize
+    numBlocks    = (max_address - memstart) // eraseBlockSize
     #print("memend = %d" % memend
     #print("memmax = %d" % memmax
     #print("memstart = %d" % memstart
@@ -723,6 +1468,16 @@ def hexWrite(handle, filename, proc, memstart, memend):
         if status == ERR_USB_WRITE:
             return ERR_USB_WRITE
 
+    return ERR_NONE
+
+# ----------------------------------------------------------------------
+def hexProgram(handle, proc, image):
+# ----------------------------------------------------------------------
+    """ write the program image returned by hexRead() """
+
+    min_address, max_address, data, codesize = image
+    writeBlockSize, eraseBlockSize = getBlockSizes(proc)
+
     # write blocks of writeBlockSize bytes
     # ------------------------------------------------------------------
 
@@ -730,7 +1485,7 @@ def hexWrite(handle, filename, proc, memstart, memend):
         index = addr8 - min_address
         # the addresses are doubled in the PIC16F HEX file
         if ("16f" in proc):
-            addr16 = addr8 / 2
+            addr16 = addr8 // 2
             status = writeFlash(handle, addr16, data[index:index+writeBlockSize])
             if status == ERR_USB_WRITE:
                 return ERR_USB_WRITE
@@ -742,15 +1497,384 @@ def hexWrite(handle, filename, proc, memstart, memend):
                 return ERR_USB_WRITE
             #print("0x%X  [%s]" % (addr8, data[index:index+writeBlockSize])
 
-    data[:] = []    # clear the list
+    return ERR_NONE
+
+# ----------------------------------------------------------------------
+def hexEeprom(filename, eesize):
+# ----------------------------------------------------------------------
+    """ returns the data EEPROM bytes {address: byte} of a hex file,
+        found from EEPROM_HEX_ADDRESS on, or an ERR_xxx code """
 
-    print("%d bytes written" % codesize)
+    eedata = {}
+    address_Hi = 0
+
+    try:
+        hexfile = open(filename, 'r')
+        lines = hexfile.readlines()
+        hexfile.close()
+    except IOError:
+        return ERR_HEX_OPEN
+
+    for line in lines:
+
+        line = line.strip()
+        if not line.startswith(':'):
+            continue
+
+        record = [int(line[i:i+2], 16) for i in range(1, len(line), 2)]
+        if sum(record) & 0xFF:
+            return ERR_HEX_CHECKSUM
+
+        byte_count  = record[0]
+        address_Lo  = (record[1] << 8) | record[2]
+        record_type = record[3]
+
+        if record_type == Extended_Linear_Address_Record:
+            address_Hi = ((record[4] << 8) | record[5]) << 16
+
+        elif record_type == Data_Record:
+            for i in range(byte_count):
+                address = address_Hi + address_Lo + i - EEPROM_HEX_ADDRESS
+                if 0 <= address < eesize:
+                    eedata[address] = record[4 + i]
+
+        elif record_type == End_Of_File_Record:
+            break
+
+    return eedata
+
+# ----------------------------------------------------------------------
+def eepromWrite(handle, eedata):
+# ----------------------------------------------------------------------
+    """ write then read back the data EEPROM bytes {address: byte},
+        up to EEBLOCKSIZE consecutive bytes per packet """
+
+    blocks = []
+    for address in sorted(eedata):
+        if blocks and address == blocks[-1][0] + len(blocks[-1][1]) \
+                  and len(blocks[-1][1]) < EEBLOCKSIZE:
+            blocks[-1][1].append(eedata[address])
+        else:
+            blocks.append((address, [eedata[address]]))
+
+    for address, datablock in blocks:
+        if writeEeprom(handle, address, datablock) == ERR_USB_WRITE:
+            return ERR_USB_WRITE
+    if TIMING is not None:
+        TIMING.data(len(eedata))
+
+    timingPhase("verify")
+
+    for address, datablock in blocks:
+        usbBuf = readEeprom(handle, address, len(datablock))
+        if usbBuf == ERR_USB_WRITE:
+            return ERR_USB_WRITE
+        if [int(b) for b in usbBuf[BOOT_DATA_START:BOOT_DATA_START + len(datablock)]] != datablock:
+            return ERR_VERIFY
 
     return ERR_NONE
 
 # ----------------------------------------------------------------------
+class UploaderError(Exception):
 # ----------------------------------------------------------------------
-def main(mcu, filename):
+    """ raised by Session and initDevice(), code is one of the ERR_xxx
+        codes above """
+
+    def __init__(self, code, message):
+        Exception.__init__(self, message)
+        self.code = code
+
+# ----------------------------------------------------------------------
+class Session(object):
+# ----------------------------------------------------------------------
+    """ a bootloader found and claimed once, for any number of
+        operations on the same handle, e.g. :
+
+            import uploader8
+            with uploader8.Session() as session:
+                session.open()
+                session.query("18f4550")
+                session.write("Blink4550.hex")
+                session.verify("Blink4550.hex")
+                session.writeEeprom({0x00: 0x42})
+                session.reset()
+
+        The errors raise UploaderError, the USB ones usb.core.USBError
+        as pyusb does. query() sets proc, device_id, device_rev,
+        memstart and memend (APPSTART and the flash size, word
+        addresses on PIC16F), eesize, version and features. """
+
+    def __init__(self):
+        self.handle     = None
+        self.cached     = None      # (filename, mtime), image
+        self.appid      = None      # application (vendor, product), --auto
+        self.proc       = None
+        self.device_id  = None
+        self.device_rev = None
+        self.memstart   = None
+        self.memend     = None
+        self.eesize     = 0
+        self.version    = None
+        self.features   = 0
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def claimed(self):
+        """ returns the handle, raises if the session is not open """
+        if self.handle is None:
+            raise UploaderError(ERR_USB_OPEN, "no bootloader open")
+        return self.handle
+
+    def queried(self):
+        """ raises if query() was not called """
+        self.claimed()
+        if self.proc is None:
+            raise UploaderError(ERR_CMD_ARG, "device not queried")
+
+    def open(self, wait=0, auto=False, uart=None, baudrate=UART_SYNC_BAUDRATE):
+        """ finds the bootloader and claims it : on USB for up to wait s,
+            after a reset of the running application if auto is set, or
+            on the uart serial port. auto is True for the known Pinguino
+            applications (APP_IDS), or the --device selector of another
+            one, VID:PID or bus-port (cf. parseSelector). """
+
+        timingPhase("discovery")
+
+        if uart is not None:
+            try:
+                self.handle = SerialHandle(uart, baudrate)
+            except ImportError:
+                raise UploaderError(ERR_USB_OPEN, "--uart needs pyserial")
+            except (IOError, OSError, ValueError) as e:
+                raise UploaderError(ERR_USB_OPEN, str(e))
+            if TIMING is not None:
+                TIMING.info["port"] = uart
+                TIMING.info["baudrate"] = baudrate
+                TIMING.attach(self.handle)
+            return
+
+        selector = None
+        if auto is not True and auto:
+            if parseSelector(auto) is None:
+                raise UploaderError(ERR_CMD_ARG, "bad device selector %s" % auto)
+            selector = auto
+
+        device = waitDevice(VENDOR_ID, PRODUCT_ID, wait)
+        if device == ERR_DEVICE_NOT_FOUND and auto:
+            device, self.appid = autoReset(VENDOR_ID, PRODUCT_ID, selector)
+        if device == ERR_DEVICE_NOT_FOUND:
+            raise UploaderError(ERR_DEVICE_NOT_FOUND, "Pinguino not found. " \
+                "Is your device connected and/or in bootloader mode ?")
+
+        timingPhase("init")
+        handle = initDevice(device)
+        if handle == ERR_USB_INIT1:
+            raise UploaderError(ERR_USB_INIT1, "upload is not possible. " \
+                "Press the Reset button and try again.")
+        self.handle = handle
+
+        if TIMING is not None:
+            port = devicePort(device)
+            if port:
+                TIMING.info["port"] = port
+            TIMING.attach(self.handle)
+
+    def close(self):
+        """ releases the bootloader, if still open """
+        if self.handle is not None:
+            closeDevice(self.handle)
+            self.handle = None
+
+    def query(self, mcu=None, manifest=None):
+        """ reads the device ID, APPSTART and the bootloader version.
+            mcu is the expected PIC (e.g. "18f4550"), any PIC18F or
+            PIC16F if None. manifest is the .json file of a bootloader
+            built with "make auto", for the versions before v5.2 """
+
+        handle = self.claimed()
+        timingPhase("id")
+
+        # the device ID is not at the same place on PIC16F and PIC18F
+        if mcu is not None:
+            mcu = mcu.lower()
+        for family in ([mcu] if mcu else ["18f", "16f"]):
+            device_id, device_rev = getDeviceID(handle, family)
+            if device_id == ERR_USB_WRITE:
+                raise UploaderError(ERR_USB_WRITE, "unknown device ID")
+            proc = getDeviceName(device_id)
+            if proc != ERR_DEVICE_NOT_FOUND:
+                break
+
+        if proc == ERR_DEVICE_NOT_FOUND:
+            raise UploaderError(ERR_DEVICE_NOT_FOUND, "unknown PIC (id=0x%X)" % device_id)
+        if mcu is not None and proc != mcu:
+            raise UploaderError(ERR_DEVICE_NOT_FOUND,
+                "program compiled for %s but device has %s" % (mcu, proc))
+
+        version = getVersion(handle)
+        if version == ERR_USB_WRITE:
+            raise UploaderError(ERR_USB_WRITE, "unable to read the version")
+
+        # lower limit of the flash memory (bootloader offset)
+        memstart = getMemStart(handle, proc)
+
+        # bootloader built with "make auto"
+        if manifest is not None:
+            appstart = getManifest(manifest, proc)
+            if appstart is None:
+                raise UploaderError(ERR_CMD_ARG,
+                    "%s is not a manifest for %s" % (manifest, proc))
+            elif [int(v) for v in version.split(".")] < [5, 2]:
+                # the bootloader doesn't return APPSTART
+                memstart = appstart
+            elif appstart != memstart:
+                raise UploaderError(ERR_CMD_ARG,
+                    "manifest APPSTART 0x%X but device has 0x%X" % (appstart, memstart))
+
+        self.proc       = proc
+        self.device_id  = device_id
+        self.cached     = None
+        self.device_rev = device_rev
+        self.memstart   = memstart
+        self.memend     = getDeviceFlash(device_id)
+        self.eesize     = getDeviceEeprom(device_id)
+        self.version    = version
+        self.features   = getFeatures(handle)
+
+        if TIMING is not None:
+            TIMING.info["proc"] = proc
+            TIMING.info["version"] = version
+
+    def image(self, filename):
+        """ returns the program image of a hex file, cf. hexRead(),
+            parsed once per session """
+
+        self.queried()
+        try:
+            key = (filename, os.path.getmtime(filename))
+        except OSError:
+            raise UploaderError(ERR_HEX_OPEN, "unable to open %s" % filename)
+        if self.cached is not None and self.cached[0] == key:
+            return self.cached[1]
+
+        timingPhase("parse")
+        image = hexRead(filename, self.proc, self.memstart, self.memend)
+        if image == ERR_HEX_OPEN:
+            raise UploaderError(image, "unable to open %s" % filename)
+        elif image == ERR_HEX_CHECKSUM:
+            raise UploaderError(image, "checksum error")
+        elif image == ERR_HEX_RECORD:
+            raise UploaderError(image, "record error")
+        self.cached = key, image
+        return image
+
+    def erase(self, end=None):
+        """ erases the flash memory from APPSTART up to end, an address
+            of the hex file (doubled on PIC16F), the whole of it by
+            default """
+
+        self.queried()
+        timingPhase("erase")
+        if end is None:
+            end = self.memend * 2 if "16f" in self.proc else self.memend
+        status = hexErase(self.handle, self.proc, self.memstart, self.memend, end)
+        if status != ERR_NONE:
+            raise UploaderError(ERR_USB_ERASE, "erase error")
+
+    def write(self, filename):
+        """ erases the flash memory the program needs, writes it and
+            returns its size in bytes """
+
+        image = self.image(filename)
+        self.erase(image[1])
+        timingPhase("write")
+        if hexProgram(self.handle, self.proc, image) != ERR_NONE:
+            raise UploaderError(ERR_USB_WRITE, "write error")
+        if TIMING is not None:
+            TIMING.data(image[3])
+        return image[3]
+
+    def dump(self, address, length):
+        """ returns length bytes of flash (multiple of MAXPACKETSIZE)
+            from address (word address on PIC16F) """
+
+        if [int(v) for v in self.version.split(".")] < [5, 1]:
+            raise UploaderError(ERR_CMD_UNKNOWN,
+                "reading the flash needs bootloader v5.1 or later")
+        data = dumpFlash(self.handle, address, length)
+        if data == ERR_USB_READ:
+            raise UploaderError(ERR_USB_READ, "read error")
+        if TIMING is not None:
+            TIMING.data(len(data))
+        return data
+
+    def read(self, address=0, length=None):
+        """ returns length bytes of flash (multiple of MAXPACKETSIZE)
+            from address (word address on PIC16F), the whole flash
+            memory by default (2 bytes per word on PIC16F) """
+
+        self.queried()
+        timingPhase("read")
+        if length is None:
+            length = self.memend * 2 if "16f" in self.proc else self.memend
+        return self.dump(address, length)
+
+    def verify(self, filename):
+        """ reads the program back (v5.1, BOOT_USE_DUMP) and compares
+            it with the hex file """
+
+        min_address, max_address, data, codesize = self.image(filename)
+        timingPhase("verify")
+        pic16 = "16f" in self.proc
+
+        # whole packets, from a byte address of the hex file
+        start  = min_address - min_address % MAXPACKETSIZE
+        length = max_address - start
+        length = length + (-length % MAXPACKETSIZE)
+        flash  = self.dump(start // 2 if pic16 else start, length)
+
+        for address in range(min_address, max_address):
+            expected = data[address - min_address]
+            actual = int(flash[address - start])
+            # 14-bit words on PIC16F
+            if pic16 and address & 1:
+                expected, actual = expected & 0x3F, actual & 0x3F
+            if expected != actual:
+                raise UploaderError(ERR_VERIFY, "verify error at 0x%05X" %
+                                    (address // 2 if pic16 else address))
+
+    def writeEeprom(self, eedata):
+        """ writes then reads back the data EEPROM bytes {address: byte}
+            (BOOT_USE_EEPROM) """
+
+        self.queried()
+        if not (self.features & BOOT_FEATURE_EEPROM):
+            raise UploaderError(ERR_CMD_UNKNOWN,
+                "EEPROM data needs a bootloader built with BOOT_USE_EEPROM")
+        timingPhase("eeprom")
+        status = eepromWrite(self.handle, eedata)
+        if status == ERR_VERIFY:
+            raise UploaderError(status, "EEPROM verify error")
+        elif status != ERR_NONE:
+            raise UploaderError(status, "EEPROM write error")
+
+    def reset(self):
+        """ starts the user application, the session is over : the
+            device has gone, its interface can't be released """
+
+        handle = self.claimed()
+        timingPhase("reset")
+        resetDevice(handle)
+        self.handle = None
+
+# ----------------------------------------------------------------------
+# ----------------------------------------------------------------------
+def main(mcu, filename, dump=False, manifest=None, wait=0, auto=False,
+         uart=None, baudrate=UART_SYNC_BAUDRATE, eeprom=None):
 # ----------------------------------------------------------------------
 # ----------------------------------------------------------------------
 
@@ -758,110 +1882,119 @@ def main(mcu, filename):
     # ------------------------------------------------------------------
 
     if filename == '':
-        closeDevice(handle)
         sys.exit("Aborting: no program to write")
 
-    hexfile = open(filename, 'r')
-    if hexfile == "":
-        sys.exit("Aborting: unable to open %s" % filename)
+    if not dump:
+        hexfile = open(filename, 'r')
+        if hexfile == "":
+            sys.exit("Aborting: unable to open %s" % filename)
 
-    hexfile.close()
+        hexfile.close()
+
+    # the session is closed by any sys.exit() below
+    with Session() as session:
+        try:
+            upload(session, mcu, filename, dump, manifest, wait, auto,
+                   uart, baudrate, eeprom)
+        except UploaderError as e:
+            sys.exit("Aborting: %s" % str(e))
+
+# ----------------------------------------------------------------------
+def upload(session, mcu, filename, dump, manifest, wait, auto,
+           uart, baudrate, eeprom):
+# ----------------------------------------------------------------------
+    """ the steps of main(), with an open session """
 
     # search for a Pinguino board
     # ------------------------------------------------------------------
 
-    print("Looking for a Pinguino board ...")
-    device = getDevice(VENDOR_ID, PRODUCT_ID)
-    if device == ERR_DEVICE_NOT_FOUND:
-        sys.exit("Aborting: Pinguino not found. Is your device connected and/or in bootloader mode ?")
+    if uart is not None:
+        print("Looking for a Pinguino board on %s ..." % uart)
     else:
-        print("Pinguino found ...")
+        print("Looking for a Pinguino board ...")
 
-    handle = initDevice(device)
-    #print(handle)
-    if handle == ERR_USB_INIT1:
-        print("... but upload is not possible.")
-        print("Press the Reset button and try again.")
-        sys.exit(0)
+    session.open(wait, auto, uart, baudrate)
 
-    # find out the processor
-    # ------------------------------------------------------------------
-
-    mcu = mcu.lower()
-    device_id, device_rev = getDeviceID(handle, mcu)
-    if device_id == ERR_USB_WRITE:
-        closeDevice(handle)
-        sys.exit("Aborting: unknown device ID")
-        
-    proc = getDeviceName(device_id)
-    if proc == ERR_DEVICE_NOT_FOUND:
-        closeDevice(handle)
-        sys.exit("Aborting: unknown PIC (id=0x%X)" % device_id)
+    if uart is not None:
+        print("Pinguino found at %d bauds ..." % baudrate)
+    else:
+        print("Pinguino found ...")
 
-    elif proc != mcu:
-        closeDevice(handle)
-        sys.exit("Aborting: program compiled for %s but device has %s" % (mcu, proc))
+    # find out the processor, the flash memory and bootloader version
+    # ------------------------------------------------------------------
 
-    else:
-        print(" - with PIC%s (id=0x%X, rev=%x)" % (proc, device_id, device_rev))
+    session.query(mcu, manifest)
+    print(" - with PIC%s (id=0x%X, rev=%x)" % (session.proc,
+          session.device_id, session.device_rev))
 
+    memfree = session.memend - session.memstart
+    print(" - with %d bytes free (%.2f/%d KB)" % (memfree, memfree/1024, session.memend/1024))
+    print("   from 0x%05X to 0x%05X" % (session.memstart, session.memend))
+    print(" - with USB bootloader v%s" % session.version)
 
-    # find out flash memory size
+    # read the whole flash memory back
     # ------------------------------------------------------------------
 
-    # lower limit of the flash memory (bootloader offset)
-    # TODO : get it from the bootloader (cf. APPSTART)
-    if ("16f" in proc):
-        memstart = 0x800
-    else:
-        memstart = 0xC00
+    if dump:
+        print("Reading flash memory ...")
+        data = session.read()
+        hexDump(filename, data, 0)
+        print("%d bytes written to %s" % (len(data), os.path.basename(filename)))
+        return
 
-    # upper limit of the flash memory
-    memend  = getDeviceFlash(device_id)
-    memfree = memend - memstart;
-    print(" - with %d bytes free (%.2f/%d KB)" % (memfree, memfree/1024, memend/1024))
-    print("   from 0x%05X to 0x%05X" % (memstart, memend))
-
-    # find out bootloader version
+    # data EEPROM, from the program and the --eeprom file
     # ------------------------------------------------------------------
 
-    #product = handle.getString(device.iProduct, 30)
-    #manufacturer = handle.getString(device.iManufacturer, 30)
-    print(" - with USB bootloader v%s" % getVersion(handle))
+    eedata = {}
+    for name in [filename] + ([eeprom] if eeprom is not None else []):
+        more = hexEeprom(name, session.eesize)
+        if not isinstance(more, dict):
+            raise UploaderError(more, "unable to read the EEPROM data of %s" % name)
+        if name == eeprom and not more:
+            raise UploaderError(ERR_CMD_ARG,
+                "no EEPROM data for PIC%s in %s" % (session.proc, name))
+        eedata.update(more)
+
+    if eedata and not (session.features & BOOT_FEATURE_EEPROM):
+        if eeprom is not None:
+            raise UploaderError(ERR_CMD_ARG,
+                "--eeprom needs a bootloader built with BOOT_USE_EEPROM")
+        print(" - EEPROM data ignored, bootloader built without BOOT_USE_EEPROM")
+        eedata = {}
 
     # start writing
     # ------------------------------------------------------------------
 
     print("Uploading user program ...")
-    status = hexWrite(handle, filename, proc, memstart, memend)
-    #print status
-    
-    if status == ERR_HEX_RECORD:
-        closeDevice(handle)
-        sys.exit("Aborting: record error")
-
-    elif status == ERR_HEX_CHECKSUM:
-        closeDevice(handle)
-        sys.exit("Aborting: checksum error")
+    codesize = session.write(filename)
+    print("%d bytes written" % codesize)
+    print("%s successfully uploaded" % os.path.basename(filename))
 
-    elif status == ERR_USB_ERASE:
-        print("Aborting: erase error")
-        closeDevice(handle)
-        sys.exit(0)
+    # then the data EEPROM, in the same session
+    # ------------------------------------------------------------------
 
-    elif status == ERR_NONE:
-        print("%s successfully uploaded" % os.path.basename(filename))
+    if eedata:
+        print("Writing data EEPROM ...")
+        session.writeEeprom(eedata)
+        print("%d bytes of EEPROM written" % len(eedata))
 
     # reset and start start user's app.
     # ------------------------------------------------------------------
 
-        resetDevice(handle)
-        # Device can't be closed because it just has been reseted
-        #closeDevice(handle)
-        sys.exit("Starting user program ...")
+    start = time.time()
+    session.reset()
+    print("Starting user program ...")
 
-    else:
-        sys.exit("Aborting: unknown error")
+    # the known applications if the app. was not seen before
+    if auto and uart is None:
+        if session.appid is None:
+            match = lambda v, p: isApplication(None, v, p)
+        else:
+            match = lambda v, p: (v, p) == session.appid
+        if waitArrival(match, ENUM_TIMEOUT):
+            print("Application back in %d ms" % ((time.time() - start) * 1000))
+        else:
+            print("Application not seen after %d s" % ENUM_TIMEOUT)
 
 # ----------------------------------------------------------------------
 # ----------------------------------------------------------------------
@@ -872,10 +2005,64 @@ if __name__ == "__main__":
         (sys.version_info[0],
          sys.version_info[1],
          "core" if PYUSB_USE_CORE else "legacy"))
-    i = -1
-    for arg in sys.argv:
-        i = i + 1
-    if i == 2:
-        main(sys.argv[1], sys.argv[2])
-    else:
-        sys.exit("Usage ex: uploader8.py 16f1459 tools/Blink1459.hex")
+    wait = 0
+    auto = False
+    uart = None
+    baudrate = UART_SYNC_BAUDRATE
+    eeprom = None
+    dump = False
+    manifest = None
+    summary = False
+    timing_json = None
+    # options in any order, before or after the mcu
+    args = []
+    argv = sys.argv[1:]
+    while argv:
+        arg = argv.pop(0)
+        if arg in ("--timing-json", "--eeprom", "--uart", "--baud",
+                   "--wait", "--device", "--manifest") and not argv:
+            args = []                   # no value, print the usage
+            break
+        if arg == "--timing":
+            summary = True
+        elif arg == "--timing-json":
+            timing_json = argv.pop(0)
+        elif arg == "--eeprom":
+            eeprom = argv.pop(0)
+        elif arg == "--uart":
+            uart = argv.pop(0)
+        elif arg == "--baud":
+            baudrate = int(argv.pop(0))
+        elif arg == "--wait":
+            wait = float(argv.pop(0))
+        elif arg == "--auto":
+            if not auto:                # --device may come first
+                auto = True
+        elif arg == "--device":
+            auto = argv.pop(0)
+        elif arg == "--dump":
+            dump = True
+        elif arg == "--manifest":
+            manifest = argv.pop(0)
+        else:
+            args.append(arg)
+    if summary or timing_json:
+        TIMING = Timing()
+    # the figures are reported whatever the outcome, sys.exit() included
+    try:
+        if len(args) == 2 and not (dump and manifest):
+            main(args[0], args[1], dump, manifest, wait=wait, auto=auto,
+                 uart=uart, baudrate=baudrate, eeprom=eeprom)
+        else:
+            sys.exit("Usage ex: uploader8.py 16f1459 tools/Blink1459.hex\n" \
+                     "          uploader8.py 18f47j53 --dump golden.hex\n" \
+                     "          uploader8.py 18f4550 --manifest bootloader.json Blink4550.hex\n" \
+                     "          uploader8.py 18f25k50 --wait 5 Blink45k50.hex\n" \
+                     "          uploader8.py 18f25k50 --auto Blink45k50.hex\n" \
+                     "          uploader8.py 18f25k50 --auto --device 04d8:feab Blink45k50.hex\n" \
+                     "          uploader8.py 18f4550 --uart /dev/ttyUSB0 --baud 1000000 Blink4550.hex\n" \
+                     "          uploader8.py 18f4550 --eeprom unit42.hex Blink4550.hex\n" \
+                     "          uploader8.py 18f4550 --timing --timing-json ci.json Blink4550.hex")
+    finally:
+        if TIMING is not None:
+            TIMING.report(timing_json, summary)
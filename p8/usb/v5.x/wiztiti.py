@@ -29,6 +29,13 @@ except ImportError:
 from wx.lib.buttons import GenBitmapTextButton
 from subprocess import Popen,PIPE,STDOUT
 
+import os
+import sys
+
+# Upload with the bootloader's help, cf. tools/uploader8.py
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "tools"))
+import uploader8
+
 
 ########################################################################
 class MainPanel(wx.Panel):
@@ -365,6 +372,15 @@ class MainPanel(wx.Panel):
     #----------------------------------------------------------------------
     def OnUpload(self,event):
         """Upload Hex file with the bootloader"""
+        dlg = wx.FileDialog(self, "Choose a program", "", "", "*.hex", wx.OPEN)
+        if dlg.ShowModal() == wx.ID_OK:
+            # the target, if only one is checked
+            procs = [c.GetLabel() for c in self.checkboxDevList if c.GetValue()]
+            if len(procs) == 1:
+                self.Upload(procs[0], None, dlg.GetPath())
+            else:
+                self.Upload(None, None, dlg.GetPath())
+        dlg.Destroy()
 
     # If User press Help button
     #----------------------------------------------------------------------
@@ -424,8 +440,32 @@ class MainPanel(wx.Panel):
     # Upload Hex file on Pinguino Board
     #----------------------------------------------------------------------
     def Upload(self, proc, osc, hex_file):
+        """Write, verify and start the program, on one open session"""
         print "hex=" + hex_file
         #Gauge.SetValue(self.count)
+        session = uploader8.Session()
+        try:
+            session.open()
+            session.query(proc)
+            codesize = session.write(hex_file)
+            message = "%d bytes uploaded on PIC%s" % (codesize, session.proc)
+            # flash read back since v5.1, not in BOOT_USE_DUMP=0 builds
+            if [int(v) for v in session.version.split(".")] >= [5, 1]:
+                try:
+                    session.verify(hex_file)
+                    message = message + " and verified"
+                except uploader8.UploaderError as e:
+                    if e.code != uploader8.ERR_USB_READ:
+                        raise
+            session.reset()
+            icon = wx.ICON_INFORMATION
+        except uploader8.UploaderError as e:
+            message = str(e)
+            icon = wx.ICON_ERROR
+        session.close()
+        dialog = wx.MessageDialog(self, message, 'Upload', wx.OK|icon)
+        dialog.ShowModal()
+        dialog.Destroy()
  
 ########################################################################
 class MainFrame(wx.Frame):